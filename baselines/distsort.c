@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <mpi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "baselines/common.h"
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/sort_type.h"
+#include "enclave/distsort.h"
+#include "host/error.h"
+
+/* Runs one of the sort engines outside of any enclave, built host-only with
+ * DISTRIBUTED_SGX_SORT_PLAINTEXT so that its messages go over MPI
+ * unencrypted. BASELINE_SORT_TYPE, set by the Makefile, picks the sort. Timed
+ * against hostonly, which encrypts, and the enclave, this separates the cost
+ * of the algorithm from that of the encryption and the enclave. */
+
+#ifndef BASELINE_SORT_TYPE
+#error "BASELINE_SORT_TYPE must name the sort to run"
+#endif /* BASELINE_SORT_TYPE */
+
+static int world_rank;
+static int world_size;
+
+static distsort_ctx_t *ctx;
+
+static void *start_thread_work(void *arg UNUSED) {
+    distsort_start_work(ctx);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    enum sort_type sort_type = BASELINE_SORT_TYPE;
+    int ret = 0;
+
+    /* Parse args. */
+    int argi = 1;
+    if (argc < (sort_type == OJOIN ? 3 : 2)) {
+        if (sort_type == OJOIN) {
+            printf("usage: %s array_size join_size [num_threads]\n", argv[0]);
+        } else {
+            printf("usage: %s array_size [num_threads]\n", argv[0]);
+        }
+        return -1;
+    }
+    ssize_t slength = atoll(argv[argi]);
+    if (slength <= 0) {
+        printf("Invalid array size\n");
+        return -1;
+    }
+    size_t length = slength;
+    argi++;
+    struct distsort_opts opts = { 0 };
+    if (sort_type == OJOIN) {
+        ssize_t sjoin_length = atoll(argv[argi]);
+        if (sjoin_length < 0 || (size_t) sjoin_length > length) {
+            printf("Invalid join size\n");
+            return -1;
+        }
+        opts.join_length = sjoin_length;
+        argi++;
+    }
+    size_t num_threads = 1;
+    if (argc > argi) {
+        ssize_t snum_threads = atoll(argv[argi]);
+        if (snum_threads <= 0) {
+            printf("Invalid number of threads\n");
+            return -1;
+        }
+        num_threads = snum_threads;
+    }
+
+    ret = init_mpi(&argc, &argv, &world_rank, &world_size);
+    if (ret) {
+        handle_error_string("Error in MPI initialization");
+        goto exit;
+    }
+
+    ret = distsort_init(&ctx, world_rank, world_size, num_threads, 0, NULL,
+            false);
+    if (ret) {
+        handle_error_string("Error initializing sort engines");
+        goto exit_finalize_mpi;
+    }
+
+    /* Start the pool threads. */
+    pthread_t *threads = malloc(num_threads * sizeof(*threads));
+    if (!threads) {
+        perror("malloc threads");
+        ret = errno;
+        goto exit_free_ctx;
+    }
+    size_t num_threads_created = 0;
+    for (size_t i = 0; i < num_threads - 1; i++) {
+        ret = pthread_create(&threads[i], NULL, start_thread_work, NULL);
+        if (ret) {
+            errno = ret;
+            perror("pthread_create");
+            goto exit_release_threads;
+        }
+        num_threads_created++;
+    }
+    while (distsort_get_num_threads_started(ctx) < num_threads_created) {
+        sched_yield();
+    }
+
+    /* Allocate array. The bucket sort and the o-join need keys for at least a
+     * full bucket. */
+    size_t local_length = distsort_local_length(ctx, length);
+    size_t buffer_len = distsort_buffer_len(ctx, length, sort_type, &opts);
+    elem_t *arr = calloc(buffer_len, sizeof(*arr));
+    if (!arr) {
+        perror("alloc array");
+        ret = errno;
+        goto exit_release_threads;
+    }
+    size_t data_size = local_length;
+    if (sort_type == SORT_BUCKET || sort_type == OJOIN) {
+        data_size = MIN(MAX(local_length, 512), buffer_len);
+    }
+
+    /* Add random elements to array. For the o-join, the last elements look up
+     * keys held earlier in the array, which are even while lookups are odd. */
+    size_t num_keys = data_size;
+    if (sort_type == OJOIN) {
+        num_keys =
+            data_size
+                - (opts.join_length / world_size
+                        + (opts.join_length % world_size
+                            <= (size_t) world_rank));
+    }
+    srand(world_rank + 1);
+    for (size_t i = 0; i < num_keys; i++) {
+        arr[i].key = rand();
+        if (sort_type == OJOIN) {
+            arr[i].key &= ~(uint64_t) 1;
+        }
+    }
+    for (size_t i = num_keys; i < data_size; i++) {
+        arr[i].key = arr[(i - num_keys) / 4].key | 1;
+    }
+
+    /* Sort and time. */
+    ret = MPI_Barrier(MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Barrier");
+        goto exit_free_arr;
+    }
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+    ret = distsort_sort(ctx, arr, length, sort_type, &opts);
+    if (ret) {
+        handle_error_string("Error sorting");
+        goto exit_free_arr;
+    }
+    ret = MPI_Barrier(MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Barrier");
+        goto exit_free_arr;
+    }
+    struct timespec end;
+    timespec_get(&end, TIME_UTC);
+
+    /* Print time taken. */
+    if (world_rank == 0) {
+        double seconds_taken =
+            (double) ((end.tv_sec * 1000000000 + end.tv_nsec)
+                    - (start.tv_sec * 1000000000 + start.tv_nsec))
+            / 1000000000;
+        printf("%f\n", seconds_taken);
+    }
+
+exit_free_arr:
+    free(arr);
+exit_release_threads:
+    distsort_release_threads(ctx);
+    for (size_t i = 0; i < num_threads_created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+exit_free_ctx:
+    distsort_free(ctx);
+exit_finalize_mpi:
+    MPI_Finalize();
+exit:
+    return ret;
+}
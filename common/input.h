@@ -0,0 +1,103 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_INPUT_H
+#define DISTRIBUTED_SGX_SORT_COMMON_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Encrypted input record files.
+ *
+ * A file starts with a struct input_header, followed by the file's elements
+ * in fixed-size chunks. Chunk i holds elements i * CHUNK_ELEMS to
+ * (i + 1) * CHUNK_ELEMS of the file (the last chunk may be short) and is laid
+ * out as a struct input_chunk_header followed by the chunk's ELEM_SIZE-byte
+ * records, encrypted with AES-128-GCM. The additional authenticated data of
+ * each chunk is the file header followed by the chunk index, so chunks cannot
+ * be moved between positions or files. All integers are little-endian.
+ *
+ * An input is either one file holding all TOTAL_ELEMS elements, from which
+ * each rank reads the chunks overlapping its range, or one shard per rank,
+ * where FIRST_ELEM is the global index of the shard's first element. */
+
+#define INPUT_MAGIC "DSSORTIN"
+#define INPUT_MAGIC_LEN 8
+#define INPUT_VERSION 1
+#define INPUT_KEY_LEN 16
+#define INPUT_IV_LEN 12
+#define INPUT_TAG_LEN 16
+
+/* The default number of elements per chunk. */
+#define INPUT_CHUNK_ELEMS 4096
+
+struct input_header {
+    unsigned char magic[INPUT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t elem_size;
+    uint64_t total_elems;
+    uint64_t first_elem;
+    uint64_t num_elems;
+    uint64_t chunk_elems;
+};
+
+struct input_chunk_header {
+    uint64_t chunk_idx;
+    unsigned char iv[INPUT_IV_LEN];
+    unsigned char tag[INPUT_TAG_LEN];
+    unsigned char reserved[4];
+};
+
+/* The additional authenticated data of a chunk. */
+struct input_chunk_aad {
+    struct input_header header;
+    uint64_t chunk_idx;
+};
+
+static inline size_t input_num_chunks(const struct input_header *header) {
+    return (header->num_elems + header->chunk_elems - 1) / header->chunk_elems;
+}
+
+static inline size_t input_chunk_num_elems(const struct input_header *header,
+        size_t chunk_idx) {
+    size_t start = chunk_idx * header->chunk_elems;
+    size_t end = start + header->chunk_elems;
+    if (end > header->num_elems) {
+        end = header->num_elems;
+    }
+    return end - start;
+}
+
+/* Returns the byte offset of chunk CHUNK_IDX in the file. */
+static inline size_t input_chunk_offset(const struct input_header *header,
+        size_t chunk_idx) {
+    return sizeof(*header)
+        + chunk_idx
+            * (sizeof(struct input_chunk_header)
+                    + header->chunk_elems * header->elem_size);
+}
+
+/* Returns the length in bytes of chunk CHUNK_IDX, including its header. */
+static inline size_t input_chunk_len(const struct input_header *header,
+        size_t chunk_idx) {
+    return sizeof(struct input_chunk_header)
+        + input_chunk_num_elems(header, chunk_idx) * header->elem_size;
+}
+
+/* Returns the first chunk and one past the last chunk of the file that overlap
+ * the global element range [START, START + LENGTH). */
+static inline void input_chunk_range(const struct input_header *header,
+        size_t start, size_t length, size_t *first_chunk, size_t *end_chunk) {
+    size_t file_start = header->first_elem;
+    size_t file_end = header->first_elem + header->num_elems;
+    size_t range_start = start > file_start ? start : file_start;
+    size_t range_end = start + length < file_end ? start + length : file_end;
+    if (range_start >= range_end) {
+        *first_chunk = 0;
+        *end_chunk = 0;
+        return;
+    }
+    *first_chunk = (range_start - file_start) / header->chunk_elems;
+    *end_chunk =
+        (range_end - file_start + header->chunk_elems - 1)
+            / header->chunk_elems;
+}
+
+#endif /* distributed-sgx-sort/common/input.h */
@@ -0,0 +1,19 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_KBENCH_H
+#define DISTRIBUTED_SGX_SORT_COMMON_KBENCH_H
+
+#include <stdint.h>
+
+#define KBENCH_NAME_LEN 32
+
+/* The most results one run of the kernel benchmark returns. */
+#define KBENCH_MAX_RESULTS 64
+
+/* The time one kernel took per operation, the median of several runs of
+ * ITERS operations each. */
+struct kbench_result {
+    char name[KBENCH_NAME_LEN];
+    uint64_t iters;
+    double ns_per_op;
+};
+
+#endif /* distributed-sgx-sort/common/kbench.h */
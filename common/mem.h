@@ -0,0 +1,62 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_MEM_H
+#define DISTRIBUTED_SGX_SORT_COMMON_MEM_H
+
+#include <stddef.h>
+#include "common/span.h"
+
+/* What the enclave's tracked allocations are for. */
+enum mem_site {
+    /* The array being sorted and the batches merged into it. */
+    MEM_SORT_ARRAY,
+
+    /* Each thread's scratch arena, kept across sorts. */
+    MEM_THREAD_BUFFERS,
+
+    /* Scratch a sort allocates for itself, such as bucket sort's blocks and
+     * the merge's buffer. */
+    MEM_SCRATCH,
+
+    /* Messages being encrypted, sent, received, or decrypted. */
+    MEM_MPI_TLS,
+
+    /* The TLS sessions with the other ranks, the handshakes' receive buffers,
+     * and the sessions' replay windows, kept across sorts. */
+    MEM_MPI_SESSIONS,
+
+    /* The per-thread RNG contexts and their pools of random bytes. */
+    MEM_RNG,
+
+    /* Chunks of encrypted input and output. */
+    MEM_IO,
+
+    /* The cost model's benchmark and tuning buffers. */
+    MEM_COST,
+
+    /* Each thread's buffer of trace events. */
+    MEM_TRACE,
+
+    /* Each thread's pool statistics, with PROFILE_THREADING. */
+    MEM_THREAD_STATS,
+
+    /* The distsort context. */
+    MEM_CONTEXT,
+
+    MEM_NUM_SITES,
+};
+
+/* The most phases whose peaks are tracked between two resets. Later phases
+ * are tracked under the last one. */
+#define MEM_MAX_PHASES 64
+
+/* The most memory the tracked allocations held during one phase. */
+struct mem_phase_stats {
+    /* The innermost span open in the job that allocated, or empty outside of
+     * any span. */
+    char phase[SPAN_NAME_LEN];
+
+    /* The peak of all sites together, and of each site. */
+    size_t peak_bytes;
+    size_t site_peak_bytes[MEM_NUM_SITES];
+};
+
+#endif /* distributed-sgx-sort/common/mem.h */
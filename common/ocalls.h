@@ -2,6 +2,9 @@
 #define DISTRIBUTED_SGX_SORT_COMMON_OCALLS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "common/mem.h"
+#include "common/span.h"
 
 #define OCALL_MPI_ANY_SOURCE (-2)
 #define OCALL_MPI_ANY_TAG (-3)
@@ -16,6 +19,43 @@ typedef struct ocall_mpi_request * ocall_mpi_request_t;
 
 struct ocall_enclave_stats {
     size_t mpi_tls_bytes_sent;
+    size_t mpi_tls_messages_sent;
+
+    /* The most memory the enclave's heap has held since it started, or for the
+     * host-only build, the most the process has held. */
+    size_t peak_memory_bytes;
+
+    /* The bytes each site in common/mem.h holds and the most each has held
+     * since the array was last freed. */
+    size_t site_bytes[MEM_NUM_SITES];
+    size_t site_peak_bytes[MEM_NUM_SITES];
+};
+
+/* How one enclave thread spent its time during one phase, measured only when
+ * the enclave is built with DISTRIBUTED_SGX_SORT_PROFILE_THREADING. Times are
+ * in nanoseconds. */
+struct ocall_thread_stats {
+    /* The innermost span open in the job the thread was working on, or empty
+     * outside of any span. */
+    char phase[SPAN_NAME_LEN];
+
+    /* Identifies the thread, numbered from 0 in the order the threads first
+     * recorded a time. */
+    uint32_t thread;
+
+    /* The tasks the thread took from the pool and the time spent running them,
+     * including any waiting they did. */
+    uint64_t num_tasks;
+    uint64_t task_ns;
+
+    /* Time spent spinning for a spinlock that another thread held, in
+     * sema_down, and in condvar_wait. */
+    uint64_t spin_ns;
+    uint64_t sema_ns;
+    uint64_t condvar_ns;
+
+    /* Time spent in the pool with no task to run. */
+    uint64_t idle_ns;
 };
 
 #define OCALL_MPI_REQUEST_NULL ((ocall_mpi_request_t) 0)
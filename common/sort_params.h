@@ -0,0 +1,49 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_SORT_PARAMS_H
+#define DISTRIBUTED_SGX_SORT_COMMON_SORT_PARAMS_H
+
+#include <stddef.h>
+
+/* Sizes that trade memory for fewer, larger messages or cheaper oblivious
+ * passes, and whose best values depend on the machine. Every rank must use the
+ * same values, since they decide how the ranks' messages line up. */
+struct sort_params {
+    /* Elements per message when the bitonic sort, ORShuffle, and o-join swap
+     * ranges with another rank. */
+    size_t bitonic_chunk_size;
+    size_t orshuffle_chunk_size;
+    size_t ojoin_chunk_size;
+
+    /* Elements per message in the Opaque sort's transposes. */
+    size_t opaque_chunk_size;
+
+    /* Elements per message when the nonoblivious sort sends partitions. */
+    size_t sample_partition_buf_size;
+
+    /* Elements per bucket in the bucket sort and o-join, a power of two. */
+    size_t bucket_size;
+
+    /* Buckets per message in the bucket sort's merge-split. */
+    size_t bucket_swap_chunk_buckets;
+
+    /* The working set per rank past which the enclave starts paging, and how
+     * much slower memory gets past it, in percent, as measured by the memory
+     * benchmark in memory-benchmark/. The cost model charges the local work
+     * of sorts whose buffers do not fit this much more. 0 bytes means no
+     * cliff is known. */
+    size_t epc_cliff_bytes;
+    size_t epc_cliff_slowdown;
+};
+
+#define SORT_PARAMS_DEFAULT { \
+    .bitonic_chunk_size = 4096, \
+    .orshuffle_chunk_size = 4096, \
+    .ojoin_chunk_size = 4096, \
+    .opaque_chunk_size = 4096, \
+    .sample_partition_buf_size = 512, \
+    .bucket_size = 512, \
+    .bucket_swap_chunk_buckets = 1, \
+    .epc_cliff_bytes = 0, \
+    .epc_cliff_slowdown = 100, \
+}
+
+#endif /* distributed-sgx-sort/common/sort_params.h */
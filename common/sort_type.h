@@ -8,6 +8,9 @@ enum sort_type {
     SORT_OPAQUE,
     SORT_ORSHUFFLE,
     OJOIN,
+
+    /* Resolved to one of the sorts above by the cost model before sorting. */
+    SORT_AUTO,
 };
 
 #endif /* distributed-sgx-sort/common/sort_type.h */
@@ -0,0 +1,34 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_SPAN_H
+#define DISTRIBUTED_SGX_SORT_COMMON_SPAN_H
+
+#include <stdint.h>
+
+/* The longest span name, including the terminating null. */
+#define SPAN_NAME_LEN 24
+
+/* The most spans a rank records between two exports. Later spans are
+ * dropped. */
+#define SPAN_MAX_RECORDS 4096
+
+/* Marks a span with no enclosing span. */
+#define SPAN_NONE UINT32_MAX
+
+/* A timed phase, as recorded in the enclave and exported to the host. */
+struct span_record {
+    char name[SPAN_NAME_LEN];
+
+    /* The index of the span enclosing this one on the same thread, or
+     * SPAN_NONE. */
+    uint32_t parent;
+
+    /* Identifies the thread the span ran on, numbered from 0 in the order the
+     * threads first recorded a span. */
+    uint32_t thread;
+
+    /* Monotonic times in nanoseconds. END_NS is 0 if the span never ended,
+     * such as when its phase failed. */
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+#endif /* distributed-sgx-sort/common/span.h */
@@ -0,0 +1,54 @@
+#ifndef DISTRIBUTED_SGX_SORT_COMMON_TRACE_H
+#define DISTRIBUTED_SGX_SORT_COMMON_TRACE_H
+
+#include <stdint.h>
+
+/* The most events one thread holds between two exports. Once a thread's
+ * buffer is full, its newest events overwrite its oldest. */
+#define TRACE_BUFFER_EVENTS 8192
+
+/* The most threads that record events. Events on later threads are
+ * dropped. */
+#define TRACE_MAX_THREADS 128
+
+enum trace_event_type {
+    /* A task taken from the thread pool's queue. */
+    TRACE_TASK,
+
+    /* Calls into the MPI-over-TLS layer. */
+    TRACE_SEND,
+    TRACE_RECV,
+    TRACE_ISEND,
+    TRACE_IRECV,
+    TRACE_WAIT,
+    TRACE_WAITANY,
+
+    /* Encryption and decryption of one buffer, such as a message. */
+    TRACE_ENCRYPT,
+    TRACE_DECRYPT,
+};
+
+/* A timed event on the timeline, as recorded in the enclave and exported to
+ * the host. */
+struct trace_event {
+    /* Times in nanoseconds, on the same clock as span_record. */
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    /* The number of bytes sent, received, encrypted, or decrypted, or 0. */
+    uint64_t bytes;
+
+    /* An enum trace_event_type. */
+    uint32_t type;
+
+    /* Identifies the thread the event ran on, numbered from 0 in the order the
+     * threads first recorded an event. */
+    uint32_t thread;
+
+    /* The rank and MPI tag of the other end of a message, or -1 if unknown.
+     * Tags include the job's mpi_tag_base, which is the tag of a task. */
+    int32_t peer;
+    int32_t tag;
+};
+
+#endif /* distributed-sgx-sort/common/trace.h */
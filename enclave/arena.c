@@ -0,0 +1,63 @@
+#include "enclave/arena.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include "common/error.h"
+#include "common/mem.h"
+#include "enclave/mem.h"
+
+/* Alignment of each allocation, one cache line. */
+#define ARENA_ALIGN 64
+
+static thread_local unsigned char *arena;
+static thread_local size_t arena_size;
+static thread_local size_t arena_top;
+
+int arena_init(size_t size) {
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    arena =
+        mem_aligned_alloc(MEM_THREAD_BUFFERS, ARENA_ALIGN,
+                size ? size : ARENA_ALIGN);
+    if (!arena) {
+        perror("malloc scratch arena");
+        return -1;
+    }
+    arena_size = size;
+    arena_top = 0;
+    return 0;
+}
+
+void arena_destroy(void) {
+    mem_free(arena);
+    arena = NULL;
+    arena_size = 0;
+    arena_top = 0;
+}
+
+bool arena_is_init(void) {
+    return arena;
+}
+
+void *arena_alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (size > arena_size - arena_top) {
+        handle_error_string(
+                "Scratch arena exhausted: %zu of %zu bytes used, %zu requested",
+                arena_top, arena_size, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = arena + arena_top;
+    arena_top += size;
+    return ptr;
+}
+
+void arena_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    arena_top = (unsigned char *) ptr - arena;
+}
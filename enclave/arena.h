@@ -0,0 +1,18 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_ARENA_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Each enclave thread owns a scratch arena, allocated once when the thread
+ * starts and kept across sorts. Allocations are carved off the top of the
+ * arena and must be released in LIFO order; freeing a pointer releases it and
+ * everything allocated after it. */
+
+int arena_init(size_t size);
+void arena_destroy(void);
+bool arena_is_init(void);
+void *arena_alloc(size_t size);
+void arena_free(void *ptr);
+
+#endif /* distributed-sgx-sort/enclave/arena.h */
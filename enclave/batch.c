@@ -0,0 +1,171 @@
+#include "enclave/batch.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <liboblivious/primitives.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/mem.h"
+#include "common/util.h"
+#include "enclave/mem.h"
+#include "enclave/qsort.h"
+#include "enclave/threading.h"
+
+/* Sorts many small arrays that each fit on this rank, without talking to the
+ * other ranks. Each array is sorted with the bitonic network for its length
+ * rounded up to a power of two. Every comparator of that network puts the
+ * smaller element at the lower index, so treating the missing elements as
+ * larger than any key makes the comparators that touch them no-ops, and they
+ * are skipped. Arrays that round up to the same length thus share one
+ * network, and are sorted together one stage at a time, so that the same loop
+ * sweeps every array in the group. Which comparators run depends only on the
+ * lengths, which the caller already reveals. */
+
+/* Each thread takes about this many tasks, so that threads that draw cheap
+ * tasks can make up for those that draw expensive ones. */
+#define TASKS_PER_THREAD 4
+
+struct batch_array {
+    size_t offset;
+    size_t length;
+    size_t padded_length;
+};
+
+/* A run of arrays with the same padded length, sorted by one thread. */
+struct batch_task {
+    const struct batch_array *arrays;
+    size_t num_arrays;
+};
+
+struct batch_sort_args {
+    elem_t *arr;
+    const struct batch_task *tasks;
+};
+
+static int compare_padded_length(const void *a_, const void *b_,
+        void *arg UNUSED) {
+    const struct batch_array *a = a_;
+    const struct batch_array *b = b_;
+    return (a->padded_length > b->padded_length)
+        - (a->padded_length < b->padded_length);
+}
+
+/* Returns roughly the number of comparators in the network for LENGTH
+ * elements, a power of two. */
+static size_t network_cost(size_t length) {
+    size_t log_length = log2ll(length);
+    return length * log_length * (log_length + 1) / 4;
+}
+
+static void compare_and_swap(elem_t *a, elem_t *b) {
+    bool cond = a->key > b->key;
+    o_memswap(a, b, sizeof(*a), cond);
+}
+
+static void sort_task(void *args_, size_t task_idx) {
+    struct batch_sort_args *args = args_;
+    const struct batch_task *task = &args->tasks[task_idx];
+    size_t padded_length = task->arrays[0].padded_length;
+
+    for (size_t k = 2; k <= padded_length; k *= 2) {
+        for (size_t j = k / 2; j > 0; j /= 2) {
+            /* The first stage of each merge compares mirrored pairs, so that
+             * every comparator sorts ascending. */
+            size_t mask = j == k / 2 ? k - 1 : j;
+            for (size_t a = 0; a < task->num_arrays; a++) {
+                elem_t *elems = args->arr + task->arrays[a].offset;
+                size_t length = task->arrays[a].length;
+                for (size_t i = 0; i < length; i++) {
+                    size_t partner = i ^ mask;
+                    if (partner > i && partner < length) {
+                        compare_and_swap(&elems[i], &elems[partner]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Sorts NUM_ARRAYS arrays, stored one after another in ARR, where array i holds
+ * LENGTHS[i] elements. */
+int batch_sort(elem_t *arr, const size_t *lengths, size_t num_arrays,
+        size_t num_threads) {
+    int ret;
+
+    if (!num_arrays) {
+        ret = 0;
+        goto exit;
+    }
+
+    struct batch_array *arrays =
+        mem_alloc(MEM_SCRATCH, num_arrays * sizeof(*arrays));
+    if (!arrays) {
+        perror("malloc batch arrays");
+        ret = -1;
+        goto exit;
+    }
+    struct batch_task *tasks =
+        mem_alloc(MEM_SCRATCH, num_arrays * sizeof(*tasks));
+    if (!tasks) {
+        perror("malloc batch tasks");
+        ret = -1;
+        goto exit_free_arrays;
+    }
+
+    /* Group the arrays by padded length. */
+    size_t offset = 0;
+    size_t total_cost = 0;
+    for (size_t i = 0; i < num_arrays; i++) {
+        arrays[i].offset = offset;
+        arrays[i].length = lengths[i];
+        arrays[i].padded_length = lengths[i] ? next_pow2ll(lengths[i]) : 1;
+        offset += lengths[i];
+        total_cost += network_cost(arrays[i].padded_length);
+    }
+    qsort_glibc(arrays, num_arrays, sizeof(*arrays), compare_padded_length,
+            NULL);
+
+    /* Cut the groups into tasks of about equal cost. */
+    size_t task_cost = MAX(total_cost / (num_threads * TASKS_PER_THREAD), 1);
+    size_t num_tasks = 0;
+    size_t curr_cost = 0;
+    for (size_t i = 0; i < num_arrays; i++) {
+        if (i == 0
+                || arrays[i].padded_length != arrays[i - 1].padded_length
+                || curr_cost >= task_cost) {
+            tasks[num_tasks].arrays = &arrays[i];
+            tasks[num_tasks].num_arrays = 0;
+            num_tasks++;
+            curr_cost = 0;
+        }
+        tasks[num_tasks - 1].num_arrays++;
+        curr_cost += network_cost(arrays[i].padded_length);
+    }
+
+    /* Sort. */
+    struct batch_sort_args args = {
+        .arr = arr,
+        .tasks = tasks,
+    };
+    struct thread_work work = {
+        .type = THREAD_WORK_ITER,
+        .iter = {
+            .func = sort_task,
+            .arg = &args,
+            .count = num_tasks,
+        },
+    };
+    thread_work_push(&work);
+    thread_work_until_empty();
+    thread_wait(&work);
+
+    ret = 0;
+
+    mem_free(tasks);
+exit_free_arrays:
+    mem_free(arrays);
+exit:
+    return ret;
+}
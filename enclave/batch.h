@@ -0,0 +1,10 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_BATCH_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_BATCH_H
+
+#include <stddef.h>
+#include "common/elem_t.h"
+
+int batch_sort(elem_t *arr, const size_t *lengths, size_t num_arrays,
+        size_t num_threads);
+
+#endif /* distributed-sgx-sort/enclave/batch.h */
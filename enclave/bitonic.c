@@ -9,19 +9,26 @@
 #include "common/elem_t.h"
 #include "common/error.h"
 #include "common/util.h"
+#include "enclave/arena.h"
+#include "enclave/comm.h"
 #include "enclave/mpi_tls.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/params.h"
 #include "enclave/threading.h"
 
-#define SWAP_CHUNK_SIZE 4096
-
-static size_t total_length;
+#define SWAP_CHUNK_SIZE (sort_params.bitonic_chunk_size)
 
 static thread_local elem_t *buffer;
 
+size_t bitonic_scratch_size(void) {
+    /* Pipelining the exchanges with communication threads requires a second
+     * chunk. */
+    return (comm_num_threads ? 2 : 1) * SWAP_CHUNK_SIZE * sizeof(*buffer);
+}
+
 int bitonic_init(void) {
     /* Allocate buffers. */
-    buffer = malloc(SWAP_CHUNK_SIZE * sizeof(*buffer));
+    buffer = arena_alloc(bitonic_scratch_size());
     if (!buffer) {
         perror("malloc local_buffer");
         goto exit;
@@ -35,17 +42,18 @@ exit:
 
 void bitonic_free(void) {
     /* Free resources. */
-    free(buffer);
+    arena_free(buffer);
+    buffer = NULL;
 }
 
 /* Array index and world rank relationship helpers. */
 
 static int get_index_address(size_t index) {
-    return index * world_size / total_length;
+    return index * world_size / current_job->total_length;
 }
 
 static size_t get_local_start(int rank) {
-    return (rank * total_length + world_size - 1) / world_size;
+    return (rank * current_job->total_length + world_size - 1) / world_size;
 }
 
 /* Swapping. */
@@ -73,6 +81,29 @@ static void swap_local_range(elem_t *arr, size_t a, size_t b, size_t count,
     }
 }
 
+/* Posts the exchange for the chunk of ELEMS_TO_SWAP elems at OUR_LOCAL_IDX
+ * with the elems at OUR_REMOTE_IDX, receiving the remote elems into
+ * CHUNK_BUFFER. */
+static int post_swap_chunk(elem_t *arr, elem_t *chunk_buffer, size_t local_idx,
+        size_t remote_idx, size_t our_local_idx, size_t our_remote_idx,
+        size_t elems_to_swap, bool crossover, comm_future_t *future) {
+    size_t local_start = get_local_start(world_rank);
+    int remote_rank = get_index_address(remote_idx);
+
+    return comm_exchange(future,
+            crossover && our_local_idx > remote_idx
+                ? arr + our_local_idx - elems_to_swap - local_start
+                : arr + our_local_idx - local_start,
+            elems_to_swap * sizeof(*arr), remote_rank,
+            crossover && local_idx > remote_idx
+                ? (our_local_idx - elems_to_swap) / SWAP_CHUNK_SIZE
+                : our_local_idx / SWAP_CHUNK_SIZE,
+            chunk_buffer, elems_to_swap * sizeof(*chunk_buffer), remote_rank,
+            crossover && local_idx < remote_idx
+                ? (our_remote_idx - elems_to_swap) / SWAP_CHUNK_SIZE
+                : our_remote_idx / SWAP_CHUNK_SIZE);
+}
+
 struct swap_remote_range_args {
     elem_t *arr;
     size_t local_idx;
@@ -92,12 +123,37 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
     int ret;
 
     size_t local_start = get_local_start(world_rank);
-    int remote_rank = get_index_address(remote_idx);
+
+    /* With dedicated communication threads, the exchange for the next chunk
+     * is posted before merging the current chunk so that the transfer
+     * overlaps with the compare-exchanges. The two chunks alternate between
+     * the two halves of the buffer. */
+    bool pipelined = comm_num_threads > 0;
+    comm_future_t futures[2];
+    bool posted[2] = { false, false };
+    size_t curr = 0;
+
+    /* Pool threads set up for another sort, which run the merge after an
+     * incremental sort, borrow their chunks from their arena. */
+    elem_t *chunk_buffers = buffer;
+    if (!chunk_buffers) {
+        chunk_buffers = arena_alloc(bitonic_scratch_size());
+        if (!chunk_buffers) {
+            handle_error_string("Error allocating chunk buffers");
+            goto exit;
+        }
+    }
 
     /* Swap elems in maximum chunk sizes of SWAP_CHUNK_SIZE and iterate until no
-     * count is remaining. */
-    size_t start = thread_idx * count / num_threads;
-    size_t end = (thread_idx + 1) * count / num_threads;
+     * count is remaining. Chunks are tagged by their index divided by
+     * SWAP_CHUNK_SIZE, so the threads split the range in whole chunks to keep
+     * two threads from exchanging chunks with the same tag at once. */
+    size_t num_chunks = CEIL_DIV(count, SWAP_CHUNK_SIZE);
+    size_t start =
+        MIN(thread_idx * num_chunks / num_threads * SWAP_CHUNK_SIZE, count);
+    size_t end =
+        MIN((thread_idx + 1) * num_chunks / num_threads * SWAP_CHUNK_SIZE,
+                count);
     size_t our_local_idx =
         crossover && local_idx > remote_idx
             ? local_idx + count - start
@@ -109,41 +165,60 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
     size_t our_count = end - start;
     while (our_count) {
         size_t elems_to_swap = MIN(our_count, SWAP_CHUNK_SIZE);
+        elem_t *chunk_buffer = chunk_buffers + curr * SWAP_CHUNK_SIZE;
 
-        /* Post receive for remote elems to buffer. */
-        mpi_tls_request_t request;
-        ret =
-            mpi_tls_irecv_bytes(buffer, elems_to_swap * sizeof(*buffer),
-                    remote_rank,
-                    crossover && local_idx < remote_idx
-                        ? (our_remote_idx - elems_to_swap) / SWAP_CHUNK_SIZE
-                        : our_remote_idx / SWAP_CHUNK_SIZE,
-                    &request);
-        if (ret) {
-            handle_error_string("Error receiving elem bytes");
-            return;
+        /* Compute the pointers for the next chunk. */
+        size_t next_local_idx;
+        size_t next_remote_idx;
+        if (crossover) {
+            if (local_idx < remote_idx) {
+                next_local_idx = our_local_idx + elems_to_swap;
+                next_remote_idx = our_remote_idx - elems_to_swap;
+            } else {
+                next_local_idx = our_local_idx - elems_to_swap;
+                next_remote_idx = our_remote_idx + elems_to_swap;
+            }
+        } else {
+            next_local_idx = our_local_idx + elems_to_swap;
+            next_remote_idx = our_remote_idx + elems_to_swap;
+        }
+        size_t next_count = our_count - elems_to_swap;
+
+        /* Post the exchange for this chunk if it wasn't posted ahead of
+         * time. */
+        if (!posted[curr]) {
+            ret =
+                post_swap_chunk(arr, chunk_buffer, local_idx, remote_idx,
+                        our_local_idx, our_remote_idx, elems_to_swap,
+                        crossover, &futures[curr]);
+            if (ret) {
+                handle_error_string("Error exchanging elem bytes");
+                goto exit;
+            }
+            posted[curr] = true;
         }
 
-        /* Send local elems to the remote. */
-        ret =
-            mpi_tls_send_bytes(
-                    crossover && our_local_idx > remote_idx
-                        ? arr + our_local_idx - elems_to_swap - local_start
-                        : arr + our_local_idx - local_start,
-                    elems_to_swap * sizeof(*arr), remote_rank,
-                    crossover && local_idx > remote_idx
-                        ? (our_local_idx - elems_to_swap) / SWAP_CHUNK_SIZE
-                        : our_local_idx / SWAP_CHUNK_SIZE);
-        if (ret) {
-            handle_error_string("Error sending elem bytes");
-            return;
+        /* Post the exchange for the next chunk. */
+        if (pipelined && next_count) {
+            ret =
+                post_swap_chunk(arr,
+                        chunk_buffers + (1 - curr) * SWAP_CHUNK_SIZE,
+                        local_idx, remote_idx, next_local_idx, next_remote_idx,
+                        MIN(next_count, SWAP_CHUNK_SIZE), crossover,
+                        &futures[1 - curr]);
+            if (ret) {
+                handle_error_string("Error exchanging elem bytes");
+                goto exit;
+            }
+            posted[1 - curr] = true;
         }
 
         /* Wait for received elems to come in. */
-        ret = mpi_tls_wait(&request, MPI_TLS_STATUS_IGNORE);
+        ret = comm_wait(&futures[curr]);
+        posted[curr] = false;
         if (ret) {
-            handle_error_string("Error waiting on receive for elem bytes");
-            return;
+            handle_error_string("Error waiting on exchange for elem bytes");
+            goto exit;
         }
 
         /* Replace the local elements with the received remote elements if
@@ -155,18 +230,20 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
                 for (size_t i = 0; i < elems_to_swap; i++) {
                     bool cond =
                         arr[our_local_idx + i - local_start].key
-                            > buffer[elems_to_swap - 1 - i].key;
+                            > chunk_buffer[elems_to_swap - 1 - i].key;
                     o_memcpy(&arr[our_local_idx + i - local_start],
-                            &buffer[elems_to_swap - 1 - i], sizeof(*arr), cond);
+                            &chunk_buffer[elems_to_swap - 1 - i], sizeof(*arr),
+                            cond);
                 }
             } else {
                 for (size_t i = 0; i < elems_to_swap; i++) {
                     bool cond =
                         arr[our_local_idx - elems_to_swap + i - local_start].key
-                            < buffer[elems_to_swap - 1 - i].key;
+                            < chunk_buffer[elems_to_swap - 1 - i].key;
                     o_memcpy(
                             &arr[our_local_idx - elems_to_swap + i - local_start],
-                            &buffer[elems_to_swap - 1 - i], sizeof(*arr), cond);
+                            &chunk_buffer[elems_to_swap - 1 - i], sizeof(*arr),
+                            cond);
                 }
             }
         } else {
@@ -174,26 +251,30 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
                 bool cond =
                     (our_local_idx < our_remote_idx)
                         == (arr[our_local_idx + i - local_start].key
-                                > buffer[i].key);
-                o_memcpy(&arr[our_local_idx + i - local_start], &buffer[i],
-                        sizeof(*arr), cond);
+                                > chunk_buffer[i].key);
+                o_memcpy(&arr[our_local_idx + i - local_start],
+                        &chunk_buffer[i], sizeof(*arr), cond);
             }
         }
 
         /* Bump pointers, decrement count, and continue. */
-        if (crossover) {
-            if (local_idx < remote_idx) {
-                our_local_idx += elems_to_swap;
-                our_remote_idx -= elems_to_swap;
-            } else {
-                our_local_idx -= elems_to_swap;
-                our_remote_idx += elems_to_swap;
-            }
-        } else {
-            our_local_idx += elems_to_swap;
-            our_remote_idx += elems_to_swap;
+        our_local_idx = next_local_idx;
+        our_remote_idx = next_remote_idx;
+        our_count = next_count;
+        if (pipelined) {
+            curr = 1 - curr;
+        }
+    }
+
+exit:
+    /* Don't leave exchanges referencing our stack behind. */
+    for (size_t i = 0; i < 2; i++) {
+        if (posted[i]) {
+            comm_wait(&futures[i]);
         }
-        our_count -= elems_to_swap;
+    }
+    if (chunk_buffers != buffer) {
+        arena_free(chunk_buffers);
     }
 }
 
@@ -436,11 +517,12 @@ static void sort(void *args_) {
 
 /* Entry. */
 
-void bitonic_sort(elem_t *arr, size_t length, size_t num_threads) {
-    total_length = length;
+int bitonic_sort(elem_t *arr, size_t length, size_t num_threads) {
+    int ret;
 
     if (1lu << log2ll(length) != length) {
-        fprintf(stderr, "Length must be a multiple of 2\n");
+        handle_error_string("Length %zu is not a power of two", length);
+        ret = -1;
         goto exit;
     }
 
@@ -448,11 +530,38 @@ void bitonic_sort(elem_t *arr, size_t length, size_t num_threads) {
     struct sort_args args = {
         .arr = arr,
         .start = 0,
-        .length = total_length,
+        .length = length,
         .num_threads = num_threads,
     };
     sort(&args);
 
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int bitonic_merge(elem_t *arr, size_t length, size_t num_threads) {
+    int ret;
+
+    if (1lu << log2ll(length) != length) {
+        handle_error_string("Length %zu is not a power of two", length);
+        ret = -1;
+        goto exit;
+    }
+
+    /* The last step of the sort merges two ascending halves. */
+    struct merge_args args = {
+        .arr = arr,
+        .start = 0,
+        .length = length,
+        .crossover = true,
+        .num_threads = num_threads,
+    };
+    merge(&args);
+
+    ret = 0;
+
 exit:
-    ;
+    return ret;
 }
@@ -6,8 +6,13 @@
 #include "common/defs.h"
 #include "common/elem_t.h"
 
+size_t bitonic_scratch_size(void);
 int bitonic_init(void);
 void bitonic_free(void);
-void bitonic_sort(elem_t *arr, size_t length, size_t num_threads);
+int bitonic_sort(elem_t *arr, size_t length, size_t num_threads);
+
+/* Merges the two ascending halves of the LENGTH elements spread across the
+ * ranks into one ascending sequence. LENGTH must be a power of two. */
+int bitonic_merge(elem_t *arr, size_t length, size_t num_threads);
 
 #endif /* distributed-sgx-sort/enclave/bitonic.h */
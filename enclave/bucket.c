@@ -16,38 +16,49 @@
 #include "common/defs.h"
 #include "common/elem_t.h"
 #include "common/error.h"
+#include "common/mem.h"
 #include "common/util.h"
+#include "enclave/arena.h"
+#include "enclave/comm.h"
 #include "enclave/crypto.h"
+#include "enclave/extmem.h"
+#include "enclave/mem.h"
 #include "enclave/mpi_tls.h"
 #include "enclave/nonoblivious.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/span.h"
 #include "enclave/synch.h"
 #include "enclave/threading.h"
 
-static size_t total_length;
-
 /* Thread-local buffer used for generic operations. */
 static thread_local elem_t *buffer;
 
 static int get_bucket_rank(size_t bucket) {
     size_t num_buckets =
-        MAX(next_pow2ll(total_length) * 2 / BUCKET_SIZE,
+        MAX(next_pow2ll(current_job->total_length) * 2 / BUCKET_SIZE,
                 (size_t) world_size * 2);
     return bucket * world_size / num_buckets;
 }
 
 static size_t get_local_bucket_start(int rank) {
     size_t num_buckets =
-        MAX(next_pow2ll(total_length) * 2 / BUCKET_SIZE,
+        MAX(next_pow2ll(current_job->total_length) * 2 / BUCKET_SIZE,
                 (size_t) world_size * 2);
     return (rank * num_buckets + world_size - 1) / world_size;
 }
 
 /* Initialization and deinitialization. */
 
+size_t bucket_scratch_size(void) {
+    /* Pipelining the merge-split exchanges with communication threads
+     * requires a second chunk. */
+    return (comm_num_threads ? 2 : 1) * BUCKET_SIZE * MAX(SWAP_CHUNK_BUCKETS, 2)
+        * sizeof(*buffer);
+}
+
 int bucket_init(void) {
     /* Allocate buffer. */
-    buffer = malloc(BUCKET_SIZE * MAX(SWAP_CHUNK_BUCKETS, 2) * sizeof(*buffer));
+    buffer = arena_alloc(bucket_scratch_size());
     if (!buffer) {
         perror("Error allocating buffer");
         goto exit;
@@ -65,7 +76,7 @@ void bucket_init_prealloc(elem_t *buffer_) {
 
 void bucket_free(void) {
     /* Free resources. */
-    free(buffer);
+    arena_free(buffer);
 }
 
 /* Bucket sort. */
@@ -122,19 +133,21 @@ exit:
 }
 
 /* Assigns random ORP IDs to the elems in ARR and distributes them evenly over
- * the 2 * LENGTH elements in OUT. Thus, ARR is assumed to be at least
- * 2 * MAX(LENGTH, BUCKET_SIZE) bytes. The result is an array with real elements
- * interspersed with dummy elements. */
+ * the first 2 * LENGTH of the OUT_LENGTH elements in OUT, filling the rest
+ * with dummy elements. Thus, OUT_LENGTH is assumed to be at least
+ * 2 * LENGTH. The result is an array with real elements interspersed with
+ * dummy elements. */
 // TODO Can we do the first bucket assignment scan while generating these?
 static int assign_random_ids_and_spread(const elem_t *arr, void *out,
-        size_t length, size_t result_start_idx, size_t num_threads) {
+        size_t length, size_t out_length, size_t result_start_idx,
+        size_t num_threads) {
     int ret;
 
     struct assign_random_id_args args = {
         .arr = arr,
         .out = out,
         .arr_length = length,
-        .out_length = MAX(length, BUCKET_SIZE) * 2,
+        .out_length = out_length,
         .result_start_idx = result_start_idx,
         .num_threads = num_threads,
         .ret = 0,
@@ -196,17 +209,79 @@ static void merge_split_swapper(size_t a, size_t b, bool should_swap, void *aux_
 }
 #endif
 
-/* Merge (BUCKET1 + i, BUCKET2 + i) for i = 0, ..., CHUNK_BUCKETS - 1 and split
- * each such that the BUCKET1 buckets contains all elements corresponding with
- * bit 0 and the BUCKET2 buckets contains all elements corresponding with bit
- * 1, with the bit given by the bit in BIT_IDX of the nodes' ORP IDs.
- * CHUNK_BUCKETS may be no more than SWAP_CHUNK_BUCKETS.
- *
- * Note that this is a modified version of the merge-split algorithm from the
- * paper, since the elements are swapped in-place rather than being swapped
- * between different buckets on different layers. */
-static int merge_split_chunk(elem_t *arr, size_t bucket1_idx, size_t
-        bucket2_idx, size_t bit_idx, size_t chunk_buckets) {
+void bucket_merge_split_pair(elem_t *bucket1, elem_t *bucket2,
+        size_t bit_idx) {
+    /* The number of elements with corresponding bit 1. */
+    size_t count1 = 0;
+    for (size_t j = 0; j < BUCKET_SIZE; j++) {
+        /* Obliviously increment count. */
+        count1 +=
+            ((bucket1[j].orp_id >> bit_idx) & 1) & !bucket1[j].is_dummy;
+    }
+    for (size_t j = 0; j < BUCKET_SIZE; j++) {
+        /* Obliviously increment count. */
+        count1 +=
+            ((bucket2[j].orp_id >> bit_idx) & 1) & !bucket2[j].is_dummy;
+    }
+
+    /* There are count1 elements with bit 1, so we need to assign
+     * BUCKET_SIZE - count1 dummy elements to have bit 1, with the
+     * remaining dummy elements assigned with bit 0. */
+    count1 = BUCKET_SIZE - count1;
+
+    /* Assign dummy elements. */
+    for (size_t j = 0; j < BUCKET_SIZE; j++) {
+        /* If count1 > 0 and the node is a dummy element, set BIT_IDX bit
+         * of ORP ID and decrement count1. Else, clear BIT_IDX bit of ORP
+         * ID. */
+        bucket1[j].orp_id &= ~(bucket1[j].is_dummy << bit_idx);
+        bucket1[j].orp_id |=
+            ((bool) count1 & bucket1[j].is_dummy) << bit_idx;
+        count1 -= (bool) count1 & bucket1[j].is_dummy;
+    }
+    for (size_t j = 0; j < BUCKET_SIZE; j++) {
+        /* If count1 > 0 and the node is a dummy element, set BIT_IDX bit
+         * of ORP ID and decrement count1. Else, clear BIT_IDX bit of ORP
+         * ID. */
+        bucket2[j].orp_id &= ~(bucket2[j].is_dummy << bit_idx);
+        bucket2[j].orp_id |=
+            ((bool) count1 & bucket2[j].is_dummy) << bit_idx;
+        count1 -= (bool) count1 & bucket2[j].is_dummy;
+    }
+
+    /* Oblivious bitonic sort elements according to BIT_IDX bit of ORP
+     * id. */
+    struct merge_split_ocompact_aux aux = {
+        .bucket1 = bucket1,
+        .bucket2 = bucket2,
+        .bit_idx = bit_idx,
+    };
+#ifdef DISTRIBUTED_SGX_SORT_MICROBENCHMARK_NOOCOMPACT
+    o_sort_generate_swaps(BUCKET_SIZE * 2, merge_split_swapper, &aux);
+#else
+    o_compact_generate_swaps(BUCKET_SIZE * 2, merge_split_is_marked,
+            merge_split_swapper, &aux);
+#endif
+}
+
+/* The buckets of one merge-split chunk and, if one of its halves is on another
+ * rank, the exchange that brings that half into a chunk buffer. */
+struct merge_split_chunk {
+    elem_t *bucket1_buckets;
+    elem_t *bucket2_buckets;
+    bool skip;
+    bool exchanging;
+    int nonlocal_rank;
+    comm_future_t future;
+};
+
+/* Sets up the merge-split of (BUCKET1 + i, BUCKET2 + i) for i = 0, ...,
+ * CHUNK_BUCKETS - 1 in CHUNK, posting the exchange of our local buckets for
+ * the remote buckets, which are received into CHUNK_BUFFER, if one side is
+ * remote. CHUNK_BUCKETS may be no more than SWAP_CHUNK_BUCKETS. */
+static int post_merge_split_chunk(elem_t *arr, size_t bucket1_idx,
+        size_t bucket2_idx, size_t chunk_buckets, elem_t *chunk_buffer,
+        struct merge_split_chunk *chunk) {
     int ret = -1;
     int bucket1_rank = get_bucket_rank(bucket1_idx);
     int bucket2_rank = get_bucket_rank(bucket2_idx);
@@ -214,126 +289,97 @@ static int merge_split_chunk(elem_t *arr, size_t bucket1_idx, size_t
     bool bucket2_local = bucket2_rank == world_rank;
     size_t local_bucket_start = get_local_bucket_start(world_rank);
 
+    chunk->exchanging = false;
+
     /* If both buckets are remote, ignore this merge-split. */
-    if (!bucket1_local && !bucket2_local) {
+    chunk->skip = !bucket1_local && !bucket2_local;
+    if (chunk->skip) {
         ret = 0;
         goto exit;
     }
 
     /* Load bucket 1 elems if local. */
-    elem_t *bucket1_buckets = NULL;
+    chunk->bucket1_buckets = NULL;
     if (bucket1_local) {
-        bucket1_buckets = arr + (bucket1_idx - local_bucket_start) * BUCKET_SIZE;
+        chunk->bucket1_buckets =
+            arr + (bucket1_idx - local_bucket_start) * BUCKET_SIZE;
     }
 
     /* Load bucket 2 elems if local. */
-    elem_t *bucket2_buckets = NULL;
+    chunk->bucket2_buckets = NULL;
     if (bucket2_local) {
-        bucket2_buckets = arr + (bucket2_idx - local_bucket_start) * BUCKET_SIZE;
+        chunk->bucket2_buckets =
+            arr + (bucket2_idx - local_bucket_start) * BUCKET_SIZE;
     }
 
     /* If remote, send our local buckets then receive the remote buckets from
      * the other node. */
-    if (!bucket1_buckets || !bucket2_buckets) {
+    if (!chunk->bucket1_buckets || !chunk->bucket2_buckets) {
         int local_bucket_idx = bucket1_local ? bucket1_idx : bucket2_idx;
         int nonlocal_bucket_idx = bucket1_local ? bucket2_idx : bucket1_idx;
-        int nonlocal_rank = bucket1_local ? bucket2_rank : bucket1_rank;
+        chunk->nonlocal_rank = bucket1_local ? bucket2_rank : bucket1_rank;
 
-        /* Post receive for remote buckets. */
-        mpi_tls_request_t request;
-        ret = mpi_tls_irecv_bytes(buffer,
-                sizeof(*buffer) * chunk_buckets * BUCKET_SIZE, nonlocal_rank,
-                nonlocal_bucket_idx, &request);
-        if (ret) {
-            handle_error_string(
-                    "Error receiving remote buckets into %d from %d",
-                    world_rank, nonlocal_rank);
-            goto exit;
-        }
-        if (bucket1_buckets) {
-            bucket2_buckets = buffer;
+        /* Exchange our local buckets for the remote buckets. */
+        elem_t *local_buckets =
+            bucket1_local ? chunk->bucket1_buckets : chunk->bucket2_buckets;
+        if (chunk->bucket1_buckets) {
+            chunk->bucket2_buckets = chunk_buffer;
         } else {
-            bucket1_buckets = buffer;
+            chunk->bucket1_buckets = chunk_buffer;
         }
-
-        /* Send local bucket. */
         ret =
-            mpi_tls_send_bytes(
-                bucket1_local ? bucket1_buckets : bucket2_buckets,
-                sizeof(*bucket1_buckets) * chunk_buckets * BUCKET_SIZE,
-                nonlocal_rank, local_bucket_idx);
+            comm_exchange(&chunk->future, local_buckets,
+                    sizeof(*local_buckets) * chunk_buckets * BUCKET_SIZE,
+                    chunk->nonlocal_rank, local_bucket_idx, chunk_buffer,
+                    sizeof(*chunk_buffer) * chunk_buckets * BUCKET_SIZE,
+                    chunk->nonlocal_rank, nonlocal_bucket_idx);
         if (ret) {
-            handle_error_string("Error sending local buckets from %d to %d",
-                    world_rank, nonlocal_rank);
+            handle_error_string("Error exchanging buckets between %d and %d",
+                    world_rank, chunk->nonlocal_rank);
             goto exit;
         }
+        chunk->exchanging = true;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Waits for the exchange of CHUNK, if any, then merges each pair of buckets
+ * and splits them such that the BUCKET1 buckets contain all elements
+ * corresponding with bit 0 and the BUCKET2 buckets contain all elements
+ * corresponding with bit 1, with the bit given by the bit in BIT_IDX of the
+ * nodes' ORP IDs.
+ *
+ * Note that this is a modified version of the merge-split algorithm from the
+ * paper, since the elements are swapped in-place rather than being swapped
+ * between different buckets on different layers. */
+static int finish_merge_split_chunk(struct merge_split_chunk *chunk,
+        size_t bit_idx, size_t chunk_buckets) {
+    int ret;
 
-        /* Wait for bucket receive. */
-        ret = mpi_tls_wait(&request, MPI_TLS_STATUS_IGNORE);
+    if (chunk->skip) {
+        ret = 0;
+        goto exit;
+    }
+
+    if (chunk->exchanging) {
+        chunk->exchanging = false;
+        ret = comm_wait(&chunk->future);
         if (ret) {
             handle_error_string(
-                    "Error waiting on receive for buckets into %d from %d",
-                    world_rank, nonlocal_rank);
+                    "Error waiting on exchange for buckets between %d and %d",
+                    world_rank, chunk->nonlocal_rank);
             goto exit;
         }
     }
 
     /* Perform merge-split for each bucket. */
     for (size_t i = 0; i < chunk_buckets; i++) {
-        elem_t *bucket1 = &bucket1_buckets[i];
-        elem_t *bucket2 = &bucket2_buckets[i];
-
-        /* The number of elements with corresponding bit 1. */
-        size_t count1 = 0;
-        for (size_t j = 0; j < BUCKET_SIZE; j++) {
-            /* Obliviously increment count. */
-            count1 +=
-                ((bucket1[j].orp_id >> bit_idx) & 1) & !bucket1[j].is_dummy;
-        }
-        for (size_t j = 0; j < BUCKET_SIZE; j++) {
-            /* Obliviously increment count. */
-            count1 +=
-                ((bucket2[j].orp_id >> bit_idx) & 1) & !bucket2[j].is_dummy;
-        }
-
-        /* There are count1 elements with bit 1, so we need to assign
-         * BUCKET_SIZE - count1 dummy elements to have bit 1, with the
-         * remaining dummy elements assigned with bit 0. */
-        count1 = BUCKET_SIZE - count1;
-
-        /* Assign dummy elements. */
-        for (size_t j = 0; j < BUCKET_SIZE; j++) {
-            /* If count1 > 0 and the node is a dummy element, set BIT_IDX bit
-             * of ORP ID and decrement count1. Else, clear BIT_IDX bit of ORP
-             * ID. */
-            bucket1[j].orp_id &= ~(bucket1[j].is_dummy << bit_idx);
-            bucket1[j].orp_id |=
-                ((bool) count1 & bucket1[j].is_dummy) << bit_idx;
-            count1 -= (bool) count1 & bucket1[j].is_dummy;
-        }
-        for (size_t j = 0; j < BUCKET_SIZE; j++) {
-            /* If count1 > 0 and the node is a dummy element, set BIT_IDX bit
-             * of ORP ID and decrement count1. Else, clear BIT_IDX bit of ORP
-             * ID. */
-            bucket2[j].orp_id &= ~(bucket2[j].is_dummy << bit_idx);
-            bucket2[j].orp_id |=
-                ((bool) count1 & bucket2[j].is_dummy) << bit_idx;
-            count1 -= (bool) count1 & bucket2[j].is_dummy;
-        }
-
-        /* Oblivious bitonic sort elements according to BIT_IDX bit of ORP
-         * id. */
-        struct merge_split_ocompact_aux aux = {
-            .bucket1 = bucket1,
-            .bucket2 = bucket2,
-            .bit_idx = bit_idx,
-        };
-#ifdef DISTRIBUTED_SGX_SORT_MICROBENCHMARK_NOOCOMPACT
-        o_sort_generate_swaps(BUCKET_SIZE * 2, merge_split_swapper, &aux);
-#else
-        o_compact_generate_swaps(BUCKET_SIZE * 2, merge_split_is_marked,
-                merge_split_swapper, &aux);
-#endif
+        bucket_merge_split_pair(&chunk->bucket1_buckets[i],
+                &chunk->bucket2_buckets[i], bit_idx);
     }
 
     ret = 0;
@@ -367,37 +413,48 @@ struct merge_split_idx_args {
     size_t bucket_offset;
     size_t num_buckets;
     size_t chunk_buckets;
+    size_t num_threads;
 
     int ret;
 };
 
-static void merge_split_idx(void *args_, size_t idx) {
-    struct merge_split_idx_args *args = args_;
-    elem_t *arr = args->arr;
-    size_t bit_idx = args->bit_idx;
+static int post_merge_split_idx(struct merge_split_idx_args *args, size_t idx,
+        elem_t *chunk_buffer, struct merge_split_chunk *chunk) {
     size_t bucket_stride = args->bucket_stride;
-    size_t bucket_offset = args->bucket_offset;
-    size_t num_buckets = args->num_buckets;
     size_t chunk_buckets = args->chunk_buckets;
-    int ret;
 
-    if (bit_idx % 2 == 1) {
-        idx = num_buckets / chunk_buckets / 2 - idx - 1;
+    if (args->bit_idx % 2 == 1) {
+        idx = args->num_buckets / chunk_buckets / 2 - idx - 1;
     }
 
     size_t bucket = (idx * chunk_buckets)
             % (bucket_stride / 2)
         + (idx * chunk_buckets) / (bucket_stride / 2)
             * bucket_stride
-        + bucket_offset;
+        + args->bucket_offset;
     size_t other_bucket = bucket + bucket_stride / 2;
-    ret =
-        merge_split_chunk(arr, bucket, other_bucket, bit_idx,
-                chunk_buckets);
+    int ret =
+        post_merge_split_chunk(args->arr, bucket, other_bucket, chunk_buckets,
+                chunk_buffer, chunk);
     if (ret) {
         handle_error_string(
                 "Error in merge split with indices %lu and %lu\n", bucket,
                 other_bucket);
+    }
+    return ret;
+}
+
+static void merge_split_idx(void *args_, size_t idx) {
+    struct merge_split_idx_args *args = args_;
+    struct merge_split_chunk chunk;
+    int ret;
+
+    ret = post_merge_split_idx(args, idx, buffer, &chunk);
+    if (ret) {
+        goto exit;
+    }
+    ret = finish_merge_split_chunk(&chunk, args->bit_idx, args->chunk_buckets);
+    if (ret) {
         goto exit;
     }
 
@@ -409,22 +466,76 @@ exit:
     }
 }
 
-/* Run merge-split as part of a butterfly network, routing based on
- * ORP_ID[START_BIT_IDX:START_BIT_IDX + NUM_LEVELS - 1]. This is modified from
- * the paper, since all merge-split operations will be constrained to the same
- * buckets of memory. */
-static int bucket_route(elem_t *arr, size_t num_levels, size_t start_bit_idx) {
+/* With communication threads, each thread takes a contiguous range of the
+ * indices instead and posts the exchange for its next chunk into its second
+ * chunk buffer before merging the current one, so that the communication
+ * threads move the next chunk while this thread merges. */
+static void merge_split_range(void *args_, size_t thread_idx) {
+    struct merge_split_idx_args *args = args_;
+    size_t chunk_buckets = args->chunk_buckets;
+    size_t count = args->num_buckets / chunk_buckets / 2;
+    size_t start = thread_idx * count / args->num_threads;
+    size_t end = (thread_idx + 1) * count / args->num_threads;
+    struct merge_split_chunk chunks[2] = {
+        { .exchanging = false },
+        { .exchanging = false },
+    };
+    size_t curr = 0;
     int ret;
 
-    size_t bucket_start = get_local_bucket_start(world_rank);
-    size_t num_buckets = get_local_bucket_start(world_rank + 1) - bucket_start;
-    if (1lu << num_levels > num_buckets) {
-        /* If 2 ^ NUM_LEVELS > NUM_BUCKETS, we need to do some merge-splits
-         * across different enclaves, so we round BUCKET_START down to the
-         * nearest multiple of 2 ^ NUM_LEVELS. */
-        bucket_start -= bucket_start % (1 << num_levels);
-        num_buckets = 1 << num_levels;
+    if (start < end) {
+        ret = post_merge_split_idx(args, start, buffer, &chunks[curr]);
+        if (ret) {
+            goto exit;
+        }
     }
+    for (size_t idx = start; idx < end; idx++) {
+        /* Post the exchange for the next chunk. */
+        if (idx + 1 < end) {
+            ret =
+                post_merge_split_idx(args, idx + 1,
+                        buffer + (1 - curr) * MAX(SWAP_CHUNK_BUCKETS, 2)
+                            * BUCKET_SIZE,
+                        &chunks[1 - curr]);
+            if (ret) {
+                goto exit;
+            }
+        }
+
+        ret = finish_merge_split_chunk(&chunks[curr], args->bit_idx,
+                chunk_buckets);
+        if (ret) {
+            goto exit;
+        }
+
+        curr = 1 - curr;
+    }
+
+    ret = 0;
+
+exit:
+    /* Wait for any exchange still posted on error so that it no longer
+     * refers to our stack. */
+    for (size_t i = 0; i < 2; i++) {
+        if (chunks[i].exchanging) {
+            comm_wait(&chunks[i].future);
+        }
+    }
+    if (ret) {
+        int expected = 0;
+        __atomic_compare_exchange_n(&args->ret, &expected, ret, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+/* Run NUM_LEVELS levels of merge-split over the NUM_BUCKETS buckets starting
+ * at bucket BUCKET_START, routing based on
+ * ORP_ID[START_BIT_IDX:START_BIT_IDX + NUM_LEVELS - 1]. */
+static int bucket_route_range(elem_t *arr, size_t bucket_start,
+        size_t num_buckets, size_t num_levels, size_t start_bit_idx,
+        size_t num_threads) {
+    int ret;
+
     for (size_t bit_idx = 0; bit_idx < num_levels; bit_idx++) {
         size_t bucket_stride = 2u << bit_idx;
         size_t chunk_buckets = MIN(bucket_stride / 2, SWAP_CHUNK_BUCKETS);
@@ -437,6 +548,7 @@ static int bucket_route(elem_t *arr, size_t num_levels, size_t start_bit_idx) {
             .bucket_offset = bucket_start,
             .num_buckets = num_buckets,
             .chunk_buckets = chunk_buckets,
+            .num_threads = num_threads,
         };
         struct thread_work work = {
             .type = THREAD_WORK_ITER,
@@ -446,6 +558,10 @@ static int bucket_route(elem_t *arr, size_t num_levels, size_t start_bit_idx) {
                 .count = num_buckets / chunk_buckets / 2,
             },
         };
+        if (comm_num_threads) {
+            work.iter.func = merge_split_range;
+            work.iter.count = num_threads;
+        }
         thread_work_push(&work);
 
         thread_work_until_empty();
@@ -466,14 +582,35 @@ exit:
     return ret;
 }
 
+/* Run merge-split as part of a butterfly network, routing based on
+ * ORP_ID[START_BIT_IDX:START_BIT_IDX + NUM_LEVELS - 1]. This is modified from
+ * the paper, since all merge-split operations will be constrained to the same
+ * buckets of memory. */
+static int bucket_route(elem_t *arr, size_t num_levels, size_t start_bit_idx,
+        size_t num_threads) {
+    size_t bucket_start = get_local_bucket_start(world_rank);
+    size_t num_buckets = get_local_bucket_start(world_rank + 1) - bucket_start;
+    if (1lu << num_levels > num_buckets) {
+        /* If 2 ^ NUM_LEVELS > NUM_BUCKETS, we need to do some merge-splits
+         * across different enclaves, so we round BUCKET_START down to the
+         * nearest multiple of 2 ^ NUM_LEVELS. */
+        bucket_start -= bucket_start % (1 << num_levels);
+        num_buckets = 1 << num_levels;
+    }
+    return bucket_route_range(arr, bucket_start, num_buckets, num_levels,
+            start_bit_idx, num_threads);
+}
+
 #ifndef DISTRIBUTED_SGX_SORT_MICROBENCHMARK_NOROUTE
-/* Distribute and receive elements from buckets in ARR to buckets in OUT.
- * Bucket i is sent to enclave i % E. */
+/* Distribute and receive elements from the NUM_BUCKETS buckets in ARR to
+ * buckets in OUT. Bucket i is sent to enclave i % E. */
 struct distributed_bucket_route_args {
     elem_t *arr;
     elem_t *out;
+    size_t num_buckets;
     volatile size_t *send_idxs;
     volatile size_t recv_idx;
+    struct thread_barrier barrier;
     volatile int ret;
 };
 static void distributed_bucket_route(void *args_, size_t thread_idx) {
@@ -483,8 +620,7 @@ static void distributed_bucket_route(void *args_, size_t thread_idx) {
     volatile size_t *send_idxs = args->send_idxs;
     volatile size_t *recv_idx = &args->recv_idx;
     size_t local_bucket_start = get_local_bucket_start(world_rank);
-    size_t num_local_buckets =
-        get_local_bucket_start(world_rank + 1) - local_bucket_start;
+    size_t num_local_buckets = args->num_buckets;
     int ret;
 
     mpi_tls_request_t requests[world_size];
@@ -497,9 +633,6 @@ static void distributed_bucket_route(void *args_, size_t thread_idx) {
         goto exit;
     }
 
-    /* Wait so that thread 0 has defeintely updated RECV_IDX. */
-    thread_wait_for_all();
-
     /* Copy our own buckets to the output if any. */
     if (thread_idx == 0) {
         for (size_t j = send_idxs[world_rank]; j < num_local_buckets;
@@ -511,6 +644,11 @@ static void distributed_bucket_route(void *args_, size_t thread_idx) {
         }
     }
 
+    /* Wait so that thread 0 has definitely updated RECV_IDX. Otherwise, other
+     * threads could post receives into the slots meant for our own buckets,
+     * leaving receives that are never matched. */
+    thread_barrier_wait(&args->barrier);
+
     /* Post a receive request for the current bucket. */
     size_t num_requests = 0;
     size_t our_recv_idx = __atomic_fetch_add(recv_idx, 1, __ATOMIC_RELAXED);
@@ -633,6 +771,10 @@ static int permute_comparator(const void *a_, const void *b_,
         + ((a->orp_id > b->orp_id) - (a->orp_id < b->orp_id));
 }
 
+void bucket_permute(elem_t *bucket) {
+    o_sort(bucket, BUCKET_SIZE, sizeof(*bucket), permute_comparator, NULL);
+}
+
 /* Permutes the real elements in the bucket by sorting according to all bits of
  * the ORP ID. This is valid because the bin assignment used the lower bits of
  * the ORP ID, leaving the upper bits free for comparison and permutation within
@@ -642,6 +784,7 @@ static int permute_comparator(const void *a_, const void *b_,
 struct permute_and_compress_args {
     elem_t *arr;
     elem_t *out;
+    size_t out_capacity;
     size_t start_idx;
     size_t *compress_idx;
     int ret;
@@ -654,8 +797,7 @@ static void permute_and_compress(void *args_, size_t bucket_idx) {
     size_t *compress_idx = args->compress_idx;
     int ret;
 
-    o_sort(arr + bucket_idx * BUCKET_SIZE, BUCKET_SIZE, sizeof(*arr),
-            permute_comparator, NULL);
+    bucket_permute(arr + bucket_idx * BUCKET_SIZE);
 
     /* Assign random ORP IDs and Count real elements. */
     size_t num_real_elems = 0;
@@ -684,6 +826,12 @@ static void permute_and_compress(void *args_, size_t bucket_idx) {
     size_t out_idx =
         __atomic_fetch_add(compress_idx, num_real_elems,
                 __ATOMIC_RELAXED);
+    if (out_idx + num_real_elems > args->out_capacity) {
+        handle_error_string("Compressed buckets exceed %zu elements",
+                args->out_capacity);
+        ret = -1;
+        goto exit;
+    }
 
     /* Copy the elements to the output. */
     memcpy(out + out_idx, arr + bucket_idx * BUCKET_SIZE,
@@ -700,11 +848,11 @@ exit:
 int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
     int ret;
 
-    total_length = length;
-
-    size_t src_local_start = total_length * world_rank / world_size;
+    size_t src_local_start =
+        (length * world_rank + world_size - 1) / world_size;
     size_t src_local_length =
-        total_length * (world_rank + 1) / world_size - src_local_start;
+        (length * (world_rank + 1) + world_size - 1) / world_size
+            - src_local_start;
     size_t local_bucket_start = get_local_bucket_start(world_rank);
     size_t num_local_buckets =
         get_local_bucket_start(world_rank + 1) - local_bucket_start;
@@ -717,32 +865,25 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
 
     elem_t *buf = arr + local_length;
 
-    struct timespec time_start;
-    if (clock_gettime(CLOCK_REALTIME, &time_start)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_t span_shuffle = span_begin("shuffle");
+    span_t span = span_begin("assign_ids");
 
     /* Spread the elements located in the first half of our input array. */
     ret =
-        assign_random_ids_and_spread(arr, buf, src_local_length, local_start,
-                num_threads);
+        assign_random_ids_and_spread(arr, buf, src_local_length, local_length,
+                local_start, num_threads);
     if (ret) {
         handle_error_string("Error assigning random IDs to elems");
         ret = errno;
         goto exit;
     }
 
-    struct timespec time_assign_ids;
-    if (clock_gettime(CLOCK_REALTIME, &time_assign_ids)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("merge_split");
 
 #ifdef DISTRIBUTED_SGX_SORT_MICROBENCHMARK_NOROUTE
-    ret = bucket_route(buf, log2ll(world_size * num_local_buckets), 0);
+    ret = bucket_route(buf, log2ll(world_size * num_local_buckets), 0,
+            num_threads);
     if (ret) {
         handle_error_string("Error routing elements through butterfly network");
         goto exit;
@@ -751,7 +892,7 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
     memcpy(arr, buf, local_length * sizeof(*arr));
 #else
     size_t route_levels1 = log2ll(world_size);
-    ret = bucket_route(buf, route_levels1, 0);
+    ret = bucket_route(buf, route_levels1, 0, num_threads);
     if (ret) {
         handle_error_string("Error routing elements through butterfly network");
         goto exit;
@@ -764,10 +905,12 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
     struct distributed_bucket_route_args args = {
         .arr = buf,
         .out = arr,
+        .num_buckets = num_local_buckets,
         .send_idxs = send_idxs,
         .recv_idx = 0,
         .ret = 0,
     };
+    thread_barrier_init(&args.barrier, num_threads);
     struct thread_work work = {
         .type = THREAD_WORK_ITER,
         .iter = {
@@ -786,19 +929,15 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
     }
 
     size_t route_levels2 = log2ll(num_local_buckets);
-    ret = bucket_route(arr, route_levels2, route_levels1);
+    ret = bucket_route(arr, route_levels2, route_levels1, num_threads);
     if (ret) {
         handle_error_string("Error routing elements through butterfly network");
         goto exit;
     }
 #endif
 
-    struct timespec time_merge_split;
-    if (clock_gettime(CLOCK_REALTIME, &time_merge_split)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("compression");
 
     /* Permute each bucket and concatenate them back together by compressing all
      * real elems together. We also assign new ORP IDs so that all elements have
@@ -808,6 +947,7 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
         struct permute_and_compress_args args = {
             .arr = arr,
             .out = buf,
+            .out_capacity = local_length,
             .start_idx = local_start,
             .compress_idx = &compress_len,
             .ret = 0,
@@ -830,31 +970,431 @@ int bucket_sort(elem_t *arr, size_t length, size_t num_threads) {
         }
     }
 
-    struct timespec time_compress;
-    if (clock_gettime(CLOCK_REALTIME, &time_compress)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span_end(span_shuffle);
 
     /* Nonoblivious sort. */
-    ret = nonoblivious_sort(buf, arr, length, compress_len, num_threads);
+    ret =
+        nonoblivious_sort(buf, arr, length, compress_len, local_length,
+                num_threads);
     if (ret) {
         handle_error_string("Error in nonoblivious sort");
         goto exit;
     }
 
-    if (world_rank == 0) {
-        printf("assign_ids       : %f\n",
-                get_time_difference(&time_start, &time_assign_ids));
-        printf("merge_split      : %f\n",
-                get_time_difference(&time_assign_ids, &time_merge_split));
-        printf("compression      : %f\n",
-                get_time_difference(&time_merge_split, &time_compress));
-        printf("shuffle          : %f\n",
-                get_time_difference(&time_start, &time_compress));
+exit:
+    return ret;
+}
+
+/* External-memory bucket sort. The input, the buckets, and the output live in
+ * encrypted stores in host memory rather than in the enclave, and are paged
+ * through two enclave blocks of 2 ^ BLOCK_LEVELS buckets each, so the enclave
+ * holds the blocks and a few pages however many elements there are. Every
+ * oblivious pass reads and writes whole blocks in an order fixed by the number
+ * of buckets and the block size, so the host learns nothing beyond what the
+ * in-enclave sort already reveals: the number of real elements in each bucket
+ * when compressing and the order in which distributed buckets arrive. */
+
+/* Returns the number of levels of buckets in each block, so that the two
+ * blocks fit BLOCK_BYTES but hold a bucket for each rank and at least two, for
+ * the nonoblivious sort's merges, and no more than 2 ^ MAX_LEVELS. */
+static size_t get_extmem_block_levels(size_t block_bytes, size_t max_levels) {
+    size_t bucket_bytes = BUCKET_SIZE * sizeof(elem_t);
+    size_t block_levels = 0;
+    while (block_levels < max_levels
+            && (size_t) 4 << block_levels <= block_bytes / bucket_bytes) {
+        block_levels++;
+    }
+    return MAX(block_levels, MAX((size_t) log2ll(world_size), 1));
+}
+
+size_t bucket_extmem_scratch_size(size_t block_bytes) {
+    size_t block_len =
+        BUCKET_SIZE << get_extmem_block_levels(block_bytes, SIZE_MAX);
+    return (block_len + BUCKET_SIZE) * 2 * sizeof(elem_t)
+        + nonoblivious_extmem_scratch_size(BUCKET_SIZE, block_len);
+}
+
+/* Returns the index of the J'th bucket of block BLOCK when each block holds
+ * the 2 ^ BLOCK_LEVELS buckets whose indices differ only in bits LEVEL to
+ * LEVEL + BLOCK_LEVELS - 1. When LEVEL is 0, blocks are contiguous. */
+static size_t get_block_bucket(size_t block, size_t j, size_t level,
+        size_t block_levels) {
+    size_t low_mask = ((size_t) 1 << level) - 1;
+    return (block & low_mask)
+        + (j << level)
+        + ((block & ~low_mask) << block_levels);
+}
+
+struct extmem_transfer_args {
+    struct extmem_store *store;
+    elem_t *block;
+    size_t block_idx;
+    size_t level;
+    size_t block_levels;
+    bool write;
+    int ret;
+};
+static void extmem_transfer_bucket(void *args_, size_t j) {
+    struct extmem_transfer_args *args = args_;
+    size_t bucket =
+        get_block_bucket(args->block_idx, j, args->level, args->block_levels);
+    int ret;
+
+    if (args->write) {
+        ret = extmem_write(args->store, bucket, args->block + j * BUCKET_SIZE);
+    } else {
+        ret = extmem_read(args->store, bucket, args->block + j * BUCKET_SIZE);
+    }
+    if (ret) {
+        handle_error_string("Error transferring bucket %zu", bucket);
+        int expected = 0;
+        __atomic_compare_exchange_n(&args->ret, &expected, ret, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+/* Reads or writes block BLOCK_IDX of STORE, as laid out by get_block_bucket,
+ * to or from BLOCK, with the buckets spread across the pool. */
+static int extmem_transfer_block(struct extmem_store *store, elem_t *block,
+        size_t block_idx, size_t level, size_t block_levels, bool write) {
+    struct extmem_transfer_args args = {
+        .store = store,
+        .block = block,
+        .block_idx = block_idx,
+        .level = level,
+        .block_levels = block_levels,
+        .write = write,
+        .ret = 0,
+    };
+    struct thread_work work = {
+        .type = THREAD_WORK_ITER,
+        .iter = {
+            .func = extmem_transfer_bucket,
+            .arg = &args,
+            .count = (size_t) 1 << block_levels,
+        },
+    };
+    thread_work_push(&work);
+    thread_work_until_empty();
+    thread_wait(&work);
+    return args.ret;
+}
+
+/* Runs bucket_route over the buckets in *SRC, a block at a time, passing them
+ * back and forth between *SRC and *DST, whose pointers are swapped after each
+ * pass, so that *SRC holds the routed buckets. Each pass loads the blocks
+ * whose buckets differ only in the next BLOCK_LEVELS bits of their index, so
+ * that those levels of the butterfly network run entirely in the enclave. */
+static int extmem_route(struct extmem_store **src, struct extmem_store **dst,
+        elem_t *block, size_t max_block_levels, size_t num_levels,
+        size_t start_bit_idx, size_t num_threads) {
+    size_t local_bucket_start = get_local_bucket_start(world_rank);
+    int ret;
+
+    for (size_t level = 0; level < num_levels; level += max_block_levels) {
+        size_t block_levels = MIN(max_block_levels, num_levels - level);
+        size_t num_blocks = (*src)->num_blocks >> block_levels;
+        ret = extmem_rekey(*dst);
+        if (ret) {
+            goto exit;
+        }
+        for (size_t i = 0; i < num_blocks; i++) {
+            ret = extmem_transfer_block(*src, block, i, level, block_levels,
+                    false);
+            if (ret) {
+                goto exit;
+            }
+            ret = bucket_route_range(block, local_bucket_start,
+                    (size_t) 1 << block_levels, block_levels,
+                    start_bit_idx + level, num_threads);
+            if (ret) {
+                handle_error_string(
+                        "Error routing elements through butterfly network");
+                goto exit;
+            }
+            ret = extmem_transfer_block(*dst, block, i, level, block_levels,
+                    true);
+            if (ret) {
+                goto exit;
+            }
+        }
+
+        struct extmem_store *temp = *src;
+        *src = *dst;
+        *dst = temp;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int bucket_sort_extmem(struct extmem_store *data, size_t length,
+        size_t src_local_start, size_t src_local_length, size_t block_bytes,
+        size_t num_threads) {
+    int ret;
+
+    size_t local_bucket_start = get_local_bucket_start(world_rank);
+    size_t num_local_buckets =
+        get_local_bucket_start(world_rank + 1) - local_bucket_start;
+    size_t local_start = local_bucket_start * BUCKET_SIZE;
+    size_t route_levels1 = log2ll(world_size);
+    size_t route_levels2 = log2ll(num_local_buckets);
+    size_t bucket_bytes = BUCKET_SIZE * sizeof(elem_t);
+
+    /* Every rank pages through the same number of blocks, and distribution
+     * exchanges whole blocks, so all ranks need the same power-of-two number
+     * of buckets, at least one per rank. */
+    if (1lu << route_levels1 != (size_t) world_size
+            || 1lu << route_levels2 != num_local_buckets
+            || num_local_buckets < (size_t) world_size) {
+        handle_error_string(
+                "External-memory bucket sort needs a power-of-two number of ranks and at least as many buckets per rank");
+        ret = -1;
+        goto exit;
+    }
+    if (data->block_len != bucket_bytes
+            || data->num_blocks < CEIL_DIV(src_local_length, BUCKET_SIZE)) {
+        handle_error_string(
+                "External-memory data must be stored in pages of a bucket");
+        ret = -1;
+        goto exit;
+    }
+
+    size_t block_levels = get_extmem_block_levels(block_bytes, route_levels2);
+    size_t block_buckets = (size_t) 1 << block_levels;
+    size_t block_len = block_buckets * BUCKET_SIZE;
+    size_t num_blocks = num_local_buckets / block_buckets;
+
+    /* Two blocks, and a page each for reading the input and writing the
+     * compressed buckets. */
+    elem_t *block =
+        mem_alloc(MEM_SCRATCH, (block_len + BUCKET_SIZE) * 2 * sizeof(*block));
+    if (!block) {
+        perror("malloc extmem blocks");
+        ret = -1;
+        goto exit;
+    }
+    elem_t *other_block = block + block_len;
+    elem_t *read_page = other_block + block_len;
+    elem_t *write_page = read_page + BUCKET_SIZE;
+
+    struct extmem_store stores[2];
+    ret = extmem_init(&stores[0], num_local_buckets, bucket_bytes);
+    if (ret) {
+        handle_error_string("Error initializing bucket store");
+        goto exit_free_block;
+    }
+    ret = extmem_init(&stores[1], num_local_buckets, bucket_bytes);
+    if (ret) {
+        handle_error_string("Error initializing bucket store");
+        goto exit_free_store0;
+    }
+    struct extmem_store *cur = &stores[0];
+    struct extmem_store *next = &stores[1];
+
+    span_t span_shuffle = span_begin("shuffle");
+    span_t span = span_begin("assign_ids");
+
+    /* Read the input half a block at a time, spread it into a block of
+     * buckets, and write them out. */
+    struct extmem_stream reader;
+    extmem_stream_init(&reader, data, read_page, 0);
+    for (size_t i = 0; i < num_blocks; i++) {
+        size_t block_src_start = i * block_len / 2;
+        size_t block_src_length =
+            MIN(src_local_length - MIN(block_src_start, src_local_length),
+                    block_len / 2);
+        ret = extmem_stream_read(&reader, other_block, block_src_length);
+        if (ret) {
+            handle_error_string("Error reading input");
+            goto exit_free_stores;
+        }
+
+        struct assign_random_id_args args = {
+            .arr = other_block,
+            .out = block,
+            .arr_length = block_src_length,
+            .out_length = block_len,
+            .result_start_idx = local_start + block_src_start * 2,
+            .num_threads = num_threads,
+            .ret = 0,
+        };
+        struct thread_work work = {
+            .type = THREAD_WORK_ITER,
+            .iter = {
+                .func = assign_random_id,
+                .arg = &args,
+                .count = num_threads,
+            },
+        };
+        thread_work_push(&work);
+        thread_work_until_empty();
+        thread_wait(&work);
+        ret = args.ret;
+        if (ret) {
+            handle_error_string("Error assigning random IDs to elems");
+            goto exit_free_stores;
+        }
+
+        ret = extmem_transfer_block(cur, block, i, 0, block_levels, true);
+        if (ret) {
+            goto exit_free_stores;
+        }
+    }
+
+    span_end(span);
+    span = span_begin("merge_split");
+
+    ret = extmem_route(&cur, &next, block, block_levels, route_levels1, 0,
+            num_threads);
+    if (ret) {
+        goto exit_free_stores;
+    }
+
+    /* Distribute the buckets a block at a time. Each rank sends and receives
+     * BLOCK_BUCKETS / WORLD_SIZE buckets to and from each rank per block, so
+     * every rank receives exactly a block's worth before moving on. */
+    if (world_size > 1) {
+        ret = extmem_rekey(next);
+        if (ret) {
+            goto exit_free_stores;
+        }
+        for (size_t i = 0; i < num_blocks; i++) {
+            ret = extmem_transfer_block(cur, block, i, 0, block_levels, false);
+            if (ret) {
+                goto exit_free_stores;
+            }
+
+            size_t send_idxs[world_size];
+            for (int j = 0; j < world_size; j++) {
+                send_idxs[j] =
+                    (j - local_bucket_start % world_size) % world_size;
+            }
+            struct distributed_bucket_route_args args = {
+                .arr = block,
+                .out = other_block,
+                .num_buckets = block_buckets,
+                .send_idxs = send_idxs,
+                .recv_idx = 0,
+                .ret = 0,
+            };
+            thread_barrier_init(&args.barrier, num_threads);
+            struct thread_work work = {
+                .type = THREAD_WORK_ITER,
+                .iter = {
+                    .func = distributed_bucket_route,
+                    .arg = &args,
+                    .count = num_threads,
+                },
+            };
+            thread_work_push(&work);
+            thread_work_until_empty();
+            thread_wait(&work);
+            ret = args.ret;
+            if (ret) {
+                handle_error_string(
+                        "Error distributing elements in butterfly network");
+                goto exit_free_stores;
+            }
+
+            ret = extmem_transfer_block(next, other_block, i, 0, block_levels,
+                    true);
+            if (ret) {
+                goto exit_free_stores;
+            }
+        }
+
+        struct extmem_store *temp = cur;
+        cur = next;
+        next = temp;
+    }
+
+    ret = extmem_route(&cur, &next, block, block_levels, route_levels2,
+            route_levels1, num_threads);
+    if (ret) {
+        goto exit_free_stores;
+    }
+
+    span_end(span);
+    span = span_begin("compression");
+
+    /* Permute and compress the buckets a block at a time, appending the real
+     * elements to the other store. */
+    ret = extmem_rekey(next);
+    if (ret) {
+        goto exit_free_stores;
+    }
+    struct extmem_stream writer;
+    extmem_stream_init(&writer, next, write_page, 0);
+    size_t compress_len = 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        ret = extmem_transfer_block(cur, block, i, 0, block_levels, false);
+        if (ret) {
+            goto exit_free_stores;
+        }
+
+        size_t block_compress_len = 0;
+        struct permute_and_compress_args args = {
+            .arr = block,
+            .out = other_block,
+            .out_capacity = block_len,
+            .start_idx = local_start + i * block_len,
+            .compress_idx = &block_compress_len,
+            .ret = 0,
+        };
+        struct thread_work work = {
+            .type = THREAD_WORK_ITER,
+            .iter = {
+                .func = permute_and_compress,
+                .arg = &args,
+                .count = block_buckets,
+            },
+        };
+        thread_work_push(&work);
+        thread_work_until_empty();
+        thread_wait(&work);
+        ret = args.ret;
+        if (ret) {
+            handle_error_string("Error permuting buckets");
+            goto exit_free_stores;
+        }
+
+        ret = extmem_stream_write(&writer, other_block, block_compress_len);
+        if (ret) {
+            handle_error_string("Error writing compressed buckets");
+            goto exit_free_stores;
+        }
+        compress_len += block_compress_len;
+    }
+    ret = extmem_stream_flush(&writer);
+    if (ret) {
+        handle_error_string("Error writing compressed buckets");
+        goto exit_free_stores;
+    }
+
+    span_end(span);
+    span_end(span_shuffle);
+
+    /* Sort the compressed buckets back into DATA, with the routed buckets'
+     * store as scratch. */
+    ret =
+        nonoblivious_sort_extmem(next, cur, compress_len, data,
+                src_local_start, src_local_length, block, other_block,
+                block_len, num_threads);
+    if (ret) {
+        handle_error_string("Error in nonoblivious sort");
+        goto exit_free_stores;
     }
 
+exit_free_stores:
+    extmem_free(&stores[1]);
+exit_free_store0:
+    extmem_free(&stores[0]);
+exit_free_block:
+    mem_free(block);
 exit:
     return ret;
 }
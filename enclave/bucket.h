@@ -3,16 +3,39 @@
 
 #include <stddef.h>
 #include "common/elem_t.h"
+#include "enclave/extmem.h"
+#include "enclave/params.h"
 
-#define BUCKET_SIZE 512
+#define BUCKET_SIZE (sort_params.bucket_size)
 
 /* The number of buckets to send/receive from the remote at a time during
  * merge-split. */
-#define SWAP_CHUNK_BUCKETS 1
+#define SWAP_CHUNK_BUCKETS (sort_params.bucket_swap_chunk_buckets)
 
+size_t bucket_scratch_size(void);
 int bucket_init(void);
 void bucket_init_prealloc(elem_t *buffer);
 void bucket_free(void);
 int bucket_sort(elem_t *arr, size_t length, size_t num_threads);
 
+/* The sort's two kernels, exposed for the kernel benchmark. The first
+ * merge-splits two local buckets by bit BIT_IDX of their elements' ORP IDs,
+ * and the second obliviously sorts one bucket by ORP ID, putting dummies
+ * last. */
+void bucket_merge_split_pair(elem_t *bucket1, elem_t *bucket2,
+        size_t bit_idx);
+void bucket_permute(elem_t *bucket);
+
+/* Like bucket_sort, but keeps the elements and the buckets encrypted in host
+ * memory and pages them through two enclave blocks of at most BLOCK_BYTES
+ * bytes in total. DATA holds this rank's SRC_LOCAL_LENGTH elements, starting
+ * at index SRC_LOCAL_START of the LENGTH elements in total, in blocks of one
+ * bucket each, and holds this rank's share of the sorted output, in the same
+ * layout, when this returns. The enclave allocates at most
+ * bucket_extmem_scratch_size(BLOCK_BYTES) bytes, however large LENGTH is. */
+size_t bucket_extmem_scratch_size(size_t block_bytes);
+int bucket_sort_extmem(struct extmem_store *data, size_t length,
+        size_t src_local_start, size_t src_local_length, size_t block_bytes,
+        size_t num_threads);
+
 #endif /* distributed-sgx-sort/enclave/bucket.h */
@@ -0,0 +1,255 @@
+#include "enclave/comm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/error.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/synch.h"
+#include "enclave/threading.h"
+
+/* The maximum number of exchanges a single communication thread keeps in
+ * flight at once. */
+#define MAX_IN_FLIGHT 64
+
+size_t comm_num_threads;
+
+static spinlock_t comm_lock;
+static comm_future_t *volatile comm_head;
+static comm_future_t *volatile comm_tail;
+static volatile bool comm_done;
+
+/* Upped once for every exchange posted and once for each communication
+ * thread on release, so that idle communication threads wait on it instead of
+ * polling the queue. Exchanges popped while busy leave their ups behind, which
+ * only cost a spurious pass of the loop. */
+static sema_t comm_posted;
+
+void comm_init(size_t num_threads) {
+    comm_num_threads = num_threads;
+}
+
+/* Performs the exchange in the calling thread. This is used when there are no
+ * communication threads. */
+static int exchange_sync(comm_future_t *future) {
+    mpi_tls_request_t request;
+    int ret;
+
+    /* Post receive for remote elems. */
+    if (future->recv_count) {
+        ret = mpi_tls_irecv_bytes(future->recv_buf, future->recv_count,
+                future->src, future->recv_tag, &request);
+        if (ret) {
+            handle_error_string("Error posting exchange receive from %d",
+                    future->src);
+            goto exit;
+        }
+    }
+
+    /* Send local elems. */
+    if (future->send_count) {
+        ret = mpi_tls_send_bytes(future->send_buf, future->send_count,
+                future->dest, future->send_tag);
+        if (ret) {
+            handle_error_string("Error sending exchange to %d", future->dest);
+            goto exit;
+        }
+    }
+
+    /* Wait for the receive. */
+    if (future->recv_count) {
+        ret = mpi_tls_wait(&request, MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error waiting on exchange receive from %d",
+                    future->src);
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int comm_exchange(comm_future_t *future, const void *send_buf,
+        size_t send_count, int dest, int send_tag, void *recv_buf,
+        size_t recv_count, int src, int recv_tag) {
+    future->send_buf = send_buf;
+    future->send_count = send_count;
+    future->dest = dest;
+    future->send_tag = send_tag;
+    future->recv_buf = recv_buf;
+    future->recv_count = recv_count;
+    future->src = src;
+    future->recv_tag = recv_tag;
+    future->job = current_job;
+    future->ret = 0;
+    sema_init(&future->done, 0);
+
+    if (!comm_num_threads) {
+        future->ret = exchange_sync(future);
+        sema_up(&future->done);
+        return future->ret;
+    }
+
+    spinlock_lock(&comm_lock);
+    future->next = NULL;
+    if (!comm_tail) {
+        comm_head = future;
+        comm_tail = future;
+    } else {
+        comm_tail->next = future;
+        comm_tail = future;
+    }
+    spinlock_unlock(&comm_lock);
+    sema_up(&comm_posted);
+
+    return 0;
+}
+
+int comm_wait(comm_future_t *future) {
+    sema_down(&future->done);
+    return future->ret;
+}
+
+/* Communication threads. */
+
+static comm_future_t *pop_exchange(void) {
+    comm_future_t *future = NULL;
+    if (comm_head) {
+        spinlock_lock(&comm_lock);
+        if (comm_head) {
+            future = comm_head;
+            if (!comm_head->next) {
+                comm_tail = NULL;
+            }
+            comm_head = comm_head->next;
+        }
+        spinlock_unlock(&comm_lock);
+    }
+    return future;
+}
+
+/* Posts the nonblocking receive and send of FUTURE. Unlike exchange_sync, the
+ * send is nonblocking as well so that a single communication thread never
+ * blocks on a peer that is waiting on a different exchange. */
+static int start_exchange(comm_future_t *future) {
+    int ret;
+
+    future->num_requests = 0;
+
+    if (future->recv_count) {
+        ret = mpi_tls_irecv_bytes(future->recv_buf, future->recv_count,
+                future->src, future->recv_tag,
+                &future->requests[future->num_requests]);
+        if (ret) {
+            handle_error_string("Error posting exchange receive from %d",
+                    future->src);
+            goto exit;
+        }
+        future->requests_done[future->num_requests] = false;
+        future->num_requests++;
+    }
+
+    if (future->send_count) {
+        ret = mpi_tls_isend_bytes(future->send_buf, future->send_count,
+                future->dest, future->send_tag,
+                &future->requests[future->num_requests]);
+        if (ret) {
+            handle_error_string("Error posting exchange send to %d",
+                    future->dest);
+            goto exit;
+        }
+        future->requests_done[future->num_requests] = false;
+        future->num_requests++;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Tests each outstanding request of FUTURE once. Returns true if all of its
+ * requests have completed. */
+static bool progress_exchange(comm_future_t *future) {
+    bool all_done = true;
+
+    for (size_t i = 0; i < future->num_requests; i++) {
+        if (future->requests_done[i]) {
+            continue;
+        }
+
+        int flag;
+        int ret =
+            mpi_tls_test(&future->requests[i], &flag, MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error testing exchange request");
+            future->ret = ret;
+            future->requests_done[i] = true;
+            continue;
+        }
+
+        if (flag) {
+            future->requests_done[i] = true;
+        } else {
+            all_done = false;
+        }
+    }
+
+    return all_done;
+}
+
+void comm_start_work(void) {
+    comm_future_t *in_flight[MAX_IN_FLIGHT];
+    size_t num_in_flight = 0;
+
+    while (!comm_done || comm_head || num_in_flight) {
+        /* With nothing in flight, wait for an exchange to be posted. */
+        if (!num_in_flight && !comm_head) {
+            sema_down(&comm_posted);
+        }
+
+        /* Start newly posted exchanges while there is room. */
+        while (num_in_flight < MAX_IN_FLIGHT) {
+            comm_future_t *future = pop_exchange();
+            if (!future) {
+                break;
+            }
+
+            current_job = future->job;
+            future->ret = start_exchange(future);
+            current_job = NULL;
+            if (future->ret) {
+                sema_up(&future->done);
+                continue;
+            }
+
+            in_flight[num_in_flight] = future;
+            num_in_flight++;
+        }
+
+        /* Drive the outstanding exchanges and complete the finished ones. The
+         * future belongs to the compute thread again once it is signaled. */
+        size_t i = 0;
+        while (i < num_in_flight) {
+            if (progress_exchange(in_flight[i])) {
+                sema_up(&in_flight[i]->done);
+                num_in_flight--;
+                in_flight[i] = in_flight[num_in_flight];
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+void comm_release_all(void) {
+    comm_done = true;
+    for (size_t i = 0; i < comm_num_threads; i++) {
+        sema_up(&comm_posted);
+    }
+}
+
+void comm_unrelease_all(void) {
+    comm_done = false;
+}
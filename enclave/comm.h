@@ -0,0 +1,49 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_COMM_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_COMM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "enclave/mpi_tls.h"
+#include "enclave/synch.h"
+#include "enclave/threading.h"
+
+/* A pairwise exchange handed to the communication threads. The compute thread
+ * posts the exchange with comm_exchange and may keep computing until it calls
+ * comm_wait on the future. */
+typedef struct comm_future {
+    const void *send_buf;
+    size_t send_count;
+    int dest;
+    int send_tag;
+    void *recv_buf;
+    size_t recv_count;
+    int src;
+    int recv_tag;
+
+    /* The job that posted the exchange, whose tags it uses. */
+    struct thread_job *job;
+
+    mpi_tls_request_t requests[2];
+    bool requests_done[2];
+    size_t num_requests;
+    int ret;
+    sema_t done;
+
+    struct comm_future *next;
+} comm_future_t;
+
+/* The number of enclave threads dedicated to communication. If 0, compute
+ * threads drive mpi_tls themselves and comm_exchange completes before
+ * returning. */
+extern size_t comm_num_threads;
+
+void comm_init(size_t num_threads);
+int comm_exchange(comm_future_t *future, const void *send_buf,
+        size_t send_count, int dest, int send_tag, void *recv_buf,
+        size_t recv_count, int src, int recv_tag);
+int comm_wait(comm_future_t *future);
+void comm_start_work(void);
+void comm_release_all(void);
+void comm_unrelease_all(void);
+
+#endif /* distributed-sgx-sort/enclave/comm.h */
@@ -0,0 +1,500 @@
+#include "enclave/cost.h"
+#include <float.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <liboblivious/primitives.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/mem.h"
+#include "common/sort_type.h"
+#include "common/util.h"
+#include "enclave/bucket.h"
+#include "enclave/mem.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/parallel_enc.h"
+#include "enclave/params.h"
+
+/* Estimates how long each sort would take from the number of compare-exchanges
+ * it does on each rank and the bytes and messages it sends, priced with
+ * constants measured by a short benchmark on startup. The counts follow each
+ * algorithm's structure; the factors in front of them were fitted to
+ * single-threaded runs of the host-only build, where each sort's memory access
+ * pattern makes its compare-exchanges cost more or less than the in-cache ones
+ * the benchmark measures. */
+
+/* Elements in the compare-exchange benchmark, which should stay in cache. */
+#define SWAP_BENCH_LENGTH 2048
+#define SWAP_BENCH_ROUNDS 64
+
+#define NET_BENCH_SMALL_ROUNDS 16
+#define NET_BENCH_LARGE_BYTES (1 << 20)
+#define NET_BENCH_LARGE_ROUNDS 4
+
+/* How much more each sort's compare-exchanges cost than the benchmark's. */
+#define BITONIC_SWAP_FACTOR 3.2
+#define BUCKET_SWAP_FACTOR 3.4
+#define OPAQUE_SWAP_FACTOR 3.4
+#define ORSHUFFLE_SWAP_FACTOR 2.2
+
+/* The tuner's search ranges, in elements. */
+#define TUNE_MIN_BUCKET_SIZE 64
+#define TUNE_MAX_BUCKET_SIZE 4096
+#define TUNE_BUCKET_ROUNDS 16
+#define TUNE_MIN_CHUNK_SIZE 64
+#define TUNE_MAX_CHUNK_SIZE 16384
+#define TUNE_CHUNK_ROUNDS 8
+
+/* A bucket may be this much slower per compare-exchange than the smallest one
+ * and still count as in cache. */
+#define TUNE_CACHE_SLOWDOWN 1.25
+
+/* The fraction of peak bandwidth a chunk size must reach. */
+#define TUNE_BANDWIDTH_FRACTION 0.9
+
+static double get_seconds(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts)) {
+        return 0;
+    }
+    return ts.tv_sec + (double) ts.tv_nsec / 1000000000;
+}
+
+static int bench_swap(struct cost_params *params) {
+    int ret;
+
+    elem_t *arr = mem_alloc(MEM_COST, SWAP_BENCH_LENGTH * sizeof(*arr));
+    if (!arr) {
+        perror("malloc swap benchmark");
+        ret = -1;
+        goto exit;
+    }
+    for (size_t i = 0; i < SWAP_BENCH_LENGTH; i++) {
+        arr[i].key = (i * 0x9e3779b97f4a7c15) >> 33;
+    }
+
+    /* Compare halves of the array at a shrinking distance, like the stages of
+     * a merge. */
+    double start = get_seconds();
+    size_t num_swaps = 0;
+    for (size_t round = 0; round < SWAP_BENCH_ROUNDS; round++) {
+        size_t dist = SWAP_BENCH_LENGTH >> (round % log2ll(SWAP_BENCH_LENGTH)
+                + 1);
+        for (size_t i = 0; i < SWAP_BENCH_LENGTH; i++) {
+            if (i & dist) {
+                continue;
+            }
+            o_memswap(&arr[i], &arr[i + dist], sizeof(*arr),
+                    arr[i].key > arr[i + dist].key);
+            num_swaps++;
+        }
+    }
+    params->swap_seconds = (get_seconds() - start) / num_swaps;
+
+    mem_free(arr);
+    ret = 0;
+exit:
+    return ret;
+}
+
+/* Bounces ROUNDS messages of COUNT bytes between ranks 0 and 1 and returns the
+ * seconds per one-way message. */
+static int ping_pong(unsigned char *buf, size_t count, size_t rounds,
+        double *seconds) {
+    int peer = 1 - world_rank;
+    int ret;
+
+    double start = get_seconds();
+    for (size_t i = 0; i < rounds; i++) {
+        if (world_rank == 0) {
+            ret = mpi_tls_send_bytes(buf, count, peer, COST_BENCH_MPI_TAG);
+            if (ret) {
+                goto exit;
+            }
+            ret =
+                mpi_tls_recv_bytes(buf, count, peer, COST_BENCH_MPI_TAG,
+                        MPI_TLS_STATUS_IGNORE);
+            if (ret) {
+                goto exit;
+            }
+        } else {
+            ret =
+                mpi_tls_recv_bytes(buf, count, peer, COST_BENCH_MPI_TAG,
+                        MPI_TLS_STATUS_IGNORE);
+            if (ret) {
+                goto exit;
+            }
+            ret = mpi_tls_send_bytes(buf, count, peer, COST_BENCH_MPI_TAG);
+            if (ret) {
+                goto exit;
+            }
+        }
+    }
+    *seconds = (get_seconds() - start) / (rounds * 2);
+
+    ret = 0;
+
+exit:
+    if (ret) {
+        handle_error_string("Error in network benchmark with %d", peer);
+    }
+    return ret;
+}
+
+/* Measures the network between ranks 0 and 1, which stand in for every pair of
+ * ranks. The other ranks skip it. */
+static int bench_net(struct cost_params *params) {
+    int ret;
+
+    if (world_size == 1 || world_rank > 1) {
+        ret = 0;
+        goto exit;
+    }
+
+    unsigned char *buf = mem_calloc(MEM_COST, NET_BENCH_LARGE_BYTES, 1);
+    if (!buf) {
+        perror("malloc network benchmark");
+        ret = -1;
+        goto exit;
+    }
+
+    double small_seconds;
+    ret = ping_pong(buf, 1, NET_BENCH_SMALL_ROUNDS, &small_seconds);
+    if (ret) {
+        goto exit_free_buf;
+    }
+    double large_seconds;
+    ret =
+        ping_pong(buf, NET_BENCH_LARGE_BYTES, NET_BENCH_LARGE_ROUNDS,
+                &large_seconds);
+    if (ret) {
+        goto exit_free_buf;
+    }
+
+    /* The messages go through the same encrypted channel as the sorts', so
+     * the time per byte already includes encrypting and decrypting it. */
+    params->net_latency_seconds = small_seconds;
+    params->net_seconds_per_byte =
+        (large_seconds - small_seconds) / NET_BENCH_LARGE_BYTES;
+
+exit_free_buf:
+    mem_free(buf);
+exit:
+    return ret;
+}
+
+/* Measures the constants for the cost model. Every rank must call this, but
+ * only rank 0's results are meaningful. */
+int cost_calibrate(struct cost_params *params) {
+    int ret;
+
+    memset(params, '\0', sizeof(*params));
+
+    ret = bench_swap(params);
+    if (ret) {
+        goto exit;
+    }
+    ret = bench_net(params);
+    if (ret) {
+        goto exit;
+    }
+
+    if (world_rank == 0) {
+        printf("[cost] swap = %.2f ns, net = %.3f ns/B + %.2f us\n",
+                params->swap_seconds * 1e9,
+                params->net_seconds_per_byte * 1e9,
+                params->net_latency_seconds * 1e6);
+    }
+
+exit:
+    return ret;
+}
+
+/* Returns the seconds per compare-exchange when merging pairs of buckets of
+ * BUCKET_SIZE elements, each pair in turn, across ARR's LENGTH elements. */
+static double time_bucket_merge(elem_t *arr, size_t length,
+        size_t bucket_size) {
+    size_t num_swaps = 0;
+
+    double start = get_seconds();
+    for (size_t round = 0; round < TUNE_BUCKET_ROUNDS; round++) {
+        for (size_t pair = 0; pair < length; pair += bucket_size * 2) {
+            for (size_t dist = bucket_size; dist; dist /= 2) {
+                for (size_t i = pair; i < pair + bucket_size * 2; i++) {
+                    if (i & dist) {
+                        continue;
+                    }
+                    o_memswap(&arr[i], &arr[i + dist], sizeof(*arr),
+                            arr[i].key > arr[i + dist].key);
+                    num_swaps++;
+                }
+            }
+        }
+    }
+    return (get_seconds() - start) / num_swaps;
+}
+
+/* Chooses the largest bucket size whose merge-splits still run at in-cache
+ * speed, which spends the fewest messages and levels on the same work. */
+static int tune_bucket_size(struct sort_params *params) {
+    size_t length = TUNE_MAX_BUCKET_SIZE * 2;
+    int ret;
+
+    elem_t *arr = mem_alloc(MEM_COST, length * sizeof(*arr));
+    if (!arr) {
+        perror("malloc bucket tuning");
+        ret = -1;
+        goto exit;
+    }
+    for (size_t i = 0; i < length; i++) {
+        arr[i].key = (i * 0x9e3779b97f4a7c15) >> 33;
+    }
+
+    double base_seconds = 0;
+    for (size_t bucket_size = TUNE_MIN_BUCKET_SIZE;
+            bucket_size <= TUNE_MAX_BUCKET_SIZE; bucket_size *= 2) {
+        double seconds = time_bucket_merge(arr, length, bucket_size);
+        if (!base_seconds) {
+            base_seconds = seconds;
+        }
+        if (seconds > base_seconds * TUNE_CACHE_SLOWDOWN) {
+            break;
+        }
+        params->bucket_size = bucket_size;
+    }
+
+    mem_free(arr);
+    ret = 0;
+exit:
+    return ret;
+}
+
+/* Chooses the smallest message size that reaches most of the bandwidth
+ * between ranks 0 and 1, which keeps buffers small without paying for latency
+ * on every message. The other ranks skip it. */
+static int tune_chunk_size(struct sort_params *params) {
+    size_t max_bytes = TUNE_MAX_CHUNK_SIZE * sizeof(elem_t);
+    double bandwidths[64];
+    size_t num_sizes = 0;
+    int ret;
+
+    if (world_size == 1 || world_rank > 1) {
+        ret = 0;
+        goto exit;
+    }
+
+    unsigned char *buf = mem_calloc(MEM_COST, max_bytes, 1);
+    if (!buf) {
+        perror("malloc chunk tuning");
+        ret = -1;
+        goto exit;
+    }
+
+    double peak = 0;
+    for (size_t chunk_size = TUNE_MIN_CHUNK_SIZE;
+            chunk_size <= TUNE_MAX_CHUNK_SIZE; chunk_size *= 2) {
+        double seconds;
+        ret =
+            ping_pong(buf, chunk_size * sizeof(elem_t), TUNE_CHUNK_ROUNDS,
+                    &seconds);
+        if (ret) {
+            goto exit_free_buf;
+        }
+        bandwidths[num_sizes] = chunk_size / seconds;
+        peak = MAX(peak, bandwidths[num_sizes]);
+        num_sizes++;
+    }
+
+    size_t chunk_size = TUNE_MIN_CHUNK_SIZE;
+    for (size_t i = 0; i < num_sizes; i++, chunk_size *= 2) {
+        if (bandwidths[i] >= peak * TUNE_BANDWIDTH_FRACTION) {
+            break;
+        }
+    }
+    params->bitonic_chunk_size = chunk_size;
+    params->orshuffle_chunk_size = chunk_size;
+    params->ojoin_chunk_size = chunk_size;
+    params->opaque_chunk_size = chunk_size;
+    params->sample_partition_buf_size = chunk_size;
+
+    ret = 0;
+
+exit_free_buf:
+    mem_free(buf);
+exit:
+    return ret;
+}
+
+/* Replaces PARAMS's sizes with ones measured for this machine. Every rank must
+ * call this, and only rank 0's results are meaningful, so callers should share
+ * them afterwards. */
+int cost_tune(struct sort_params *params) {
+    int ret;
+
+    ret = tune_bucket_size(params);
+    if (ret) {
+        goto exit;
+    }
+    ret = tune_chunk_size(params);
+    if (ret) {
+        goto exit;
+    }
+    params->bucket_swap_chunk_buckets =
+        MAX(params->bitonic_chunk_size / params->bucket_size, 1);
+
+    if (world_rank == 0) {
+        printf("[tune] bucket = %zu, chunk = %zu elements\n",
+                params->bucket_size, params->bitonic_chunk_size);
+    }
+
+exit:
+    return ret;
+}
+
+/* Prices sending BYTES in MESSAGES messages from each rank. */
+static double comm_cost(const struct cost_params *params, double bytes,
+        double messages) {
+    return bytes * params->net_seconds_per_byte
+        + messages * params->net_latency_seconds;
+}
+
+/* Returns how many times slower local work runs on a buffer of BUFFER_BYTES
+ * per rank, which is only slower once it crosses the EPC cliff. */
+static double paging_factor(double buffer_bytes) {
+    if (!sort_params.epc_cliff_bytes
+            || buffer_bytes <= sort_params.epc_cliff_bytes) {
+        return 1;
+    }
+    return sort_params.epc_cliff_slowdown / 100.0;
+}
+
+/* Returns the estimated seconds ALGO takes to sort LENGTH elements with
+ * NUM_THREADS threads per rank. */
+static double estimate(const struct cost_params *params, enum sort_type algo,
+        size_t length, size_t num_threads) {
+    double n = (double) length / world_size;
+    double log_length = log2ll(next_pow2ll(length));
+    double log_n = log2ll(next_pow2ll(MAX((size_t) n, 1)));
+    double log_size = log2ll(next_pow2ll(world_size));
+    double remote_fraction = (double) (world_size - 1) / world_size;
+    double elem_bytes = sizeof(elem_t);
+    double swap = params->swap_seconds / num_threads;
+
+    switch (algo) {
+        case SORT_BITONIC: {
+            /* Every stage compares each element once, and the last
+             * LOG_SIZE * (LOG_SIZE + 1) / 2 stages compare across ranks. */
+            double remote_stages = log_size * (log_size + 1) / 2;
+            return BITONIC_SWAP_FACTOR * n / 2 * log_length
+                    * (log_length + 1) / 2 * swap
+                    * paging_factor(n * elem_bytes)
+                + comm_cost(params, n * elem_bytes * remote_stages,
+                        CEIL_DIV((size_t) n, sort_params.bitonic_chunk_size)
+                            * remote_stages);
+        }
+
+        case SORT_BUCKET: {
+            /* The buckets double the array with dummies. Each level of the
+             * route merge-splits them, the last LOG_SIZE levels across ranks,
+             * and then each bucket is sorted to permute it. A final
+             * nonoblivious sort sends the elements bound for other ranks. */
+            size_t num_buckets =
+                MAX(next_pow2ll(length) * 2 / BUCKET_SIZE,
+                        (size_t) world_size * 2);
+            double log_buckets = log2ll(num_buckets);
+            double log_bucket_size = log2ll(BUCKET_SIZE);
+            double buffer_bytes =
+                (double) num_buckets / world_size * BUCKET_SIZE * 2
+                    * elem_bytes;
+            return BUCKET_SWAP_FACTOR * 2 * n
+                    * (log_buckets + log_bucket_size) * swap
+                    * paging_factor(buffer_bytes)
+                + comm_cost(params,
+                        n * elem_bytes * (log_size + remote_fraction),
+                        (double) num_buckets / world_size * log_size
+                            + world_size - 1);
+        }
+
+        case SORT_OPAQUE: {
+            /* The local sorts are bitonic sorts of the whole column. */
+            double paging = paging_factor(2 * n * elem_bytes);
+            if (world_size == 1) {
+                return OPAQUE_SWAP_FACTOR * n / 2 * log_n * (log_n + 1) / 2
+                    * swap * paging;
+            }
+
+            /* Four local sorts, two transposes, and two shifts of half the
+             * array. */
+            return OPAQUE_SWAP_FACTOR * 4 * (n / 2 * log_n * (log_n + 1) / 2)
+                    * swap * paging
+                + comm_cost(params, 3 * n * elem_bytes, world_size * 2 + 4);
+        }
+
+        case SORT_ORSHUFFLE: {
+            /* Each level of the shuffle's recursion compacts its part of the
+             * array, and the compactions of parts spanning several ranks
+             * cross ranks in as many rounds as the bitonic sort's last
+             * merges. A final nonoblivious sort sends the elements bound for
+             * other ranks. */
+            double remote_stages = log_size * (log_size + 1) / 2;
+            return ORSHUFFLE_SWAP_FACTOR * n * log_length * log_length / 2
+                    * swap * paging_factor(4 * n * elem_bytes)
+                + comm_cost(params,
+                        n * elem_bytes * (remote_stages + remote_fraction),
+                        CEIL_DIV((size_t) n, sort_params.orshuffle_chunk_size)
+                                * remote_stages
+                            + world_size - 1);
+        }
+
+        case OJOIN:
+        case SORT_AUTO:
+        case SORT_UNSET:
+            break;
+    }
+
+    return DBL_MAX;
+}
+
+/* Returns the sort among those whose bits are set in SUPPORTED, indexed by
+ * their sort_type, that PARAMS predicts is fastest for LENGTH elements with
+ * NUM_THREADS threads per rank, printing each estimate on rank 0. Returns
+ * SORT_UNSET if none is supported. */
+enum sort_type cost_choose(const struct cost_params *params, size_t length,
+        size_t num_threads, uint32_t supported) {
+    static const struct {
+        enum sort_type algo;
+        const char *name;
+    } candidates[] = {
+        { SORT_BITONIC, "bitonic" },
+        { SORT_BUCKET, "bucket" },
+        { SORT_OPAQUE, "opaque" },
+        { SORT_ORSHUFFLE, "orshuffle" },
+    };
+    enum sort_type best = SORT_UNSET;
+    double best_seconds = DBL_MAX;
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+        if (!(supported & ((uint32_t) 1 << candidates[i].algo))) {
+            if (world_rank == 0) {
+                printf("[cost] %-9s = n/a\n", candidates[i].name);
+            }
+            continue;
+        }
+        double seconds =
+            estimate(params, candidates[i].algo, length, num_threads);
+        if (world_rank == 0) {
+            printf("[cost] %-9s = %f\n", candidates[i].name, seconds);
+        }
+        if (seconds < best_seconds) {
+            best = candidates[i].algo;
+            best_seconds = seconds;
+        }
+    }
+
+    return best;
+}
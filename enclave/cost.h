@@ -0,0 +1,25 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_COST_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_COST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common/sort_params.h"
+#include "common/sort_type.h"
+
+/* The machine constants the cost model is calibrated with. */
+struct cost_params {
+    /* Seconds per oblivious compare-exchange of two elements on one thread. */
+    double swap_seconds;
+
+    /* Seconds per byte and per message to send between ranks, including the
+     * encryption on either end. */
+    double net_seconds_per_byte;
+    double net_latency_seconds;
+};
+
+int cost_calibrate(struct cost_params *params);
+int cost_tune(struct sort_params *params);
+enum sort_type cost_choose(const struct cost_params *params, size_t length,
+        size_t num_threads, uint32_t supported);
+
+#endif /* distributed-sgx-sort/enclave/cost.h */
@@ -1,32 +1,53 @@
 #include "enclave/crypto.h"
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 #include <mbedtls/cipher.h>
 #include <mbedtls/entropy.h>
 #include <mbedtls/gcm.h>
 #include "common/error.h"
+#include "common/mem.h"
+#include "common/trace.h"
+#include "enclave/mem.h"
+#include "enclave/trace.h"
 
 mbedtls_entropy_context entropy_ctx;
 
-struct thread_local_ctx ctxs[THREAD_LOCAL_LIST_MAXLEN];
-size_t ctx_len;
+/* One context per enclave thread, sized by rand_init. A context is in use
+ * while its PTR is set, and threads that leave the enclave give theirs back
+ * with crypto_thread_free, so a later set of threads can reuse them. */
+static struct thread_local_ctx *ctxs;
+static size_t ctxs_cap;
 thread_local struct thread_local_ctx *ctx;
 
 const unsigned char zeroes[RAND_BYTES_POOL_LEN];
 
-int rand_init(void) {
+int rand_init(size_t num_threads) {
+    ctxs = mem_calloc(MEM_RNG, num_threads, sizeof(*ctxs));
+    if (!ctxs) {
+        perror("malloc crypto thread contexts");
+        return -1;
+    }
+    ctxs_cap = num_threads;
+
     mbedtls_entropy_init(&entropy_ctx);
     return 0;
 }
 
 void rand_free(void) {
-    for (size_t i = 0; i < ctx_len; i++) {
-        mbedtls_cipher_free(&ctxs[i].cipher_ctx);
-        ctxs[i].ptr = NULL;
+    for (size_t i = 0; i < ctxs_cap; i++) {
+        if (ctxs[i].ptr) {
+            mbedtls_cipher_free(&ctxs[i].cipher_ctx);
+            ctxs[i].ptr = NULL;
+        }
     }
-    ctx_len = 0;
+    mem_free(ctxs);
+    ctxs = NULL;
+    ctxs_cap = 0;
     mbedtls_entropy_free(&entropy_ctx);
 }
 
@@ -34,22 +55,30 @@ int crypto_ensure_thread_local_ctx_init(void) {
     int ret;
 
     if (!ctx || !ctx->ptr) {
-        size_t idx =
-            __atomic_fetch_add(&ctx_len, 1, __ATOMIC_RELAXED);
-        if (ctx_len >= THREAD_LOCAL_LIST_MAXLEN) {
-            handle_error_string("Too many threads for crypto");
-            ret = -1;
-            goto exit_dec_ctx_len;
+        /* Claim the first free context. */
+        size_t idx;
+        for (idx = 0; idx < ctxs_cap; idx++) {
+            struct thread_local_ctx **expected = NULL;
+            if (__atomic_compare_exchange_n(&ctxs[idx].ptr, &expected, &ctx,
+                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        if (idx >= ctxs_cap) {
+            handle_error_string(
+                    "Too many threads for crypto: only %zu contexts",
+                    ctxs_cap);
+            ctx = NULL;
+            return -1;
         }
         ctx = &ctxs[idx];
-        ctx->ptr = &ctx;
 
         /* Get seed from entropy. */
         unsigned char seed[16];
         ret = mbedtls_entropy_func(&entropy_ctx, seed, sizeof(seed));
         if (ret) {
             handle_mbedtls_error(ret, "mbedtls_entropy_func");
-            goto exit_dec_ctx_len;
+            goto exit_release_ctx;
         }
 
         /* Get cipher info. */
@@ -57,7 +86,7 @@ int crypto_ensure_thread_local_ctx_init(void) {
             mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_CTR);
         if (!cipherinfo) {
             handle_error_string("mbedtls_cipher_info_from_type");
-            goto exit_dec_ctx_len;
+            goto exit_release_ctx;
         }
 
         /* Setup cipher. */
@@ -82,15 +111,25 @@ int crypto_ensure_thread_local_ctx_init(void) {
 
 exit_free_cipher:
     mbedtls_cipher_free(&ctx->cipher_ctx);
-exit_dec_ctx_len:
-    __atomic_fetch_sub(&ctx_len, 1, __ATOMIC_RELAXED);
+exit_release_ctx:
+    __atomic_store_n(&ctx->ptr, NULL, __ATOMIC_RELEASE);
     ctx = NULL;
     return ret;
 }
 
+void crypto_thread_free(void) {
+    if (!ctx || !ctx->ptr) {
+        return;
+    }
+    mbedtls_cipher_free(&ctx->cipher_ctx);
+    __atomic_store_n(&ctx->ptr, NULL, __ATOMIC_RELEASE);
+    ctx = NULL;
+}
+
 int aad_encrypt(const void *key, const void *plaintext, size_t plaintext_len,
         const void *aad, size_t aad_len, const void *iv, void *ciphertext,
         void *tag) {
+    uint64_t trace_start = trace_begin();
     int ret = -1;
 
     /* Initialize encryption context. */
@@ -118,6 +157,7 @@ int aad_encrypt(const void *key, const void *plaintext, size_t plaintext_len,
         goto exit_free_ctx;
     }
 
+    trace_end(TRACE_ENCRYPT, trace_start, -1, -1, plaintext_len);
     ret = 0;
 
 exit_free_ctx:
@@ -128,6 +168,7 @@ exit_free_ctx:
 int aad_decrypt(const void *key, const void *ciphertext, size_t ciphertext_len,
         const void *aad, size_t aad_len, const void *iv, const void *tag,
         void *plaintext) {
+    uint64_t trace_start = trace_begin();
     int ret = -1;
 
     /* Initialize encryption context. */
@@ -153,6 +194,7 @@ int aad_decrypt(const void *key, const void *ciphertext, size_t ciphertext_len,
         goto exit_free_ctx;
     }
 
+    trace_end(TRACE_DECRYPT, trace_start, -1, -1, ciphertext_len);
     ret = 0;
 
 exit_free_ctx:
@@ -16,7 +16,6 @@
 #define IV_LEN 12
 #define TAG_LEN 16
 
-#define THREAD_LOCAL_LIST_MAXLEN 64
 #define RAND_BYTES_POOL_LEN 1048576
 
 extern mbedtls_entropy_context entropy_ctx;
@@ -35,7 +34,10 @@ extern thread_local struct thread_local_ctx *ctx;
 
 int crypto_ensure_thread_local_ctx_init(void);
 
-int rand_init(void);
+/* Gives the calling thread's context back before it leaves the enclave. */
+void crypto_thread_free(void);
+
+int rand_init(size_t num_threads);
 void rand_free(void);
 
 extern const unsigned char zeroes[RAND_BYTES_POOL_LEN];
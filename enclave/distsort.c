@@ -0,0 +1,1105 @@
+#include "enclave/distsort.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/sort_params.h"
+#include "common/sort_type.h"
+#include "common/util.h"
+#include "enclave/arena.h"
+#include "enclave/batch.h"
+#include "enclave/bitonic.h"
+#include "enclave/bucket.h"
+#include "enclave/comm.h"
+#include "enclave/cost.h"
+#include "enclave/crypto.h"
+#include "enclave/extmem.h"
+#include "enclave/fingerprint.h"
+#include "enclave/mem.h"
+#include "enclave/merge.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/nonoblivious.h"
+#include "enclave/ojoin.h"
+#include "enclave/opaque.h"
+#include "enclave/orshuffle.h"
+#include "enclave/params.h"
+#include "enclave/span.h"
+#include "enclave/thread_stats.h"
+#include "enclave/threading.h"
+#include "enclave/trace.h"
+
+/* The engines read the rank and world size of the current context from these
+ * globals, declared in enclave/parallel_enc.h. */
+int world_rank;
+int world_size;
+
+struct distsort_ctx {
+    int world_rank;
+    int world_size;
+    size_t num_threads;
+    size_t num_comm_threads;
+
+    /* The size of each thread's scratch arena, enough for the largest
+     * algorithm's per-thread buffers. */
+    size_t arena_size;
+
+    /* The algorithm the pool threads are set up for, or SORT_UNSET while they
+     * wait for one to be chosen. */
+    volatile enum sort_type sort_type;
+
+    /* The number of threads that have entered through distsort_start_work or
+     * distsort_start_comm_work. */
+    size_t num_threads_started;
+
+    /* Set once the threads are released, so that workers still waiting for a
+     * sort to be chosen can leave when the caller bails out before any
+     * sort. */
+    volatile bool threads_released;
+
+    /* The number of pool threads not yet claimed by a running job. */
+    size_t num_workers_free;
+
+    /* Bit i is set while job i runs. */
+    uint32_t active_jobs;
+
+    /* The cost model's constants, measured by the first distsort_choose. */
+    bool cost_calibrated;
+    struct cost_params cost_params;
+
+    /* The key elements are fingerprinted with, shared by the first
+     * distsort_fingerprint. */
+    bool fingerprint_key_ready;
+    struct fingerprint_key fingerprint_key;
+};
+
+/* The thread pool, RNG, and MPI-over-TLS sessions belong to the whole
+ * enclave, so only one context can own them at a time. */
+static distsort_ctx_t *active_ctx;
+
+int distsort_init(distsort_ctx_t **ctx_, int world_rank_, int world_size_,
+        size_t num_threads, size_t num_comm_threads,
+        struct sort_params *params, bool tune) {
+    int ret;
+
+    if (!num_threads) {
+        handle_error_string("At least one thread is required");
+        ret = -1;
+        goto exit;
+    }
+    if (active_ctx) {
+        handle_error_string("Only one sort context may exist at a time");
+        ret = -1;
+        goto exit;
+    }
+
+    distsort_ctx_t *ctx = mem_calloc(MEM_CONTEXT, 1, sizeof(*ctx));
+    if (!ctx) {
+        perror("malloc distsort ctx");
+        ret = -1;
+        goto exit;
+    }
+    ctx->world_rank = world_rank_;
+    ctx->world_size = world_size_;
+    ctx->num_threads = num_threads;
+    ctx->num_comm_threads = num_comm_threads;
+    ctx->sort_type = SORT_UNSET;
+    ctx->num_workers_free = num_threads - 1;
+
+    /* Set global parameters. */
+    world_rank = world_rank_;
+    world_size = world_size_;
+    total_num_threads = num_threads;
+    comm_init(num_comm_threads);
+
+    /* Init entropy. Every compute and communication thread gets its own RNG
+     * context, as does each thread calling in to run a concurrent job. */
+    ret = rand_init(num_threads + num_comm_threads + DISTSORT_MAX_JOBS);
+    if (ret) {
+        handle_error_string("Error initializing RNG");
+        goto exit_free_ctx;
+    }
+
+    /* Init MPI-over-TLS. */
+    ret = mpi_tls_init(world_rank, world_size, &entropy_ctx);
+    if (ret) {
+        handle_error_string("Error initializing MPI-over-TLS");
+        goto exit_free_rand;
+    }
+
+    /* Set the parameters, which the scratch sizes depend on. Rank 0's are
+     * shared before checking them, so that every rank runs with the same
+     * values and every rank fails if they are bad. */
+    struct sort_params default_params = SORT_PARAMS_DEFAULT;
+    struct sort_params new_params = params ? *params : default_params;
+    if (tune) {
+        ret = cost_tune(&new_params);
+        if (ret) {
+            handle_error_string("Error tuning parameters");
+            goto exit_free_mpi_tls;
+        }
+    }
+    ret = sort_params_share(&new_params);
+    if (ret) {
+        goto exit_free_mpi_tls;
+    }
+    ret = sort_params_check(&new_params);
+    if (ret) {
+        goto exit_free_mpi_tls;
+    }
+    sort_params = new_params;
+    if (params) {
+        *params = new_params;
+    }
+
+    /* Size the scratch arenas for the largest algorithm. The bucket sort,
+     * ORShuffle, and o-join hold their own buffer while running the
+     * nonoblivious sort, and the bucket sort and ORShuffle also hold it while
+     * borrowing the bitonic merge's chunks for distsort_merge. */
+    ctx->arena_size = bitonic_scratch_size();
+    ctx->arena_size =
+        MAX(ctx->arena_size,
+                bucket_scratch_size()
+                    + MAX(nonoblivious_scratch_size(),
+                        bitonic_scratch_size()));
+    ctx->arena_size =
+        MAX(ctx->arena_size,
+                orshuffle_scratch_size()
+                    + MAX(nonoblivious_scratch_size(),
+                        bitonic_scratch_size()));
+    ctx->arena_size =
+        MAX(ctx->arena_size,
+                ojoin_scratch_size() + nonoblivious_scratch_size());
+
+    /* Init the calling thread's arena. Worker threads init their own when they
+     * start. */
+    ret = arena_init(ctx->arena_size);
+    if (ret) {
+        handle_error_string("Error initializing scratch arena");
+        goto exit_free_mpi_tls;
+    }
+
+    active_ctx = ctx;
+    *ctx_ = ctx;
+
+    return 0;
+
+exit_free_mpi_tls:
+    mpi_tls_free();
+exit_free_rand:
+    rand_free();
+exit_free_ctx:
+    mem_free(ctx);
+exit:
+    return ret;
+}
+
+void distsort_free(distsort_ctx_t *ctx) {
+    trace_free();
+    thread_stats_free();
+    arena_destroy();
+    mpi_tls_free();
+    rand_free();
+    if (active_ctx == ctx) {
+        active_ctx = NULL;
+    }
+    mem_free(ctx);
+}
+
+size_t distsort_get_num_threads_started(distsort_ctx_t *ctx) {
+    return __atomic_load_n(&ctx->num_threads_started, __ATOMIC_ACQUIRE);
+}
+
+void distsort_start_work(distsort_ctx_t *ctx) {
+    __atomic_add_fetch(&ctx->num_threads_started, 1, __ATOMIC_RELEASE);
+
+    /* Wait for the calling thread to choose the sort. */
+    while (!ctx->sort_type) {
+        if (ctx->threads_released) {
+            return;
+        }
+    }
+
+    if (arena_init(ctx->arena_size)) {
+        handle_error_string("Error initializing scratch arena");
+        return;
+    }
+
+    switch (ctx->sort_type) {
+        case SORT_BITONIC:
+            /* Initialize sort. */
+            if (bitonic_init()) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Start work. */
+            thread_start_work();
+
+            /* Free sort. */
+            bitonic_free();
+            break;
+
+        case SORT_BUCKET:
+            /* Initialize sort. */
+            if (bucket_init()) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Start work. */
+            thread_start_work();
+
+            /* Free sort. */
+            bucket_free();
+            break;
+
+        case SORT_OPAQUE:
+            /* Start work. */
+            thread_start_work();
+            break;
+
+        case SORT_ORSHUFFLE:
+            /* Initialize sort. */
+            if (orshuffle_init()) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Start work. */
+            thread_start_work();
+
+            /* Free sort. */
+            orshuffle_free();
+            break;
+
+        case OJOIN:
+            /* Initialize o-join. */
+            if (ojoin_init()) {
+                handle_error_string("Error initializing ojoin");
+                goto exit;
+            }
+
+            /* Start work. */
+            thread_start_work();
+
+            /* Free sort. */
+            ojoin_free();
+            break;
+
+        case SORT_AUTO:
+        case SORT_UNSET:
+            handle_error_string("Invalid sort type");
+            goto exit;
+    }
+
+exit:
+    arena_destroy();
+    crypto_thread_free();
+}
+
+void distsort_start_comm_work(distsort_ctx_t *ctx) {
+    __atomic_add_fetch(&ctx->num_threads_started, 1, __ATOMIC_RELEASE);
+
+    comm_start_work();
+    crypto_thread_free();
+}
+
+void distsort_release_threads(distsort_ctx_t *ctx) {
+    ctx->threads_released = true;
+    thread_release_all();
+    comm_release_all();
+}
+
+/* Readies the context for a new set of threads, which wait for the next sort
+ * to be chosen, once the previous set has left. */
+void distsort_unrelease_threads(distsort_ctx_t *ctx) {
+    ctx->sort_type = SORT_UNSET;
+    ctx->num_threads_started = 0;
+    ctx->threads_released = false;
+    thread_unrelease_all();
+    comm_unrelease_all();
+}
+
+size_t distsort_local_start(const distsort_ctx_t *ctx, size_t length) {
+    return (ctx->world_rank * length + ctx->world_size - 1) / ctx->world_size;
+}
+
+size_t distsort_local_length(const distsort_ctx_t *ctx, size_t length) {
+    return ((ctx->world_rank + 1) * length + ctx->world_size - 1)
+            / ctx->world_size
+        - distsort_local_start(ctx, length);
+}
+
+/* Returns what ALGO needs of LENGTH elements in total and the number of ranks
+ * in order to sort them, or NULL if it can sort them. */
+static const char *get_length_requirement(const distsort_ctx_t *ctx,
+        size_t length, enum sort_type algo) {
+    size_t num_ranks = ctx->world_size;
+    bool pow2_ranks = next_pow2ll(num_ranks) == num_ranks;
+
+    switch (algo) {
+        case SORT_BITONIC:
+        case SORT_ORSHUFFLE:
+            /* The bitonic network and ORShuffle's compaction halve the array
+             * at every level, down to single ranks and then elements. */
+            if (!pow2_ranks || next_pow2ll(length) != length
+                    || length < num_ranks) {
+                return "a power-of-two array size of at least the number of "
+                    "ranks on a power-of-two number of ranks";
+            }
+            return NULL;
+        case SORT_OPAQUE: {
+            /* The columns are the ranks' shares, which the local bitonic
+             * sorts need to be the same power-of-two length, and columnsort
+             * needs each column to divide among the ranks and to hold at
+             * least 2 * (ranks - 1) ^ 2 elements. */
+            size_t column_length = length / num_ranks;
+            if (length % num_ranks
+                    || next_pow2ll(column_length) != column_length
+                    || column_length % num_ranks
+                    || column_length < 2 * (num_ranks - 1) * (num_ranks - 1)) {
+                return "the number of ranks times a power of two of at least "
+                    "2 * (ranks - 1) ^ 2, on a power-of-two number of ranks";
+            }
+            return NULL;
+        }
+        case SORT_BUCKET:
+        case OJOIN:
+            /* The butterfly network splits the buckets in halves across the
+             * ranks. */
+            if (!pow2_ranks) {
+                return "a power-of-two number of ranks";
+            }
+            return NULL;
+        case SORT_AUTO:
+        case SORT_UNSET:
+            break;
+    }
+
+    return NULL;
+}
+
+/* Checks that ALGO can sort LENGTH elements in total, printing what it needs
+ * if not. */
+static int check_length(const distsort_ctx_t *ctx, size_t length,
+        enum sort_type algo) {
+    if (algo == SORT_UNSET || algo == SORT_AUTO) {
+        handle_error_string("Invalid sort type");
+        return -1;
+    }
+
+    const char *requirement = get_length_requirement(ctx, length, algo);
+    if (requirement) {
+        handle_error_string(
+                "Cannot sort %zu elements on %d ranks: the sort needs %s",
+                length, ctx->world_size, requirement);
+        return -1;
+    }
+    return 0;
+}
+
+size_t distsort_buffer_len(const distsort_ctx_t *ctx, size_t length,
+        enum sort_type algo, const struct distsort_opts *opts) {
+    size_t local_length = distsort_local_length(ctx, length);
+
+    if (check_length(ctx, length, algo)) {
+        return 0;
+    }
+
+    switch (algo) {
+        case SORT_BITONIC:
+            return local_length;
+        case OJOIN:
+        case SORT_BUCKET: {
+            if (algo == SORT_BUCKET && opts && opts->extmem_block_bytes) {
+                /* The elements are sorted in host memory, so the buffer only
+                 * holds them. */
+                return MAX(local_length, 1);
+            }
+
+            /* The total number of buckets is the max of either double the
+             * number of buckets needed to hold all the elements or double the
+             * number of enclaves (since each enclaves needs at least two
+             * buckets. */
+            size_t num_buckets =
+                MAX(next_pow2ll(length) * 2 / BUCKET_SIZE,
+                        (size_t) ctx->world_size * 2);
+            size_t local_num_buckets =
+                num_buckets * (ctx->world_rank + 1) / ctx->world_size
+                    - num_buckets * ctx->world_rank / ctx->world_size;
+            /* The bucket sort relies on having 2 local buffers, so we allocate
+             * double the size of a single buffer (a single buffer is
+             * local_num_buckets * BUCKET_SIZE elements). */
+            return local_num_buckets * BUCKET_SIZE * 2;
+        }
+        case SORT_OPAQUE:
+            return local_length * 2;
+        case SORT_ORSHUFFLE:
+            return MAX(local_length * 2, 512) * 2;
+        case SORT_AUTO:
+        case SORT_UNSET:
+            break;
+    }
+
+    return 0;
+}
+
+int distsort_extmem_init(distsort_ctx_t *ctx, struct extmem_store *store,
+        size_t length) {
+    size_t local_length = distsort_local_length(ctx, length);
+    return extmem_init(store, MAX(CEIL_DIV(local_length, BUCKET_SIZE), 1),
+            BUCKET_SIZE * sizeof(elem_t));
+}
+
+int distsort_prepare(distsort_ctx_t *ctx, enum sort_type algo) {
+    if (algo == SORT_UNSET || algo == SORT_AUTO) {
+        handle_error_string("Invalid sort type");
+        return -1;
+    }
+
+    enum sort_type expected = SORT_UNSET;
+    if (!__atomic_compare_exchange_n(&ctx->sort_type, &expected, algo, false,
+                __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)
+            && expected != algo) {
+        handle_error_string(
+                "Pool threads are set up for another sort; restart them first");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Claims NUM_WORKERS pool threads for a job, waiting for running jobs to
+ * release them if needed. Claimed threads serve only the job until it ends, so
+ * jobs whose budgets fit in the pool together cannot starve each other of
+ * threads. */
+static void claim_workers(distsort_ctx_t *ctx, size_t num_workers) {
+    size_t num_free = __atomic_load_n(&ctx->num_workers_free, __ATOMIC_ACQUIRE);
+    do {
+        while (num_free < num_workers) {
+            num_free =
+                __atomic_load_n(&ctx->num_workers_free, __ATOMIC_ACQUIRE);
+        }
+    } while (!__atomic_compare_exchange_n(&ctx->num_workers_free, &num_free,
+                num_free - num_workers, true, __ATOMIC_ACQUIRE,
+                __ATOMIC_ACQUIRE));
+}
+
+/* Sorts this rank's share of LENGTH elements at ELEMS with the external-memory
+ * bucket sort, copying them to host memory and back. */
+static int sort_extmem_elems(distsort_ctx_t *ctx, elem_t *elems,
+        size_t length, size_t block_bytes, size_t num_threads) {
+    size_t local_length = distsort_local_length(ctx, length);
+    struct extmem_store store;
+    struct extmem_stream stream;
+    int ret;
+
+    ret = distsort_extmem_init(ctx, &store, length);
+    if (ret) {
+        handle_error_string("Error initializing external memory");
+        goto exit;
+    }
+    elem_t *page = mem_alloc(MEM_SCRATCH, store.block_len);
+    if (!page) {
+        perror("malloc extmem page");
+        ret = -1;
+        goto exit_free_store;
+    }
+
+    extmem_stream_init(&stream, &store, page, 0);
+    ret = extmem_stream_write(&stream, elems, local_length);
+    if (ret) {
+        goto exit_free_page;
+    }
+    ret = extmem_stream_flush(&stream);
+    if (ret) {
+        goto exit_free_page;
+    }
+
+    ret =
+        bucket_sort_extmem(&store, length, distsort_local_start(ctx, length),
+                local_length, block_bytes, num_threads);
+    if (ret) {
+        goto exit_free_page;
+    }
+
+    extmem_stream_init(&stream, &store, page, 0);
+    ret = extmem_stream_read(&stream, elems, local_length);
+    if (ret) {
+        goto exit_free_page;
+    }
+
+exit_free_page:
+    mem_free(page);
+exit_free_store:
+    extmem_free(&store);
+exit:
+    return ret;
+}
+
+static int run_sort(distsort_ctx_t *ctx, elem_t *elems, size_t length,
+        enum sort_type algo, const struct distsort_opts *opts,
+        size_t num_threads) {
+    int ret = 0;
+
+    switch (algo) {
+        case SORT_BITONIC:
+            /* Initialize sort. */
+            ret = bitonic_init();
+            if (ret) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Sort. */
+            ret = bitonic_sort(elems, length, num_threads);
+            if (ret) {
+                handle_error_string("Error in bitonic sort");
+            }
+
+            bitonic_free();
+            break;
+
+        case SORT_BUCKET:
+            /* Initialize sort. */
+            ret = bucket_init();
+            if (ret) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Sort. */
+            if (opts->extmem_block_bytes) {
+                ret =
+                    sort_extmem_elems(ctx, elems, length,
+                            opts->extmem_block_bytes, num_threads);
+            } else {
+                ret = bucket_sort(elems, length, num_threads);
+            }
+            if (ret) {
+                handle_error_string("Error in bucket sort");
+            }
+
+            bucket_free();
+            break;
+
+        case SORT_OPAQUE:
+            /* Sort. */
+            ret = opaque_sort(elems, length, num_threads);
+            if (ret) {
+                handle_error_string("Error in Opaque sort");
+            }
+            break;
+
+        case SORT_ORSHUFFLE:
+            /* Initialize sort. */
+            ret = orshuffle_init();
+            if (ret) {
+                handle_error_string("Error initializing sort");
+                goto exit;
+            }
+
+            /* Sort. */
+            ret = orshuffle_sort(elems, length, num_threads);
+            if (ret) {
+                handle_error_string("Error in ORShuffle sort");
+            }
+
+            orshuffle_free();
+            break;
+
+        case OJOIN:
+            /* Initialize o-join. */
+            ret = ojoin_init();
+            if (ret) {
+                handle_error_string("Error initializing ojoin");
+                goto exit;
+            }
+
+            /* Join. */
+            ret = ojoin(elems, length, opts->join_length, num_threads);
+            if (ret) {
+                handle_error_string("Error in o-join");
+            }
+
+            ojoin_free();
+            break;
+
+        case SORT_AUTO:
+        case SORT_UNSET:
+            break;
+    }
+
+exit:
+    return ret;
+}
+
+int distsort_choose(distsort_ctx_t *ctx, size_t length,
+        const struct distsort_opts *opts, enum sort_type *algo) {
+    int ret;
+
+    /* Only the bucket sort keeps its data in external memory. */
+    if (opts && opts->extmem_block_bytes) {
+        *algo = SORT_BUCKET;
+        ret = 0;
+        goto exit;
+    }
+
+    if (!ctx->cost_calibrated) {
+        ret = cost_calibrate(&ctx->cost_params);
+        if (ret) {
+            handle_error_string("Error calibrating cost model");
+            goto exit;
+        }
+        ctx->cost_calibrated = true;
+    }
+
+    /* Only the sorts that can handle LENGTH are candidates. Every rank finds
+     * the same ones, so they all fail together if there are none. */
+    static const enum sort_type candidates[] = {
+        SORT_BITONIC,
+        SORT_BUCKET,
+        SORT_OPAQUE,
+        SORT_ORSHUFFLE,
+    };
+    uint32_t supported = 0;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+        if (!get_length_requirement(ctx, length, candidates[i])) {
+            supported |= (uint32_t) 1 << candidates[i];
+        }
+    }
+    if (!supported) {
+        handle_error_string("No sort can sort %zu elements on %d ranks",
+                length, ctx->world_size);
+        ret = -1;
+        goto exit;
+    }
+
+    /* Rank 0 chooses for everyone, so that ranks whose measurements differ
+     * still run the same sort. */
+    if (ctx->world_rank == 0) {
+        size_t num_threads =
+            opts && opts->num_threads ? opts->num_threads : ctx->num_threads;
+        *algo =
+            cost_choose(&ctx->cost_params, length, num_threads, supported);
+        for (int rank = 1; rank < ctx->world_size; rank++) {
+            ret =
+                mpi_tls_send_bytes(algo, sizeof(*algo), rank,
+                        COST_CHOICE_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending sort choice to %d", rank);
+                goto exit;
+            }
+        }
+    } else {
+        ret =
+            mpi_tls_recv_bytes(algo, sizeof(*algo), 0, COST_CHOICE_MPI_TAG,
+                    MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error receiving sort choice from 0");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* A job running on the calling thread. */
+struct job {
+    struct thread_job thread_job;
+    uint32_t job_bit;
+    size_t num_threads;
+    bool owns_arena;
+};
+
+static size_t get_job_num_threads(const distsort_ctx_t *ctx,
+        const struct distsort_opts *opts) {
+    return opts->num_threads ? opts->num_threads : ctx->num_threads;
+}
+
+/* Returns an upper bound on the number of MPI tags ALGO uses to sort LENGTH
+ * elements in total with NUM_THREADS threads. The chunked exchanges tag their
+ * messages with chunk or bucket indices, so the count grows with LENGTH. */
+static size_t get_sort_num_tags(const distsort_ctx_t *ctx, size_t length,
+        enum sort_type algo, size_t num_threads) {
+    size_t num_buckets =
+        MAX(next_pow2ll(length) * 2 / sort_params.bucket_size,
+                (size_t) ctx->world_size * 2);
+    size_t num_tags;
+
+    switch (algo) {
+        case SORT_BITONIC:
+            num_tags =
+                CEIL_DIV(next_pow2ll(length), sort_params.bitonic_chunk_size);
+            break;
+        case SORT_BUCKET:
+            num_tags = num_buckets;
+            break;
+        case OJOIN:
+            /* OJOIN bucket sorts before its own chunked exchanges. */
+            num_tags =
+                MAX(num_buckets,
+                    OCOMPACT_MARKED_COUNT_MPI_TAG
+                        + CEIL_DIV(num_buckets * sort_params.bucket_size,
+                            sort_params.ojoin_chunk_size));
+            break;
+        case SORT_ORSHUFFLE:
+            num_tags =
+                MAX(OCOMPACT_MARKED_COUNT_MPI_TAG
+                        + CEIL_DIV(length, sort_params.orshuffle_chunk_size),
+                    num_threads);
+            break;
+        case SORT_AUTO:
+            /* Any of the sorts the cost model picks from. */
+            num_tags =
+                MAX(get_sort_num_tags(ctx, length, SORT_BITONIC, num_threads),
+                    MAX(get_sort_num_tags(ctx, length, SORT_BUCKET,
+                            num_threads),
+                        get_sort_num_tags(ctx, length, SORT_ORSHUFFLE,
+                            num_threads)));
+            break;
+        default:
+            num_tags = 0;
+            break;
+    }
+
+    return MAX(num_tags, MPI_TLS_NUM_FIXED_TAGS);
+}
+
+/* Claims OPTS's job ID and thread budget for a job sorting LENGTH elements in
+ * total with ALGO, and makes it the calling thread's job. The job's messages
+ * use NUM_TAGS tags, which must fit in the job's share of MPI_TAG_UB. Work
+ * pushed from then on runs under the job. */
+static int begin_job(distsort_ctx_t *ctx, struct job *job, size_t length,
+        enum sort_type algo, size_t num_tags,
+        const struct distsort_opts *opts) {
+    int ret;
+
+    job->num_threads = get_job_num_threads(ctx, opts);
+    if (job->num_threads > ctx->num_threads) {
+        handle_error_string("Job wants %zu threads, but the pool has %zu",
+                job->num_threads, ctx->num_threads);
+        ret = -1;
+        goto exit;
+    }
+    if (opts->job_id >= MIN(DISTSORT_MAX_JOBS, mpi_tls_max_jobs)) {
+        handle_error_string(
+                "Job ID %u is out of range; MPI_TAG_UB allows %zu jobs",
+                opts->job_id, MIN(DISTSORT_MAX_JOBS, mpi_tls_max_jobs));
+        ret = -1;
+        goto exit;
+    }
+    if (num_tags > (size_t) mpi_tls_job_tag_stride) {
+        handle_error_string(
+                "Job of %zu elements needs %zu MPI tags, but MPI_TAG_UB allows "
+                    "%d per job",
+                length, num_tags, mpi_tls_job_tag_stride);
+        ret = -1;
+        goto exit;
+    }
+
+    job->job_bit = (uint32_t) 1 << opts->job_id;
+    if (__atomic_fetch_or(&ctx->active_jobs, job->job_bit, __ATOMIC_ACQUIRE)
+            & job->job_bit) {
+        handle_error_string("Job %u is already running", opts->job_id);
+        ret = -1;
+        goto exit;
+    }
+
+    ret = distsort_prepare(ctx, algo);
+    if (ret) {
+        goto exit_release_job;
+    }
+
+    /* Threads other than the one that created the context need their own
+     * arena to run a job. */
+    job->owns_arena = !arena_is_init();
+    if (job->owns_arena) {
+        ret = arena_init(ctx->arena_size);
+        if (ret) {
+            handle_error_string("Error initializing scratch arena");
+            goto exit_release_job;
+        }
+    }
+
+    claim_workers(ctx, job->num_threads - 1);
+
+    job->thread_job.total_length = length;
+    job->thread_job.mpi_tag_base = opts->job_id * mpi_tls_job_tag_stride;
+    thread_job_begin(&job->thread_job, job->num_threads - 1);
+
+    return 0;
+
+exit_release_job:
+    __atomic_fetch_and(&ctx->active_jobs, ~job->job_bit, __ATOMIC_RELEASE);
+exit:
+    return ret;
+}
+
+static void end_job(distsort_ctx_t *ctx, struct job *job) {
+    thread_job_end(&job->thread_job);
+
+    __atomic_add_fetch(&ctx->num_workers_free, job->num_threads - 1,
+            __ATOMIC_RELEASE);
+
+    if (job->owns_arena) {
+        arena_destroy();
+        crypto_thread_free();
+    }
+
+    __atomic_fetch_and(&ctx->active_jobs, ~job->job_bit, __ATOMIC_RELEASE);
+}
+
+int distsort_sort(distsort_ctx_t *ctx, elem_t *elems, size_t length,
+        enum sort_type algo, const struct distsort_opts *opts) {
+    static const struct distsort_opts default_opts;
+    struct job job;
+    int ret;
+
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    ret = check_length(ctx, length, algo);
+    if (ret) {
+        goto exit;
+    }
+
+    ret =
+        begin_job(ctx, &job, length, algo,
+                get_sort_num_tags(ctx, length, algo,
+                    get_job_num_threads(ctx, opts)),
+                opts);
+    if (ret) {
+        goto exit;
+    }
+
+    ret = run_sort(ctx, elems, length, algo, opts, job.num_threads);
+
+    end_job(ctx, &job);
+exit:
+    return ret;
+}
+
+int distsort_sort_extmem(distsort_ctx_t *ctx, struct extmem_store *store,
+        size_t length, const struct distsort_opts *opts) {
+    struct job job;
+    int ret;
+
+    if (!opts->extmem_block_bytes) {
+        handle_error_string("External-memory sorts need a block size");
+        ret = -1;
+        goto exit;
+    }
+    ret = check_length(ctx, length, SORT_BUCKET);
+    if (ret) {
+        goto exit;
+    }
+
+    ret =
+        begin_job(ctx, &job, length, SORT_BUCKET,
+                get_sort_num_tags(ctx, length, SORT_BUCKET,
+                    get_job_num_threads(ctx, opts)),
+                opts);
+    if (ret) {
+        goto exit;
+    }
+
+    ret = bucket_init();
+    if (ret) {
+        handle_error_string("Error initializing sort");
+        goto exit_end_job;
+    }
+
+    ret =
+        bucket_sort_extmem(store, length, distsort_local_start(ctx, length),
+                distsort_local_length(ctx, length), opts->extmem_block_bytes,
+                job.num_threads);
+    if (ret) {
+        handle_error_string("Error in bucket sort");
+    }
+
+    bucket_free();
+exit_end_job:
+    end_job(ctx, &job);
+exit:
+    return ret;
+}
+
+int distsort_sort_batch(distsort_ctx_t *ctx, elem_t *elems,
+        const size_t *lengths, size_t num_arrays,
+        const struct distsort_opts *opts) {
+    static const struct distsort_opts default_opts;
+    struct job job;
+    int ret;
+
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    /* The batch needs no per-thread buffers, so it runs on whatever sort the
+     * pool threads are set up for. */
+    enum sort_type algo = ctx->sort_type ? ctx->sort_type : SORT_BITONIC;
+
+    size_t total_length = 0;
+    for (size_t i = 0; i < num_arrays; i++) {
+        total_length += lengths[i];
+    }
+
+    ret =
+        begin_job(ctx, &job, total_length, algo, MPI_TLS_NUM_FIXED_TAGS, opts);
+    if (ret) {
+        goto exit;
+    }
+
+    ret = batch_sort(elems, lengths, num_arrays, job.num_threads);
+    if (ret) {
+        handle_error_string("Error in batch sort");
+    }
+
+    end_job(ctx, &job);
+exit:
+    return ret;
+}
+
+int distsort_fingerprint(distsort_ctx_t *ctx, const elem_t *elems,
+        size_t length, const struct distsort_opts *opts,
+        uint64_t *fingerprint) {
+    static const struct distsort_opts default_opts;
+    struct job job;
+    int ret;
+
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    /* Hashing needs no per-thread buffers, so it runs on whatever sort the
+     * pool threads are set up for. */
+    enum sort_type algo = ctx->sort_type ? ctx->sort_type : SORT_BITONIC;
+
+    ret = begin_job(ctx, &job, length, algo, MPI_TLS_NUM_FIXED_TAGS, opts);
+    if (ret) {
+        goto exit;
+    }
+
+    if (!ctx->fingerprint_key_ready) {
+        ret = fingerprint_key_init(&ctx->fingerprint_key, ctx->world_rank,
+                ctx->world_size);
+        if (ret) {
+            goto exit_end_job;
+        }
+        ctx->fingerprint_key_ready = true;
+    }
+
+    *fingerprint =
+        fingerprint_elems(&ctx->fingerprint_key, elems, length,
+                job.num_threads);
+
+    ret = 0;
+
+exit_end_job:
+    end_job(ctx, &job);
+exit:
+    return ret;
+}
+
+size_t distsort_collect_spans(distsort_ctx_t *ctx, struct span_record *spans,
+        size_t capacity) {
+    (void) ctx;
+    return span_collect(spans, capacity);
+}
+
+size_t distsort_collect_thread_stats(distsort_ctx_t *ctx,
+        struct ocall_thread_stats *stats, size_t capacity) {
+    (void) ctx;
+    return thread_stats_collect(stats, capacity);
+}
+
+size_t distsort_get_mem_stats(distsort_ctx_t *ctx, size_t *site_bytes,
+        size_t *site_peak_bytes, struct mem_phase_stats *phases,
+        size_t capacity) {
+    (void) ctx;
+    mem_get_sites(site_bytes, site_peak_bytes);
+    return mem_get_phases(phases, capacity);
+}
+
+void distsort_reset_mem_stats(distsort_ctx_t *ctx) {
+    (void) ctx;
+    mem_reset_peaks();
+}
+
+void distsort_set_trace(distsort_ctx_t *ctx, bool enabled) {
+    (void) ctx;
+    trace_set_enabled(enabled);
+}
+
+size_t distsort_collect_trace(distsort_ctx_t *ctx, struct trace_event *events,
+        size_t capacity) {
+    (void) ctx;
+    return trace_collect(events, capacity);
+}
+
+uint64_t distsort_trace_time(distsort_ctx_t *ctx) {
+    (void) ctx;
+    return span_time_ns();
+}
+
+int distsort_merge(distsort_ctx_t *ctx, elem_t *elems, size_t length,
+        elem_t *batch, size_t batch_length, enum sort_type algo,
+        const struct distsort_opts *opts) {
+    static const struct distsort_opts default_opts;
+    struct job job;
+    int ret;
+
+    if (!opts) {
+        opts = &default_opts;
+    }
+    if (algo == OJOIN) {
+        handle_error_string("Invalid sort type for a merge");
+        ret = -1;
+        goto exit;
+    }
+    ret = check_length(ctx, batch_length, algo);
+    if (ret) {
+        goto exit;
+    }
+
+    /* The merge runs a bitonic merge over both halves padded to a power of
+     * two. */
+    size_t merge_length =
+        2 * MAX(next_pow2ll(MAX(length, batch_length)),
+                (size_t) ctx->world_size);
+    size_t num_threads = get_job_num_threads(ctx, opts);
+    ret =
+        begin_job(ctx, &job, batch_length, algo,
+                MAX(get_sort_num_tags(ctx, batch_length, algo, num_threads),
+                    get_sort_num_tags(ctx, merge_length, SORT_BITONIC,
+                        num_threads)),
+                opts);
+    if (ret) {
+        goto exit;
+    }
+
+    ret = run_sort(ctx, batch, batch_length, algo, opts, job.num_threads);
+    if (ret) {
+        goto exit_end_job;
+    }
+
+    ret = merge_sorted(elems, length, batch, batch_length, job.num_threads);
+    if (ret) {
+        handle_error_string("Error merging batch");
+        goto exit_end_job;
+    }
+
+exit_end_job:
+    end_job(ctx, &job);
+exit:
+    return ret;
+}
@@ -0,0 +1,214 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_DISTSORT_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_DISTSORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common/elem_t.h"
+#include "common/mem.h"
+#include "common/ocalls.h"
+#include "common/sort_params.h"
+#include "common/span.h"
+#include "common/sort_type.h"
+#include "common/trace.h"
+#include "enclave/extmem.h"
+
+/* The sort engines as a library, for enclaves that want to sort their own
+ * buffers rather than go through the ecalls in parallel_enc.c. The enclave
+ * imports distsort.edl for the ocalls the engines make and links
+ * libdistsort.a; the host links the matching ocall implementations in
+ * host/ocalls.c, host/output.c, and host/sema.c.
+ *
+ * A context holds the state of the jobs run through it and sets up the RNG, the
+ * MPI-over-TLS sessions with the other ranks, and the thread pool, which the
+ * engines keep in enclave-wide globals along with the sort parameters. The
+ * enclave hands its threads to the pool by having them call distsort_start_work
+ * or distsort_start_comm_work, which return once distsort_release_threads is
+ * called.
+ *
+ * Several jobs may run on one context at once, each called from its own
+ * enclave thread, sharing the pool and the sessions with the other ranks. */
+
+typedef struct distsort_ctx distsort_ctx_t;
+
+/* The number of jobs that may run on a context at once. An MPI
+ * implementation with a small MPI_TAG_UB allows fewer, and limits how large
+ * each job's sort may be. */
+#define DISTSORT_MAX_JOBS 32
+
+struct distsort_opts {
+    /* For OJOIN, the number of elements at the end of the array that look up
+     * existing keys. */
+    size_t join_length;
+
+    /* For SORT_BUCKET, keep the buckets encrypted in host memory and page them
+     * through enclave blocks totalling this many bytes, or 0 to keep them in
+     * the enclave. */
+    size_t extmem_block_bytes;
+
+    /* Identifies the job among those running at the same time, from 0 to
+     * DISTSORT_MAX_JOBS - 1. A job's messages only match messages with the
+     * same ID, so every rank must use the same ID for the same job. */
+    unsigned int job_id;
+
+    /* The number of threads the job may use, including the calling thread,
+     * or 0 for all of the context's threads. The job waits until enough pool
+     * threads are free, so concurrent jobs should split the pool between
+     * them. */
+    size_t num_threads;
+};
+
+/* Creates a context for this rank of WORLD_SIZE ranks, with NUM_THREADS
+ * compute threads, including the caller, and NUM_COMM_THREADS communication
+ * threads. The pool, RNG, and sessions are enclave-wide globals, so this fails
+ * while another context exists.
+ *
+ * The engines run with rank 0's PARAMS, or SORT_PARAMS_DEFAULT if PARAMS is
+ * NULL. If TUNE is set, rank 0 first replaces them with sizes measured for
+ * this machine, which takes a fraction of a second and exchanges messages
+ * between ranks 0 and 1. The parameters in effect are written back to PARAMS,
+ * so that the caller can save tuned ones for later runs. */
+int distsort_init(distsort_ctx_t **ctx, int world_rank, int world_size,
+        size_t num_threads, size_t num_comm_threads,
+        struct sort_params *params, bool tune);
+void distsort_free(distsort_ctx_t *ctx);
+
+/* Thread pool entry points for the enclave's other threads. */
+void distsort_start_work(distsort_ctx_t *ctx);
+void distsort_start_comm_work(distsort_ctx_t *ctx);
+size_t distsort_get_num_threads_started(distsort_ctx_t *ctx);
+void distsort_release_threads(distsort_ctx_t *ctx);
+void distsort_unrelease_threads(distsort_ctx_t *ctx);
+
+/* Returns the index of this rank's first element and the number of elements
+ * it holds, before and after sorting, when sorting LENGTH elements in
+ * total. */
+size_t distsort_local_start(const distsort_ctx_t *ctx, size_t length);
+size_t distsort_local_length(const distsort_ctx_t *ctx, size_t length);
+
+/* Returns the number of elements the buffer passed to distsort_sort must hold
+ * to sort LENGTH elements in total with ALGO, or 0 after printing what ALGO
+ * needs if it cannot sort that many elements on this many ranks. distsort_sort
+ * fails for the same lengths. */
+size_t distsort_buffer_len(const distsort_ctx_t *ctx, size_t length,
+        enum sort_type algo, const struct distsort_opts *opts);
+
+/* Initializes STORE, in host memory, with room for this rank's
+ * distsort_local_length elements of LENGTH in total, for distsort_sort_extmem.
+ * Each of its blocks holds a page of elements, and the caller writes and reads
+ * them in order with the extmem_stream functions and a page buffer of
+ * STORE->block_len bytes. Free it with extmem_free. */
+int distsort_extmem_init(distsort_ctx_t *ctx, struct extmem_store *store,
+        size_t length);
+
+/* Chooses the sort that the cost model predicts is fastest for LENGTH
+ * elements in total with OPTS, for use in place of SORT_AUTO, which the other
+ * calls do not accept. Every rank must call this, and all of them get rank 0's
+ * choice. The first call measures the constants the model is priced with,
+ * which takes a few milliseconds and exchanges messages between ranks 0 and
+ * 1. */
+int distsort_choose(distsort_ctx_t *ctx, size_t length,
+        const struct distsort_opts *opts, enum sort_type *algo);
+
+/* Sets up the pool threads for ALGO and lets them start taking work, so that
+ * the caller can use the pool, e.g. to fill its buffer, before sorting. Pool
+ * threads are set up for one algorithm at a time, so changing algorithms
+ * requires releasing the threads and starting them again. distsort_sort
+ * calls this itself. */
+int distsort_prepare(distsort_ctx_t *ctx, enum sort_type algo);
+
+/* Sorts LENGTH elements in total across all ranks with ALGO. ELEMS holds this
+ * rank's distsort_local_length elements and room for distsort_buffer_len
+ * elements in total, and holds this rank's share of the sorted output when
+ * this returns. OPTS may be NULL for the defaults. */
+int distsort_sort(distsort_ctx_t *ctx, elem_t *elems, size_t length,
+        enum sort_type algo, const struct distsort_opts *opts);
+
+/* Like distsort_sort with SORT_BUCKET and OPTS's extmem_block_bytes, which
+ * must be set, but with this rank's elements in STORE, from
+ * distsort_extmem_init, which holds this rank's share of the sorted output,
+ * written under a new key, when this returns. The enclave holds the blocks
+ * and a constant amount besides, however large LENGTH is, so arrays larger
+ * than the EPC sort without paging. */
+int distsort_sort_extmem(distsort_ctx_t *ctx, struct extmem_store *store,
+        size_t length, const struct distsort_opts *opts);
+
+/* Sorts NUM_ARRAYS independent arrays held by this rank, stored one after
+ * another in ELEMS, where array i holds LENGTHS[i] elements. Nothing is
+ * exchanged with the other ranks, so each rank may sort a different batch. The
+ * arrays are sorted together by one oblivious network per padded length,
+ * which pays for waking the pool once per batch rather than once per array.
+ * The batch runs on whichever sort the pool threads are set up for, or sets
+ * them up for SORT_BITONIC. Only OPTS's job ID and thread budget apply. */
+int distsort_sort_batch(distsort_ctx_t *ctx, elem_t *elems,
+        const size_t *lengths, size_t num_arrays,
+        const struct distsort_opts *opts);
+
+/* Merges BATCH_LENGTH new elements into LENGTH elements that are already
+ * sorted across all ranks, such as by distsort_sort, for data that grows in
+ * batches. BATCH holds this rank's distsort_local_length new elements and room
+ * for distsort_buffer_len elements in total for ALGO, which sorts the batch
+ * first and so must be able to sort BATCH_LENGTH elements. ELEMS holds this
+ * rank's share of the sorted elements and room for
+ * distsort_local_length(ctx, LENGTH + BATCH_LENGTH) elements, and holds this
+ * rank's share of all of them when this returns. The merge is one distributed
+ * bitonic merge over both padded to the same power of two, so it costs about
+ * as much as the last merge of a bitonic sort. Keys must be less than
+ * UINT64_MAX, which the padding uses, and the number of ranks must be a power
+ * of two. */
+int distsort_merge(distsort_ctx_t *ctx, elem_t *elems, size_t length,
+        elem_t *batch, size_t batch_length, enum sort_type algo,
+        const struct distsort_opts *opts);
+
+/* Sets *FINGERPRINT to an order-independent fingerprint of the LENGTH
+ * elements at ELEMS, as described in enclave/fingerprint.h. The fingerprints
+ * of every rank's share add up, modulo 2^64, to the same sum before and after
+ * a sort, unless the sort lost, duplicated, or changed elements. Only OPTS's
+ * job ID and thread budget apply. Every rank must make the first call on a
+ * context, which shares the hash key. */
+int distsort_fingerprint(distsort_ctx_t *ctx, const elem_t *elems,
+        size_t length, const struct distsort_opts *opts,
+        uint64_t *fingerprint);
+
+/* Copies up to CAPACITY of the spans timing the phases of the jobs run since
+ * the last call into SPANS and forgets them, returning the number copied. The
+ * spans are described in common/span.h. No job may be running. */
+size_t distsort_collect_spans(distsort_ctx_t *ctx, struct span_record *spans,
+        size_t capacity);
+
+/* Copies how each thread spent its time in each phase since the last call that
+ * copied them into STATS and forgets them, with the same protocol as
+ * distsort_collect_trace. Threads are only measured in enclaves built with
+ * DISTRIBUTED_SGX_SORT_PROFILE_THREADING, and this returns 0 otherwise. No job
+ * may be running. */
+size_t distsort_collect_thread_stats(distsort_ctx_t *ctx,
+        struct ocall_thread_stats *stats, size_t capacity);
+
+/* Writes the bytes each allocation site holds and the most each has held since
+ * the last reset to SITE_BYTES and SITE_PEAK_BYTES, which have room for
+ * MEM_NUM_SITES each, and copies up to CAPACITY of the peaks of the phases
+ * that allocated since then into PHASES, returning the number copied. */
+size_t distsort_get_mem_stats(distsort_ctx_t *ctx, size_t *site_bytes,
+        size_t *site_peak_bytes, struct mem_phase_stats *phases,
+        size_t capacity);
+
+/* Starts the peaks counted by distsort_get_mem_stats over from the bytes held
+ * now. No job may be running. */
+void distsort_reset_mem_stats(distsort_ctx_t *ctx);
+
+/* Turns recording of the timeline events described in common/trace.h on or
+ * off. No job may be running. */
+void distsort_set_trace(distsort_ctx_t *ctx, bool enabled);
+
+/* Returns the number of events recorded since the last call that copied them.
+ * If that many fit in CAPACITY, copies them into EVENTS and forgets them, so
+ * a caller that does not know the count can call this with a CAPACITY of 0
+ * first. No job may be running. */
+size_t distsort_collect_trace(distsort_ctx_t *ctx, struct trace_event *events,
+        size_t capacity);
+
+/* Returns the current time on the clock spans and events are timed with, for
+ * lining up the timelines of different ranks. */
+uint64_t distsort_trace_time(distsort_ctx_t *ctx);
+
+#endif /* distributed-sgx-sort/enclave/distsort.h */
@@ -0,0 +1,285 @@
+#include "enclave/extmem.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "enclave/crypto.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/enclave.h>
+#include "enclave/parallel_t.h"
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+void *ocall_extmem_alloc(size_t size);
+void ocall_extmem_free(void *ptr);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+static_assert(EXTMEM_KEY_LEN == KEY_LEN, "Extmem key must be an AES key");
+
+/* Each slot in host memory holds the IV and tag followed by the encrypted
+ * block. */
+struct extmem_slot_header {
+    unsigned char iv[IV_LEN];
+    unsigned char tag[TAG_LEN];
+    unsigned char reserved[4];
+};
+
+struct extmem_aad {
+    uint64_t block_idx;
+};
+
+static size_t get_slot_len(const struct extmem_store *store) {
+    return sizeof(struct extmem_slot_header) + store->block_len;
+}
+
+int extmem_init(struct extmem_store *store, size_t num_blocks,
+        size_t block_len) {
+    int ret;
+
+    store->num_blocks = num_blocks;
+    store->block_len = block_len;
+
+    /* Each store gets its own key, which never leaves the enclave. */
+    ret = extmem_rekey(store);
+    if (ret) {
+        goto exit;
+    }
+
+    size_t slots_len = num_blocks * get_slot_len(store);
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_extmem_alloc((void **) &store->slots,
+            slots_len);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_extmem_alloc");
+        ret = result;
+        goto exit;
+    }
+    if (store->slots && !oe_is_outside_enclave(store->slots, slots_len)) {
+        handle_error_string("Host returned extmem inside the enclave");
+        ret = -1;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    store->slots = ocall_extmem_alloc(slots_len);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (!store->slots) {
+        handle_error_string("Error allocating %zu bytes of host memory",
+                slots_len);
+        ret = -1;
+        goto exit;
+    }
+
+    return 0;
+
+exit:
+    memset(store->key, '\0', sizeof(store->key));
+    return ret;
+}
+
+void extmem_free(struct extmem_store *store) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_extmem_free(store->slots);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_extmem_free");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ocall_extmem_free(store->slots);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    store->slots = NULL;
+    memset(store->key, '\0', sizeof(store->key));
+}
+
+int extmem_rekey(struct extmem_store *store) {
+    int ret;
+
+    ret = rand_read(store->key, sizeof(store->key));
+    if (ret) {
+        handle_error_string("Error generating extmem key");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+/* Reads and authenticates block BLOCK_IDX into BLOCK. The ciphertext is
+ * copied into BLOCK before decrypting it in place, so the host cannot change
+ * it between authentication and decryption. */
+int extmem_read(struct extmem_store *store, size_t block_idx, void *block) {
+    int ret;
+
+    if (block_idx >= store->num_blocks) {
+        handle_error_string("Reading out-of-range extmem block %zu",
+                block_idx);
+        ret = -1;
+        goto exit;
+    }
+
+    const unsigned char *slot = store->slots + block_idx * get_slot_len(store);
+    struct extmem_slot_header header;
+    memcpy(&header, slot, sizeof(header));
+    memcpy(block, slot + sizeof(header), store->block_len);
+
+    struct extmem_aad aad = {
+        .block_idx = block_idx,
+    };
+    ret = aad_decrypt(store->key, block, store->block_len, &aad, sizeof(aad),
+            header.iv, header.tag, block);
+    if (ret) {
+        handle_error_string("Error authenticating extmem block %zu",
+                block_idx);
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+int extmem_write(struct extmem_store *store, size_t block_idx,
+        const void *block) {
+    int ret;
+
+    if (block_idx >= store->num_blocks) {
+        handle_error_string("Writing out-of-range extmem block %zu",
+                block_idx);
+        ret = -1;
+        goto exit;
+    }
+
+    unsigned char *slot = store->slots + block_idx * get_slot_len(store);
+    struct extmem_slot_header header = { 0 };
+    ret = rand_read(header.iv, sizeof(header.iv));
+    if (ret) {
+        handle_error_string("Error generating extmem IV");
+        goto exit;
+    }
+
+    struct extmem_aad aad = {
+        .block_idx = block_idx,
+    };
+    ret = aad_encrypt(store->key, block, store->block_len, &aad, sizeof(aad),
+            header.iv, slot + sizeof(header), header.tag);
+    if (ret) {
+        handle_error_string("Error encrypting extmem block %zu", block_idx);
+        goto exit;
+    }
+    memcpy(slot, &header, sizeof(header));
+
+exit:
+    return ret;
+}
+
+void extmem_stream_init(struct extmem_stream *stream,
+        struct extmem_store *store, elem_t *page, size_t idx) {
+    stream->store = store;
+    stream->page = page;
+    stream->page_len = store->block_len / sizeof(elem_t);
+    stream->idx = idx;
+    stream->page_loaded = false;
+}
+
+const elem_t *extmem_stream_peek(struct extmem_stream *stream) {
+    size_t offset = stream->idx % stream->page_len;
+    int ret;
+
+    if (!stream->page_loaded) {
+        ret = extmem_read(stream->store, stream->idx / stream->page_len,
+                stream->page);
+        if (ret) {
+            return NULL;
+        }
+        stream->page_loaded = true;
+    }
+
+    return &stream->page[offset];
+}
+
+int extmem_stream_read(struct extmem_stream *stream, elem_t *elems,
+        size_t count) {
+    int ret;
+
+    while (count) {
+        size_t offset = stream->idx % stream->page_len;
+        size_t page_idx = stream->idx / stream->page_len;
+        size_t num_elems = MIN(count, stream->page_len - offset);
+
+        if (!offset && num_elems == stream->page_len) {
+            /* Read whole pages straight into ELEMS. */
+            ret = extmem_read(stream->store, page_idx, elems);
+            if (ret) {
+                goto exit;
+            }
+        } else {
+            if (!stream->page_loaded) {
+                ret = extmem_read(stream->store, page_idx, stream->page);
+                if (ret) {
+                    goto exit;
+                }
+                stream->page_loaded = true;
+            }
+            memcpy(elems, stream->page + offset,
+                    num_elems * sizeof(*elems));
+        }
+
+        stream->idx += num_elems;
+        if (stream->idx % stream->page_len == 0) {
+            stream->page_loaded = false;
+        }
+        elems += num_elems;
+        count -= num_elems;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int extmem_stream_write(struct extmem_stream *stream, const elem_t *elems,
+        size_t count) {
+    int ret;
+
+    while (count) {
+        size_t offset = stream->idx % stream->page_len;
+        size_t page_idx = stream->idx / stream->page_len;
+        size_t num_elems = MIN(count, stream->page_len - offset);
+
+        if (!offset && num_elems == stream->page_len) {
+            /* Write whole pages straight from ELEMS. */
+            ret = extmem_write(stream->store, page_idx, elems);
+            if (ret) {
+                goto exit;
+            }
+        } else {
+            memcpy(stream->page + offset, elems, num_elems * sizeof(*elems));
+            if (offset + num_elems == stream->page_len) {
+                ret = extmem_write(stream->store, page_idx, stream->page);
+                if (ret) {
+                    goto exit;
+                }
+            }
+        }
+
+        stream->idx += num_elems;
+        elems += num_elems;
+        count -= num_elems;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Writes the partial page at the end of the stream, if any. */
+int extmem_stream_flush(struct extmem_stream *stream) {
+    if (stream->idx % stream->page_len == 0) {
+        return 0;
+    }
+    return extmem_write(stream->store, stream->idx / stream->page_len,
+            stream->page);
+}
@@ -0,0 +1,70 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_EXTMEM_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_EXTMEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common/elem_t.h"
+
+#define EXTMEM_KEY_LEN 16
+
+/* A store of fixed-size blocks kept encrypted and authenticated in untrusted
+ * host memory. Every write encrypts the block under a fresh IV with the
+ * block's index as additional authenticated data.
+ *
+ * The enclave keeps no state per block, so its footprint does not grow with
+ * the store. Instead, the store is used in passes: between extmem_init or
+ * extmem_rekey and the next extmem_rekey, each block may be written at most
+ * once, and a block may only be read once it has been written. Each pass
+ * draws a new key, so blocks from earlier passes fail to authenticate, and the
+ * host can neither move blocks nor replay stale ones. Which blocks are read
+ * and written, and when, is visible to the host, so callers must access
+ * blocks in an order that does not depend on the data. */
+
+struct extmem_store {
+    unsigned char *slots;
+    size_t num_blocks;
+    size_t block_len;
+    unsigned char key[EXTMEM_KEY_LEN];
+};
+
+int extmem_init(struct extmem_store *store, size_t num_blocks,
+        size_t block_len);
+void extmem_free(struct extmem_store *store);
+
+/* Starts a new pass, after which the store's blocks must all be written again
+ * before they are read. */
+int extmem_rekey(struct extmem_store *store);
+
+int extmem_read(struct extmem_store *store, size_t block_idx, void *block);
+int extmem_write(struct extmem_store *store, size_t block_idx,
+        const void *block);
+
+/* A cursor that reads or writes the elements of a store in order, where each
+ * block of the store holds a page of block_len / sizeof(elem_t) elements.
+ * Partial pages go through PAGE, a page-sized buffer in the enclave, and whole
+ * pages are read and written directly. A stream either reads or writes. A
+ * writing stream must start at the start of a page and be flushed once the
+ * last element is written. */
+struct extmem_stream {
+    struct extmem_store *store;
+    elem_t *page;
+    size_t page_len;
+    size_t idx;
+    bool page_loaded;
+};
+
+void extmem_stream_init(struct extmem_stream *stream,
+        struct extmem_store *store, elem_t *page, size_t idx);
+
+/* Returns the stream's next element without advancing past it, or NULL on
+ * error. The element stays valid until the stream moves. */
+const elem_t *extmem_stream_peek(struct extmem_stream *stream);
+
+int extmem_stream_read(struct extmem_stream *stream, elem_t *elems,
+        size_t count);
+int extmem_stream_write(struct extmem_stream *stream, const elem_t *elems,
+        size_t count);
+int extmem_stream_flush(struct extmem_stream *stream);
+
+#endif /* distributed-sgx-sort/enclave/extmem.h */
@@ -0,0 +1,131 @@
+#include "enclave/fingerprint.h"
+#include <stddef.h>
+#include <stdint.h>
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "enclave/crypto.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/threading.h"
+
+static inline uint64_t rotl(uint64_t x, unsigned int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; \
+        v1 = rotl(v1, 13); \
+        v1 ^= v0; \
+        v0 = rotl(v0, 32); \
+        v2 += v3; \
+        v3 = rotl(v3, 16); \
+        v3 ^= v2; \
+        v0 += v3; \
+        v3 = rotl(v3, 21); \
+        v3 ^= v0; \
+        v2 += v1; \
+        v1 = rotl(v1, 17); \
+        v1 ^= v2; \
+        v2 = rotl(v2, 32); \
+    } while (0)
+
+/* SipHash-2-4 of the 16-byte message M0 || M1. */
+static uint64_t siphash(const struct fingerprint_key *key, uint64_t m0,
+        uint64_t m1) {
+    uint64_t v0 = key->k0 ^ 0x736f6d6570736575;
+    uint64_t v1 = key->k1 ^ 0x646f72616e646f6d;
+    uint64_t v2 = key->k0 ^ 0x6c7967656e657261;
+    uint64_t v3 = key->k1 ^ 0x7465646279746573;
+    uint64_t blocks[] = { m0, m1, (uint64_t) 16 << 56 };
+
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(*blocks); i++) {
+        v3 ^= blocks[i];
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= blocks[i];
+    }
+
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+int fingerprint_key_init(struct fingerprint_key *key, int world_rank,
+        int world_size) {
+    int ret;
+
+    if (world_rank == 0) {
+        ret = rand_read(key, sizeof(*key));
+        if (ret) {
+            handle_error_string("Error generating fingerprint key");
+            goto exit;
+        }
+        for (int rank = 1; rank < world_size; rank++) {
+            ret = mpi_tls_send_bytes(key, sizeof(*key), rank,
+                    FINGERPRINT_KEY_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending fingerprint key to %d",
+                        rank);
+                goto exit;
+            }
+        }
+    } else {
+        ret = mpi_tls_recv_bytes(key, sizeof(*key), 0,
+                FINGERPRINT_KEY_MPI_TAG, MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error receiving fingerprint key from 0");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+struct fingerprint_args {
+    const struct fingerprint_key *key;
+    const elem_t *elems;
+    size_t length;
+    size_t num_tasks;
+    uint64_t sum;
+};
+
+static void fingerprint_task(void *args_, size_t task_idx) {
+    struct fingerprint_args *args = args_;
+    size_t start = args->length * task_idx / args->num_tasks;
+    size_t end = args->length * (task_idx + 1) / args->num_tasks;
+
+    uint64_t sum = 0;
+    for (size_t i = start; i < end; i++) {
+        sum += siphash(args->key, args->elems[i].key, args->elems[i].value);
+    }
+    __atomic_add_fetch(&args->sum, sum, __ATOMIC_RELAXED);
+}
+
+uint64_t fingerprint_elems(const struct fingerprint_key *key,
+        const elem_t *elems, size_t length, size_t num_threads) {
+    struct fingerprint_args args = {
+        .key = key,
+        .elems = elems,
+        .length = length,
+        .num_tasks = num_threads,
+        .sum = 0,
+    };
+    struct thread_work work = {
+        .type = THREAD_WORK_ITER,
+        .iter = {
+            .func = fingerprint_task,
+            .arg = &args,
+            .count = num_threads,
+        },
+    };
+    thread_work_push(&work);
+    thread_work_until_empty();
+    thread_wait(&work);
+    return args.sum;
+}
@@ -0,0 +1,30 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_FINGERPRINT_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_FINGERPRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common/elem_t.h"
+
+/* An order-independent fingerprint of a multiset of elements: the sum, modulo
+ * 2^64, of a keyed SipHash-2-4 of each element's key and value. Sums over
+ * disjoint parts add up to the sum over the whole, so each rank fingerprints
+ * its own share before and after sorting, and the differences across ranks
+ * add up to 0 when the output is a permutation of the input. The hash key is
+ * secret, so the host cannot craft a wrong output with the same sum. */
+
+struct fingerprint_key {
+    uint64_t k0;
+    uint64_t k1;
+};
+
+/* Has rank 0 draw a random key and send it to the other ranks. Every rank
+ * must call this. */
+int fingerprint_key_init(struct fingerprint_key *key, int world_rank,
+        int world_size);
+
+/* Returns the sum of the hashes of LENGTH elements at ELEMS, split into
+ * NUM_THREADS tasks for the pool. */
+uint64_t fingerprint_elems(const struct fingerprint_key *key,
+        const elem_t *elems, size_t length, size_t num_threads);
+
+#endif /* distributed-sgx-sort/enclave/fingerprint.h */
@@ -0,0 +1,329 @@
+#include "enclave/input.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/input.h"
+#include "common/mem.h"
+#include "enclave/crypto.h"
+#include "enclave/extmem.h"
+#include "enclave/mem.h"
+
+static_assert(INPUT_KEY_LEN == KEY_LEN, "Input key must be an AES key");
+static_assert(INPUT_IV_LEN == IV_LEN, "Input IV must be a GCM IV");
+static_assert(INPUT_TAG_LEN == TAG_LEN, "Input tag must be a GCM tag");
+
+static unsigned char key[INPUT_KEY_LEN];
+static bool key_set;
+
+/* State of the ingestion in progress. */
+static elem_t *arr;
+static size_t local_start;
+static size_t local_length;
+static struct input_header header;
+static size_t first_chunk;
+static size_t end_chunk;
+static bool *chunks_ingested;
+static elem_t *chunk_buf;
+
+/* For ingestion into external memory, the elements are appended to STORE
+ * through WRITER rather than written to ARR, so chunks must arrive in
+ * order. */
+static struct extmem_store *store;
+static struct extmem_stream writer;
+static elem_t *page;
+static size_t next_chunk;
+
+int input_set_key(const unsigned char *key_, size_t key_len) {
+    if (key_len != sizeof(key)) {
+        handle_error_string("Input key must be %zu bytes", sizeof(key));
+        return -1;
+    }
+    memcpy(key, key_, sizeof(key));
+    key_set = true;
+    return 0;
+}
+
+/* Checks HEADER_ against the elements this rank needs and sets up the state
+ * the two kinds of ingestion share. */
+static int begin(size_t local_start_, size_t local_length_,
+        size_t total_length, const struct input_header *header_) {
+    int ret;
+
+    if (!key_set) {
+        handle_error_string("No input key set");
+        ret = -1;
+        goto exit;
+    }
+
+    /* Validate the header. It is authenticated later as part of every chunk's
+     * AAD. */
+    if (memcmp(header_->magic, INPUT_MAGIC, INPUT_MAGIC_LEN) != 0
+            || header_->version != INPUT_VERSION) {
+        handle_error_string("Not an input file of version %d", INPUT_VERSION);
+        ret = -1;
+        goto exit;
+    }
+    if (header_->elem_size != sizeof(elem_t)) {
+        handle_error_string("Input element size %u does not match %zu",
+                header_->elem_size, sizeof(elem_t));
+        ret = -1;
+        goto exit;
+    }
+    if (header_->total_elems != total_length) {
+        handle_error_string("Input holds %" PRIu64 " elements, not %zu",
+                header_->total_elems, total_length);
+        ret = -1;
+        goto exit;
+    }
+    if (!header_->chunk_elems
+            || header_->first_elem > header_->total_elems
+            || header_->num_elems > header_->total_elems - header_->first_elem) {
+        handle_error_string("Invalid input file layout");
+        ret = -1;
+        goto exit;
+    }
+
+    /* The chunk buffer is sized by CHUNK_ELEMS, and chunks are decrypted into
+     * it before their tags are checked, so bound it before allocating. A chunk
+     * holds no more than the whole file, though files shorter than the default
+     * chunk keep the default. */
+    if (header_->chunk_elems
+                > MAX(header_->num_elems, (uint64_t) INPUT_CHUNK_ELEMS)
+            || header_->chunk_elems > SIZE_MAX / sizeof(elem_t)) {
+        handle_error_string("Input chunks of %" PRIu64 " elements are too long",
+                header_->chunk_elems);
+        ret = -1;
+        goto exit;
+    }
+    if (header_->first_elem > local_start_
+            || header_->first_elem + header_->num_elems
+                < local_start_ + local_length_) {
+        handle_error_string(
+                "Input covers elements %" PRIu64 " to %" PRIu64 ", but this rank needs %zu to %zu",
+                header_->first_elem, header_->first_elem + header_->num_elems,
+                local_start_, local_start_ + local_length_);
+        ret = -1;
+        goto exit;
+    }
+
+    local_start = local_start_;
+    local_length = local_length_;
+    header = *header_;
+    input_chunk_range(&header, local_start, local_length, &first_chunk,
+            &end_chunk);
+    if (end_chunk > (SIZE_MAX - header.first_elem) / header.chunk_elems) {
+        handle_error_string("Input chunk offsets overflow");
+        ret = -1;
+        goto exit;
+    }
+
+    chunk_buf = mem_alloc(MEM_IO, header.chunk_elems * sizeof(*chunk_buf));
+    if (!chunk_buf) {
+        perror("malloc chunk buffer");
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int input_begin(elem_t *arr_, size_t local_start_, size_t local_length_,
+        size_t total_length, const struct input_header *header_) {
+    int ret;
+
+    ret = begin(local_start_, local_length_, total_length, header_);
+    if (ret) {
+        goto exit;
+    }
+
+    arr = arr_;
+    chunks_ingested =
+        mem_calloc(MEM_IO, end_chunk - first_chunk, sizeof(*chunks_ingested));
+    if (!chunks_ingested) {
+        perror("malloc ingested chunks");
+        ret = -1;
+        goto exit_free_chunk_buf;
+    }
+
+    return 0;
+
+exit_free_chunk_buf:
+    mem_free(chunk_buf);
+    chunk_buf = NULL;
+exit:
+    return ret;
+}
+
+int input_begin_extmem(struct extmem_store *store_, size_t local_start_,
+        size_t local_length_, size_t total_length,
+        const struct input_header *header_) {
+    int ret;
+
+    ret = begin(local_start_, local_length_, total_length, header_);
+    if (ret) {
+        goto exit;
+    }
+
+    page = mem_alloc(MEM_IO, store_->block_len);
+    if (!page) {
+        perror("malloc input page");
+        ret = -1;
+        goto exit_free_chunk_buf;
+    }
+    store = store_;
+    extmem_stream_init(&writer, store, page, 0);
+    next_chunk = first_chunk;
+
+    return 0;
+
+exit_free_chunk_buf:
+    mem_free(chunk_buf);
+    chunk_buf = NULL;
+exit:
+    return ret;
+}
+
+int input_ingest_chunk(const unsigned char *chunk, size_t chunk_len) {
+    struct input_chunk_header chunk_header;
+    int ret;
+
+    if (!chunks_ingested && !store) {
+        handle_error_string("No ingestion in progress");
+        ret = -1;
+        goto exit;
+    }
+
+    if (chunk_len < sizeof(chunk_header)) {
+        handle_error_string("Input chunk too short");
+        ret = -1;
+        goto exit;
+    }
+    memcpy(&chunk_header, chunk, sizeof(chunk_header));
+    size_t chunk_idx = chunk_header.chunk_idx;
+    if (chunk_idx < first_chunk || chunk_idx >= end_chunk
+            || (store
+                ? chunk_idx != next_chunk
+                : chunks_ingested[chunk_idx - first_chunk])) {
+        handle_error_string("Unexpected input chunk %zu", chunk_idx);
+        ret = -1;
+        goto exit;
+    }
+    if (chunk_len != input_chunk_len(&header, chunk_idx)) {
+        handle_error_string("Input chunk %zu has the wrong length", chunk_idx);
+        ret = -1;
+        goto exit;
+    }
+
+    /* Work out which of the chunk's elements belong to this rank. */
+    size_t chunk_start = header.first_elem + chunk_idx * header.chunk_elems;
+    size_t chunk_num_elems = input_chunk_num_elems(&header, chunk_idx);
+    size_t copy_start = MAX(chunk_start, local_start);
+    size_t copy_end =
+        MIN(chunk_start + chunk_num_elems, local_start + local_length);
+
+    /* Decrypt straight into the array if the whole chunk is ours. */
+    elem_t *plaintext;
+    if (!store && copy_start == chunk_start
+            && copy_end == chunk_start + chunk_num_elems) {
+        plaintext = arr + chunk_start - local_start;
+    } else {
+        plaintext = chunk_buf;
+    }
+
+    struct input_chunk_aad aad = {
+        .header = header,
+        .chunk_idx = chunk_idx,
+    };
+    ret = aad_decrypt(key, chunk + sizeof(chunk_header),
+            chunk_num_elems * sizeof(elem_t), &aad, sizeof(aad),
+            chunk_header.iv, chunk_header.tag, plaintext);
+    if (ret) {
+        handle_error_string("Error decrypting input chunk %zu", chunk_idx);
+        goto exit;
+    }
+
+    /* Clear the fields the sorts use for bookkeeping. */
+    for (size_t i = copy_start; i < copy_end; i++) {
+        elem_t *elem = &plaintext[i - chunk_start];
+        elem->orp_id = 0;
+        elem->is_dummy = false;
+        elem->compact_marked_prefix_sum = false;
+    }
+
+    if (store) {
+        ret =
+            extmem_stream_write(&writer, chunk_buf + copy_start - chunk_start,
+                    copy_end - copy_start);
+        if (ret) {
+            handle_error_string("Error writing input chunk %zu", chunk_idx);
+            goto exit;
+        }
+        next_chunk++;
+    } else {
+        if (plaintext == chunk_buf) {
+            memcpy(arr + copy_start - local_start,
+                    chunk_buf + copy_start - chunk_start,
+                    (copy_end - copy_start) * sizeof(*arr));
+        }
+        chunks_ingested[chunk_idx - first_chunk] = true;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int input_end(void) {
+    int ret;
+
+    if (!chunks_ingested && !store) {
+        handle_error_string("No ingestion in progress");
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+    if (store) {
+        if (next_chunk < end_chunk) {
+            handle_error_string("Input chunk %zu was never ingested",
+                    next_chunk);
+            ret = -1;
+        } else {
+            ret = extmem_stream_flush(&writer);
+            if (ret) {
+                handle_error_string("Error writing input");
+            }
+        }
+        mem_free(page);
+        page = NULL;
+        store = NULL;
+    } else {
+        for (size_t i = 0; i < end_chunk - first_chunk; i++) {
+            if (!chunks_ingested[i]) {
+                handle_error_string("Input chunk %zu was never ingested",
+                        first_chunk + i);
+                ret = -1;
+                break;
+            }
+        }
+        mem_free(chunks_ingested);
+        chunks_ingested = NULL;
+    }
+
+    mem_free(chunk_buf);
+    chunk_buf = NULL;
+
+exit:
+    return ret;
+}
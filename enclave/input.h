@@ -0,0 +1,23 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_INPUT_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_INPUT_H
+
+#include <stddef.h>
+#include "common/elem_t.h"
+#include "common/input.h"
+#include "enclave/extmem.h"
+
+int input_set_key(const unsigned char *key, size_t key_len);
+int input_begin(elem_t *arr, size_t local_start, size_t local_length,
+        size_t total_length, const struct input_header *header);
+
+/* Like input_begin, but appends this rank's elements to STORE, whose blocks
+ * each hold a page of elements, instead of writing them to an array, which
+ * requires the chunks to be ingested in order. */
+int input_begin_extmem(struct extmem_store *store, size_t local_start,
+        size_t local_length, size_t total_length,
+        const struct input_header *header);
+
+int input_ingest_chunk(const unsigned char *chunk, size_t chunk_len);
+int input_end(void);
+
+#endif /* distributed-sgx-sort/enclave/input.h */
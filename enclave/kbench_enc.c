@@ -0,0 +1,472 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liboblivious/primitives.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/kbench.h"
+#include "common/sort_params.h"
+#include "common/sort_type.h"
+#include "common/util.h"
+#include "enclave/bucket.h"
+#include "enclave/crypto.h"
+#include "enclave/distsort.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/parallel_enc.h"
+#include "enclave/qsort.h"
+#include "enclave/span.h"
+#include "enclave/threading.h"
+#include "enclave/window.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include "enclave/kbench_t.h"
+#endif
+
+/* Times the sort engines' hot kernels one at a time, outside of any sort, so
+ * that a change to one of them shows up on its own rather than as noise in a
+ * whole sort. Each kernel runs enough operations to take KBENCH_MIN_NS, and
+ * then that many operations KBENCH_RUNS times, reporting the median. */
+
+#define KBENCH_MIN_NS 50000000
+#define KBENCH_RUNS 5
+
+/* The round trips are timed for a fixed count, since both ranks must run the
+ * same number. */
+#define KBENCH_ROUND_TRIPS 1000
+
+/* The elements qsort_glibc sorts per operation. */
+#define KBENCH_QSORT_LENGTH 4096
+
+#define KBENCH_MAX_BYTES 65536
+
+static distsort_ctx_t *sort_ctx;
+
+/* Scratch for the kernels, and a copy of the random keys that qsort_glibc
+ * restores each operation. */
+static elem_t *elems;
+static elem_t *qsort_keys;
+static unsigned char *bytes;
+static unsigned char *other_bytes;
+
+/* Runs ITERS operations of a kernel with PARAM. */
+typedef int (*kbench_func_t)(size_t param, size_t iters);
+
+struct kbench_kernel {
+    const char *name;
+    kbench_func_t func;
+    size_t param;
+
+    /* Whether the kernel exchanges messages with another rank, in which case
+     * only ranks 0 and 1 run it, for KBENCH_ROUND_TRIPS operations. */
+    bool remote;
+};
+
+static int bench_memswap(size_t size, size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        o_memswap(bytes, other_bytes, size, i & 1);
+    }
+    return 0;
+}
+
+static int bench_merge_split(size_t param UNUSED, size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        bucket_merge_split_pair(elems, elems + BUCKET_SIZE, i % 32);
+    }
+    return 0;
+}
+
+static int bench_bucket_permute(size_t param UNUSED, size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        bucket_permute(elems);
+    }
+    return 0;
+}
+
+static int bench_rand_read(size_t size, size_t iters) {
+    int ret;
+
+    for (size_t i = 0; i < iters; i++) {
+        ret = rand_read(bytes, size);
+        if (ret) {
+            handle_error_string("Error reading random bytes");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static int bench_rand_bit(size_t param UNUSED, size_t iters) {
+    int ret;
+
+    for (size_t i = 0; i < iters; i++) {
+        bool bit;
+        ret = rand_bit(&bit);
+        if (ret) {
+            handle_error_string("Error reading random bit");
+            goto exit;
+        }
+        bytes[i % KBENCH_MAX_BYTES] = bit;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static const unsigned char bench_key[KEY_LEN];
+static const unsigned char bench_iv[IV_LEN];
+
+static int bench_aad_encrypt(size_t size, size_t iters) {
+    unsigned char tag[TAG_LEN];
+    int ret;
+
+    for (size_t i = 0; i < iters; i++) {
+        ret =
+            aad_encrypt(bench_key, bytes, size, &i, sizeof(i), bench_iv,
+                    other_bytes, tag);
+        if (ret) {
+            handle_error_string("Error encrypting");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static int bench_aad_decrypt(size_t size, size_t iters) {
+    unsigned char tag[TAG_LEN];
+    size_t aad = 0;
+    int ret;
+
+    ret =
+        aad_encrypt(bench_key, bytes, size, &aad, sizeof(aad), bench_iv,
+                other_bytes, tag);
+    if (ret) {
+        handle_error_string("Error encrypting");
+        goto exit;
+    }
+
+    for (size_t i = 0; i < iters; i++) {
+        ret =
+            aad_decrypt(bench_key, other_bytes, size, &aad, sizeof(aad),
+                    bench_iv, tag, bytes);
+        if (ret) {
+            handle_error_string("Error decrypting");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static int bench_window_add(size_t param UNUSED, size_t iters) {
+    window_t window;
+    int ret;
+
+    ret = window_init(&window);
+    if (ret) {
+        handle_error_string("Error initializing window");
+        goto exit;
+    }
+
+    for (size_t i = 0; i < iters; i++) {
+        bool was_set;
+        ret = window_add(&window, i, &was_set);
+        if (ret) {
+            handle_error_string("Error adding to window");
+            goto exit_free_window;
+        }
+    }
+
+exit_free_window:
+    window_free(&window);
+exit:
+    return ret;
+}
+
+static int compare_keys(const void *a_, const void *b_, void *arg UNUSED) {
+    const elem_t *a = a_;
+    const elem_t *b = b_;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+/* Each operation restores the random keys before sorting them, so the copy is
+ * part of the time. */
+static int bench_qsort(size_t length, size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        memcpy(elems, qsort_keys, length * sizeof(*elems));
+        qsort_glibc(elems, length, sizeof(*elems), compare_keys, NULL);
+    }
+    return 0;
+}
+
+static void noop_task(void *arg UNUSED, size_t i UNUSED) {}
+
+/* Each operation pushes one task per pool thread and waits for all of
+ * them. */
+static int bench_thread_push(size_t param UNUSED, size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        struct thread_work work = {
+            .type = THREAD_WORK_ITER,
+            .iter = {
+                .func = noop_task,
+                .count = total_num_threads,
+            },
+        };
+        thread_work_push(&work);
+        thread_work_until_empty();
+        thread_wait(&work);
+    }
+    return 0;
+}
+
+static int bench_mpi_tls_round_trip(size_t size, size_t iters) {
+    int peer = !world_rank;
+    int ret;
+
+    for (size_t i = 0; i < iters; i++) {
+        if (world_rank == 0) {
+            ret = mpi_tls_send_bytes(bytes, size, peer, KBENCH_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending to %d", peer);
+                goto exit;
+            }
+        }
+        ret =
+            mpi_tls_recv_bytes(bytes, size, peer, KBENCH_MPI_TAG,
+                    MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error receiving from %d", peer);
+            goto exit;
+        }
+        if (world_rank == 1) {
+            ret = mpi_tls_send_bytes(bytes, size, peer, KBENCH_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending to %d", peer);
+                goto exit;
+            }
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static const struct kbench_kernel kernels[] = {
+    { "o_memswap/8", bench_memswap, 8, false },
+    { "o_memswap/16", bench_memswap, 16, false },
+    { "o_memswap/32", bench_memswap, 32, false },
+    { "o_memswap/64", bench_memswap, 64, false },
+    { "o_memswap/128", bench_memswap, 128, false },
+    { "o_memswap/256", bench_memswap, 256, false },
+    { "merge_split_pair", bench_merge_split, 0, false },
+    { "bucket_permute", bench_bucket_permute, 0, false },
+    { "rand_read/8", bench_rand_read, 8, false },
+    { "rand_read/4096", bench_rand_read, 4096, false },
+    { "rand_bit", bench_rand_bit, 0, false },
+    { "aad_encrypt/128", bench_aad_encrypt, 128, false },
+    { "aad_encrypt/4096", bench_aad_encrypt, 4096, false },
+    { "aad_encrypt/65536", bench_aad_encrypt, 65536, false },
+    { "aad_decrypt/128", bench_aad_decrypt, 128, false },
+    { "aad_decrypt/4096", bench_aad_decrypt, 4096, false },
+    { "aad_decrypt/65536", bench_aad_decrypt, 65536, false },
+    { "window_add", bench_window_add, 0, false },
+    { "qsort_glibc/4096", bench_qsort, KBENCH_QSORT_LENGTH, false },
+    { "thread_push", bench_thread_push, 0, false },
+    { "mpi_tls_round_trip/8", bench_mpi_tls_round_trip, 8, true },
+    { "mpi_tls_round_trip/4096", bench_mpi_tls_round_trip, 4096, true },
+};
+
+static int compare_doubles(const void *a_, const void *b_, void *arg UNUSED) {
+    const double *a = a_;
+    const double *b = b_;
+    return (*a > *b) - (*a < *b);
+}
+
+/* Times KERNEL into RESULT. */
+static int run_kernel(const struct kbench_kernel *kernel,
+        struct kbench_result *result) {
+    int ret;
+
+    /* Double the operations until they take long enough to time. */
+    size_t iters = KBENCH_ROUND_TRIPS;
+    if (!kernel->remote) {
+        iters = 1;
+        while (1) {
+            uint64_t start = span_time_ns();
+            ret = kernel->func(kernel->param, iters);
+            if (ret) {
+                goto exit;
+            }
+            if (span_time_ns() - start >= KBENCH_MIN_NS) {
+                break;
+            }
+            iters *= 2;
+        }
+    }
+
+    double ns_per_op[KBENCH_RUNS];
+    for (size_t i = 0; i < KBENCH_RUNS; i++) {
+        uint64_t start = span_time_ns();
+        ret = kernel->func(kernel->param, iters);
+        if (ret) {
+            goto exit;
+        }
+        ns_per_op[i] = (double) (span_time_ns() - start) / iters;
+    }
+    qsort_glibc(ns_per_op, KBENCH_RUNS, sizeof(*ns_per_op), compare_doubles,
+            NULL);
+
+    strncpy(result->name, kernel->name, sizeof(result->name) - 1);
+    result->name[sizeof(result->name) - 1] = '\0';
+    result->iters = iters;
+    result->ns_per_op = ns_per_op[KBENCH_RUNS / 2];
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int ecall_kbench_init(int world_rank_, int world_size_, size_t num_threads) {
+    int ret;
+
+    ret = distsort_init(&sort_ctx, world_rank_, world_size_, num_threads, 0,
+            NULL, false);
+    if (ret) {
+        goto exit;
+    }
+
+    size_t num_elems = MAX(BUCKET_SIZE * 2, KBENCH_QSORT_LENGTH);
+    elems = calloc(num_elems, sizeof(*elems));
+    if (!elems) {
+        perror("malloc kbench elems");
+        ret = -1;
+        goto exit_free_ctx;
+    }
+    qsort_keys = malloc(KBENCH_QSORT_LENGTH * sizeof(*qsort_keys));
+    if (!qsort_keys) {
+        perror("malloc kbench keys");
+        ret = -1;
+        goto exit_free_elems;
+    }
+    bytes = calloc(KBENCH_MAX_BYTES, 1);
+    if (!bytes) {
+        perror("malloc kbench bytes");
+        ret = -1;
+        goto exit_free_qsort_keys;
+    }
+    other_bytes = calloc(KBENCH_MAX_BYTES, 1);
+    if (!other_bytes) {
+        perror("malloc kbench bytes");
+        ret = -1;
+        goto exit_free_bytes;
+    }
+
+    /* Fill the buckets half with dummies, as merge-split sees them, and draw
+     * random keys for the sorts. */
+    for (size_t i = 0; i < num_elems; i++) {
+        ret = rand_read(&elems[i].orp_id, sizeof(elems[i].orp_id));
+        if (ret) {
+            handle_error_string("Error generating ORP IDs");
+            goto exit_free_other_bytes;
+        }
+        elems[i].is_dummy = i % 2;
+    }
+    for (size_t i = 0; i < KBENCH_QSORT_LENGTH; i++) {
+        ret = rand_read(&qsort_keys[i].key, sizeof(qsort_keys[i].key));
+        if (ret) {
+            handle_error_string("Error generating keys");
+            goto exit_free_other_bytes;
+        }
+    }
+
+    return 0;
+
+exit_free_other_bytes:
+    free(other_bytes);
+exit_free_bytes:
+    free(bytes);
+exit_free_qsort_keys:
+    free(qsort_keys);
+exit_free_elems:
+    free(elems);
+exit_free_ctx:
+    distsort_free(sort_ctx);
+    sort_ctx = NULL;
+exit:
+    return ret;
+}
+
+void ecall_kbench_free(void) {
+    free(other_bytes);
+    free(bytes);
+    free(qsort_keys);
+    free(elems);
+    distsort_free(sort_ctx);
+    sort_ctx = NULL;
+}
+
+void ecall_kbench_start_work(void) {
+    distsort_start_work(sort_ctx);
+}
+
+size_t ecall_kbench_get_num_threads_started(void) {
+    return distsort_get_num_threads_started(sort_ctx);
+}
+
+void ecall_kbench_release_threads(void) {
+    distsort_release_threads(sort_ctx);
+}
+
+int ecall_kbench_run(struct kbench_result *results, size_t capacity,
+        size_t *num_results) {
+    int ret;
+
+    /* Let the pool threads take work for the threading kernel. */
+    ret = distsort_prepare(sort_ctx, SORT_BITONIC);
+    if (ret) {
+        goto exit;
+    }
+
+    *num_results = 0;
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(*kernels); i++) {
+        if (kernels[i].remote && (world_size < 2 || world_rank > 1)) {
+            continue;
+        }
+        if (*num_results >= capacity) {
+            handle_error_string("Too many kernel results");
+            ret = -1;
+            goto exit;
+        }
+
+        ret = run_kernel(&kernels[i], &results[*num_results]);
+        if (ret) {
+            handle_error_string("Error running %s", kernels[i].name);
+            goto exit;
+        }
+        (*num_results)++;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
@@ -0,0 +1,179 @@
+#include "enclave/mem.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/defs.h"
+#include "common/mem.h"
+#include "enclave/span.h"
+#include "enclave/synch.h"
+#include "enclave/threading.h"
+
+/* Written just before each tracked allocation. Its size keeps the allocation
+ * aligned as malloc would. */
+struct mem_header {
+    uint32_t site;
+
+    /* The distance from the start of the underlying allocation to the memory
+     * handed out. */
+    uint32_t offset;
+
+    size_t size;
+};
+
+static size_t site_bytes[MEM_NUM_SITES];
+static size_t site_peak_bytes[MEM_NUM_SITES];
+static size_t total_bytes;
+
+static struct mem_phase_stats phases[MEM_MAX_PHASES];
+static size_t num_phases;
+static spinlock_t phases_lock;
+
+static void update_max(size_t *max, size_t value) {
+    size_t curr = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > curr
+            && !__atomic_compare_exchange_n(max, &curr, value, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/* Returns the entry for the current phase of the calling thread's job, adding
+ * it if needed. */
+static struct mem_phase_stats *get_phase(void) {
+    const char *name = current_job ? span_name(current_job->span) : "";
+
+    size_t len = __atomic_load_n(&num_phases, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < len; i++) {
+        if (!strncmp(phases[i].phase, name, sizeof(phases[i].phase))) {
+            return &phases[i];
+        }
+    }
+
+    struct mem_phase_stats *phase = &phases[MEM_MAX_PHASES - 1];
+    spinlock_lock(&phases_lock);
+    for (size_t i = len; i < num_phases; i++) {
+        if (!strncmp(phases[i].phase, name, sizeof(phases[i].phase))) {
+            phase = &phases[i];
+            goto exit_unlock;
+        }
+    }
+    if (num_phases < MEM_MAX_PHASES) {
+        phase = &phases[num_phases];
+        memset(phase, '\0', sizeof(*phase));
+        strncpy(phase->phase, name, sizeof(phase->phase) - 1);
+        __atomic_store_n(&num_phases, num_phases + 1, __ATOMIC_RELEASE);
+    }
+exit_unlock:
+    spinlock_unlock(&phases_lock);
+    return phase;
+}
+
+static void count_alloc(enum mem_site site, size_t size) {
+    size_t site_total =
+        __atomic_add_fetch(&site_bytes[site], size, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&total_bytes, size, __ATOMIC_RELAXED);
+    update_max(&site_peak_bytes[site], site_total);
+
+    struct mem_phase_stats *phase = get_phase();
+    update_max(&phase->peak_bytes, total);
+    update_max(&phase->site_peak_bytes[site], site_total);
+}
+
+static void count_free(enum mem_site site, size_t size) {
+    __atomic_sub_fetch(&site_bytes[site], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&total_bytes, size, __ATOMIC_RELAXED);
+}
+
+/* Fills in the header before PTR and counts the allocation. */
+static void *track(enum mem_site site, unsigned char *ptr, size_t offset,
+        size_t size) {
+    struct mem_header *header = (struct mem_header *) ptr - 1;
+    header->site = site;
+    header->offset = offset;
+    header->size = size;
+    count_alloc(site, size);
+    return ptr;
+}
+
+void *mem_alloc(enum mem_site site, size_t size) {
+    unsigned char *raw = malloc(sizeof(struct mem_header) + size);
+    if (!raw) {
+        return NULL;
+    }
+    return track(site, raw + sizeof(struct mem_header),
+            sizeof(struct mem_header), size);
+}
+
+void *mem_calloc(enum mem_site site, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = mem_alloc(site, count * size);
+    if (ptr) {
+        memset(ptr, '\0', count * size);
+    }
+    return ptr;
+}
+
+void *mem_realloc(enum mem_site site, void *ptr, size_t size) {
+    if (!ptr) {
+        return mem_alloc(site, size);
+    }
+
+    /* Only memory from mem_alloc and mem_calloc starts right before its
+     * header, which realloc needs. */
+    struct mem_header *header = (struct mem_header *) ptr - 1;
+    enum mem_site old_site = header->site;
+    size_t old_size = header->size;
+    unsigned char *raw =
+        realloc(header, sizeof(struct mem_header) + size);
+    if (!raw) {
+        return NULL;
+    }
+    count_free(old_site, old_size);
+    return track(site, raw + sizeof(struct mem_header),
+            sizeof(struct mem_header), size);
+}
+
+void *mem_aligned_alloc(enum mem_site site, size_t alignment, size_t size) {
+    size_t offset = MAX(alignment, sizeof(struct mem_header));
+    size_t raw_size = (offset + size + alignment - 1) / alignment * alignment;
+    unsigned char *raw = aligned_alloc(alignment, raw_size);
+    if (!raw) {
+        return NULL;
+    }
+    return track(site, raw + offset, offset, size);
+}
+
+void mem_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    struct mem_header *header = (struct mem_header *) ptr - 1;
+    count_free(header->site, header->size);
+    free((unsigned char *) ptr - header->offset);
+}
+
+void mem_get_sites(size_t *site_bytes_, size_t *site_peak_bytes_) {
+    for (size_t i = 0; i < MEM_NUM_SITES; i++) {
+        site_bytes_[i] = __atomic_load_n(&site_bytes[i], __ATOMIC_RELAXED);
+        site_peak_bytes_[i] =
+            __atomic_load_n(&site_peak_bytes[i], __ATOMIC_RELAXED);
+    }
+}
+
+size_t mem_get_phases(struct mem_phase_stats *phases_, size_t capacity) {
+    size_t count =
+        MIN(__atomic_load_n(&num_phases, __ATOMIC_ACQUIRE), capacity);
+    if (count) {
+        memcpy(phases_, phases, count * sizeof(*phases_));
+    }
+    return count;
+}
+
+void mem_reset_peaks(void) {
+    for (size_t i = 0; i < MEM_NUM_SITES; i++) {
+        site_peak_bytes[i] = site_bytes[i];
+    }
+    num_phases = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_MEM_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_MEM_H
+
+#include <stddef.h>
+#include "common/mem.h"
+
+/* Tracked allocation. These wrap the C allocator, counting the bytes each
+ * site holds, their peak, and the peak during each phase of a job, so that
+ * the enclave heap can be sized from measurements rather than estimates.
+ * Memory from these must be freed with mem_free, and mem_free must only be
+ * given memory from these. */
+
+void *mem_alloc(enum mem_site site, size_t size);
+void *mem_calloc(enum mem_site site, size_t count, size_t size);
+void *mem_realloc(enum mem_site site, void *ptr, size_t size);
+
+/* Allocates SIZE bytes aligned to ALIGNMENT, a power of two. */
+void *mem_aligned_alloc(enum mem_site site, size_t alignment, size_t size);
+
+void mem_free(void *ptr);
+
+/* Writes the bytes each site holds and the most each has held since the last
+ * reset to SITE_BYTES and SITE_PEAK_BYTES, which have room for MEM_NUM_SITES
+ * each. */
+void mem_get_sites(size_t *site_bytes, size_t *site_peak_bytes);
+
+/* Copies up to CAPACITY of the phases' peaks since the last reset into PHASES,
+ * in the order the phases first allocated, and returns the number copied. */
+size_t mem_get_phases(struct mem_phase_stats *phases, size_t capacity);
+
+/* Starts the peaks over from the bytes held now. No job may be running. */
+void mem_reset_peaks(void);
+
+#endif /* distributed-sgx-sort/enclave/mem.h */
@@ -0,0 +1,285 @@
+#include "enclave/merge.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/mem.h"
+#include "common/util.h"
+#include "enclave/bitonic.h"
+#include "enclave/mem.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/parallel_enc.h"
+#include "enclave/params.h"
+#include "enclave/span.h"
+#include "enclave/threading.h"
+
+/* Merges a sorted batch into a sorted array, both spread across the ranks,
+ * with one distributed bitonic merge. The array and the batch are each padded
+ * to the same power of two with elements larger than any key and laid out as
+ * the two halves of one sequence, whose crossover merge leaves the real
+ * elements first. Elements move between ranks on a schedule that depends only
+ * on the lengths, and the merge network's comparisons are fixed, so the merge
+ * reveals only the lengths. */
+
+#define CHUNK_SIZE (sort_params.bitonic_chunk_size)
+
+static size_t get_local_start(int rank, size_t length) {
+    return (rank * length + world_size - 1) / world_size;
+}
+
+/* Returns the index of the first source element at or after destination index
+ * IDX when the source starts at destination index OFFSET. */
+static size_t dest_to_source(size_t idx, size_t offset) {
+    return idx > offset ? idx - offset : 0;
+}
+
+/* Moves the first COUNT elements of the sequence of SRC_LENGTH elements spread
+ * across the ranks, of which this rank holds SRC, to start at index OFFSET of
+ * the sequence of DST_LENGTH elements, of which this rank holds DST. */
+static int redistribute(const elem_t *src, size_t src_length, size_t count,
+        elem_t *dst, size_t dst_length, size_t offset) {
+    size_t src_start = get_local_start(world_rank, src_length);
+    size_t src_end = MIN(get_local_start(world_rank + 1, src_length), count);
+    size_t dst_start = get_local_start(world_rank, dst_length);
+    size_t dst_end = get_local_start(world_rank + 1, dst_length);
+    size_t send_idxs[world_size];
+    size_t send_ends[world_size];
+    size_t recv_idxs[world_size];
+    size_t recv_ends[world_size];
+    mpi_tls_request_t requests[world_size * 2];
+    size_t num_requests = 0;
+    int ret;
+
+    /* Find the source indices this rank sends to and receives from each rank.
+     * Each is a single range, since both sequences are laid out in rank
+     * order. */
+    for (int rank = 0; rank < world_size; rank++) {
+        send_idxs[rank] =
+            MAX(src_start,
+                    dest_to_source(get_local_start(rank, dst_length), offset));
+        send_ends[rank] =
+            MIN(src_end,
+                    dest_to_source(get_local_start(rank + 1, dst_length),
+                        offset));
+        send_ends[rank] = MAX(send_ends[rank], send_idxs[rank]);
+
+        recv_idxs[rank] =
+            MAX(get_local_start(rank, src_length),
+                    dest_to_source(dst_start, offset));
+        recv_ends[rank] =
+            MIN(MIN(get_local_start(rank + 1, src_length), count),
+                    dest_to_source(dst_end, offset));
+        recv_ends[rank] = MAX(recv_ends[rank], recv_idxs[rank]);
+    }
+
+    /* Copy our own elements. */
+    memcpy(dst + offset + send_idxs[world_rank] - dst_start,
+            src + send_idxs[world_rank] - src_start,
+            (send_ends[world_rank] - send_idxs[world_rank]) * sizeof(*dst));
+
+    /* Post the first chunk to and from each other rank. Send requests are at
+     * even indices and receive requests at odd indices. */
+    for (int rank = 0; rank < world_size; rank++) {
+        mpi_tls_request_t *send_request = &requests[rank * 2];
+        mpi_tls_request_t *recv_request = &requests[rank * 2 + 1];
+        send_request->type = MPI_TLS_NULL;
+        recv_request->type = MPI_TLS_NULL;
+        if (rank == world_rank) {
+            continue;
+        }
+
+        if (send_idxs[rank] < send_ends[rank]) {
+            size_t elems_to_send =
+                MIN(send_ends[rank] - send_idxs[rank], CHUNK_SIZE);
+            ret =
+                mpi_tls_isend_bytes(src + send_idxs[rank] - src_start,
+                        elems_to_send * sizeof(*src), rank,
+                        MERGE_REDISTRIBUTE_MPI_TAG, send_request);
+            if (ret) {
+                handle_error_string("Error posting send from %d to %d",
+                        world_rank, rank);
+                goto exit;
+            }
+            send_idxs[rank] += elems_to_send;
+            num_requests++;
+        }
+
+        if (recv_idxs[rank] < recv_ends[rank]) {
+            size_t elems_to_recv =
+                MIN(recv_ends[rank] - recv_idxs[rank], CHUNK_SIZE);
+            ret =
+                mpi_tls_irecv_bytes(dst + offset + recv_idxs[rank] - dst_start,
+                        elems_to_recv * sizeof(*dst), rank,
+                        MERGE_REDISTRIBUTE_MPI_TAG, recv_request);
+            if (ret) {
+                handle_error_string("Error posting receive into %d from %d",
+                        world_rank, rank);
+                goto exit;
+            }
+            recv_idxs[rank] += elems_to_recv;
+            num_requests++;
+        }
+    }
+
+    /* Post each rank's next chunk as its last one completes. */
+    while (num_requests) {
+        size_t index;
+        ret =
+            mpi_tls_waitany(world_size * 2, requests, &index,
+                    MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error waiting on requests");
+            goto exit;
+        }
+        int rank = index / 2;
+
+        if (index % 2 == 0) {
+            if (send_idxs[rank] < send_ends[rank]) {
+                size_t elems_to_send =
+                    MIN(send_ends[rank] - send_idxs[rank], CHUNK_SIZE);
+                ret =
+                    mpi_tls_isend_bytes(src + send_idxs[rank] - src_start,
+                            elems_to_send * sizeof(*src), rank,
+                            MERGE_REDISTRIBUTE_MPI_TAG, &requests[index]);
+                if (ret) {
+                    handle_error_string("Error posting send from %d to %d",
+                            world_rank, rank);
+                    goto exit;
+                }
+                send_idxs[rank] += elems_to_send;
+            } else {
+                requests[index].type = MPI_TLS_NULL;
+                num_requests--;
+            }
+        } else {
+            if (recv_idxs[rank] < recv_ends[rank]) {
+                size_t elems_to_recv =
+                    MIN(recv_ends[rank] - recv_idxs[rank], CHUNK_SIZE);
+                ret =
+                    mpi_tls_irecv_bytes(
+                            dst + offset + recv_idxs[rank] - dst_start,
+                            elems_to_recv * sizeof(*dst), rank,
+                            MERGE_REDISTRIBUTE_MPI_TAG, &requests[index]);
+                if (ret) {
+                    handle_error_string(
+                            "Error posting receive into %d from %d",
+                            world_rank, rank);
+                    goto exit;
+                }
+                recv_idxs[rank] += elems_to_recv;
+            } else {
+                requests[index].type = MPI_TLS_NULL;
+                num_requests--;
+            }
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Fills this rank's part of the range [START, END) of the sequence of LENGTH
+ * elements, of which this rank holds ARR, with padding. */
+static void pad(elem_t *arr, size_t length, size_t start, size_t end) {
+    size_t local_start = get_local_start(world_rank, length);
+    size_t local_end = get_local_start(world_rank + 1, length);
+
+    for (size_t i = MAX(start, local_start); i < MIN(end, local_end); i++) {
+        memset(&arr[i - local_start], '\0', sizeof(arr[i - local_start]));
+        arr[i - local_start].key = UINT64_MAX;
+        arr[i - local_start].is_dummy = true;
+    }
+}
+
+/* Merges the BATCH_LENGTH sorted elements in BATCH into the LENGTH sorted
+ * elements in ARR, leaving this rank's share of all of them in ARR, which
+ * must have room for it. */
+int merge_sorted(elem_t *arr, size_t length, const elem_t *batch,
+        size_t batch_length, size_t num_threads) {
+    int ret;
+
+    if (next_pow2ll(world_size) != (size_t) world_size) {
+        handle_error_string("Merging requires a power-of-two number of ranks");
+        ret = -1;
+        goto exit;
+    }
+
+    /* Each half holds at least one element on every rank, so that both
+     * lengths are powers of two split evenly across the ranks. */
+    size_t half_length =
+        MAX(next_pow2ll(MAX(length, batch_length)), (size_t) world_size);
+    size_t merge_length = half_length * 2;
+    elem_t *buf =
+        mem_alloc(MEM_SCRATCH, merge_length / world_size * sizeof(*buf));
+    if (!buf) {
+        perror("malloc merge buffer");
+        ret = -1;
+        goto exit;
+    }
+
+    span_t span_merge = span_begin("merge_sorted");
+    span_t span = span_begin("layout");
+
+    /* Lay out the padded array and batch as the two halves. */
+    ret = redistribute(arr, length, length, buf, merge_length, 0);
+    if (ret) {
+        handle_error_string("Error moving array to merge");
+        goto exit_free_buf;
+    }
+    ret =
+        redistribute(batch, batch_length, batch_length, buf, merge_length,
+                half_length);
+    if (ret) {
+        handle_error_string("Error moving batch to merge");
+        goto exit_free_buf;
+    }
+    pad(buf, merge_length, length, half_length);
+    pad(buf, merge_length, half_length + batch_length, merge_length);
+
+    span_end(span);
+    span = span_begin("bitonic_merge");
+
+    /* Merge. The bitonic merge reads the layout from the job's length. */
+    size_t job_length = current_job->total_length;
+    ret = bitonic_init();
+    if (ret) {
+        handle_error_string("Error initializing merge");
+        goto exit_free_buf;
+    }
+    current_job->total_length = merge_length;
+    ret = bitonic_merge(buf, merge_length, num_threads);
+    current_job->total_length = job_length;
+    bitonic_free();
+    if (ret) {
+        handle_error_string("Error in bitonic merge");
+        goto exit_free_buf;
+    }
+
+    span_end(span);
+    span = span_begin("balance");
+
+    /* Drop the padding, which sorted to the end, and spread the rest evenly
+     * across the ranks. */
+    ret =
+        redistribute(buf, merge_length, length + batch_length, arr,
+                length + batch_length, 0);
+    if (ret) {
+        handle_error_string("Error moving merged array");
+        goto exit_free_buf;
+    }
+
+    span_end(span);
+    span_end(span_merge);
+
+exit_free_buf:
+    mem_free(buf);
+exit:
+    return ret;
+}
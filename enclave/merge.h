@@ -0,0 +1,10 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_MERGE_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_MERGE_H
+
+#include <stddef.h>
+#include "common/elem_t.h"
+
+int merge_sorted(elem_t *arr, size_t length, const elem_t *batch,
+        size_t batch_length, size_t num_threads);
+
+#endif /* distributed-sgx-sort/enclave/merge.h */
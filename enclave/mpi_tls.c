@@ -14,10 +14,15 @@
 #include <mbedtls/ssl.h>
 #include "common/defs.h"
 #include "common/error.h"
+#include "common/mem.h"
 #include "common/ocalls.h"
+#include "common/trace.h"
 #include "common/util.h"
 #include "enclave/crypto.h"
+#include "enclave/mem.h"
 #include "enclave/synch.h"
+#include "enclave/threading.h"
+#include "enclave/trace.h"
 #include "enclave/window.h"
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
@@ -27,6 +32,13 @@
 #include "enclave/parallel_t.h"
 #endif /* DISTRUBTED_SGX_SORT_HOSTONLY */
 
+/* Plaintext messages leave the data between ranks unprotected, so they are
+ * only for host-only baselines that measure what the encryption costs. */
+#if defined(DISTRIBUTED_SGX_SORT_PLAINTEXT) \
+    && !defined(DISTRIBUTED_SGX_SORT_HOSTONLY)
+#error "DISTRIBUTED_SGX_SORT_PLAINTEXT requires DISTRIBUTED_SGX_SORT_HOSTONLY"
+#endif /* DISTRIBUTED_SGX_SORT_PLAINTEXT && !DISTRIBUTED_SGX_SORT_HOSTONLY */
+
 /* Include simulation cert and key data if compiling in simulation mode or
  * hostonly mode. */
 #if defined(OE_SIMULATION) || defined(OE_SIMULATION_CERT) || defined(DISTRIBUTED_SGX_SORT_HOSTONLY)
@@ -80,6 +92,11 @@ static int ciphersuites[] = {
 
 /* Bandwidth measurement. */
 size_t mpi_tls_bytes_sent;
+size_t mpi_tls_messages_sent;
+
+/* The split of the MPI tags between jobs. */
+int mpi_tls_job_tag_stride = MPI_TLS_MAX_JOB_TAG_STRIDE;
+size_t mpi_tls_max_jobs = 1;
 
 #if !defined(OE_SIMULATION) && !defined(OE_SIMULATION_CERT) && !defined(DISTRIBUTED_SGX_SORT_HOSTONLY)
 static int verify_callback(void *data UNUSED, mbedtls_x509_crt *crt UNUSED,
@@ -124,6 +141,7 @@ static int send_callback(void *hs_session_, const unsigned char *buf,
     }
 
     __atomic_add_fetch(&mpi_tls_bytes_sent, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mpi_tls_messages_sent, 1, __ATOMIC_RELAXED);
 
     ret = len;
 
@@ -296,7 +314,8 @@ static int init_handshake_session(struct mpi_tls_handshake_session *hs_session,
         goto exit_free_ssl;
     }
     hs_session->recv_buf_cap = max_payload_len + ret;
-    hs_session->recv_buf = malloc(hs_session->recv_buf_cap);
+    hs_session->recv_buf =
+        mem_alloc(MEM_MPI_SESSIONS, hs_session->recv_buf_cap);
     if (!hs_session->recv_buf) {
         perror("malloc hs_session->recv_buf");
         ret = -1;
@@ -320,7 +339,7 @@ static void free_handshake_session(struct mpi_tls_handshake_session *session) {
     mbedtls_ctr_drbg_free(&session->drbg);
     mbedtls_ssl_free(&session->ssl);
     mbedtls_ssl_config_free(&session->conf);
-    free(session->recv_buf);
+    mem_free(session->recv_buf);
 }
 
 static int load_certificate_and_key(mbedtls_x509_crt *cert,
@@ -401,6 +420,43 @@ exit:
     return ret;
 }
 
+/* Splits the tags up to the MPI implementation's MPI_TAG_UB between jobs,
+ * giving each job the largest power of two up to MPI_TLS_MAX_JOB_TAG_STRIDE
+ * that fits. */
+static int init_job_tags(void) {
+    int tag_ub;
+    int ret;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_mpi_tag_ub(&tag_ub);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_mpi_tag_ub");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    tag_ub = ocall_mpi_tag_ub();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    /* MPI guarantees tags up to 32767, which also leaves room for the fixed
+     * tags. */
+    if (tag_ub < 32767) {
+        handle_error_string("MPI_TAG_UB of %d is below 32767", tag_ub);
+        ret = -1;
+        goto exit;
+    }
+
+    size_t num_tags = (size_t) tag_ub + 1;
+    mpi_tls_job_tag_stride =
+        MIN(1lu << log2ll(num_tags), (size_t) MPI_TLS_MAX_JOB_TAG_STRIDE);
+    mpi_tls_max_jobs = num_tags / mpi_tls_job_tag_stride;
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
 int mpi_tls_init(size_t world_rank_, size_t world_size_,
         mbedtls_entropy_context *entropy) {
     int ret;
@@ -408,6 +464,11 @@ int mpi_tls_init(size_t world_rank_, size_t world_size_,
     world_rank = world_rank_;
     world_size = world_size_;
 
+    ret = init_job_tags();
+    if (ret) {
+        goto exit;
+    }
+
     /* Load certificate and private key. */
     mbedtls_x509_crt_init(&cert);
     mbedtls_pk_init(&privkey);
@@ -418,7 +479,7 @@ int mpi_tls_init(size_t world_rank_, size_t world_size_,
     }
 
     /* Initialize sessions. */
-    sessions = malloc(world_size * sizeof(*sessions));
+    sessions = mem_alloc(MEM_MPI_SESSIONS, world_size * sizeof(*sessions));
     if (!sessions) {
         perror("malloc encrypted MPI sessions");
         ret = -1;
@@ -443,8 +504,8 @@ int mpi_tls_init(size_t world_rank_, size_t world_size_,
 
     /* Initialize TLS handshake sessions. */
     struct mpi_tls_handshake_session *handshake_sessions =
-        malloc(world_size * sizeof(*handshake_sessions));
-    if (!sessions) {
+        mem_alloc(MEM_MPI_SESSIONS, world_size * sizeof(*handshake_sessions));
+    if (!handshake_sessions) {
         perror("malloc TLS handshake sessions");
         ret = -1;
         goto exit_free_sessions;
@@ -464,7 +525,7 @@ int mpi_tls_init(size_t world_rank_, size_t world_size_,
             for (int j = 0; j < i; j++) {
                 free_handshake_session(&handshake_sessions[j]);
             }
-            free(sessions);
+            mem_free(handshake_sessions);
             goto exit_free_sessions;
         }
     }
@@ -503,7 +564,7 @@ exit_free_handshake_sessions:
         }
         free_handshake_session(&handshake_sessions[i]);
     }
-    free(handshake_sessions);
+    mem_free(handshake_sessions);
 exit_free_sessions:
     if (ret) {
         /* Only free if function failed. */
@@ -513,7 +574,7 @@ exit_free_sessions:
             }
             window_free(&sessions[i].window);
         }
-        free(sessions);
+        mem_free(sessions);
     }
 exit_free_keys:
     mbedtls_x509_crt_free(&cert);
@@ -529,23 +590,55 @@ void mpi_tls_free(void) {
         }
         window_free(&sessions[i].window);
     }
-    free(sessions);
+    mem_free(sessions);
     mbedtls_x509_crt_free(&cert);
     mbedtls_pk_free(&privkey);
 }
 
-int mpi_tls_send_bytes(const void *buf, size_t count, int dest, int tag) {
-    struct mpi_tls_session *session = &sessions[dest];
-    int ret;
+/* Moves TAG into the tag namespace of the calling thread's job, storing the
+ * result in JOB_TAG. Fails if TAG would reach into the next job's tags. */
+static int get_job_tag(int tag, int *job_tag) {
+    if (tag < 0 || tag >= mpi_tls_job_tag_stride) {
+        handle_error_string("MPI tag %d is outside the job's %d tags", tag,
+                mpi_tls_job_tag_stride);
+        return -1;
+    }
+    *job_tag = current_job ? current_job->mpi_tag_base + tag : tag;
+    return 0;
+}
 
-    /* Allocate message. */
-    size_t msg_len = sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN + count;
-    struct mpi_tls_msg *msg = malloc(msg_len);
-    if (!msg) {
-        perror("malloc out_buf");
-        ret = -1;
-        goto exit;
+/* Records waiting from START_NS on REQUEST, which completed with STATUS. */
+static void trace_wait(enum trace_event_type type, uint64_t start_ns,
+        const mpi_tls_request_t *request, const mpi_tls_status_t *status) {
+    switch (request->type) {
+    case MPI_TLS_NULL:
+        trace_end(type, start_ns, -1, -1, 0);
+        break;
+    case MPI_TLS_SEND:
+        trace_end(type, start_ns, request->peer, request->tag,
+                request->count);
+        break;
+    case MPI_TLS_RECV:
+        trace_end(type, start_ns, status->source, status->tag, status->count);
+        break;
     }
+}
+
+/* The bytes each message adds to the data it carries: the counter, IV, and
+ * tag, or nothing for plaintext messages. */
+#ifndef DISTRIBUTED_SGX_SORT_PLAINTEXT
+#define MSG_OVERHEAD (sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN)
+#else /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+#define MSG_OVERHEAD 0
+#endif /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+
+/* Seals the COUNT bytes in BUF into MSG, which holds MSG_OVERHEAD + COUNT
+ * bytes, for sending over SESSION with TAG. */
+static int seal_msg(struct mpi_tls_session *session, int tag, const void *buf,
+        size_t count, struct mpi_tls_msg *msg) {
+#ifndef DISTRIBUTED_SGX_SORT_PLAINTEXT
+    int ret;
+
     uint64_t counter =
         __atomic_fetch_add(&session->counter, 1, __ATOMIC_RELAXED);
     msg->counter = htonll(counter);
@@ -554,7 +647,7 @@ int mpi_tls_send_bytes(const void *buf, size_t count, int dest, int tag) {
     ret = rand_read(msg->ciphertext, IV_LEN);
     if (ret) {
         handle_error_string("Error generating encrypted MPI IV");
-        goto exit_free_msg;
+        goto exit;
     }
 
     /* Encrypt. Tag goes in the TAG_LEN bytes after the IV. Ciphertext goes in
@@ -569,6 +662,93 @@ int mpi_tls_send_bytes(const void *buf, size_t count, int dest, int tag) {
                 msg->ciphertext + IV_LEN + TAG_LEN, msg->ciphertext + IV_LEN);
     if (ret) {
         handle_error_string("Error encrypting encrypted MPI data");
+        goto exit;
+    }
+
+exit:
+    return ret;
+#else /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+    (void) session;
+    (void) tag;
+    memcpy(msg, buf, count);
+    return 0;
+#endif /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+}
+
+/* Opens MSG, received with STATUS, into BUF, and replaces STATUS->count with
+ * the number of bytes it carried. */
+static int open_msg(struct mpi_tls_msg *msg, mpi_tls_status_t *status,
+        void *buf) {
+#ifndef DISTRIBUTED_SGX_SORT_PLAINTEXT
+    struct mpi_tls_session *session = &sessions[status->source];
+    int ret;
+
+    /* Decrypt. */
+    if ((size_t) status->count < MSG_OVERHEAD) {
+        handle_error_string(
+                "Received encrypted MPI data is shorter than IV + tag length");
+        ret = -1;
+        goto exit;
+    }
+    struct mpi_tls_auth_data auth_data = {
+        .tag = htonl(status->tag),
+        .counter = msg->counter,
+    };
+    ret =
+        aad_decrypt(session->recv_key, msg->ciphertext + IV_LEN + TAG_LEN,
+            status->count - MSG_OVERHEAD, &auth_data, sizeof(auth_data),
+            msg->ciphertext, msg->ciphertext + IV_LEN, buf);
+    if (ret) {
+        handle_error_string("Error decrypting encrypted MPI data");
+        goto exit;
+    }
+    status->count -= MSG_OVERHEAD;
+
+    /* Check counter uniqueness. */
+    spinlock_lock(&session->window_lock);
+    bool was_set;
+    uint64_t counter = ntohll(msg->counter);
+    ret = window_add(&session->window, counter, &was_set);
+    if (ret) {
+        handle_error_string("Error adding encrypted MPI counter to window");
+        goto exit_unlock;
+    }
+    if (was_set) {
+        handle_error_string("Duplicate counter: %" PRIu64, counter);
+        ret = -1;
+        goto exit_unlock;
+    }
+
+exit_unlock:
+    spinlock_unlock(&session->window_lock);
+exit:
+    return ret;
+#else /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+    memcpy(buf, msg, status->count);
+    return 0;
+#endif /* DISTRIBUTED_SGX_SORT_PLAINTEXT */
+}
+
+int mpi_tls_send_bytes(const void *buf, size_t count, int dest, int tag) {
+    struct mpi_tls_session *session = &sessions[dest];
+    uint64_t trace_start = trace_begin();
+    int ret;
+
+    ret = get_job_tag(tag, &tag);
+    if (ret) {
+        goto exit;
+    }
+
+    /* Allocate and seal message. */
+    size_t msg_len = MSG_OVERHEAD + count;
+    struct mpi_tls_msg *msg = mem_alloc(MEM_MPI_TLS, msg_len);
+    if (!msg) {
+        perror("malloc out_buf");
+        ret = -1;
+        goto exit;
+    }
+    ret = seal_msg(session, tag, buf, count, msg);
+    if (ret) {
         goto exit_free_msg;
     }
 
@@ -590,15 +770,18 @@ int mpi_tls_send_bytes(const void *buf, size_t count, int dest, int tag) {
     }
 
     __atomic_add_fetch(&mpi_tls_bytes_sent, msg_len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mpi_tls_messages_sent, 1, __ATOMIC_RELAXED);
+    trace_end(TRACE_SEND, trace_start, dest, tag, count);
 
 exit_free_msg:
-    free(msg);
+    mem_free(msg);
 exit:
     return ret;
 }
 
 int mpi_tls_recv_bytes(void *buf, size_t count, int src, int tag,
         mpi_tls_status_t *status) {
+    uint64_t trace_start = trace_begin();
     int ret;
 
     mpi_tls_status_t ignored_status;
@@ -610,11 +793,16 @@ int mpi_tls_recv_bytes(void *buf, size_t count, int src, int tag,
     }
     if (tag == MPI_TLS_ANY_TAG) {
         tag = OCALL_MPI_ANY_TAG;
+    } else {
+        ret = get_job_tag(tag, &tag);
+        if (ret) {
+            goto exit;
+        }
     }
 
     /* Allocate message. */
-    size_t msg_len = sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN + count;
-    struct mpi_tls_msg *msg = malloc(msg_len);
+    size_t msg_len = MSG_OVERHEAD + count;
+    struct mpi_tls_msg *msg = mem_alloc(MEM_MPI_TLS, msg_len);
     if (!msg) {
         perror("malloc msg");
         ret = -1;
@@ -639,48 +827,16 @@ int mpi_tls_recv_bytes(void *buf, size_t count, int src, int tag,
         goto exit_free_msg;
     }
 
-    /* Decrypt. */
-    if ((size_t) status->count
-            < sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN) {
-        handle_error_string(
-                "Received encrypted MPI data is shorter than IV + tag length");
-        goto exit_free_msg;
-    }
-    struct mpi_tls_auth_data auth_data = {
-        .tag = htonl(status->tag),
-        .counter = msg->counter,
-    };
-    ret =
-        aad_decrypt(sessions[status->source].recv_key,
-            msg->ciphertext + IV_LEN + TAG_LEN,
-            status->count - sizeof(*msg) - IV_LEN - TAG_LEN, &auth_data,
-            sizeof(auth_data), msg->ciphertext, msg->ciphertext + IV_LEN, buf);
+    ret = open_msg(msg, status, buf);
     if (ret) {
-        handle_error_string("Error decrypting encrypted MPI data");
         goto exit_free_msg;
     }
-    status->count -= sizeof(*msg) + IV_LEN + TAG_LEN;
 
-    /* Check counter uniqueness. */
-    spinlock_lock(&sessions[status->source].window_lock);
-    bool was_set;
-    uint64_t counter = ntohll(msg->counter);
-    ret = window_add(&sessions[status->source].window, counter, &was_set);
-    if (ret) {
-        handle_error_string("Error adding encrypted MPI counter to window");
-        spinlock_unlock(&sessions[status->source].window_lock);
-        goto exit_free_msg;
-    }
-    if (was_set) {
-        handle_error_string("Duplicate counter: %" PRIu64, counter);
-        spinlock_unlock(&sessions[status->source].window_lock);
-        ret = -1;
-        goto exit_free_msg;
-    }
-    spinlock_unlock(&sessions[status->source].window_lock);
+    trace_end(TRACE_RECV, trace_start, status->source, status->tag,
+            status->count);
 
 exit_free_msg:
-    free(msg);
+    mem_free(msg);
 exit:
     return ret;
 }
@@ -689,44 +845,31 @@ int mpi_tls_isend_bytes(const void *buf_, size_t count, int dest, int tag,
         mpi_tls_request_t *request) {
     struct mpi_tls_session *session = &sessions[dest];
     const unsigned char *buf = buf_;
+    uint64_t trace_start = trace_begin();
     int ret;
 
-    /* Allocate message. */
-    request->msg_len = sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN + count;
-    request->msg = malloc(request->msg_len);
+    ret = get_job_tag(tag, &tag);
+    if (ret) {
+        goto exit;
+    }
+
+    /* Allocate and seal message. */
+    request->msg_len = MSG_OVERHEAD + count;
+    request->msg = mem_alloc(MEM_MPI_TLS, request->msg_len);
     if (!request->msg) {
         perror("malloc request->msg");
         ret = -1;
         goto exit;
     }
-    uint64_t counter =
-        __atomic_fetch_add(&session->counter, 1, __ATOMIC_RELAXED);
-    request->msg->counter = htonll(counter);
-
-    /* Generate IV in the first IV_LEN bytes of the buffer. */
-    ret = rand_read(request->msg->ciphertext, IV_LEN);
-    if (ret) {
-        handle_error_string("Error generating encrypted MPI IV");
-        goto exit_free_msg;
-    }
-
-    /* Encrypt. Tag goes in the TAG_LEN bytes after the IV. Ciphertext goes in
-     * the remaining bytes after the IV and tag. */
-    struct mpi_tls_auth_data auth_data = {
-        .tag = htonl(tag),
-        .counter = request->msg->counter,
-    };
-    ret =
-        aad_encrypt(session->send_key, buf, count, &auth_data,
-                sizeof(auth_data), request->msg->ciphertext,
-                request->msg->ciphertext + IV_LEN + TAG_LEN,
-                request->msg->ciphertext + IV_LEN);
+    ret = seal_msg(session, tag, buf, count, request->msg);
     if (ret) {
-        handle_error_string("Error encrypting encrypted MPI data");
         goto exit_free_msg;
     }
 
     request->type = MPI_TLS_SEND;
+    request->count = count;
+    request->peer = dest;
+    request->tag = tag;
 
     /* Send buffer over MPI. */
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
@@ -750,17 +893,20 @@ int mpi_tls_isend_bytes(const void *buf_, size_t count, int dest, int tag,
 
     __atomic_add_fetch(&mpi_tls_bytes_sent, request->msg_len,
             __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mpi_tls_messages_sent, 1, __ATOMIC_RELAXED);
+    trace_end(TRACE_ISEND, trace_start, dest, tag, count);
 
 exit:
     return ret;
 
 exit_free_msg:
-    free(request->msg);
+    mem_free(request->msg);
     return ret;
 }
 
 int mpi_tls_irecv_bytes(void *buf, size_t count, int src, int tag,
         mpi_tls_request_t *request) {
+    uint64_t trace_start = trace_begin();
     int ret;
 
     if (src == MPI_TLS_ANY_SOURCE) {
@@ -768,11 +914,16 @@ int mpi_tls_irecv_bytes(void *buf, size_t count, int src, int tag,
     }
     if (tag == MPI_TLS_ANY_TAG) {
         tag = OCALL_MPI_ANY_TAG;
+    } else {
+        ret = get_job_tag(tag, &tag);
+        if (ret) {
+            goto exit;
+        }
     }
 
     /* Allocate receive buffer. */
-    request->msg_len = sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN + count;
-    request->msg = malloc(request->msg_len);
+    request->msg_len = MSG_OVERHEAD + count;
+    request->msg = mem_alloc(MEM_MPI_TLS, request->msg_len);
     if (!request->msg) {
         perror("malloc request->msg");
         ret = -1;
@@ -801,16 +952,20 @@ int mpi_tls_irecv_bytes(void *buf, size_t count, int src, int tag,
     request->buf = buf;
     request->type = MPI_TLS_RECV;
     request->count = count;
+    request->peer = src;
+    request->tag = tag;
+    trace_end(TRACE_IRECV, trace_start, src, tag, count);
 
 exit:
     return ret;
 
 exit_free_msg:
-    free(request->msg);
+    mem_free(request->msg);
     return ret;
 }
 
 int mpi_tls_wait(mpi_tls_request_t *request, mpi_tls_status_t *status) {
+    uint64_t trace_start = trace_begin();
     int ret;
 
     mpi_tls_status_t ignored_status;
@@ -868,58 +1023,25 @@ int mpi_tls_wait(mpi_tls_request_t *request, mpi_tls_status_t *status) {
         break;
 
     case MPI_TLS_RECV: {
-        /* Decrypt. */
-        if ((size_t) status->count
-                < sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN) {
-            handle_error_string(
-                    "Received encrypted MPI data is shorter than IV + tag length");
-            goto exit;
-        }
-        struct mpi_tls_auth_data auth_data = {
-            .tag = htonl(status->tag),
-            .counter = wait_msg->counter,
-        };
-        ret =
-            aad_decrypt(sessions[status->source].recv_key,
-                request->msg->ciphertext + IV_LEN + TAG_LEN,
-                status->count - sizeof(*request->msg) - IV_LEN - TAG_LEN,
-                &auth_data, sizeof(auth_data), request->msg->ciphertext,
-                request->msg->ciphertext + IV_LEN, request->buf);
+        ret = open_msg(request->msg, status, request->buf);
         if (ret) {
-            handle_error_string("Error decrypting encrypted MPI data");
             goto exit;
         }
-        status->count -= sizeof(*request->msg) + IV_LEN + TAG_LEN;
-
-        /* Check counter uniqueness. */
-        spinlock_lock(&sessions[status->source].window_lock);
-        bool was_set;
-        uint64_t counter = ntohll(request->msg->counter);
-        ret = window_add(&sessions[status->source].window, counter, &was_set);
-        if (ret) {
-            handle_error_string("Error adding encrypted MPI counter to window");
-            spinlock_unlock(&sessions[status->source].window_lock);
-            goto exit;
-        }
-        if (was_set) {
-            handle_error_string("Duplicate counter: %" PRIu64, counter);
-            spinlock_unlock(&sessions[status->source].window_lock);
-            ret = -1;
-            goto exit;
-        }
-        spinlock_unlock(&sessions[status->source].window_lock);
 
         break;
         }
     }
 
+    trace_wait(TRACE_WAIT, trace_start, request, status);
+
 exit:
-    free(request->msg);
+    mem_free(request->msg);
     return ret;
 }
 
 int mpi_tls_waitany(size_t count, mpi_tls_request_t *requests, size_t *index,
         mpi_tls_status_t *status) {
+    uint64_t trace_start = trace_begin();
     int ret;
 
     mpi_tls_status_t ignored_status;
@@ -978,52 +1100,96 @@ int mpi_tls_waitany(size_t count, mpi_tls_request_t *requests, size_t *index,
         break;
 
     case MPI_TLS_RECV: {
-        /* Decrypt. */
-        if ((size_t) status->count
-                < sizeof(struct mpi_tls_msg) + IV_LEN + TAG_LEN) {
-            handle_error_string(
-                    "Received encrypted MPI data is shorter than IV + tag length");
-            goto exit;
-        }
-        struct mpi_tls_auth_data auth_data = {
-            .tag = htonl(status->tag),
-            .counter = wait_msg->counter,
-        };
-        ret =
-            aad_decrypt(sessions[status->source].recv_key,
-                wait_msg->ciphertext + IV_LEN + TAG_LEN,
-                status->count - sizeof(*wait_msg) - IV_LEN - TAG_LEN,
-                &auth_data, sizeof(auth_data), wait_msg->ciphertext,
-                wait_msg->ciphertext + IV_LEN, requests[*index].buf);
+        ret = open_msg(wait_msg, status, requests[*index].buf);
         if (ret) {
-            handle_error_string("Error decrypting encrypted MPI data");
             goto exit;
         }
-        status->count -= sizeof(*wait_msg) + IV_LEN + TAG_LEN;
 
-        /* Check counter uniqueness. */
-        spinlock_lock(&sessions[status->source].window_lock);
-        bool was_set;
-        uint64_t counter = ntohll(wait_msg->counter);
-        ret = window_add(&sessions[status->source].window, counter, &was_set);
+        break;
+    }
+    }
+
+    trace_wait(TRACE_WAITANY, trace_start, &requests[*index], status);
+
+exit:
+    mem_free(requests[*index].msg);
+    return ret;
+}
+
+int mpi_tls_test(mpi_tls_request_t *request, int *flag,
+        mpi_tls_status_t *status) {
+    int ret;
+
+    mpi_tls_status_t ignored_status;
+    if (status == MPI_TLS_STATUS_IGNORE) {
+        status = &ignored_status;
+    }
+
+    if (request->type == MPI_TLS_NULL) {
+        *flag = true;
+        ret = 0;
+        goto exit;
+    }
+
+    struct mpi_tls_msg *wait_msg;
+    size_t wait_msg_len;
+    switch (request->type) {
+    case MPI_TLS_SEND:
+        wait_msg = NULL;
+        wait_msg_len = 0;
+        break;
+    case MPI_TLS_RECV:
+        wait_msg = request->msg;
+        wait_msg_len = request->msg_len;
+        break;
+    default:
+        handle_error_string("Invalid request type");
+        ret = -1;
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result =
+        ocall_mpi_try_wait(&ret, (unsigned char *) wait_msg, wait_msg_len,
+                &request->mpi_request, flag, status);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_mpi_try_wait");
+        ret = result;
+        goto exit_free_msg;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret =
+        ocall_mpi_try_wait((unsigned char *) wait_msg, wait_msg_len,
+                &request->mpi_request, flag, status);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error testing request");
+        goto exit_free_msg;
+    }
+
+    /* If the request is still pending, leave it untouched for the next
+     * test. */
+    if (!*flag) {
+        goto exit;
+    }
+
+    switch (request->type) {
+    case MPI_TLS_NULL:
+    case MPI_TLS_SEND:
+        break;
+
+    case MPI_TLS_RECV: {
+        ret = open_msg(request->msg, status, request->buf);
         if (ret) {
-            handle_error_string("Error adding encrypted MPI counter to window");
-            spinlock_unlock(&sessions[status->source].window_lock);
-            goto exit;
+            goto exit_free_msg;
         }
-        if (was_set) {
-            handle_error_string("Duplicate counter: %" PRIu64, counter);
-            spinlock_unlock(&sessions[status->source].window_lock);
-            ret = -1;
-            goto exit;
-        }
-        spinlock_unlock(&sessions[status->source].window_lock);
 
         break;
     }
     }
 
+exit_free_msg:
+    mem_free(request->msg);
 exit:
-    free(requests[*index].msg);
     return ret;
 }
@@ -17,6 +17,8 @@ typedef struct mpi_tls_request {
 
     void *buf;
     size_t count;
+    int peer;
+    int tag;
     struct mpi_tls_msg *msg;
     size_t msg_len;
 } mpi_tls_request_t;
@@ -25,6 +27,7 @@ typedef ocall_mpi_status_t mpi_tls_status_t;
 
 /* Bandwidth measurement. */
 extern size_t mpi_tls_bytes_sent;
+extern size_t mpi_tls_messages_sent;
 
 #define MPI_TLS_ANY_SOURCE (-2)
 #define MPI_TLS_ANY_TAG (-3)
@@ -43,8 +46,23 @@ int mpi_tls_irecv_bytes(void *buf, size_t count, int src, int tag,
 int mpi_tls_wait(mpi_tls_request_t *request, mpi_tls_status_t *status);
 int mpi_tls_waitany(size_t count, mpi_tls_request_t *requests, size_t *index,
         mpi_tls_status_t *status);
+int mpi_tls_test(mpi_tls_request_t *request, int *flag,
+        mpi_tls_status_t *status);
+
+/* Central location for MPI tags. Each job's tags are offset by its
+ * mpi_tag_base, a multiple of mpi_tls_job_tag_stride, so tags within a job
+ * must stay below the stride, and messages with tags that do not fail. The
+ * bitonic sort uses chunk indices as tags and the bucket sort uses bucket
+ * indices.
+ *
+ * Each job gets up to MPI_TLS_MAX_JOB_TAG_STRIDE tags. mpi_tls_init lowers the
+ * stride to fit under the MPI implementation's MPI_TAG_UB, which may be as low
+ * as 32767, and sets mpi_tls_max_jobs to the number of strides that fit. */
+
+#define MPI_TLS_MAX_JOB_TAG_STRIDE (1 << 24)
 
-/* Central location for MPI tags. */
+extern int mpi_tls_job_tag_stride;
+extern size_t mpi_tls_max_jobs;
 
 #define BUCKET_DISTRIBUTE_MPI_TAG 1
 #define SAMPLE_PARTITION_MPI_TAG 2
@@ -54,5 +72,13 @@ int mpi_tls_waitany(size_t count, mpi_tls_request_t *requests, size_t *index,
 #define OCOMPACT_MARKED_COUNT_MPI_TAG 6
 #define OPAQUE_TRANSPOSE_MPI_TAG 7
 #define OPAQUE_BACKSHIFT_MPI_TAG 8
+#define COST_BENCH_MPI_TAG 9
+#define COST_CHOICE_MPI_TAG 10
+#define SORT_PARAMS_MPI_TAG 11
+#define MERGE_REDISTRIBUTE_MPI_TAG 12
+#define FINGERPRINT_KEY_MPI_TAG 13
+#define VERIFY_MPI_TAG 14
+#define KBENCH_MPI_TAG 15
+#define MPI_TLS_NUM_FIXED_TAGS 16
 
 #endif /* distributed-sgx-sort/enclave/mpi_tls.h */
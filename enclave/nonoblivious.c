@@ -10,14 +10,24 @@
 #include "common/elem_t.h"
 #include "common/error.h"
 #include "common/util.h"
+#include "enclave/arena.h"
+#include "enclave/extmem.h"
+#include "enclave/mem.h"
 #include "enclave/mpi_tls.h"
+#include "enclave/output.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/params.h"
 #include "enclave/qsort.h"
+#include "enclave/span.h"
 #include "enclave/synch.h"
 #include "enclave/threading.h"
 
 #define BUF_SIZE 1024
-#define SAMPLE_PARTITION_BUF_SIZE 512
+#define SAMPLE_PARTITION_BUF_SIZE (sort_params.sample_partition_buf_size)
+
+size_t nonoblivious_scratch_size(void) {
+    return SAMPLE_PARTITION_BUF_SIZE * sizeof(elem_t);
+}
 
 /* Compares elements by the tuple (key, ORP ID). The check for the ORP ID must
  * always be run (it must be oblivious whether the comparison result is based on
@@ -520,6 +530,7 @@ struct send_and_receive_partitions_args {
     volatile size_t recv_idx;
     volatile size_t recv_num;
     size_t total_num_recvs;
+    struct thread_barrier barrier;
     int ret;
 };
 static void send_and_receive_partitions(void *args_, size_t thread_idx) {
@@ -539,7 +550,7 @@ static void send_and_receive_partitions(void *args_, size_t thread_idx) {
      * in chunks. */
 
     /* Allocate receive buffer. */
-    elem_t *buf = malloc(SAMPLE_PARTITION_BUF_SIZE * sizeof(*buf));
+    elem_t *buf = arena_alloc(nonoblivious_scratch_size());
     if (!buf) {
         perror("malloc buf");
         ret = errno;
@@ -557,7 +568,7 @@ static void send_and_receive_partitions(void *args_, size_t thread_idx) {
     }
 
     /* Wait so that thread 0 has defeintely updated RECV_IDX. */
-    thread_wait_for_all();
+    thread_barrier_wait(&args->barrier);
 
     /* Post a receive request. */
     size_t num_requests = 0;
@@ -673,7 +684,7 @@ static void send_and_receive_partitions(void *args_, size_t thread_idx) {
     ret = 0;
 
 exit_free_buf:
-    free(buf);
+    arena_free(buf);
 exit:
     if (ret) {
         int expected = 0;
@@ -682,9 +693,91 @@ exit:
     }
 }
 
-/* Performs a non-oblivious samplesort across all enclaves. */
+/* Sends SEND_COUNTS[i], the number of elements this rank sends to rank i, to
+ * every other rank and sets RECV_COUNTS[i] to the number rank i sends to this
+ * rank. */
+static int exchange_counts(const size_t *send_counts, size_t *recv_counts) {
+    mpi_tls_request_t requests[world_size];
+    int ret;
+
+    /* Send our count to all other enclaves. */
+    size_t recv_count;
+    for (int i = 0; i < world_size; i++) {
+        if (i == world_rank) {
+            /* Post receive. */
+            ret =
+                mpi_tls_irecv_bytes(&recv_count, sizeof(recv_count),
+                        MPI_TLS_ANY_SOURCE, SAMPLE_PARTITION_MPI_TAG,
+                        &requests[i]);
+            if (ret) {
+                handle_error_string(
+                        "Error posting receive for sample partition count into %d",
+                        world_rank);
+                goto exit;
+            }
+        } else {
+            /* Post send. */
+            ret =
+                mpi_tls_isend_bytes(&send_counts[i], sizeof(send_counts[i]), i,
+                        SAMPLE_PARTITION_MPI_TAG, &requests[i]);
+            if (ret) {
+                handle_error_string(
+                        "Error posting send for sample partition count from %d to %d",
+                        world_rank, i);
+                goto exit;
+            }
+        }
+    }
+
+    /* Loop (WORLD_SIZE - 1) * 2 times for WORLD_SIZE - 1 sends and
+     * WORLD_SIZE - 1 receives. */
+    size_t receives_left = world_size - 1;
+    recv_counts[world_rank] = send_counts[world_rank];
+    for (int i = 0; i < (world_size - 1) * 2; i++) {
+        size_t index;
+        mpi_tls_status_t status;
+        ret = mpi_tls_waitany(world_size, requests, &index, &status);
+        if (ret) {
+            handle_error_string(
+                    "Error waiting on receives for sample partition count");
+            goto exit;
+        }
+
+        if (index == (size_t) world_rank) {
+            recv_counts[status.source] = recv_count;
+            receives_left--;
+
+            if (receives_left > 0) {
+                /* Post receive. */
+                ret =
+                    mpi_tls_irecv_bytes(&recv_count, sizeof(recv_count),
+                            MPI_TLS_ANY_SOURCE, SAMPLE_PARTITION_MPI_TAG,
+                            &requests[index]);
+                if (ret) {
+                    handle_error_string(
+                            "Error posting receive for sample partition count into %d",
+                            world_rank);
+                    goto exit;
+                }
+            } else {
+                requests[index].type = MPI_TLS_NULL;
+            }
+        } else {
+            requests[index].type = MPI_TLS_NULL;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Performs a non-oblivious samplesort across all enclaves. OUT must have room
+ * for CAPACITY elements. */
 static int distributed_sample_partition(elem_t *arr, elem_t *out,
-        size_t local_length, size_t *out_length, size_t num_threads) {
+        size_t local_length, size_t capacity, size_t *out_length,
+        size_t num_threads) {
     int ret;
 
     /* This should never be called if this is a single-enclave sort. */
@@ -695,7 +788,6 @@ static int distributed_sample_partition(elem_t *arr, elem_t *out,
     size_t send_end_idxs[world_size];
     size_t send_counts[world_size];
     size_t recv_counts[world_size];
-    mpi_tls_request_t requests[world_size];
 
     /* Partition the data. Rank 0 partitions/samples from its own array using
      * quickselect and sends the samples to everyone else. All other ranks then
@@ -756,78 +848,26 @@ static int distributed_sample_partition(elem_t *arr, elem_t *out,
     }
 
     /* Sum the number of elements that the other enclaves have sent to us. */
-    /* Send our count to all other enclaves. */
-    size_t recv_count;
+    ret = exchange_counts(send_counts, recv_counts);
+    if (ret) {
+        goto exit;
+    }
+    *out_length = 0;
     for (int i = 0; i < world_size; i++) {
-        if (i == world_rank) {
-            /* Post receive. */
-            ret =
-                mpi_tls_irecv_bytes(&recv_count, sizeof(recv_count),
-                        MPI_TLS_ANY_SOURCE, SAMPLE_PARTITION_MPI_TAG,
-                        &requests[i]);
-            if (ret) {
-                handle_error_string(
-                        "Error posting receive for sample partition count into %d",
-                        world_rank);
-                goto exit;
-            }
-        } else {
-            /* Post send. */
-            ret =
-                mpi_tls_isend_bytes(&send_counts[i], sizeof(send_counts[i]), i,
-                        SAMPLE_PARTITION_MPI_TAG, &requests[i]);
-            if (ret) {
-                handle_error_string(
-                        "Error posting send for sample partition count from %d to %d",
-                        world_rank, i);
-                goto exit;
-            }
-        }
+        *out_length += recv_counts[i];
     }
-
-    /* Loop (WORLD_SIZE - 1) * 2 times for WORLD_SIZE - 1 sends and
-     * WORLD_SIZE - 1 receives. */
-    size_t receives_left = world_size - 1;
-    recv_counts[world_rank] = send_counts[world_rank];
-    *out_length = recv_counts[world_rank];
-    for (int i = 0; i < (world_size - 1) * 2; i++) {
-        size_t index;
-        mpi_tls_status_t status;
-        ret = mpi_tls_waitany(world_size, requests, &index, &status);
-        if (ret) {
-            handle_error_string(
-                    "Error waiting on receives for sample partition count");
-            goto exit;
-        }
-
-        if (index == (size_t) world_rank) {
-            recv_counts[status.source] = recv_count;
-            *out_length += recv_count;
-            receives_left--;
-
-            if (receives_left > 0) {
-                /* Post receive. */
-                ret =
-                    mpi_tls_irecv_bytes(&recv_count, sizeof(recv_count),
-                            MPI_TLS_ANY_SOURCE, SAMPLE_PARTITION_MPI_TAG,
-                            &requests[index]);
-                if (ret) {
-                    handle_error_string(
-                            "Error posting receive for sample partition count into %d",
-                            world_rank);
-                    goto exit;
-                }
-            } else {
-                requests[index].type = MPI_TLS_NULL;
-            }
-        } else {
-            requests[index].type = MPI_TLS_NULL;
-        }
+    if (*out_length > capacity) {
+        handle_error_string("Partition of %zu elements exceeds %zu elements",
+                *out_length, capacity);
+        ret = -1;
+        goto exit;
     }
 
     /* Sending starts at the previous sample index (or 0). */
-    memcpy(send_idxs + 1, send_end_idxs, (world_size - 1) * sizeof(*send_idxs));
     send_idxs[0] = 0;
+    for (int i = 1; i < world_size; i++) {
+        send_idxs[i] = send_end_idxs[i - 1];
+    }
 
     //printf("%d\n", getpid());
     //volatile int loop = 1;
@@ -852,6 +892,7 @@ static int distributed_sample_partition(elem_t *arr, elem_t *out,
         .total_num_recvs = total_num_recvs,
         .ret = 0,
     };
+    thread_barrier_init(&args.barrier, num_threads);
     struct thread_work work = {
         .type = THREAD_WORK_ITER,
         .iter = {
@@ -873,58 +914,52 @@ exit:
     return ret;
 }
 
-/* Balance the elements across enclaves after the unbalanced partitioning step
- * and sorting step. */
-static int balance(elem_t *arr, elem_t *out, size_t total_length,
-        size_t in_length) {
-    mpi_tls_request_t requests[world_size * 2];
-    mpi_tls_request_t *send_requests = requests;
-    mpi_tls_request_t *recv_requests = requests + world_size;
+/* Gathers IN_LENGTH, the number of elements this rank holds, and OUT_START,
+ * the index of this rank's first element once balanced, from every rank
+ * through rank 0. RANK_CUM_IDXS[i] is set to the number of elements held by
+ * ranks 0 to i - 1 and RANK_OUT_STARTS[i] to rank i's OUT_START, and both
+ * have WORLD_SIZE + 1 entries, the last of which is the total number of
+ * elements. */
+static int gather_rank_idxs(size_t in_length, size_t out_start,
+        size_t *rank_cum_idxs, size_t *rank_out_starts) {
+    size_t idxs[world_size + 1][2];
     int ret;
 
-    /* This should never be called if this is a single-enclave sort. */
-    assert(world_size > 1);
-
-    /* Get all cumulative lengths across ranks. RANK_LENGTHS[i] holds the number
-     * of elements in ranks 0 to i - 1. */
-    size_t rank_cum_idxs[world_size + 1];
-    size_t send_idxs[world_size];
-    size_t recv_idxs[world_size];
-    size_t send_final_idxs[world_size];
-    size_t recv_final_idxs[world_size];
     if (world_rank == 0) {
-        /* Receive individual lengths from everyone. */
-        rank_cum_idxs[0] = in_length;
+        /* Receive individual lengths and starts from everyone. */
+        idxs[0][0] = in_length;
+        idxs[0][1] = out_start;
         for (int i = 0; i < world_size - 1; i++) {
-            size_t rank_length;
+            size_t rank_idxs[2];
             mpi_tls_status_t status;
             ret =
-                mpi_tls_recv_bytes(&rank_length, sizeof(rank_length),
+                mpi_tls_recv_bytes(rank_idxs, sizeof(rank_idxs),
                         MPI_TLS_ANY_SOURCE, BALANCE_MPI_TAG, &status);
             if (ret) {
                 handle_error_string("Error receiving rank length into %d", 0);
                 goto exit;
             }
-            rank_cum_idxs[status.source] = rank_length;
+            idxs[status.source][0] = rank_idxs[0];
+            idxs[status.source][1] = rank_idxs[1];
         }
 
         /* Compute cumulative lengths. */
         size_t cur_length = 0;
         for (int i = 0; i < world_size; i++) {
             size_t prev_length = cur_length;
-            cur_length += rank_cum_idxs[i];
-            rank_cum_idxs[i] = prev_length;
+            cur_length += idxs[i][0];
+            idxs[i][0] = prev_length;
         }
-        rank_cum_idxs[world_size] = total_length;
+        idxs[world_size][0] = cur_length;
+        idxs[world_size][1] = cur_length;
 
-        /* Send cumulative lengths to everyone. */
+        /* Send cumulative lengths and starts to everyone. */
         for (int i = 0; i < world_size; i++) {
             if (i == world_rank) {
                 continue;
             }
             ret =
-                mpi_tls_send_bytes(rank_cum_idxs, sizeof(rank_cum_idxs), i,
-                        BALANCE_MPI_TAG);
+                mpi_tls_send_bytes(idxs, sizeof(idxs), i, BALANCE_MPI_TAG);
             if (ret) {
                 handle_error_string(
                         "Error sending cumulative lengths from %d to %d", 0, i);
@@ -932,9 +967,10 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
             }
         }
     } else {
-        /* Send length to rank 0. */
+        /* Send length and start to rank 0. */
+        size_t rank_idxs[2] = { in_length, out_start };
         ret =
-            mpi_tls_send_bytes(&in_length, sizeof(in_length), 0,
+            mpi_tls_send_bytes(rank_idxs, sizeof(rank_idxs), 0,
                     BALANCE_MPI_TAG);
         if (ret) {
             handle_error_string("Error sending rank length from %d to %d", 0,
@@ -942,10 +978,9 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
             goto exit;
         }
 
-        /* Receive cumulative lengths from rank 0. */
+        /* Receive cumulative lengths and starts from rank 0. */
         ret =
-            mpi_tls_recv_bytes(rank_cum_idxs, sizeof(rank_cum_idxs), 0,
-                    BALANCE_MPI_TAG, NULL);
+            mpi_tls_recv_bytes(idxs, sizeof(idxs), 0, BALANCE_MPI_TAG, NULL);
         if (ret) {
             handle_error_string(
                     "Error receiving cumulative lengths from %d into %d", 0,
@@ -954,14 +989,54 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
         }
     }
 
+    for (int i = 0; i <= world_size; i++) {
+        rank_cum_idxs[i] = idxs[i][0];
+        rank_out_starts[i] = idxs[i][1];
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Balance the elements across enclaves after the unbalanced partitioning step
+ * and sorting step. */
+static int balance(elem_t *arr, elem_t *out, size_t total_length,
+        size_t in_length) {
+    mpi_tls_request_t requests[world_size * 2];
+    mpi_tls_request_t *send_requests = requests;
+    mpi_tls_request_t *recv_requests = requests + world_size;
+    int ret;
+
+    /* This should never be called if this is a single-enclave sort. */
+    assert(world_size > 1);
+
+    /* Get all cumulative lengths and output starts across ranks. */
+    size_t rank_cum_idxs[world_size + 1];
+    size_t rank_out_starts[world_size + 1];
+    size_t send_idxs[world_size];
+    size_t recv_idxs[world_size];
+    size_t send_final_idxs[world_size];
+    size_t recv_final_idxs[world_size];
+    size_t recv_lens[world_size];
+    size_t local_start =
+        (world_rank * total_length + world_size - 1) / world_size;
+    size_t local_end =
+        ((world_rank + 1) * total_length + world_size - 1) / world_size;
+    size_t local_length = local_end - local_start;
+    ret =
+        gather_rank_idxs(in_length, local_start, rank_cum_idxs,
+                rank_out_starts);
+    if (ret) {
+        goto exit;
+    }
+
     /* Compute at which indices we need to send the elements we currently have
      * to each rank and at which indices we need to receive elements from other
      * ranks. */
-    size_t local_start = world_rank * total_length / world_size;
-    size_t local_end = (world_rank + 1) * total_length / world_size;
-    size_t local_length = local_end - local_start;
     for (int i = 0; i < world_size; i++) {
-        size_t i_local_start = i * total_length / world_size;
+        size_t i_local_start = rank_out_starts[i];
         send_idxs[i] =
             MAX(
                     MIN(i_local_start, rank_cum_idxs[world_rank + 1]),
@@ -988,6 +1063,7 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
             if (elems_to_copy) {
                 memcpy(out + recv_idxs[i], arr + send_idxs[i],
                         elems_to_copy * sizeof(*out));
+                output_mark_final(out, recv_idxs[i], elems_to_copy);
                 send_idxs[i] += elems_to_copy;
                 recv_idxs[i] += elems_to_copy;
             }
@@ -1033,6 +1109,7 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
                 goto exit;
             }
             recv_idxs[i] += elems_to_recv;
+            recv_lens[i] = elems_to_recv;
             num_requests++;
         } else {
             recv_requests[i].type = MPI_TLS_NULL;
@@ -1073,7 +1150,10 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
             }
         } else {
             int rank = index - world_size;
-            /* This was a receive request. */
+            /* This was a receive request. These elements are now in their
+             * final position and can be output. */
+            output_mark_final(out, recv_idxs[rank] - recv_lens[rank],
+                    recv_lens[rank]);
             if (recv_idxs[rank] < recv_final_idxs[rank]) {
                 size_t elems_to_recv =
                     MIN(recv_final_idxs[rank] - recv_idxs[rank],
@@ -1089,6 +1169,7 @@ static int balance(elem_t *arr, elem_t *out, size_t total_length,
                     goto exit;
                 }
                 recv_idxs[rank] += elems_to_recv;
+                recv_lens[rank] = elems_to_recv;
             } else {
                 recv_requests[rank].type = MPI_TLS_NULL;
                 num_requests--;
@@ -1103,68 +1184,50 @@ exit:
 }
 
 int nonoblivious_sort(elem_t *arr, elem_t *out, size_t length,
-        size_t local_length, size_t num_threads) {
+        size_t local_length, size_t capacity, size_t num_threads) {
     int ret;
 
     if (world_size == 1) {
-        struct timespec time_start;
-        if (clock_gettime(CLOCK_REALTIME, &time_start)) {
-            handle_error_string("Error getting time");
-            ret = errno;
+        if (length > capacity) {
+            handle_error_string("%zu elements exceed %zu elements", length,
+                    capacity);
+            ret = -1;
             goto exit;
         }
 
+        span_t span = span_begin("local_sort");
+
         /* Sort local partitions. */
         ret = mergesort(arr, out, length, num_threads);
         if (ret) {
             handle_error_string("Error in non-oblivious local sort");
             goto exit;
         }
+        output_mark_final(out, 0, length);
 
         /* Copy local sort output to final output. */
         memcpy(arr, out, length * sizeof(*arr));
 
-        struct timespec time_finish;
-        if (clock_gettime(CLOCK_REALTIME, &time_finish)) {
-            handle_error_string("Error getting time");
-            ret = errno;
-            goto exit;
-        }
-
-        if (world_rank == 0) {
-            printf("sample_partition : %f\n", 0.0);
-            printf("local_sort       : %f\n",
-                    get_time_difference(&time_start, &time_finish));
-            printf("balance          : %f\n", 0.0);
-        }
+        span_end(span);
 
         goto exit;
     }
 
-    struct timespec time_start;
-    if (clock_gettime(CLOCK_REALTIME, &time_start)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_t span = span_begin("sample_partition");
 
     /* Partition permuted data such that each enclave has its own partition of
      * element, e.g. enclave 0 has the lowest elements, then enclave 1, etc. */
     size_t partition_length;
     ret =
-        distributed_sample_partition(arr, out, local_length, &partition_length,
-                num_threads);
+        distributed_sample_partition(arr, out, local_length, capacity,
+                &partition_length, num_threads);
     if (ret) {
         handle_error_string("Error in distributed sample partitioning");
         goto exit;
     }
 
-    struct timespec time_sample_partition;
-    if (clock_gettime(CLOCK_REALTIME, &time_sample_partition)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("local_sort");
 
     /* Sort local partitions. */
     ret = mergesort(out, arr, partition_length, num_threads);
@@ -1173,12 +1236,8 @@ int nonoblivious_sort(elem_t *arr, elem_t *out, size_t length,
         goto exit;
     }
 
-    struct timespec time_local_sort;
-    if (clock_gettime(CLOCK_REALTIME, &time_local_sort)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("balance");
 
     /* Balance partitions. */
     ret = balance(arr, out, length, partition_length);
@@ -1187,22 +1246,823 @@ int nonoblivious_sort(elem_t *arr, elem_t *out, size_t length,
         goto exit;
     }
 
-    struct timespec time_finish;
-    if (clock_gettime(CLOCK_REALTIME, &time_finish)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit;
+    span_end(span);
+
+exit:
+    return ret;
+}
+
+/* External-memory nonoblivious sort. The elements stay encrypted in host
+ * memory, in stores whose blocks each hold a page of elements, and are
+ * streamed through the enclave's two blocks and a few pages. The pages read
+ * and written after the sample partitioning depend on how the elements
+ * compare, which is fine for the same reason the in-enclave nonoblivious sort
+ * may branch on them: the elements were randomly permuted first. */
+
+/* Pages 0 and 1 stream through the stores, and the rest hold the messages of
+ * the partition exchange and the balancing. */
+static size_t get_extmem_num_pages(void) {
+    return MAX((size_t) world_size * 2 + 2, 5);
+}
+
+size_t nonoblivious_extmem_scratch_size(size_t page_len, size_t block_len) {
+    size_t fan_in = block_len / page_len;
+    return get_extmem_num_pages() * page_len * sizeof(elem_t)
+        + fan_in * (sizeof(struct extmem_stream) + 2 * sizeof(size_t));
+}
+
+/* Returns the rank whose partition ELEM falls into, which is the number of
+ * the WORLD_SIZE - 1 sorted SAMPLES that ELEM is greater than. */
+static int get_partition(const elem_t *elem, const struct sample *samples) {
+    size_t left = 0;
+    size_t right = world_size - 1;
+    while (left < right) {
+        size_t mid = (left + right) / 2;
+        if (elem_sample_comparator(elem, &samples[mid]) > 0) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
     }
+    return left;
+}
+
+/* Rank 0 picks WORLD_SIZE - 1 splitters from the first BLOCK_LEN of the LENGTH
+ * elements in SRC, which are a random sample since they were permuted, and
+ * sends them to everyone else. */
+static int get_extmem_samples(struct extmem_store *src, size_t length,
+        elem_t *block, elem_t *buf, size_t block_len, elem_t *page,
+        struct sample *samples, size_t num_threads) {
+    int ret;
 
     if (world_rank == 0) {
-        printf("sample_partition : %f\n",
-                get_time_difference(&time_start, &time_sample_partition));
-        printf("local_sort       : %f\n",
-                get_time_difference(&time_sample_partition, &time_local_sort));
-        printf("balance          : %f\n",
-                get_time_difference(&time_local_sort, &time_finish));
+        size_t sample_len = MIN(length, block_len);
+        struct extmem_stream reader;
+        extmem_stream_init(&reader, src, page, 0);
+        ret = extmem_stream_read(&reader, block, sample_len);
+        if (ret) {
+            handle_error_string("Error reading sample");
+            goto exit;
+        }
+        ret = mergesort(block, buf, sample_len, num_threads);
+        if (ret) {
+            handle_error_string("Error sorting sample");
+            goto exit;
+        }
+
+        /* Without a sample, everything goes to the last rank. */
+        for (size_t i = 0; i < (size_t) world_size - 1; i++) {
+            if (sample_len) {
+                const elem_t *elem = &buf[sample_len * (i + 1) / world_size];
+                samples[i].key = elem->key;
+                samples[i].orp_id = elem->orp_id;
+            } else {
+                samples[i].key = UINT64_MAX;
+                samples[i].orp_id = UINT64_MAX;
+            }
+        }
+
+        for (int i = 1; i < world_size; i++) {
+            ret =
+                mpi_tls_send_bytes(samples,
+                        (world_size - 1) * sizeof(*samples), i,
+                        QUICKSELECT_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending samples from %d to %d", 0,
+                        i);
+                goto exit;
+            }
+        }
+    } else {
+        ret =
+            mpi_tls_recv_bytes(samples, (world_size - 1) * sizeof(*samples),
+                    0, QUICKSELECT_MPI_TAG, MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error receiving samples from %d into %d", 0,
+                    world_rank);
+            goto exit;
+        }
     }
 
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* The state of the partition exchange. */
+struct extmem_exchange {
+    struct extmem_stream *writer;
+    elem_t *send_pages;
+    elem_t *recv_pages;
+    size_t page_len;
+    size_t *send_fills;
+    size_t *recv_left;
+    mpi_tls_request_t *requests;
+};
+
+/* Waits for one of the exchange's requests, the first WORLD_SIZE of which are
+ * sends and the rest receives, and writes any elements received. */
+static int progress_extmem_exchange(struct extmem_exchange *exchange) {
+    size_t index;
+    mpi_tls_status_t status;
+    int ret;
+
+    ret =
+        mpi_tls_waitany(world_size * 2, exchange->requests, &index, &status);
+    if (ret) {
+        handle_error_string("Error waiting on partition requests");
+        goto exit;
+    }
+
+    if (index < (size_t) world_size) {
+        exchange->requests[index].type = MPI_TLS_NULL;
+        ret = 0;
+        goto exit;
+    }
+
+    /* Write the received elements and receive more, if any are left. */
+    int rank = index - world_size;
+    elem_t *page = exchange->recv_pages + rank * exchange->page_len;
+    size_t num_received = status.count / sizeof(*page);
+    if (num_received > exchange->recv_left[rank]) {
+        handle_error_string("Received too many partitioned elements from %d",
+                rank);
+        ret = -1;
+        goto exit;
+    }
+    ret = extmem_stream_write(exchange->writer, page, num_received);
+    if (ret) {
+        handle_error_string("Error writing partitioned elements");
+        goto exit;
+    }
+    exchange->recv_left[rank] -= num_received;
+    if (exchange->recv_left[rank]) {
+        ret =
+            mpi_tls_irecv_bytes(page, exchange->page_len * sizeof(*page), rank,
+                    SAMPLE_PARTITION_DISTRIBUTE_MPI_TAG,
+                    &exchange->requests[index]);
+        if (ret) {
+            handle_error_string("Error receiving partitioned data");
+            goto exit;
+        }
+    } else {
+        exchange->requests[index].type = MPI_TLS_NULL;
+    }
+
+exit:
+    return ret;
+}
+
+/* Sends the elements gathered for RANK, once the previous send to RANK has
+ * completed, so that each rank has at most one message in flight to each
+ * other rank. */
+static int flush_extmem_exchange(struct extmem_exchange *exchange, int rank) {
+    int ret;
+
+    while (exchange->requests[rank].type != MPI_TLS_NULL) {
+        ret = progress_extmem_exchange(exchange);
+        if (ret) {
+            goto exit;
+        }
+    }
+
+    ret =
+        mpi_tls_isend_bytes(exchange->send_pages + rank * exchange->page_len,
+                exchange->send_fills[rank] * sizeof(elem_t), rank,
+                SAMPLE_PARTITION_DISTRIBUTE_MPI_TAG, &exchange->requests[rank]);
+    if (ret) {
+        handle_error_string("Error sending partitioned data");
+        goto exit;
+    }
+    exchange->send_fills[rank] = 0;
+
+exit:
+    return ret;
+}
+
+/* Sends each of the LENGTH elements in SRC to the rank whose partition it
+ * falls into by SAMPLES, a block at a time through BLOCK, and writes the
+ * elements that belong to this rank to DST, which must have room for the sum
+ * of RECV_COUNTS. */
+static int exchange_extmem_partitions(struct extmem_store *src, size_t length,
+        const struct sample *samples, const size_t *recv_counts,
+        struct extmem_store *dst, elem_t *block, size_t block_len,
+        elem_t *pages) {
+    size_t page_len = src->block_len / sizeof(elem_t);
+    size_t send_fills[world_size];
+    size_t recv_left[world_size];
+    mpi_tls_request_t requests[world_size * 2];
+    struct extmem_stream reader;
+    struct extmem_stream writer;
+    int ret;
+
+    extmem_stream_init(&reader, src, pages, 0);
+    extmem_stream_init(&writer, dst, pages + page_len, 0);
+    struct extmem_exchange exchange = {
+        .writer = &writer,
+        .send_pages = pages + 2 * page_len,
+        .recv_pages = pages + (2 + world_size) * page_len,
+        .page_len = page_len,
+        .send_fills = send_fills,
+        .recv_left = recv_left,
+        .requests = requests,
+    };
+
+    /* Post a receive from every rank that sends to us. */
+    for (int i = 0; i < world_size; i++) {
+        send_fills[i] = 0;
+        recv_left[i] = i == world_rank ? 0 : recv_counts[i];
+        requests[i].type = MPI_TLS_NULL;
+        if (recv_left[i]) {
+            ret =
+                mpi_tls_irecv_bytes(exchange.recv_pages + i * page_len,
+                        page_len * sizeof(elem_t), i,
+                        SAMPLE_PARTITION_DISTRIBUTE_MPI_TAG,
+                        &requests[world_size + i]);
+            if (ret) {
+                handle_error_string("Error receiving partitioned data");
+                goto exit;
+            }
+        } else {
+            requests[world_size + i].type = MPI_TLS_NULL;
+        }
+    }
+
+    /* Route the elements a block at a time, sending each rank's page once it
+     * fills. */
+    for (size_t start = 0; start < length; start += block_len) {
+        size_t num_elems = MIN(block_len, length - start);
+        ret = extmem_stream_read(&reader, block, num_elems);
+        if (ret) {
+            handle_error_string("Error reading elements to partition");
+            goto exit;
+        }
+        for (size_t i = 0; i < num_elems; i++) {
+            int rank = get_partition(&block[i], samples);
+            if (rank == world_rank) {
+                ret = extmem_stream_write(&writer, &block[i], 1);
+                if (ret) {
+                    handle_error_string("Error writing partitioned elements");
+                    goto exit;
+                }
+                continue;
+            }
+
+            memcpy(&exchange.send_pages[rank * page_len + send_fills[rank]],
+                    &block[i], sizeof(*block));
+            send_fills[rank]++;
+            if (send_fills[rank] == page_len) {
+                ret = flush_extmem_exchange(&exchange, rank);
+                if (ret) {
+                    goto exit;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < world_size; i++) {
+        if (send_fills[i]) {
+            ret = flush_extmem_exchange(&exchange, i);
+            if (ret) {
+                goto exit;
+            }
+        }
+    }
+
+    /* Finish the remaining sends and receives. */
+    for (;;) {
+        bool pending = false;
+        for (int i = 0; i < world_size * 2; i++) {
+            pending = pending || requests[i].type != MPI_TLS_NULL;
+        }
+        if (!pending) {
+            break;
+        }
+        ret = progress_extmem_exchange(&exchange);
+        if (ret) {
+            goto exit;
+        }
+    }
+
+    ret = extmem_stream_flush(&writer);
+    if (ret) {
+        handle_error_string("Error writing partitioned elements");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+/* Moves the element at the top of HEAP, which holds HEAP_LEN indices into
+ * RUNS ordered by each run's next element, down to its place, starting at
+ * IDX. */
+static void sift_down_runs(size_t *heap, size_t heap_len, size_t idx,
+        struct extmem_stream *runs) {
+    for (;;) {
+        size_t smallest = idx;
+        for (size_t child = idx * 2 + 1;
+                child < MIN(idx * 2 + 3, heap_len); child++) {
+            if (mergesort_comparator(extmem_stream_peek(&runs[heap[child]]),
+                        extmem_stream_peek(&runs[heap[smallest]]), NULL)
+                    < 0) {
+                smallest = child;
+            }
+        }
+        if (smallest == idx) {
+            break;
+        }
+        size_t temp = heap[idx];
+        heap[idx] = heap[smallest];
+        heap[smallest] = temp;
+        idx = smallest;
+    }
+}
+
+/* Merges each FAN_IN consecutive sorted runs of RUN_LEN of the LENGTH elements
+ * in SRC into one run in DST. Each run is read through its own page of
+ * RUN_PAGES, and the output is written through OUT_PAGE. */
+static int merge_extmem_runs(struct extmem_store *src,
+        struct extmem_store *dst, size_t length, size_t run_len,
+        size_t fan_in, elem_t *run_pages, elem_t *out_page,
+        struct extmem_stream *runs, size_t *run_ends, size_t *heap) {
+    size_t page_len = src->block_len / sizeof(elem_t);
+    struct extmem_stream writer;
+    int ret;
+
+    extmem_stream_init(&writer, dst, out_page, 0);
+
+    for (size_t group_start = 0; group_start < length;
+            group_start += run_len * fan_in) {
+        /* Open the group's runs, loading each one's first element. */
+        size_t heap_len = 0;
+        for (size_t i = 0; i < fan_in; i++) {
+            size_t run_start = group_start + i * run_len;
+            if (run_start >= length) {
+                break;
+            }
+            extmem_stream_init(&runs[i], src, run_pages + i * page_len,
+                    run_start);
+            run_ends[i] = MIN(run_start + run_len, length);
+            if (!extmem_stream_peek(&runs[i])) {
+                handle_error_string("Error reading run");
+                ret = -1;
+                goto exit;
+            }
+            heap[heap_len] = i;
+            heap_len++;
+        }
+        for (size_t i = heap_len / 2; i-- > 0;) {
+            sift_down_runs(heap, heap_len, i, runs);
+        }
+
+        /* Repeatedly move the lowest next element to the output. */
+        while (heap_len) {
+            size_t run = heap[0];
+            elem_t elem;
+            ret = extmem_stream_read(&runs[run], &elem, 1);
+            if (ret) {
+                handle_error_string("Error reading run");
+                goto exit;
+            }
+            ret = extmem_stream_write(&writer, &elem, 1);
+            if (ret) {
+                handle_error_string("Error writing merged run");
+                goto exit;
+            }
+
+            if (runs[run].idx == run_ends[run]) {
+                heap_len--;
+                heap[0] = heap[heap_len];
+            } else if (!extmem_stream_peek(&runs[run])) {
+                handle_error_string("Error reading run");
+                ret = -1;
+                goto exit;
+            }
+            sift_down_runs(heap, heap_len, 0, runs);
+        }
+    }
+
+    ret = extmem_stream_flush(&writer);
+    if (ret) {
+        handle_error_string("Error writing merged run");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+/* Sorts the LENGTH elements in STORES[0], passing them back and forth between
+ * STORES[0] and STORES[1], except that the last pass writes to DST instead if
+ * DST is not NULL. The first pass sorts runs of BLOCK_LEN elements in BLOCK
+ * and BUF, and each later pass merges as many runs as BLOCK has pages. Sets
+ * *SORTED to the store holding the sorted elements. */
+static int extmem_mergesort(struct extmem_store *stores[2], size_t length,
+        struct extmem_store *dst, elem_t *block, elem_t *buf,
+        size_t block_len, elem_t *pages, size_t num_threads,
+        struct extmem_store **sorted) {
+    size_t page_len = stores[0]->block_len / sizeof(elem_t);
+    size_t fan_in = block_len / page_len;
+    int ret;
+
+    /* Sort runs of a block each. */
+    struct extmem_store *in = stores[0];
+    struct extmem_store *out = block_len >= length && dst ? dst : stores[1];
+    ret = extmem_rekey(out);
+    if (ret) {
+        goto exit;
+    }
+    struct extmem_stream reader;
+    struct extmem_stream writer;
+    extmem_stream_init(&reader, in, pages, 0);
+    extmem_stream_init(&writer, out, pages + page_len, 0);
+    for (size_t start = 0; start < length; start += block_len) {
+        size_t run_len = MIN(block_len, length - start);
+        ret = extmem_stream_read(&reader, block, run_len);
+        if (ret) {
+            handle_error_string("Error reading run");
+            goto exit;
+        }
+        ret = mergesort(block, buf, run_len, num_threads);
+        if (ret) {
+            handle_error_string("Error in non-oblivious local sort");
+            goto exit;
+        }
+        ret = extmem_stream_write(&writer, buf, run_len);
+        if (ret) {
+            handle_error_string("Error writing run");
+            goto exit;
+        }
+    }
+    ret = extmem_stream_flush(&writer);
+    if (ret) {
+        handle_error_string("Error writing run");
+        goto exit;
+    }
+    in = out;
+
+    if (block_len >= length) {
+        *sorted = in;
+        ret = 0;
+        goto exit;
+    }
+
+    /* Merge the runs until one is left. */
+    void *merge_state =
+        mem_alloc(MEM_SCRATCH,
+                fan_in * (sizeof(struct extmem_stream) + 2 * sizeof(size_t)));
+    if (!merge_state) {
+        perror("malloc merge state");
+        ret = -1;
+        goto exit;
+    }
+    struct extmem_stream *runs = merge_state;
+    size_t *run_ends = (size_t *) (runs + fan_in);
+    size_t *heap = run_ends + fan_in;
+    for (size_t run_len = block_len; run_len < length; run_len *= fan_in) {
+        if (run_len * fan_in >= length && dst) {
+            out = dst;
+        } else {
+            out = in == stores[0] ? stores[1] : stores[0];
+        }
+        ret = extmem_rekey(out);
+        if (ret) {
+            goto exit_free_merge_state;
+        }
+        ret =
+            merge_extmem_runs(in, out, length, run_len, fan_in, block, buf,
+                    runs, run_ends, heap);
+        if (ret) {
+            goto exit_free_merge_state;
+        }
+        in = out;
+    }
+    *sorted = in;
+
+    ret = 0;
+
+exit_free_merge_state:
+    mem_free(merge_state);
+exit:
+    return ret;
+}
+
+/* Moves the sorted IN_LENGTH elements in SRC to the ranks that hold them once
+ * balanced, writing the DST_LENGTH elements from index DST_START onwards to
+ * DST. Every rank works through its pieces in the order of the elements'
+ * final indices, with one send and one receive in flight at a time, which
+ * keeps the messages in flight to a page per rank without deadlocking, since
+ * the rank any piece waits on is always working on an earlier piece. */
+static int balance_extmem(struct extmem_store *src, size_t in_length,
+        struct extmem_store *dst, size_t dst_start, size_t dst_length,
+        elem_t *pages) {
+    size_t page_len = src->block_len / sizeof(elem_t);
+    size_t rank_cum_idxs[world_size + 1];
+    size_t rank_out_starts[world_size + 1];
+    mpi_tls_request_t requests[2];
+    struct extmem_stream reader;
+    struct extmem_stream self_reader;
+    struct extmem_stream writer;
+    elem_t *send_page = pages + 3 * page_len;
+    elem_t *recv_page = pages + 4 * page_len;
+    int ret;
+
+    ret =
+        gather_rank_idxs(in_length, dst_start, rank_cum_idxs,
+                rank_out_starts);
+    if (ret) {
+        goto exit;
+    }
+    size_t in_start = rank_cum_idxs[world_rank];
+    size_t in_end = rank_cum_idxs[world_rank + 1];
+    size_t out_end = dst_start + dst_length;
+    if (out_end != rank_out_starts[world_rank + 1]) {
+        handle_error_string("Ranks disagree on the output layout");
+        ret = -1;
+        goto exit;
+    }
+
+    ret = extmem_rekey(dst);
+    if (ret) {
+        goto exit;
+    }
+    extmem_stream_init(&writer, dst, pages + 2 * page_len, 0);
+
+    /* The next piece to send and the next to receive, as global indices. */
+    int send_rank = -1;
+    size_t send_idx = 0;
+    size_t send_end = 0;
+    int recv_rank = -1;
+    size_t recv_idx = 0;
+    size_t recv_end = 0;
+    size_t recv_len = 0;
+    requests[0].type = MPI_TLS_NULL;
+    requests[1].type = MPI_TLS_NULL;
+
+    for (;;) {
+        /* Move on to the next nonempty pieces. */
+        while (send_idx == send_end && send_rank < world_size) {
+            send_rank++;
+            if (send_rank == world_rank || send_rank == world_size) {
+                continue;
+            }
+            send_idx = MAX(in_start, rank_out_starts[send_rank]);
+            send_end =
+                MAX(MIN(in_end, rank_out_starts[send_rank + 1]), send_idx);
+            extmem_stream_init(&reader, src, pages, send_idx - in_start);
+        }
+        while (recv_idx == recv_end && recv_rank < world_size) {
+            recv_rank++;
+            if (recv_rank == world_size) {
+                continue;
+            }
+            recv_idx = MAX(dst_start, rank_cum_idxs[recv_rank]);
+            recv_end =
+                MAX(MIN(out_end, rank_cum_idxs[recv_rank + 1]), recv_idx);
+        }
+
+        /* Post the next send. */
+        if (requests[0].type == MPI_TLS_NULL && send_idx < send_end) {
+            size_t num_elems = MIN(page_len, send_end - send_idx);
+            ret = extmem_stream_read(&reader, send_page, num_elems);
+            if (ret) {
+                handle_error_string("Error reading balance elements");
+                goto exit;
+            }
+            ret =
+                mpi_tls_isend_bytes(send_page, num_elems * sizeof(*send_page),
+                        send_rank, BALANCE_MPI_TAG, &requests[0]);
+            if (ret) {
+                handle_error_string(
+                        "Error sending balance elements from %d to %d",
+                        world_rank, send_rank);
+                goto exit;
+            }
+            send_idx += num_elems;
+        }
+
+        /* Copy our own piece, or post the next receive. */
+        if (requests[1].type == MPI_TLS_NULL && recv_idx < recv_end) {
+            if (recv_rank == world_rank) {
+                extmem_stream_init(&self_reader, src, pages + page_len,
+                        recv_idx - in_start);
+                while (recv_idx < recv_end) {
+                    size_t num_elems = MIN(page_len, recv_end - recv_idx);
+                    ret =
+                        extmem_stream_read(&self_reader, recv_page,
+                                num_elems);
+                    if (ret) {
+                        handle_error_string("Error reading balance elements");
+                        goto exit;
+                    }
+                    ret = extmem_stream_write(&writer, recv_page, num_elems);
+                    if (ret) {
+                        handle_error_string("Error writing balance elements");
+                        goto exit;
+                    }
+                    recv_idx += num_elems;
+                }
+                continue;
+            }
+
+            recv_len = MIN(page_len, recv_end - recv_idx);
+            ret =
+                mpi_tls_irecv_bytes(recv_page, recv_len * sizeof(*recv_page),
+                        recv_rank, BALANCE_MPI_TAG, &requests[1]);
+            if (ret) {
+                handle_error_string(
+                        "Error receiving balance elements from %d into %d",
+                        recv_rank, world_rank);
+                goto exit;
+            }
+        }
+
+        if (requests[0].type == MPI_TLS_NULL
+                && requests[1].type == MPI_TLS_NULL) {
+            break;
+        }
+
+        size_t index;
+        mpi_tls_status_t status;
+        ret = mpi_tls_waitany(2, requests, &index, &status);
+        if (ret) {
+            handle_error_string("Error waiting on balance MPI requests");
+            goto exit;
+        }
+        requests[index].type = MPI_TLS_NULL;
+        if (index == 1) {
+            ret = extmem_stream_write(&writer, recv_page, recv_len);
+            if (ret) {
+                handle_error_string("Error writing balance elements");
+                goto exit;
+            }
+            recv_idx += recv_len;
+        }
+    }
+
+    ret = extmem_stream_flush(&writer);
+    if (ret) {
+        handle_error_string("Error writing balance elements");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+/* Sorts the SRC_LENGTH elements in SRC across all enclaves into DST, as
+ * described for nonoblivious_sort_extmem, with PAGES for streaming. */
+static int distributed_sort_extmem(struct extmem_store *src,
+        size_t src_length, struct extmem_store *dst, size_t dst_start,
+        size_t dst_length, elem_t *block, elem_t *buf, size_t block_len,
+        elem_t *pages, size_t num_threads) {
+    size_t page_len = src->block_len / sizeof(elem_t);
+    struct sample samples[world_size - 1];
+    size_t send_counts[world_size];
+    size_t recv_counts[world_size];
+    struct extmem_store partitions[2];
+    int ret;
+
+    /* This should never be called if this is a single-enclave sort. */
+    assert(world_size > 1);
+
+    span_t span = span_begin("sample_partition");
+
+    ret =
+        get_extmem_samples(src, src_length, block, buf, block_len, pages,
+                samples, num_threads);
+    if (ret) {
+        goto exit;
+    }
+
+    /* Count the elements bound for each rank. */
+    memset(send_counts, '\0', sizeof(send_counts));
+    struct extmem_stream reader;
+    extmem_stream_init(&reader, src, pages, 0);
+    for (size_t start = 0; start < src_length; start += block_len) {
+        size_t num_elems = MIN(block_len, src_length - start);
+        ret = extmem_stream_read(&reader, block, num_elems);
+        if (ret) {
+            handle_error_string("Error reading elements to partition");
+            goto exit;
+        }
+        for (size_t i = 0; i < num_elems; i++) {
+            send_counts[get_partition(&block[i], samples)]++;
+        }
+    }
+
+    ret = exchange_counts(send_counts, recv_counts);
+    if (ret) {
+        goto exit;
+    }
+    size_t partition_length = 0;
+    for (int i = 0; i < world_size; i++) {
+        partition_length += recv_counts[i];
+    }
+
+    /* Partition the elements into a new pair of stores, since a partition may
+     * hold more elements than this rank's buckets. */
+    size_t num_pages = MAX(CEIL_DIV(partition_length, page_len), 1);
+    ret = extmem_init(&partitions[0], num_pages, src->block_len);
+    if (ret) {
+        handle_error_string("Error initializing partition store");
+        goto exit;
+    }
+    ret = extmem_init(&partitions[1], num_pages, src->block_len);
+    if (ret) {
+        handle_error_string("Error initializing partition store");
+        goto exit_free_partition0;
+    }
+
+    ret =
+        exchange_extmem_partitions(src, src_length, samples, recv_counts,
+                &partitions[0], block, block_len, pages);
+    if (ret) {
+        handle_error_string("Error sending and receiving partitions");
+        goto exit_free_partitions;
+    }
+
+    span_end(span);
+    span = span_begin("local_sort");
+
+    struct extmem_store *stores[2] = { &partitions[0], &partitions[1] };
+    struct extmem_store *sorted;
+    ret =
+        extmem_mergesort(stores, partition_length, NULL, block, buf,
+                block_len, pages, num_threads, &sorted);
+    if (ret) {
+        handle_error_string("Error in non-oblivious local sort");
+        goto exit_free_partitions;
+    }
+
+    span_end(span);
+    span = span_begin("balance");
+
+    ret =
+        balance_extmem(sorted, partition_length, dst, dst_start, dst_length,
+                pages);
+    if (ret) {
+        handle_error_string("Error in non-oblivious balancing");
+        goto exit_free_partitions;
+    }
+
+    span_end(span);
+
+exit_free_partitions:
+    extmem_free(&partitions[1]);
+exit_free_partition0:
+    extmem_free(&partitions[0]);
+exit:
+    return ret;
+}
+
+int nonoblivious_sort_extmem(struct extmem_store *src,
+        struct extmem_store *tmp, size_t src_length, struct extmem_store *dst,
+        size_t dst_start, size_t dst_length, elem_t *block, elem_t *buf,
+        size_t block_len, size_t num_threads) {
+    size_t page_len = src->block_len / sizeof(elem_t);
+    int ret;
+
+    elem_t *pages =
+        mem_alloc(MEM_SCRATCH,
+                get_extmem_num_pages() * page_len * sizeof(*pages));
+    if (!pages) {
+        perror("malloc extmem pages");
+        ret = -1;
+        goto exit;
+    }
+
+    if (world_size > 1) {
+        ret =
+            distributed_sort_extmem(src, src_length, dst, dst_start,
+                    dst_length, block, buf, block_len, pages, num_threads);
+        goto exit_free_pages;
+    }
+
+    if (src_length != dst_length) {
+        handle_error_string("%zu elements do not match %zu elements",
+                src_length, dst_length);
+        ret = -1;
+        goto exit_free_pages;
+    }
+
+    span_t span = span_begin("local_sort");
+
+    struct extmem_store *stores[2] = { src, tmp };
+    struct extmem_store *sorted;
+    ret =
+        extmem_mergesort(stores, src_length, dst, block, buf, block_len,
+                pages, num_threads, &sorted);
+    if (ret) {
+        handle_error_string("Error in non-oblivious local sort");
+        goto exit_free_pages;
+    }
+
+    span_end(span);
+
+exit_free_pages:
+    mem_free(pages);
 exit:
     return ret;
 }
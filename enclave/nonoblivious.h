@@ -3,8 +3,29 @@
 
 #include <stddef.h>
 #include "common/elem_t.h"
+#include "enclave/extmem.h"
 
+size_t nonoblivious_scratch_size(void);
+
+/* Sorts the LOCAL_LENGTH elements in ARR across all enclaves, where LENGTH is
+ * the total number of elements, leaving this enclave's share of the sorted
+ * output in BUF. ARR and BUF must each have room for CAPACITY elements, which
+ * bounds how unevenly the sample partitioning may split the elements. */
 int nonoblivious_sort(elem_t *arr, elem_t *buf, size_t length,
-        size_t local_length, size_t num_threads);
+        size_t local_length, size_t capacity, size_t num_threads);
+
+/* Like nonoblivious_sort, but with the elements in stores in host memory,
+ * whose blocks each hold a page of elements, streamed through BLOCK and BUF,
+ * each of BLOCK_LEN elements, a multiple of the page length. Sorts the
+ * SRC_LENGTH elements in SRC across all enclaves and rewrites DST with this
+ * enclave's share of the sorted output, the DST_LENGTH elements starting at
+ * index DST_START. TMP must have as many blocks as SRC. The contents of SRC
+ * and TMP are lost. Besides BLOCK and BUF, the enclave only allocates
+ * nonoblivious_extmem_scratch_size bytes, however many elements there are. */
+size_t nonoblivious_extmem_scratch_size(size_t page_len, size_t block_len);
+int nonoblivious_sort_extmem(struct extmem_store *src,
+        struct extmem_store *tmp, size_t src_length, struct extmem_store *dst,
+        size_t dst_start, size_t dst_length, elem_t *block, elem_t *buf,
+        size_t block_len, size_t num_threads);
 
 #endif /* distributed-sgx-sort/enclave/nonoblivious.h */
@@ -8,20 +8,27 @@
 #include "common/defs.h"
 #include "common/elem_t.h"
 #include "common/error.h"
+#include "enclave/arena.h"
 #include "enclave/bucket.h"
 #include "enclave/mpi_tls.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/params.h"
 #include "enclave/threading.h"
 
-#define SWAP_CHUNK_SIZE 4096
+#define SWAP_CHUNK_SIZE (sort_params.ojoin_chunk_size)
 
 static thread_local elem_t *buffer;
 
+size_t ojoin_scratch_size(void) {
+    /* The buffer doubles as the bucket sort's. */
+    return bucket_scratch_size();
+}
+
 int ojoin_init(void) {
     int ret;
 
     /* Allocate buffer. */
-    buffer = malloc(BUCKET_SIZE * MAX(SWAP_CHUNK_BUCKETS, 2) * sizeof(*buffer));
+    buffer = arena_alloc(ojoin_scratch_size());
     if (!buffer) {
         perror("malloc buffer");
         ret = errno;
@@ -37,7 +44,7 @@ exit:
 }
 
 void ojoin_free(void) {
-    free(buffer);
+    arena_free(buffer);
 }
 
 /* Array index and world rank relationship helpers. */
@@ -3,9 +3,11 @@
 
 #include <stddef.h>
 #include "common/elem_t.h"
+#include "enclave/params.h"
 
-#define BUCKET_SIZE 512
+#define BUCKET_SIZE (sort_params.bucket_size)
 
+size_t ojoin_scratch_size(void);
 int ojoin_init(void);
 void ojoin_free(void);
 int ojoin(elem_t *arr, size_t length, size_t join_length, size_t num_threads);
@@ -9,9 +9,13 @@
 #include "common/defs.h"
 #include "common/elem_t.h"
 #include "common/error.h"
+#include "common/mem.h"
 #include "common/util.h"
+#include "enclave/mem.h"
 #include "enclave/mpi_tls.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/params.h"
+#include "enclave/span.h"
 #include "enclave/threading.h"
 
 /* Array index and world rank relationship helpers. */
@@ -174,7 +178,7 @@ static void local_bitonic_sort(void *args_) {
     }
 }
 
-#define CHUNK_SIZE 4096
+#define CHUNK_SIZE (sort_params.opaque_chunk_size)
 
 static int transpose(elem_t *arr, elem_t *out, size_t local_length,
         bool reverse) {
@@ -183,7 +187,8 @@ static int transpose(elem_t *arr, elem_t *out, size_t local_length,
     size_t requests_len = world_size;
     int ret;
 
-    elem_t (*bufs)[CHUNK_SIZE] = malloc(world_size * sizeof(*bufs));
+    elem_t (*bufs)[CHUNK_SIZE] =
+        mem_alloc(MEM_SCRATCH, world_size * sizeof(*bufs));
     if (!bufs) {
         ret = -1;
         goto exit;
@@ -283,12 +288,12 @@ static int transpose(elem_t *arr, elem_t *out, size_t local_length,
             if (offsets[index] < local_length / world_size) {
                 /* Send elements with stride of world_size. */
                 size_t elems_to_decrypt =
-                        MIN(CEIL_DIV(local_length - offsets[index], world_size),
+                        MIN(local_length / world_size - offsets[index],
                                 CHUNK_SIZE);
                 for (size_t i = 0; i < elems_to_decrypt; i++) {
                     size_t decrypt_offset =
                         !reverse
-                            ? offsets[index] + i * world_size
+                            ? index + (offsets[index] + i) * world_size
                             : index * local_length / world_size + offsets[index] + i;
                     memcpy(&bufs[index][i], &arr[decrypt_offset],
                             sizeof(bufs[index][i]));
@@ -314,7 +319,7 @@ static int transpose(elem_t *arr, elem_t *out, size_t local_length,
     }
 
 exit_free_bufs:
-    free(bufs);
+    mem_free(bufs);
 exit:
     return ret;
 }
@@ -443,12 +448,7 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
     elem_t *buf = arr + local_length;
     int ret;
 
-    struct timespec time_start;
-    if (clock_gettime(CLOCK_REALTIME, &time_start)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_t span = span_begin("column-localsort1");
 
     /* Step 1: Local sort. */
     {
@@ -461,17 +461,14 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         local_bitonic_sort(&sort_args);
     }
 
+    span_end(span);
+
     if (world_size == 1) {
         ret = 0;
         goto exit;
     }
 
-    struct timespec time_localsort1;
-    if (clock_gettime(CLOCK_REALTIME, &time_localsort1)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span = span_begin("column-transpose1");
 
     /* Step 2: Transpose. */
     ret = transpose(arr, buf, local_length, false);
@@ -480,12 +477,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         goto exit;
     }
 
-    struct timespec time_transpose1;
-    if (clock_gettime(CLOCK_REALTIME, &time_transpose1)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-localsort2");
 
     /* Step 3: Local sort. */
     {
@@ -498,12 +491,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         local_bitonic_sort(&sort_args);
     }
 
-    struct timespec time_localsort2;
-    if (clock_gettime(CLOCK_REALTIME, &time_localsort2)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-transpose2");
 
     /* Step 4: Transpose. */
     ret = transpose(buf, arr, local_length, true);
@@ -512,12 +501,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         goto exit;
     }
 
-    struct timespec time_transpose2;
-    if (clock_gettime(CLOCK_REALTIME, &time_transpose2)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-localsort3");
 
     /* Step 5: Local sort. */
     {
@@ -530,12 +515,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         local_bitonic_sort(&sort_args);
     }
 
-    struct timespec time_localsort3;
-    if (clock_gettime(CLOCK_REALTIME, &time_localsort3)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-backshift");
 
     /* Step 6: Back shift. */
     ret = back_shift(arr, buf, local_length, false);
@@ -544,12 +525,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         goto exit;
     }
 
-    struct timespec time_backshift;
-    if (clock_gettime(CLOCK_REALTIME, &time_backshift)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-localsort4");
 
     /* Step 7: Local sort. */
     {
@@ -562,12 +539,8 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         local_bitonic_sort(&sort_args);
     }
 
-    struct timespec time_localsort4;
-    if (clock_gettime(CLOCK_REALTIME, &time_localsort4)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
+    span_end(span);
+    span = span_begin("column-forwardshift");
 
     /* Step 8: Forward shift. */
     ret = back_shift(buf, arr, local_length, true);
@@ -576,31 +549,7 @@ int opaque_sort(elem_t *arr, size_t length, size_t num_threads) {
         goto exit;
     }
 
-    struct timespec time_forwardshift;
-    if (clock_gettime(CLOCK_REALTIME, &time_forwardshift)) {
-        handle_error_string("Error getitng time");
-        ret = errno;
-        goto exit;
-    }
-
-    if (world_rank == 0) {
-        printf("column-localsort1  : %f\n",
-                get_time_difference(&time_start, &time_localsort1));
-        printf("column-transpose1  : %f\n",
-                get_time_difference(&time_localsort1, &time_transpose1));
-        printf("column-localsort2  : %f\n",
-                get_time_difference(&time_transpose1, &time_localsort2));
-        printf("column-transpose2  : %f\n",
-                get_time_difference(&time_localsort2, &time_transpose2));
-        printf("column-localsort3  : %f\n",
-                get_time_difference(&time_transpose2, &time_localsort3));
-        printf("column-backshift   : %f\n",
-                get_time_difference(&time_localsort3, &time_backshift));
-        printf("column-localsort4  : %f\n",
-                get_time_difference(&time_backshift, &time_localsort4));
-        printf("column-forwardshift: %f\n",
-                get_time_difference(&time_localsort4, &time_forwardshift));
-    }
+    span_end(span);
 
 
 exit:
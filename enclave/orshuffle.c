@@ -14,23 +14,29 @@
 #include "common/defs.h"
 #include "common/error.h"
 #include "common/util.h"
+#include "enclave/arena.h"
 #include "enclave/crypto.h"
 #include "enclave/mpi_tls.h"
 #include "enclave/nonoblivious.h"
+#include "enclave/output.h"
 #include "enclave/parallel_enc.h"
+#include "enclave/params.h"
+#include "enclave/span.h"
 #include "enclave/threading.h"
 
-#define SWAP_CHUNK_SIZE 4096
+#define SWAP_CHUNK_SIZE (sort_params.orshuffle_chunk_size)
 #define MARK_COINS 2048
 
-static size_t total_length;
-
 static thread_local elem_t *buffer;
 
+size_t orshuffle_scratch_size(void) {
+    return SWAP_CHUNK_SIZE * sizeof(*buffer);
+}
+
 int orshuffle_init(void) {
     int ret;
 
-    buffer = malloc(SWAP_CHUNK_SIZE * sizeof(*buffer));
+    buffer = arena_alloc(orshuffle_scratch_size());
     if (!buffer) {
         perror("malloc buffer");
         ret = errno;
@@ -44,17 +50,17 @@ exit:
 }
 
 void orshuffle_free(void) {
-    free(buffer);
+    arena_free(buffer);
 }
 
 /* Array index and world rank relationship helpers. */
 
 static int get_index_address(size_t index) {
-    return index * world_size / total_length;
+    return index * world_size / current_job->total_length;
 }
 
 static size_t get_local_start(int rank) {
-    return (rank * total_length + world_size - 1) / world_size;
+    return (rank * current_job->total_length + world_size - 1) / world_size;
 }
 
 /* Marking helper. */
@@ -126,20 +132,25 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
         (offset % (length / 2) + left_marked_count >= length / 2) != (offset >= length / 2);
 
     /* Swap elems in maximum chunk sizes of SWAP_CHUNK_SIZE and iterate until no
-     * count is remaining. */
+     * count is remaining. The remote splits the range between its threads the
+     * same way, so each chunk is tagged by the thread and the chunk's index
+     * within the thread's share. The index wraps to keep the tags below the
+     * job's stride, which is safe since each thread waits for one chunk before
+     * exchanging the next. */
     size_t start = thread_idx * count / num_threads;
     size_t end = (thread_idx + 1) * count / num_threads;
     size_t our_local_idx = local_idx + start;
     size_t our_remote_idx = remote_idx + start;
     size_t our_count = end - start;
-    while (our_count) {
+    size_t num_chunk_tags = mpi_tls_job_tag_stride / num_threads;
+    for (size_t chunk_idx = 0; our_count; chunk_idx++) {
         size_t elems_to_swap = MIN(our_count, SWAP_CHUNK_SIZE);
+        int tag = chunk_idx % num_chunk_tags * num_threads + thread_idx;
 
         /* Post receive for remote elems to buffer. */
         mpi_tls_request_t request;
         ret = mpi_tls_irecv_bytes(buffer,
-                elems_to_swap * sizeof(*buffer), remote_rank,
-                our_local_idx / SWAP_CHUNK_SIZE, &request);
+                elems_to_swap * sizeof(*buffer), remote_rank, tag, &request);
         if (ret) {
             handle_error_string("Error receiving elem bytes");
             goto exit;
@@ -148,8 +159,7 @@ static void swap_remote_range(void *args_, size_t thread_idx) {
         /* Send local elems to the remote. */
         ret =
             mpi_tls_send_bytes(arr + our_local_idx - local_start,
-                    elems_to_swap * sizeof(*arr), remote_rank,
-                    our_remote_idx / SWAP_CHUNK_SIZE);
+                    elems_to_swap * sizeof(*arr), remote_rank, tag);
         if (ret) {
             handle_error_string("Error sending elem bytes");
             goto exit;
@@ -736,32 +746,30 @@ exit:
 }
 
 int orshuffle_sort(elem_t *arr, size_t length, size_t num_threads) {
-    size_t local_start = length * world_rank / world_size;
-    size_t local_length = length * (world_rank + 1) / world_size - local_start;
+    size_t local_start = get_local_start(world_rank);
+    size_t local_length = get_local_start(world_rank + 1) - local_start;
     int ret;
 
-    struct timespec time_start;
-    if (clock_gettime(CLOCK_REALTIME, &time_start)) {
-        handle_error_string("Error getting time");
-        ret = errno;
+    /* Each thread tags its remote swaps with its own residue modulo
+     * NUM_THREADS, so every thread needs at least one tag below the job's
+     * stride. */
+    if (num_threads > (size_t) mpi_tls_job_tag_stride) {
+        handle_error_string("%zu threads need more than the job's %d MPI tags",
+                num_threads, mpi_tls_job_tag_stride);
+        ret = -1;
         goto exit;
     }
 
-    total_length = length;
+    span_t span = span_begin("shuffle");
 
-    bool *marked = malloc(local_length * sizeof(*marked));
-    if (!marked) {
-        perror("malloc marked arr");
-        ret = errno;
-        goto exit;
-    }
+    /* The marked and prefix sum arrays are only needed for the shuffle, so
+     * carve them out of the second half of the array given to us, which is
+     * unused until the nonoblivious sort below. That half holds
+     * MAX(LOCAL_LENGTH * 2, 512) elements, far more than the
+     * LOCAL_LENGTH * (1 + sizeof(size_t)) bytes needed. */
     size_t *marked_prefix_sums =
-        malloc(local_length * sizeof(*marked_prefix_sums));
-    if (!marked_prefix_sums) {
-        perror("malloc marked prefix sums arr");
-        ret = errno;
-        goto exit_free_marked;
-    }
+        (size_t *) (arr + MAX(local_length * 2, 512));
+    bool *marked = (bool *) (marked_prefix_sums + local_length);
 
     struct shuffle_args shuffle_args = {
         .arr = arr,
@@ -775,14 +783,9 @@ int orshuffle_sort(elem_t *arr, size_t length, size_t num_threads) {
     if (shuffle_args.ret) {
         handle_error_string("Error in recursive shuffle");
         ret = shuffle_args.ret;
-        goto exit_free_marked_prefix_sums;
+        goto exit;
     }
 
-    free(marked);
-    marked = NULL;
-    free(marked_prefix_sums);
-    marked_prefix_sums = NULL;
-
     /* Assign random IDs to ensure uniqueness. */
     struct assign_random_id_args assign_random_id_args = {
         .arr = arr,
@@ -805,37 +808,26 @@ int orshuffle_sort(elem_t *arr, size_t length, size_t num_threads) {
     if (assign_random_id_args.ret) {
         handle_error_string("Error assigning random ORP IDs");
         ret = assign_random_id_args.ret;
-        goto exit_free_marked_prefix_sums;
+        goto exit;
     }
 
-    struct timespec time_shuffle;
-    if (clock_gettime(CLOCK_REALTIME, &time_shuffle)) {
-        handle_error_string("Error getting time");
-        ret = errno;
-        goto exit_free_marked_prefix_sums;
-    }
+    span_end(span);
 
     /* Nonoblivious sort. This requires MAX(LOCAL_LENGTH * 2, 512) elements for
      * both the array and buffer, so use the second half of the array given to
      * us (which should be of length MAX(LOCAL_LENGTH * 2, 512) * 2). */
     elem_t *buf = arr + MAX(local_length * 2, 512);
-    ret = nonoblivious_sort(arr, buf, length, local_length, num_threads);
+    output_stage(buf);
+    ret =
+        nonoblivious_sort(arr, buf, length, local_length,
+                MAX(local_length * 2, 512), num_threads);
     if (ret) {
-        goto exit_free_marked_prefix_sums;
+        goto exit;
     }
 
     /* Copy the output to the final output. */
     memcpy(arr, buf, local_length * sizeof(*arr));
 
-    if (world_rank == 0) {
-        printf("shuffle          : %f\n",
-                get_time_difference(&time_start, &time_shuffle));
-    }
-
-exit_free_marked_prefix_sums:
-    free(marked_prefix_sums);
-exit_free_marked:
-    free(marked);
 exit:
     return ret;
 }
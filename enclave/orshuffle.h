@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include "common/elem_t.h"
 
+size_t orshuffle_scratch_size(void);
 int orshuffle_init(void);
 void orshuffle_free(void);
 int orshuffle_sort(elem_t *arr, size_t length, size_t num_threads);
@@ -0,0 +1,339 @@
+#include "enclave/output.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/input.h"
+#include "common/mem.h"
+#include "enclave/crypto.h"
+#include "enclave/extmem.h"
+#include "enclave/mem.h"
+#include "enclave/threading.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/enclave.h>
+#include "enclave/parallel_t.h"
+#endif
+
+/* Sorted output is written in the input file format, one file per rank, so
+ * that the output of one sort can be fed back in as sharded input. Each chunk
+ * is encrypted as soon as all of its elements are in their final position,
+ * by whichever pool thread picks up the chunk's task, and handed to the host,
+ * whose writer thread writes it out. */
+
+static_assert(INPUT_KEY_LEN == KEY_LEN, "Output key must be an AES key");
+
+static unsigned char key[INPUT_KEY_LEN];
+static bool key_set;
+
+struct output_chunk {
+    struct thread_work work;
+    size_t num_final;
+    bool emitted;
+
+    /* The array the chunk is encrypted from. */
+    const elem_t *src;
+};
+
+/* State of the output in progress. STAGING is the array whose marks count,
+ * which is ARR unless the last phase sorts into a buffer that is then copied
+ * over ARR. */
+static elem_t *arr;
+static const elem_t *staging;
+static size_t local_length;
+static struct input_header header;
+static struct output_chunk *chunks;
+static size_t num_chunks;
+static bool failed;
+
+/* For output from external memory, the elements are read from STORE in order
+ * once the sort is done, since they are not in the enclave to be marked
+ * final. */
+static struct extmem_store *store;
+
+int output_set_key(const unsigned char *key_, size_t key_len) {
+    if (key_len != sizeof(key)) {
+        handle_error_string("Output key must be %zu bytes", sizeof(key));
+        return -1;
+    }
+    memcpy(key, key_, sizeof(key));
+    key_set = true;
+    return 0;
+}
+
+static int write_bytes(const void *buf, size_t len, size_t offset) {
+    int ret;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_output_write(&ret, buf, len, offset);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_output_write");
+        return result;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ocall_output_write(buf, len, offset);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    return ret;
+}
+
+/* Sets up the header for this rank's LOCAL_LENGTH_ elements starting at
+ * LOCAL_START and writes it. */
+static int begin(size_t local_start, size_t local_length_,
+        size_t total_length) {
+    int ret;
+
+    if (!key_set) {
+        handle_error_string("No output key set");
+        ret = -1;
+        goto exit;
+    }
+
+    local_length = local_length_;
+    header = (struct input_header) {
+        .version = INPUT_VERSION,
+        .elem_size = sizeof(elem_t),
+        .total_elems = total_length,
+        .first_elem = local_start,
+        .num_elems = local_length,
+        .chunk_elems = INPUT_CHUNK_ELEMS,
+    };
+    memcpy(header.magic, INPUT_MAGIC, INPUT_MAGIC_LEN);
+    num_chunks = input_num_chunks(&header);
+    failed = false;
+
+    ret = write_bytes(&header, sizeof(header), 0);
+    if (ret) {
+        handle_error_string("Error writing output header");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+int output_begin(elem_t *arr_, size_t local_start, size_t local_length_,
+        size_t total_length) {
+    int ret;
+
+    ret = begin(local_start, local_length_, total_length);
+    if (ret) {
+        goto exit;
+    }
+
+    arr = arr_;
+    staging = arr;
+    chunks = mem_calloc(MEM_IO, MAX(num_chunks, 1), sizeof(*chunks));
+    if (!chunks) {
+        perror("malloc output chunks");
+        ret = -1;
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+int output_begin_extmem(struct extmem_store *store_, size_t local_start,
+        size_t local_length_, size_t total_length) {
+    int ret;
+
+    ret = begin(local_start, local_length_, total_length);
+    if (ret) {
+        goto exit;
+    }
+
+    store = store_;
+
+exit:
+    return ret;
+}
+
+/* Encrypts chunk CHUNK_IDX, whose elements are at SRC, and writes it. */
+static int write_chunk(size_t chunk_idx, const elem_t *src) {
+    size_t len = input_chunk_len(&header, chunk_idx);
+    int ret;
+
+    unsigned char *buf = mem_alloc(MEM_IO, len);
+    if (!buf) {
+        perror("malloc output chunk");
+        ret = -1;
+        goto exit;
+    }
+
+    struct input_chunk_header chunk_header = {
+        .chunk_idx = chunk_idx,
+    };
+    ret = rand_read(chunk_header.iv, sizeof(chunk_header.iv));
+    if (ret) {
+        handle_error_string("Error generating output IV");
+        goto exit_free_buf;
+    }
+
+    struct input_chunk_aad aad = {
+        .header = header,
+        .chunk_idx = chunk_idx,
+    };
+    ret = aad_encrypt(key, src,
+            input_chunk_num_elems(&header, chunk_idx) * sizeof(*src), &aad,
+            sizeof(aad), chunk_header.iv, buf + sizeof(chunk_header),
+            chunk_header.tag);
+    if (ret) {
+        handle_error_string("Error encrypting output chunk %zu", chunk_idx);
+        goto exit_free_buf;
+    }
+    memcpy(buf, &chunk_header, sizeof(chunk_header));
+
+    ret = write_bytes(buf, len, input_chunk_offset(&header, chunk_idx));
+    if (ret) {
+        handle_error_string("Error writing output chunk %zu", chunk_idx);
+        goto exit_free_buf;
+    }
+
+exit_free_buf:
+    mem_free(buf);
+exit:
+    return ret;
+}
+
+static void encrypt_chunk(void *chunk_) {
+    struct output_chunk *chunk = chunk_;
+    size_t chunk_idx = chunk - chunks;
+
+    if (write_chunk(chunk_idx, chunk->src + chunk_idx * header.chunk_elems)) {
+        failed = true;
+    }
+}
+
+static void emit_chunk(size_t chunk_idx, const elem_t *src) {
+    struct output_chunk *chunk = &chunks[chunk_idx];
+
+    if (__atomic_exchange_n(&chunk->emitted, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    chunk->src = src;
+    chunk->work.type = THREAD_WORK_SINGLE;
+    chunk->work.single.func = encrypt_chunk;
+    chunk->work.single.arg = chunk;
+    thread_work_push(&chunk->work);
+}
+
+/* Declares that the sort's last phase writes its output to STAGING_, which is
+ * copied over the array being output, unchanged, before the sort returns, so
+ * that elements marked final in STAGING_ are final. STAGING_ must stay intact
+ * until output_end. This is a no-op unless an output is in progress. */
+void output_stage(const elem_t *staging_) {
+    if (!chunks) {
+        return;
+    }
+    staging = staging_;
+}
+
+/* Marks elements BASE[OFFSET] to BASE[OFFSET + COUNT - 1] as being in their
+ * final position and queues every chunk that this completes. This is a no-op
+ * unless an output is in progress and BASE is the array being output or the
+ * buffer staged by output_stage, so sorts can call it from phases that are
+ * not always the last one. Each element must be marked at most once. */
+void output_mark_final(const elem_t *base, size_t offset, size_t count) {
+    if (!chunks || base != staging || offset >= local_length) {
+        return;
+    }
+    size_t end = MIN(offset + count, local_length);
+
+    for (size_t chunk_idx = offset / header.chunk_elems;
+            chunk_idx * header.chunk_elems < end; chunk_idx++) {
+        size_t chunk_start = chunk_idx * header.chunk_elems;
+        size_t chunk_num_elems = input_chunk_num_elems(&header, chunk_idx);
+        size_t num_final =
+            MIN(end, chunk_start + chunk_num_elems)
+                - MAX(offset, chunk_start);
+        if (__atomic_add_fetch(&chunks[chunk_idx].num_final, num_final,
+                    __ATOMIC_ACQ_REL)
+                == chunk_num_elems) {
+            emit_chunk(chunk_idx, staging);
+        }
+    }
+}
+
+/* Reads each chunk from the store in turn and writes it. */
+static int end_extmem(void) {
+    int ret;
+
+    elem_t *chunk_buf =
+        mem_alloc(MEM_IO, header.chunk_elems * sizeof(*chunk_buf));
+    if (!chunk_buf) {
+        perror("malloc output chunk buffer");
+        ret = -1;
+        goto exit;
+    }
+    elem_t *page = mem_alloc(MEM_IO, store->block_len);
+    if (!page) {
+        perror("malloc output page");
+        ret = -1;
+        goto exit_free_chunk_buf;
+    }
+
+    struct extmem_stream reader;
+    extmem_stream_init(&reader, store, page, 0);
+    for (size_t i = 0; i < num_chunks; i++) {
+        ret =
+            extmem_stream_read(&reader, chunk_buf,
+                    input_chunk_num_elems(&header, i));
+        if (ret) {
+            handle_error_string("Error reading output chunk %zu", i);
+            goto exit_free_page;
+        }
+        ret = write_chunk(i, chunk_buf);
+        if (ret) {
+            goto exit_free_page;
+        }
+    }
+
+    ret = 0;
+
+exit_free_page:
+    mem_free(page);
+exit_free_chunk_buf:
+    mem_free(chunk_buf);
+exit:
+    return ret;
+}
+
+/* Queues the chunks that no phase marked final, which are final now that the
+ * sort is done, and waits for all chunks to be written. */
+int output_end(void) {
+    int ret;
+
+    if (store) {
+        ret = end_extmem();
+        store = NULL;
+        goto exit;
+    }
+
+    if (!chunks) {
+        handle_error_string("No output in progress");
+        ret = -1;
+        goto exit;
+    }
+
+    for (size_t i = 0; i < num_chunks; i++) {
+        emit_chunk(i, arr);
+    }
+    thread_work_until_empty();
+    for (size_t i = 0; i < num_chunks; i++) {
+        thread_wait(&chunks[i].work);
+    }
+
+    ret = failed ? -1 : 0;
+
+    mem_free(chunks);
+    chunks = NULL;
+
+exit:
+    return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_OUTPUT_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_OUTPUT_H
+
+#include <stddef.h>
+#include "common/elem_t.h"
+#include "enclave/extmem.h"
+
+int output_set_key(const unsigned char *key, size_t key_len);
+int output_begin(elem_t *arr, size_t local_start, size_t local_length,
+        size_t total_length);
+
+/* Like output_begin, but for elements in STORE, whose blocks each hold a page
+ * of elements. Nothing is marked final during the sort, and output_end reads
+ * and writes the chunks in order. */
+int output_begin_extmem(struct extmem_store *store, size_t local_start,
+        size_t local_length, size_t total_length);
+
+void output_stage(const elem_t *staging);
+void output_mark_final(const elem_t *base, size_t offset, size_t count);
+int output_end(void);
+
+#endif /* distributed-sgx-sort/enclave/output.h */
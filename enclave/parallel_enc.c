@@ -1,432 +1,849 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <liboblivious/primitives.h>
 #include "common/defs.h"
 #include "common/elem_t.h"
 #include "common/error.h"
+#include "common/mem.h"
+#include "common/sort_params.h"
 #include "common/sort_type.h"
 #include "common/util.h"
-#include "enclave/bitonic.h"
 #include "enclave/bucket.h"
-#include "enclave/crypto.h"
+#include "enclave/distsort.h"
+#include "enclave/extmem.h"
+#include "enclave/input.h"
+#include "enclave/mem.h"
 #include "enclave/mpi_tls.h"
-#include "enclave/ojoin.h"
-#include "enclave/opaque.h"
-#include "enclave/orshuffle.h"
+#include "enclave/output.h"
+#include "enclave/parallel_enc.h"
 #include "enclave/threading.h"
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 #include <openenclave/enclave.h>
+#include <openenclave/advanced/mallinfo.h>
 #include "enclave/parallel_t.h"
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+#include <sys/resource.h>
 #endif
 
-int world_rank;
-int world_size;
+static distsort_ctx_t *ctx;
 
 static elem_t *arr;
 static size_t total_length;
-static size_t join_length;
+static struct distsort_opts opts;
+
+/* With external memory, the bucket sort's array is kept in DATA_STORE in host
+ * memory instead of in ARR, a page of elements per block, and the enclave only
+ * holds a page of it at a time outside of the sort. */
+static struct extmem_store data_store;
+static bool in_extmem;
+
+/* If nonzero, each rank's array is sorted as independent arrays of this many
+ * elements. */
+static size_t batch_len;
+
+/* The sum of the fingerprints of the elements sorted so far, taken on this rank
+ * before sorting, and whether ecall_verify_sorted checks the output against
+ * it. The o-join writes values into its output, so its output is not a
+ * permutation of its input. */
+static uint64_t input_fingerprint;
+static bool check_fingerprint;
+
+/* New elements to merge into the sorted array. */
+static elem_t *increment;
+static size_t increment_length;
+
+int ecall_sort_init(int world_rank_, int world_size_, size_t num_threads,
+        size_t num_comm_threads, struct sort_params *params, bool tune) {
+    return distsort_init(&ctx, world_rank_, world_size_, num_threads,
+            num_comm_threads, params, tune);
+}
+
+/* Returns the generated key of element IDX on this rank. Keys are a hash of
+ * the rank and index rather than a shared rand() stream, so any thread can
+ * generate any part of the array and the input does not depend on the number
+ * of threads. Like rand(), keys are 31 bits. */
+static uint64_t generate_key(size_t idx) {
+    uint64_t z = ((uint64_t) (world_rank + 1) << 48) + idx;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+    return z >> 33;
+}
 
-static volatile enum sort_type sort_type;
+struct populate_args {
+    elem_t *arr;
+    size_t alloc_size;
+    size_t num_keys;
+    uint64_t key_mask;
+    size_t num_threads;
+};
+
+/* Zeroes and populates thread THREAD_IDX's share of the array, so that its
+ * pages are committed and first touched by pool threads in parallel rather
+ * than all by the main thread. */
+static void populate(void *args_, size_t thread_idx) {
+    struct populate_args *args = args_;
+    size_t start = args->alloc_size * thread_idx / args->num_threads;
+    size_t end = args->alloc_size * (thread_idx + 1) / args->num_threads;
+
+    memset(args->arr + start, '\0', (end - start) * sizeof(*args->arr));
+
+    for (size_t i = start; i < MIN(end, args->num_keys); i++) {
+        args->arr[i].key = generate_key(i) & args->key_mask;
+    }
+}
 
-int ecall_sort_init(int world_rank_, int world_size_, size_t num_threads) {
+/* Calls FUNC on each page of this rank's elements in DATA_STORE in order,
+ * read into PAGE, with the index of the page's first element and the number of
+ * elements on it. FUNC is called once with no elements if the rank has
+ * none. */
+static int for_each_page(elem_t *page,
+        int (*func)(const elem_t *page, size_t start, size_t len, void *arg),
+        void *arg) {
+    size_t local_length = distsort_local_length(ctx, total_length);
+    size_t page_len = data_store.block_len / sizeof(*page);
     int ret;
 
-    /* Set global parameters. */
-    world_rank = world_rank_;
-    world_size = world_size_;
-    total_num_threads = num_threads;
+    for (size_t i = 0; i == 0 || i * page_len < local_length; i++) {
+        size_t len = MIN(page_len, local_length - i * page_len);
+        if (len) {
+            ret = extmem_read(&data_store, i, page);
+            if (ret) {
+                handle_error_string("Error reading page %zu", i);
+                goto exit;
+            }
+        }
+        ret = func(page, i * page_len, len, arg);
+        if (ret) {
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+static int fingerprint_page(const elem_t *page, size_t start UNUSED,
+        size_t len, void *fingerprint_) {
+    uint64_t *fingerprint = fingerprint_;
+    uint64_t page_fingerprint;
+    int ret;
 
-    /* Init entropy. */
-    ret = rand_init();
+    ret = distsort_fingerprint(ctx, page, len, &opts, &page_fingerprint);
     if (ret) {
-        handle_error_string("Error initializing RNG");
         goto exit;
     }
+    *fingerprint += page_fingerprint;
 
-    /* Init MPI-over-TLS. */
-    ret = mpi_tls_init(world_rank, world_size, &entropy_ctx);
-    if (ret) {
-        handle_error_string("Error initializing MPI-over-TLS");
-        goto exit_free_rand;
+exit:
+    return ret;
+}
+
+/* Fingerprints this rank's elements in DATA_STORE a page at a time. */
+static int fingerprint_store(uint64_t *fingerprint) {
+    int ret;
+
+    elem_t *page = mem_alloc(MEM_IO, data_store.block_len);
+    if (!page) {
+        perror("malloc fingerprint page");
+        ret = -1;
+        goto exit;
     }
 
+    *fingerprint = 0;
+    ret = for_each_page(page, fingerprint_page, fingerprint);
+
+    mem_free(page);
 exit:
     return ret;
+}
+
+/* Allocates DATA_STORE for the external-memory bucket sort and, if
+ * GENERATE_INPUT, fills it with the same keys as ARR would hold, generated a
+ * page at a time. */
+static int alloc_store(bool generate_input) {
+    size_t local_length = distsort_local_length(ctx, total_length);
+    int ret;
+
+    ret = distsort_prepare(ctx, SORT_BUCKET);
+    if (ret) {
+        goto exit;
+    }
+    ret = distsort_extmem_init(ctx, &data_store, total_length);
+    if (ret) {
+        handle_error_string("Error initializing external memory");
+        goto exit;
+    }
+
+    check_fingerprint = true;
+    if (!generate_input) {
+        in_extmem = true;
+        return 0;
+    }
+
+    size_t page_len = data_store.block_len / sizeof(elem_t);
+    elem_t *page = mem_alloc(MEM_IO, data_store.block_len);
+    if (!page) {
+        perror("malloc input page");
+        ret = -1;
+        goto exit_free_store;
+    }
+    for (size_t i = 0; i * page_len < local_length; i++) {
+        size_t len = MIN(page_len, local_length - i * page_len);
+        memset(page, '\0', data_store.block_len);
+        for (size_t j = 0; j < len; j++) {
+            page[j].key = generate_key(i * page_len + j);
+        }
+        ret = extmem_write(&data_store, i, page);
+        if (ret) {
+            handle_error_string("Error writing input page %zu", i);
+            goto exit_free_page;
+        }
+    }
+    mem_free(page);
+
+    ret = fingerprint_store(&input_fingerprint);
+    if (ret) {
+        handle_error_string("Error fingerprinting input");
+        goto exit_free_store;
+    }
 
-exit_free_rand:
-    rand_free();
+    in_extmem = true;
+    return 0;
+
+exit_free_page:
+    mem_free(page);
+exit_free_store:
+    extmem_free(&data_store);
+exit:
     return ret;
 }
 
-int ecall_sort_alloc_arr(size_t total_length_, enum sort_type sort_type,
-        size_t join_length_) {
+int ecall_sort_alloc_arr(size_t total_length_, enum sort_type sort_type_,
+        size_t join_length, bool generate_input) {
     total_length = total_length_;
-    join_length = join_length_;
-    size_t local_length =
-        ((world_rank + 1) * total_length + world_size - 1) / world_size
-            - (world_rank * total_length + world_size - 1) / world_size;
+    opts.join_length = join_length;
+    size_t local_length = distsort_local_length(ctx, total_length);
     int ret;
-    (void) join_length;
 
-    /* Establish sort size. */
-    size_t data_size;
-    size_t alloc_size;
-    switch (sort_type) {
-        case SORT_BITONIC:
-            data_size = local_length;
-            alloc_size = local_length;
-            break;
-        case OJOIN:
-        case SORT_BUCKET: {
-            /* The total number of buckets is the max of either double the
-             * number of buckets needed to hold all the elements or double the
-             * number of enclaves (since each enclaves needs at least two
-             * buckets. */
-            size_t num_buckets =
-                MAX(next_pow2ll(total_length) * 2 / BUCKET_SIZE,
-                        (size_t) world_size * 2);
-            size_t local_num_buckets =
-                num_buckets * (world_rank + 1) / world_size
-                    - num_buckets * world_rank / world_size;
-            /* The bucket sort relies on having 2 local buffers, so we allocate
-             * double the size of a single buffer (a single buffer is
-             * local_num_buckets * BUCKET_SIZE elements). */
-            data_size = MAX(local_length, 512);
-            alloc_size = local_num_buckets * BUCKET_SIZE * 2;
-            break;
-        case SORT_OPAQUE:
-            data_size = local_length;
-            alloc_size = local_length * 2;
-            break;
-        case SORT_ORSHUFFLE:
-            data_size = local_length;
-            alloc_size = MAX(local_length * 2, 512) * 2;
-            break;
-        case SORT_UNSET:
-        default:
-            handle_error_string("Invalid sort type");
-            ret = -1;
-            goto exit;
-        }
+    if (sort_type_ == SORT_BUCKET && opts.extmem_block_bytes) {
+        return alloc_store(generate_input);
+    }
+
+    /* Establish sort size. Without extmem, the bucket sort and the o-join
+     * generate keys for at least a full bucket. */
+    size_t alloc_size =
+        distsort_buffer_len(ctx, total_length, sort_type_, &opts);
+    if (!alloc_size) {
+        handle_error_string("Error sizing array");
+        ret = -1;
+        goto exit;
+    }
+    size_t data_size = local_length;
+    if ((sort_type_ == SORT_BUCKET && !opts.extmem_block_bytes)
+            || sort_type_ == OJOIN) {
+        data_size = MAX(local_length, 512);
     }
 
     /* Allocate array. */
-    arr = calloc(alloc_size, sizeof(*arr));
+    arr = mem_alloc(MEM_SORT_ARRAY, alloc_size * sizeof(*arr));
     if (!arr) {
         perror("malloc arr");
         ret = -1;
         goto exit;
     }
 
-    /* Populate array. */
-    srand(world_rank + 1);
-    if (sort_type == OJOIN) {
-        size_t request_start =
+    /* Choose the sort now, which lets waiting threads into the pool, and
+     * populate the array in parallel. For joins, the last part of the array
+     * holds requests for existing keys, which are filled in afterwards. If
+     * the input is ingested instead, the array is only zeroed. */
+    ret = distsort_prepare(ctx, sort_type_);
+    if (ret) {
+        goto exit_free_arr;
+    }
+    size_t num_keys = generate_input ? data_size : 0;
+    if (generate_input && sort_type_ == OJOIN) {
+        num_keys =
             data_size
                 - (join_length / world_size
                         + (join_length % world_size <= (size_t) world_rank));
-        for (size_t i = 0; i < request_start; i++) {
-            arr[i].key = rand() & ~1;
-        }
-        for (size_t i = request_start; i < data_size; i++) {
-            arr[i].key = arr[(i - request_start) / 4].key | 1;
+    }
+    struct populate_args populate_args = {
+        .arr = arr,
+        .alloc_size = alloc_size,
+        .num_keys = num_keys,
+        .key_mask = sort_type_ == OJOIN ? ~(uint64_t) 1 : ~(uint64_t) 0,
+        .num_threads = total_num_threads,
+    };
+    struct thread_work work = {
+        .type = THREAD_WORK_ITER,
+        .iter = {
+            .func = populate,
+            .arg = &populate_args,
+            .count = total_num_threads,
+        },
+    };
+    thread_work_push(&work);
+    thread_work_until_empty();
+    thread_wait(&work);
+
+    if (generate_input && sort_type_ == OJOIN) {
+        for (size_t i = num_keys; i < data_size; i++) {
+            arr[i].key = arr[(i - num_keys) / 4].key | 1;
         }
-    } else {
-        for (size_t i = 0; i < data_size; i++) {
-            arr[i].key = rand();
+    }
+
+    /* Fingerprint generated input now, and ingested input once it is all
+     * in. */
+    check_fingerprint = sort_type_ != OJOIN;
+    if (check_fingerprint && generate_input) {
+        ret =
+            distsort_fingerprint(ctx, arr, local_length, &opts,
+                    &input_fingerprint);
+        if (ret) {
+            handle_error_string("Error fingerprinting input");
+            goto exit_free_arr;
         }
     }
 
-    ret = 0;
+    return 0;
+
+exit_free_arr:
+    mem_free(arr);
+    arr = NULL;
+exit:
+    return ret;
+}
+
+void ecall_set_extmem(size_t block_bytes) {
+    opts.extmem_block_bytes = block_bytes;
+}
+
+void ecall_set_batch(size_t batch_len_) {
+    batch_len = batch_len_;
+}
+
+int ecall_set_data_key(const unsigned char *key, size_t key_len) {
+    int ret;
+
+    /* Inputs and outputs share a key, so that a sort's output can be sorted
+     * again. */
+    ret = input_set_key(key, key_len);
+    if (ret) {
+        goto exit;
+    }
+    ret = output_set_key(key, key_len);
+    if (ret) {
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+int ecall_ingest_begin(const struct input_header *header) {
+    size_t local_start = distsort_local_start(ctx, total_length);
+    size_t local_length = distsort_local_length(ctx, total_length);
+    if (in_extmem) {
+        return input_begin_extmem(&data_store, local_start, local_length,
+                total_length, header);
+    }
+    return input_begin(arr, local_start, local_length, total_length, header);
+}
+
+int ecall_ingest_chunk(const unsigned char *chunk, size_t chunk_len) {
+    return input_ingest_chunk(chunk, chunk_len);
+}
+
+int ecall_ingest_end(void) {
+    size_t local_length = distsort_local_length(ctx, total_length);
+    int ret;
+
+    ret = input_end();
+    if (ret) {
+        goto exit;
+    }
+
+    if (check_fingerprint) {
+        if (in_extmem) {
+            ret = fingerprint_store(&input_fingerprint);
+        } else {
+            ret =
+                distsort_fingerprint(ctx, arr, local_length, &opts,
+                        &input_fingerprint);
+        }
+        if (ret) {
+            handle_error_string("Error fingerprinting input");
+            goto exit;
+        }
+    }
 
 exit:
     return ret;
 }
 
+int ecall_output_begin(void) {
+    size_t local_start = distsort_local_start(ctx, total_length);
+    size_t local_length = distsort_local_length(ctx, total_length);
+    if (in_extmem) {
+        return output_begin_extmem(&data_store, local_start, local_length,
+                total_length);
+    }
+    return output_begin(arr, local_start, local_length, total_length);
+}
+
+int ecall_output_end(void) {
+    return output_end();
+}
+
 void ecall_sort_free_arr(void) {
-    free(arr);
+    if (in_extmem) {
+        extmem_free(&data_store);
+        in_extmem = false;
+    }
+    mem_free(arr);
+    arr = NULL;
     mpi_tls_bytes_sent = 0;
+    mpi_tls_messages_sent = 0;
+    distsort_reset_mem_stats(ctx);
 }
 
 void ecall_sort_free(void) {
-    mpi_tls_free();
-    rand_free();
+    distsort_free(ctx);
+    ctx = NULL;
 }
 
-int ecall_verify_sorted(void) {
-    size_t local_length =
-        ((world_rank + 1) * total_length + world_size - 1) / world_size
-            - (world_rank * total_length + world_size - 1) / world_size;
-    uint64_t first_key = 0;
-    uint64_t prev_key = 0;
+struct verify_args {
+    const elem_t *arr;
+    size_t length;
+    size_t num_tasks;
+    bool sorted;
+};
+
+/* Checks that each element of task TASK_IDX's share of the array is no
+ * smaller than the one before it, except at the start of each batch. */
+static void verify_task(void *args_, size_t task_idx) {
+    struct verify_args *args = args_;
+    size_t start = args->length * task_idx / args->num_tasks;
+    size_t end = args->length * (task_idx + 1) / args->num_tasks;
+
+    for (size_t i = MAX(start, 1); i < end; i++) {
+        if ((!batch_len || i % batch_len)
+                && args->arr[i - 1].key > args->arr[i].key) {
+            __atomic_store_n(&args->sorted, false, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+/* The last key of a rank, sent to the next rank to check the boundary. */
+struct verify_boundary {
+    uint64_t last_key;
+    bool has_key;
+};
+
+/* What ecall_verify_sorted learns from a rank's elements in DATA_STORE. */
+struct verify_store_args {
+    uint64_t first_key;
+    uint64_t last_key;
+    uint64_t fingerprint;
+    bool sorted;
+};
+
+static int verify_page(const elem_t *page, size_t start, size_t len,
+        void *args_) {
+    struct verify_store_args *args = args_;
+    uint64_t page_fingerprint;
     int ret;
 
-    for (int rank = 0; rank < world_size; rank++) {
-        if (rank == world_rank) {
-            for (size_t i = 0; i < local_length; i++) {
-                if (i == 0) {
-                    first_key = arr[i].key;
-                } else if (prev_key > arr[i].key) {
-                    printf("Not sorted correctly!\n");
-                    break;
-                }
-                prev_key = arr[i].key;
-            }
+    for (size_t i = 0; i < len; i++) {
+        if (start + i == 0) {
+            args->first_key = page[i].key;
+        } else if (args->last_key > page[i].key) {
+            args->sorted = false;
         }
-        ocall_mpi_barrier();
+        args->last_key = page[i].key;
     }
 
-    if (world_rank < world_size - 1) {
-        /* Send largest value to next elem. prev_key now contains the last item
-         * in the array. */
-#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-        oe_result_t result =
-            ocall_mpi_send_bytes(&ret, (unsigned char *) &prev_key,
-                    sizeof(prev_key), world_rank + 1, 0);
-        if (result != OE_OK) {
-            handle_oe_error(result, "ocall_mpi_send_bytes");
+    if (check_fingerprint) {
+        ret = distsort_fingerprint(ctx, page, len, &opts, &page_fingerprint);
+        if (ret) {
+            goto exit;
+        }
+        args->fingerprint += page_fingerprint;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int ecall_verify_sorted(void) {
+    size_t local_length = distsort_local_length(ctx, total_length);
+    bool sorted;
+    uint64_t first_key = local_length && !in_extmem ? arr[0].key : 0;
+    uint64_t last_key =
+        local_length && !in_extmem ? arr[local_length - 1].key : 0;
+    uint64_t output_fingerprint = 0;
+    int ret;
+
+    if (in_extmem) {
+        /* Scan this rank's share in host memory a page at a time, which also
+         * fingerprints it. */
+        struct verify_store_args store_args = {
+            .sorted = true,
+        };
+        elem_t *page = mem_alloc(MEM_IO, data_store.block_len);
+        if (!page) {
+            perror("malloc verify page");
             ret = -1;
             goto exit;
         }
-#else
+        ret = for_each_page(page, verify_page, &store_args);
+        mem_free(page);
+        if (ret) {
+            handle_error_string("Error verifying output");
+            goto exit;
+        }
+        sorted = store_args.sorted;
+        first_key = store_args.first_key;
+        last_key = store_args.last_key;
+        output_fingerprint = store_args.fingerprint;
+    } else {
+        /* Check this rank's share with every thread. */
+        struct verify_args args = {
+            .arr = arr,
+            .length = local_length,
+            .num_tasks = total_num_threads,
+            .sorted = true,
+        };
+        struct thread_work work = {
+            .type = THREAD_WORK_ITER,
+            .iter = {
+                .func = verify_task,
+                .arg = &args,
+                .count = total_num_threads,
+            },
+        };
+        thread_work_push(&work);
+        thread_work_until_empty();
+        thread_wait(&work);
+        sorted = args.sorted;
+
+        /* Fingerprint the output to compare against the input on rank 0. */
+        if (check_fingerprint) {
+            ret =
+                distsort_fingerprint(ctx, arr, local_length, &opts,
+                        &output_fingerprint);
+            if (ret) {
+                handle_error_string("Error fingerprinting output");
+                goto exit;
+            }
+        }
+    }
+    if (!sorted) {
+        printf("Not sorted correctly!\n");
+    }
+    uint64_t fingerprint_diff =
+        check_fingerprint ? output_fingerprint - input_fingerprint : 0;
+
+    /* Send the last key to the next rank, which checks it against its first
+     * key. Batched arrays do not continue across ranks. */
+    if (!batch_len && world_rank < world_size - 1) {
+        struct verify_boundary boundary = {
+            .last_key = last_key,
+            .has_key = local_length > 0,
+        };
         ret =
-            ocall_mpi_send_bytes((unsigned char *) &prev_key, sizeof(prev_key),
-                    world_rank + 1, 0);
-#endif
+            mpi_tls_send_bytes(&boundary, sizeof(boundary), world_rank + 1,
+                    VERIFY_MPI_TAG);
         if (ret) {
-            handle_error_string("Error sending highest value to next node");
+            handle_error_string("Error sending last key to %d",
+                    world_rank + 1);
             goto exit;
         }
     }
-
-    if (world_rank > 0) {
-        /* Receive previous elem's largest value and compare. */
-        ocall_mpi_status_t status;
-#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-        oe_result_t result =
-            ocall_mpi_recv_bytes(&ret, (unsigned char *) &prev_key,
-                    sizeof(prev_key), world_rank - 1, 0, &status);
-        if (result != OE_OK) {
-            handle_oe_error(result, "ocall_mpi_recv_bytes");
-            ret = -1;
+    if (check_fingerprint && world_rank > 0) {
+        ret =
+            mpi_tls_send_bytes(&fingerprint_diff, sizeof(fingerprint_diff), 0,
+                    VERIFY_MPI_TAG);
+        if (ret) {
+            handle_error_string("Error sending fingerprint to 0");
             goto exit;
         }
-#else
+    }
+
+    if (!batch_len && world_rank > 0) {
+        struct verify_boundary boundary;
         ret =
-            ocall_mpi_recv_bytes((unsigned char *) &prev_key, sizeof(prev_key),
-                    world_rank - 1, 0, &status);
-#endif
+            mpi_tls_recv_bytes(&boundary, sizeof(boundary), world_rank - 1,
+                    VERIFY_MPI_TAG, MPI_TLS_STATUS_IGNORE);
         if (ret) {
-            handle_error_string(
-                    "Error receiving highest value from pmrevious node");
+            handle_error_string("Error receiving last key from %d",
+                    world_rank - 1);
             goto exit;
         }
-        if (prev_key > first_key) {
+        if (boundary.has_key && local_length
+                && boundary.last_key > first_key) {
             printf("Not sorted correctly at enclave boundaries!\n");
         }
     }
 
+    /* The differences between the output's and the input's fingerprints add
+     * up to 0 if the output is a permutation of the input. */
+    if (check_fingerprint && world_rank == 0) {
+        for (int rank = 1; rank < world_size; rank++) {
+            uint64_t diff;
+            ret =
+                mpi_tls_recv_bytes(&diff, sizeof(diff), rank, VERIFY_MPI_TAG,
+                        MPI_TLS_STATUS_IGNORE);
+            if (ret) {
+                handle_error_string("Error receiving fingerprint from %d",
+                        rank);
+                goto exit;
+            }
+            fingerprint_diff += diff;
+        }
+        if (fingerprint_diff) {
+            printf("Not sorted correctly: output is not a permutation of the"
+                    " input!\n");
+        }
+    }
+
     ret = 0;
 
 exit:
     return ret;
 }
 
-void ecall_start_work(void) {
-    /* Wait for master thread to choose sort. */
-    while (!sort_type) {}
-
-    switch (sort_type) {
-        case SORT_BITONIC:
-            /* Initialize sort. */
-            if (bitonic_init()) {
-                handle_error_string("Error initializing sort");
-                return;
-            }
-
-            /* Start work. */
-            thread_start_work();
-
-            /* Free sort. */
-            bitonic_free();
-            break;
-
-        case SORT_BUCKET:
-            /* Initialize sort. */
-            if (bucket_init()) {
-                handle_error_string("Error initializing sort");
-                return;
-            }
-
-            /* Start work. */
-            thread_start_work();
-
-            /* Free sort. */
-            bucket_free();
-            break;
-
-        case SORT_OPAQUE:
-            /* Start work. */
-            thread_start_work();
-            break;
-
-        case SORT_ORSHUFFLE:
-            /* Initialize sort. */
-            if (orshuffle_init()) {
-                handle_error_string("Error initializing sort");
-                return;
-            }
-
-            /* Start work. */
-            thread_start_work();
-
-            /* Free sort. */
-            orshuffle_free();
-            break;
-
-        case OJOIN:
-            /* Initialize o-join. */
-            if (ojoin_init()) {
-                handle_error_string("Error initializing ojoin");
-                return;
-            }
-
-            /* Start work. */
-            thread_start_work();
-
-            /* Free sort. */
-            ojoin_free();
-            break;
+size_t ecall_get_num_threads_started(void) {
+    return distsort_get_num_threads_started(ctx);
+}
 
-        case SORT_UNSET:
-            handle_error_string("Invalid sort type");
-            goto exit;
-    }
+void ecall_start_work(void) {
+    distsort_start_work(ctx);
+}
 
-exit:
-    ;
+void ecall_start_comm_work(void) {
+    distsort_start_comm_work(ctx);
 }
 
 void ecall_release_threads(void) {
-    thread_release_all();
+    distsort_release_threads(ctx);
 }
 
 void ecall_unrelease_threads(void) {
-    thread_unrelease_all();
+    distsort_unrelease_threads(ctx);
 }
 
 int ecall_bitonic_sort(void) {
-    int ret = -1;
+    return distsort_sort(ctx, arr, total_length, SORT_BITONIC, &opts);
+}
 
-    sort_type = SORT_BITONIC;
+/* Sorts DATA_STORE and checks that the enclave's sort buffers stayed within
+ * the blocks and pages that the external-memory bucket sort needs for the
+ * block size, which do not depend on the array size. */
+static int sort_store(void) {
+    size_t site_bytes[MEM_NUM_SITES];
+    size_t site_peak_bytes[MEM_NUM_SITES];
+    int ret;
 
-    /* Initialize sort. */
-    if (bitonic_init()) {
-        handle_error_string("Error initializing sort");
+    ret = distsort_sort_extmem(ctx, &data_store, total_length, &opts);
+    if (ret) {
         goto exit;
     }
 
-    /* Sort. */
-    bitonic_sort(arr, total_length, total_num_threads);
-
-    ret = 0;
+    distsort_get_mem_stats(ctx, site_bytes, site_peak_bytes, NULL, 0);
+    size_t peak_bytes =
+        site_peak_bytes[MEM_SORT_ARRAY] + site_peak_bytes[MEM_SCRATCH];
+    size_t max_bytes = bucket_extmem_scratch_size(opts.extmem_block_bytes);
+    if (peak_bytes > max_bytes) {
+        handle_error_string(
+                "External-memory sort held %zu bytes in the enclave, more than "
+                    "the %zu its blocks need",
+                peak_bytes, max_bytes);
+        ret = -1;
+        goto exit;
+    }
 
-    bitonic_free();
 exit:
     return ret;
 }
 
 int ecall_bucket_sort(void) {
-    int ret;
-
-    sort_type = SORT_BUCKET;
-
-    /* Initialize sort. */
-    ret = bucket_init();
-    if (ret) {
-        handle_error_string("Error initializing sort");
-        goto exit;
+    if (in_extmem) {
+        return sort_store();
     }
+    return distsort_sort(ctx, arr, total_length, SORT_BUCKET, &opts);
+}
 
-    /* Sort. */
-    ret = bucket_sort(arr, total_length, total_num_threads);
-    if (ret) {
-        handle_error_string("Error in bucket sort");
-        goto exit_free_sort;
-    }
+int ecall_opaque_sort(void) {
+    return distsort_sort(ctx, arr, total_length, SORT_OPAQUE, &opts);
+}
 
-exit_free_sort:
-    bucket_free();
-exit:
-    return ret;
+int ecall_orshuffle_sort(void) {
+    return distsort_sort(ctx, arr, total_length, SORT_ORSHUFFLE, &opts);
 }
 
-int ecall_opaque_sort(void) {
-    int ret;
+int ecall_ojoin(void) {
+    return distsort_sort(ctx, arr, total_length, OJOIN, &opts);
+}
 
-    sort_type = SORT_BUCKET;
+int ecall_sort_batch(void) {
+    size_t local_length = distsort_local_length(ctx, total_length);
+    size_t num_arrays = CEIL_DIV(local_length, batch_len);
+    int ret;
 
-    /* Sort. */
-    ret = opaque_sort(arr, total_length, total_num_threads);
-    if (ret) {
-        handle_error_string("Error in Opaque sort");
+    size_t *lengths =
+        mem_alloc(MEM_SCRATCH, MAX(num_arrays, 1) * sizeof(*lengths));
+    if (!lengths) {
+        perror("malloc batch lengths");
+        ret = -1;
         goto exit;
     }
+    for (size_t i = 0; i < num_arrays; i++) {
+        lengths[i] = MIN(batch_len, local_length - i * batch_len);
+    }
 
+    ret = distsort_sort_batch(ctx, arr, lengths, num_arrays, &opts);
+
+    mem_free(lengths);
 exit:
     return ret;
 }
 
-int ecall_orshuffle_sort(void) {
+int ecall_alloc_increment(size_t length, enum sort_type sort_type) {
+    size_t local_length = distsort_local_length(ctx, length);
     int ret;
 
-    sort_type = SORT_ORSHUFFLE;
+    size_t alloc_size = distsort_buffer_len(ctx, length, sort_type, &opts);
+    if (!alloc_size) {
+        handle_error_string("Error sizing increment");
+        ret = -1;
+        goto exit;
+    }
 
-    /* Initialize sort. */
-    ret = orshuffle_init();
-    if (ret) {
-        handle_error_string("Error initializing sort");
+    increment = mem_calloc(MEM_SORT_ARRAY, alloc_size, sizeof(*increment));
+    if (!increment) {
+        perror("malloc increment");
+        ret = -1;
         goto exit;
     }
+    increment_length = length;
 
-    /* Sort. */
-    ret = orshuffle_sort(arr, total_length, total_num_threads);
-    if (ret) {
-        handle_error_string("Error in ORShuffle sort");
-        goto exit_free_sort;
+    /* Generate keys from indices past the array's, so that they differ from
+     * the keys already sorted. */
+    for (size_t i = 0; i < local_length; i++) {
+        increment[i].key = generate_key(total_length + i);
+    }
+
+    if (check_fingerprint) {
+        uint64_t increment_fingerprint;
+        ret =
+            distsort_fingerprint(ctx, increment, local_length, &opts,
+                    &increment_fingerprint);
+        if (ret) {
+            handle_error_string("Error fingerprinting increment");
+            goto exit_free_increment;
+        }
+        input_fingerprint += increment_fingerprint;
     }
 
-exit_free_sort:
-    orshuffle_free();
+    return 0;
+
+exit_free_increment:
+    mem_free(increment);
+    increment = NULL;
 exit:
     return ret;
 }
 
-int ecall_ojoin(void) {
+int ecall_merge_increment(enum sort_type sort_type) {
+    size_t length = total_length + increment_length;
     int ret;
 
-    sort_type = OJOIN;
-
-    /* Initialize sort. */
-    ret = ojoin_init();
-    if (ret) {
-        handle_error_string("Error initializing sort");
-        goto exit;
+    elem_t *new_arr =
+        mem_realloc(MEM_SORT_ARRAY, arr,
+                MAX(distsort_local_length(ctx, length), 1) * sizeof(*arr));
+    if (!new_arr) {
+        perror("realloc arr");
+        ret = -1;
+        goto exit_free_increment;
     }
+    arr = new_arr;
 
-    /* Sort. */
-    ret = ojoin(arr, total_length, join_length, total_num_threads);
+    ret =
+        distsort_merge(ctx, arr, total_length, increment, increment_length,
+                sort_type, &opts);
     if (ret) {
-        handle_error_string("Error in ORShuffle sort");
-        goto exit_free_sort;
+        goto exit_free_increment;
     }
+    total_length = length;
 
-exit_free_sort:
-    orshuffle_free();
-exit:
+exit_free_increment:
+    mem_free(increment);
+    increment = NULL;
     return ret;
 }
 
-void ecall_get_stats(struct ocall_enclave_stats *stats) {
+int ecall_choose_sort(size_t total_length_, enum sort_type *sort_type) {
+    return distsort_choose(ctx, total_length_, &opts, sort_type);
+}
+
+void ecall_get_stats(struct ocall_enclave_stats *stats,
+        struct ocall_thread_stats *thread_stats, size_t capacity,
+        size_t *num_thread_stats) {
     stats->mpi_tls_bytes_sent = mpi_tls_bytes_sent;
+    stats->mpi_tls_messages_sent = mpi_tls_messages_sent;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_mallinfo_t info;
+    stats->peak_memory_bytes =
+        oe_allocator_mallinfo(&info) == OE_OK
+            ? info.peak_allocated_heap_size
+            : 0;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    struct rusage usage;
+    stats->peak_memory_bytes =
+        getrusage(RUSAGE_SELF, &usage) ? 0 : (size_t) usage.ru_maxrss * 1024;
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    distsort_get_mem_stats(ctx, stats->site_bytes, stats->site_peak_bytes,
+            NULL, 0);
+
+    *num_thread_stats =
+        distsort_collect_thread_stats(ctx, thread_stats, capacity);
+}
+
+void ecall_get_mem_phases(struct mem_phase_stats *phases, size_t capacity,
+        size_t *num_phases) {
+    size_t site_bytes[MEM_NUM_SITES];
+    size_t site_peak_bytes[MEM_NUM_SITES];
+    *num_phases = distsort_get_mem_stats(ctx, site_bytes, site_peak_bytes,
+            phases, capacity);
+}
+
+void ecall_get_spans(struct span_record *spans, size_t capacity,
+        size_t *num_spans) {
+    *num_spans = distsort_collect_spans(ctx, spans, capacity);
+}
+
+void ecall_set_trace(bool enabled) {
+    distsort_set_trace(ctx, enabled);
+}
+
+void ecall_collect_trace(struct trace_event *events, size_t capacity,
+        size_t *num_events) {
+    *num_events = distsort_collect_trace(ctx, events, capacity);
+}
+
+void ecall_get_trace_time(uint64_t *time_ns) {
+    *time_ns = distsort_trace_time(ctx);
 }
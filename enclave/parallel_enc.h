@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 
+/* The rank and world size of the current sort context, defined in
+ * enclave/distsort.c. */
 extern int world_rank;
 extern int world_size;
 
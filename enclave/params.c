@@ -0,0 +1,62 @@
+#include "enclave/params.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/error.h"
+#include "common/sort_params.h"
+#include "common/util.h"
+#include "enclave/mpi_tls.h"
+#include "enclave/parallel_enc.h"
+
+struct sort_params sort_params = SORT_PARAMS_DEFAULT;
+
+/* Checks that PARAMS can be sorted with, such as ones read from a file. */
+int sort_params_check(const struct sort_params *params) {
+    if (!params->bitonic_chunk_size || !params->orshuffle_chunk_size
+            || !params->ojoin_chunk_size || !params->opaque_chunk_size
+            || !params->sample_partition_buf_size
+            || !params->bucket_swap_chunk_buckets) {
+        handle_error_string("Chunk sizes must be positive");
+        return -1;
+    }
+    if (params->bucket_size < 2
+            || next_pow2ll(params->bucket_size) != params->bucket_size) {
+        handle_error_string("Bucket size must be a power of two");
+        return -1;
+    }
+    if (params->epc_cliff_slowdown < 100) {
+        handle_error_string("EPC cliff slowdown must be at least 100%%");
+        return -1;
+    }
+    return 0;
+}
+
+/* Replaces PARAMS on every rank with rank 0's, so that ranks started with
+ * different parameter files still agree. */
+int sort_params_share(struct sort_params *params) {
+    int ret;
+
+    if (world_rank == 0) {
+        for (int rank = 1; rank < world_size; rank++) {
+            ret =
+                mpi_tls_send_bytes(params, sizeof(*params), rank,
+                        SORT_PARAMS_MPI_TAG);
+            if (ret) {
+                handle_error_string("Error sending parameters to %d", rank);
+                goto exit;
+            }
+        }
+    } else {
+        ret =
+            mpi_tls_recv_bytes(params, sizeof(*params), 0,
+                    SORT_PARAMS_MPI_TAG, MPI_TLS_STATUS_IGNORE);
+        if (ret) {
+            handle_error_string("Error receiving parameters from 0");
+            goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
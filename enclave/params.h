@@ -0,0 +1,12 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_PARAMS_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_PARAMS_H
+
+#include "common/sort_params.h"
+
+/* The parameters the engines run with, set by distsort_init. */
+extern struct sort_params sort_params;
+
+int sort_params_check(const struct sort_params *params);
+int sort_params_share(struct sort_params *params);
+
+#endif /* distributed-sgx-sort/enclave/params.h */
@@ -0,0 +1,102 @@
+#include "enclave/span.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include "common/defs.h"
+#include "common/span.h"
+#include "enclave/threading.h"
+
+static struct span_record records[SPAN_MAX_RECORDS];
+
+/* The number of spans begun since the last collection, which may exceed
+ * SPAN_MAX_RECORDS when spans were dropped. */
+static size_t num_records;
+
+static uint32_t num_threads_seen;
+
+/* Counts the collections, so that threads can tell that their open span, left
+ * open by a failed phase, was collected. */
+static uint32_t epoch;
+
+/* The innermost open span on this thread and the collection it was begun
+ * after. */
+static thread_local span_t current_span = SPAN_NONE;
+static thread_local uint32_t current_epoch;
+
+/* This thread's ID plus 1, or 0 before its first span. */
+static thread_local uint32_t thread_id;
+
+/* Spans use the monotonic clock so that adjustments to the wall clock do not
+ * skew them, falling back to the wall clock where the monotonic clock is
+ * unavailable, as it is in some enclave runtimes. */
+uint64_t span_time_ns(void) {
+    static bool no_monotonic;
+    struct timespec ts;
+
+    if (no_monotonic || clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        no_monotonic = true;
+        if (clock_gettime(CLOCK_REALTIME, &ts)) {
+            return 0;
+        }
+    }
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+span_t span_begin(const char *name) {
+    size_t index = __atomic_fetch_add(&num_records, 1, __ATOMIC_RELAXED);
+    if (index >= SPAN_MAX_RECORDS) {
+        return SPAN_NONE;
+    }
+
+    if (!thread_id) {
+        thread_id =
+            __atomic_add_fetch(&num_threads_seen, 1, __ATOMIC_RELAXED);
+    }
+
+    if (current_epoch != __atomic_load_n(&epoch, __ATOMIC_RELAXED)) {
+        current_span = SPAN_NONE;
+        current_epoch = epoch;
+    }
+
+    struct span_record *record = &records[index];
+    strncpy(record->name, name, sizeof(record->name) - 1);
+    record->name[sizeof(record->name) - 1] = '\0';
+    record->parent = current_span;
+    record->thread = thread_id - 1;
+    record->end_ns = 0;
+    record->start_ns = span_time_ns();
+
+    current_span = index;
+    if (current_job) {
+        current_job->span = index;
+    }
+    return index;
+}
+
+void span_end(span_t span) {
+    if (span == SPAN_NONE
+            || current_epoch != __atomic_load_n(&epoch, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    records[span].end_ns = span_time_ns();
+    current_span = records[span].parent;
+    if (current_job) {
+        current_job->span = current_span;
+    }
+}
+
+const char *span_name(span_t span) {
+    return span == SPAN_NONE ? "" : records[span].name;
+}
+
+size_t span_collect(struct span_record *spans, size_t capacity) {
+    size_t count = MIN(MIN(num_records, SPAN_MAX_RECORDS), capacity);
+    memcpy(spans, records, count * sizeof(*spans));
+    num_records = 0;
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_RELAXED);
+    return count;
+}
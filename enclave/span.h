@@ -0,0 +1,35 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_SPAN_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_SPAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common/span.h"
+
+/* Phase timing. A span times one phase of a sort on the calling thread, and
+ * spans begun while another is open on the same thread nest inside it. Each
+ * rank records its spans in one buffer, which the host collects after a sort
+ * to compare the phases across ranks. Spans are begun on the thread that began
+ * the job, which also marks the innermost one as the job's current phase. */
+
+typedef uint32_t span_t;
+
+/* Returns the time in nanoseconds on the clock spans are timed with. */
+uint64_t span_time_ns(void);
+
+/* Begins a span named NAME, truncated to SPAN_NAME_LEN - 1 characters, and
+ * returns it for span_end. */
+span_t span_begin(const char *name);
+
+/* Ends SPAN, which must be the innermost open span on the calling thread, or
+ * enclose it if the phases in between failed without ending theirs. */
+void span_end(span_t span);
+
+/* Returns the name of SPAN, or an empty name for SPAN_NONE. */
+const char *span_name(span_t span);
+
+/* Copies up to CAPACITY of the spans recorded since the last call into SPANS,
+ * in the order they began, and forgets them. Returns the number copied. No
+ * spans may be open. */
+size_t span_collect(struct span_record *spans, size_t capacity);
+
+#endif /* distributed-sgx-sort/enclave/span.h */
@@ -1,7 +1,20 @@
 #include "enclave/synch.h"
 #include <stddef.h>
+#include <stdint.h>
 #include "common/defs.h"
+#include "common/error.h"
+#include "enclave/thread_stats.h"
 
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/enclave.h>
+#include "enclave/parallel_t.h"
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+void ocall_sema_wait(uint64_t key);
+void ocall_sema_wake(uint64_t key);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+/* The number of times a semaphore is polled before its waiter sleeps on the
+ * host. */
 #define ADAPTIVE_TIMEOUT 10000
 
 #define PAUSE() asm("pause")
@@ -11,9 +24,16 @@ void spinlock_init(spinlock_t *lock) {
 }
 
 void spinlock_lock(spinlock_t *lock) {
+    /* Only time the lock when another thread holds it. */
+    if (spinlock_trylock(lock)) {
+        return;
+    }
+
+    uint64_t start = thread_stats_begin();
     while (lock->locked || __atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
         PAUSE();
     }
+    thread_stats_end(THREAD_STAT_SPIN, start);
 }
 
 bool spinlock_trylock(spinlock_t *lock) {
@@ -28,21 +48,75 @@ void spinlock_unlock(spinlock_t *lock) {
 
 void sema_init(sema_t *sema, unsigned int initial_value) {
     sema->value = initial_value;
+    sema->sleepers = 0;
+}
+
+/* Sleeps on the host until SEMA may have been upped. The host only knows SEMA
+ * by its address and may return early, so the caller checks again. */
+static void sleep_on_host(sema_t *sema) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_sema_wait((uint64_t) (uintptr_t) sema);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_sema_wait");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ocall_sema_wait((uint64_t) (uintptr_t) sema);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+}
+
+static void wake_on_host(sema_t *sema) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_result_t result = ocall_sema_wake((uint64_t) (uintptr_t) sema);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ocall_sema_wake");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ocall_sema_wake((uint64_t) (uintptr_t) sema);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 }
 
 void sema_up(sema_t *sema) {
-    __atomic_add_fetch(&sema->value, 1, __ATOMIC_ACQUIRE);
+    /* The up and the check for sleepers are ordered against a waiter's
+     * registration and check of the value, so that either the waiter sees the
+     * up or this sees the waiter. The waiter may already have returned, in
+     * which case the wakeup is spurious. */
+    __atomic_add_fetch(&sema->value, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sema->sleepers, __ATOMIC_SEQ_CST)) {
+        wake_on_host(sema);
+    }
 }
 
-void sema_down(sema_t *sema) {
+/* Polls SEMA for ADAPTIVE_TIMEOUT rounds, which covers the short waits inside
+ * a sort, and then sleeps on the host between checks so that idle threads
+ * give up their cores. */
+static void sema_wait(sema_t *sema) {
     unsigned int val;
     size_t spin_count = 0;
-    do {
-        spin_count++;
-        PAUSE();
+    for (;;) {
         val = sema->value;
-    } while (!val || !__atomic_compare_exchange_n(&sema->value, &val, val - 1,
-                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if (val && __atomic_compare_exchange_n(&sema->value, &val, val - 1,
+                    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if (spin_count < ADAPTIVE_TIMEOUT) {
+            spin_count++;
+            PAUSE();
+            continue;
+        }
+
+        __atomic_add_fetch(&sema->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&sema->value, __ATOMIC_SEQ_CST)) {
+            sleep_on_host(sema);
+        }
+        __atomic_sub_fetch(&sema->sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void sema_down(sema_t *sema) {
+    uint64_t start = thread_stats_begin();
+    sema_wait(sema);
+    thread_stats_end(THREAD_STAT_SEMA, start);
 }
 
 struct condvar_waiter {
@@ -66,7 +140,9 @@ void condvar_wait(condvar_t *condvar, spinlock_t *lock) {
     }
     condvar->tail = &waiter;
     spinlock_unlock(lock);
-    sema_down(&waiter.sema);
+    uint64_t start = thread_stats_begin();
+    sema_wait(&waiter.sema);
+    thread_stats_end(THREAD_STAT_CONDVAR, start);
     spinlock_lock(lock);
 }
 
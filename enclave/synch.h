@@ -14,6 +14,9 @@ void spinlock_unlock(spinlock_t *lock);
 
 typedef struct sema {
     volatile unsigned int value;
+
+    /* The number of waiters sleeping on the host, which sema_up wakes. */
+    volatile unsigned int sleepers;
 } sema_t;
 
 void sema_init(sema_t *sema, unsigned int initial_value);
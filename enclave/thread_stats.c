@@ -0,0 +1,156 @@
+#include "enclave/thread_stats.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "common/defs.h"
+#include "common/mem.h"
+#include "common/ocalls.h"
+#include "common/span.h"
+#include "enclave/mem.h"
+#include "enclave/span.h"
+#include "enclave/threading.h"
+
+#ifdef DISTRIBUTED_SGX_SORT_PROFILE_THREADING
+
+/* One thread's times, one entry per phase it spent time in. */
+struct thread_phases {
+    size_t num_phases;
+    struct ocall_thread_stats phases[THREAD_STATS_MAX_PHASES];
+};
+
+static struct thread_phases *threads[THREAD_STATS_MAX_THREADS];
+static uint32_t num_threads;
+
+/* Counts the calls to thread_stats_free, so that threads can tell that their
+ * times were freed. Starts at 1 so that no thread's times are current before
+ * its first wait. */
+static uint32_t generation = 1;
+
+/* This thread's times, or NULL if it has none, and the generation they were
+ * allocated in. */
+static thread_local struct thread_phases *phases;
+static thread_local uint32_t phases_generation;
+static thread_local uint32_t thread_id;
+
+/* Returns the calling thread's entry for the current phase of its job,
+ * adding it if needed, or NULL if there is no room for it. */
+static struct ocall_thread_stats *get_phase(void) {
+    uint32_t gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    if (phases_generation != gen) {
+        phases = NULL;
+        phases_generation = gen;
+        uint32_t index =
+            __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+        if (index < THREAD_STATS_MAX_THREADS) {
+            phases = mem_alloc(MEM_THREAD_STATS, sizeof(*phases));
+            if (phases) {
+                phases->num_phases = 0;
+            }
+            threads[index] = phases;
+            thread_id = index;
+        }
+    }
+    if (!phases) {
+        return NULL;
+    }
+
+    const char *name = current_job ? span_name(current_job->span) : "";
+    for (size_t i = 0; i < phases->num_phases; i++) {
+        if (!strncmp(phases->phases[i].phase, name,
+                    sizeof(phases->phases[i].phase))) {
+            return &phases->phases[i];
+        }
+    }
+    if (phases->num_phases == THREAD_STATS_MAX_PHASES) {
+        return NULL;
+    }
+
+    struct ocall_thread_stats *stats = &phases->phases[phases->num_phases];
+    memset(stats, '\0', sizeof(*stats));
+    strncpy(stats->phase, name, sizeof(stats->phase) - 1);
+    stats->thread = thread_id;
+    phases->num_phases++;
+    return stats;
+}
+
+uint64_t thread_stats_begin(void) {
+    return span_time_ns();
+}
+
+void thread_stats_end(enum thread_stat stat, uint64_t start_ns) {
+    uint64_t elapsed = span_time_ns() - start_ns;
+
+    struct ocall_thread_stats *stats = get_phase();
+    if (!stats) {
+        return;
+    }
+
+    switch (stat) {
+        case THREAD_STAT_TASK:
+            stats->num_tasks++;
+            stats->task_ns += elapsed;
+            break;
+        case THREAD_STAT_SPIN:
+            stats->spin_ns += elapsed;
+            break;
+        case THREAD_STAT_SEMA:
+            stats->sema_ns += elapsed;
+            break;
+        case THREAD_STAT_CONDVAR:
+            stats->condvar_ns += elapsed;
+            break;
+        case THREAD_STAT_IDLE:
+            stats->idle_ns += elapsed;
+            break;
+    }
+}
+
+size_t thread_stats_collect(struct ocall_thread_stats *stats,
+        size_t capacity) {
+    size_t count = 0;
+    size_t threads_len = MIN(num_threads, THREAD_STATS_MAX_THREADS);
+    for (size_t i = 0; i < threads_len; i++) {
+        if (threads[i]) {
+            count += threads[i]->num_phases;
+        }
+    }
+    if (count > capacity) {
+        return count;
+    }
+
+    size_t copied = 0;
+    for (size_t i = 0; i < threads_len; i++) {
+        if (!threads[i]) {
+            continue;
+        }
+        memcpy(stats + copied, threads[i]->phases,
+                threads[i]->num_phases * sizeof(*stats));
+        copied += threads[i]->num_phases;
+        threads[i]->num_phases = 0;
+    }
+
+    return count;
+}
+
+void thread_stats_free(void) {
+    size_t threads_len = MIN(num_threads, THREAD_STATS_MAX_THREADS);
+    for (size_t i = 0; i < threads_len; i++) {
+        mem_free(threads[i]);
+        threads[i] = NULL;
+    }
+    num_threads = 0;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+}
+
+#else /* DISTRIBUTED_SGX_SORT_PROFILE_THREADING */
+
+size_t thread_stats_collect(struct ocall_thread_stats *stats UNUSED,
+        size_t capacity UNUSED) {
+    return 0;
+}
+
+void thread_stats_free(void) {}
+
+#endif /* DISTRIBUTED_SGX_SORT_PROFILE_THREADING */
@@ -0,0 +1,58 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_THREAD_STATS_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_THREAD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common/ocalls.h"
+
+/* Contention and idle-time profiling of the thread pool and the primitives in
+ * enclave/synch.h. Every wait reads the clock twice, which in an enclave is
+ * two ocalls, so the measurements are only compiled in when
+ * DISTRIBUTED_SGX_SORT_PROFILE_THREADING is defined, and the hooks are empty
+ * otherwise. */
+
+/* The most threads and phases per thread that are measured. Later ones are
+ * dropped. */
+#define THREAD_STATS_MAX_THREADS 128
+#define THREAD_STATS_MAX_PHASES 32
+
+enum thread_stat {
+    THREAD_STAT_TASK,
+    THREAD_STAT_SPIN,
+    THREAD_STAT_SEMA,
+    THREAD_STAT_CONDVAR,
+    THREAD_STAT_IDLE,
+};
+
+#ifdef DISTRIBUTED_SGX_SORT_PROFILE_THREADING
+
+/* Returns the start time to pass to thread_stats_end. */
+uint64_t thread_stats_begin(void);
+
+/* Adds the time from START_NS until now to STAT for the calling thread and
+ * the current phase of its job. */
+void thread_stats_end(enum thread_stat stat, uint64_t start_ns);
+
+#else /* DISTRIBUTED_SGX_SORT_PROFILE_THREADING */
+
+static inline uint64_t thread_stats_begin(void) {
+    return 0;
+}
+
+static inline void thread_stats_end(enum thread_stat stat, uint64_t start_ns) {
+    (void) stat;
+    (void) start_ns;
+}
+
+#endif /* DISTRIBUTED_SGX_SORT_PROFILE_THREADING */
+
+/* Returns the number of thread and phase pairs measured since the last call
+ * that copied them. If that many fit in CAPACITY, copies them into STATS and
+ * forgets them. No job may be running. */
+size_t thread_stats_collect(struct ocall_thread_stats *stats,
+        size_t capacity);
+
+/* Frees the per-thread measurements. No job may be running. */
+void thread_stats_free(void);
+
+#endif /* distributed-sgx-sort/enclave/thread_stats.h */
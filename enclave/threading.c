@@ -1,7 +1,13 @@
 #include "enclave/threading.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+#include "common/trace.h"
+#include "enclave/span.h"
 #include "enclave/synch.h"
+#include "enclave/thread_stats.h"
+#include "enclave/trace.h"
 
 struct task {
     struct thread_work *work;
@@ -16,13 +22,26 @@ struct task {
 size_t total_num_threads;
 size_t num_threads_working;
 
-static spinlock_t thread_work_lock;
-static struct thread_work *volatile work_head;
-static struct thread_work *volatile work_tail;
+thread_local struct thread_job *current_job;
+
+/* Work pushed outside of any job. */
+static struct thread_queue work_queue;
 static volatile bool work_done;
 
+/* Jobs that have begun and not yet ended. */
+static spinlock_t jobs_lock;
+static struct thread_job *volatile jobs_head;
+
+/* Returns the queue that the calling thread's work goes to and comes from. */
+static struct thread_queue *get_queue(void) {
+    return current_job ? &current_job->queue : &work_queue;
+}
+
 void thread_work_push(struct thread_work *work) {
+    struct thread_queue *queue = get_queue();
+
     sema_init(&work->done, 0);
+    work->job = current_job;
 
     switch (work->type) {
         case THREAD_WORK_SINGLE:
@@ -38,30 +57,30 @@ void thread_work_push(struct thread_work *work) {
             break;
     }
 
-    spinlock_lock(&thread_work_lock);
+    spinlock_lock(&queue->lock);
     work->next = NULL;
-    if (!work_tail) {
+    if (!queue->tail) {
         /* Empty list. Set head and tail. */
-        work_head = work;
-        work_tail = work;
+        queue->head = work;
+        queue->tail = work;
     } else {
         /* List has values. */
-        work_tail->next = work;
-        work_tail = work;
+        queue->tail->next = work;
+        queue->tail = work;
     }
-    spinlock_unlock(&thread_work_lock);
+    spinlock_unlock(&queue->lock);
 }
 
 void thread_wait(struct thread_work *work) {
     sema_down(&work->done);
 }
 
-static bool get_task(struct task *task) {
+static bool get_task(struct thread_queue *queue, struct task *task) {
     task->work = NULL;
-    if (work_head) {
-        spinlock_lock(&thread_work_lock);
-        if (work_head) {
-            task->work = work_head;
+    if (queue->head) {
+        spinlock_lock(&queue->lock);
+        if (queue->head) {
+            task->work = queue->head;
 
             bool pop_work = false;
             switch (task->work->type) {
@@ -79,18 +98,23 @@ static bool get_task(struct task *task) {
             }
 
             if (pop_work) {
-                if (!work_head->next) {
-                    work_tail = NULL;
+                if (!queue->head->next) {
+                    queue->tail = NULL;
                 }
-                work_head = work_head->next;
+                queue->head = queue->head->next;
             }
         }
-        spinlock_unlock(&thread_work_lock);
+        spinlock_unlock(&queue->lock);
     }
     return task->work;
 }
 
 static void do_task(struct task *task) {
+    struct thread_job *prev_job = current_job;
+    current_job = task->work->job;
+    uint64_t stats_start = thread_stats_begin();
+    uint64_t trace_start = trace_begin();
+
     switch (task->work->type) {
         case THREAD_WORK_SINGLE:
             task->work->single.func(task->work->single.arg);
@@ -108,46 +132,172 @@ static void do_task(struct task *task) {
             }
             break;
     }
+
+    trace_end(TRACE_TASK, trace_start, -1,
+            current_job ? current_job->mpi_tag_base : -1, 0);
+    thread_stats_end(THREAD_STAT_TASK, stats_start);
+    current_job = prev_job;
+}
+
+/* Starts the calling pool thread's idle time if it has not started, where
+ * *IDLE_START holds its start or 0. */
+static void idle_begin(uint64_t *idle_start) {
+    if (!*idle_start) {
+        *idle_start = thread_stats_begin();
+    }
+}
+
+static void idle_end(uint64_t *idle_start) {
+    if (*idle_start) {
+        thread_stats_end(THREAD_STAT_IDLE, *idle_start);
+        *idle_start = 0;
+    }
+}
+
+/* Returns a job that wants more workers than have joined it, after joining
+ * it, or NULL if no job does. */
+static struct thread_job *join_job(void) {
+    struct thread_job *job = NULL;
+
+    if (jobs_head) {
+        spinlock_lock(&jobs_lock);
+        for (job = jobs_head; job; job = job->next) {
+            if (job->num_workers_joined < job->num_workers) {
+                job->num_workers_joined++;
+                break;
+            }
+        }
+        spinlock_unlock(&jobs_lock);
+    }
+
+    return job;
+}
+
+/* Takes work from JOB's queue until the job ends. A worker stays with one job
+ * rather than taking whichever work is first in line: the work of a
+ * distributed sort blocks on messages from the same work on the other ranks,
+ * so if each rank's workers could be busy with a different job, the ranks
+ * could each wait on work that the other has no thread left to run. */
+static void serve_job(struct thread_job *job) {
+    struct thread_job *prev_job = current_job;
+    uint64_t idle_start = 0;
+    struct task task;
+
+    /* Attribute the time spent waiting for the job's work to the job. */
+    current_job = job;
+
+    while (!job->done || job->queue.head) {
+        if (get_task(&job->queue, &task)) {
+            idle_end(&idle_start);
+            do_task(&task);
+        } else {
+            idle_begin(&idle_start);
+        }
+    }
+    idle_end(&idle_start);
+
+    current_job = prev_job;
+    __atomic_sub_fetch(&job->num_workers_joined, 1, __ATOMIC_RELEASE);
 }
 
 void thread_start_work(void) {
     __atomic_add_fetch(&num_threads_working, 1, __ATOMIC_ACQUIRE);
 
+    uint64_t idle_start = 0;
     while (!work_done) {
         struct task task;
-        if (get_task(&task)) {
+        if (get_task(&work_queue, &task)) {
+            idle_end(&idle_start);
             do_task(&task);
+            continue;
+        }
+
+        struct thread_job *job = join_job();
+        if (job) {
+            idle_end(&idle_start);
+            serve_job(job);
+        } else {
+            idle_begin(&idle_start);
         }
     }
+    idle_end(&idle_start);
 
     __atomic_sub_fetch(&num_threads_working, 1, __ATOMIC_RELEASE);
 }
 
 void thread_work_until_empty(void) {
+    struct thread_queue *queue = get_queue();
+
     __atomic_add_fetch(&num_threads_working, 1, __ATOMIC_ACQUIRE);
 
     struct task task;
-    while (get_task(&task)) {
+    while (get_task(queue, &task)) {
         do_task(&task);
     }
 
     __atomic_sub_fetch(&num_threads_working, 1, __ATOMIC_RELEASE);
 }
 
-void thread_wait_for_all(void) {
-    static size_t num_threads_waiting;
-    static condvar_t all_threads_finished;
-    static spinlock_t all_threads_lock;
+/* Begins JOB on the calling thread, which takes part in the job's work along
+ * with NUM_WORKERS pool threads. The caller makes sure that the jobs running
+ * at once never want more workers than the pool has, since a job may wait on
+ * all of its workers at once. */
+void thread_job_begin(struct thread_job *job, size_t num_workers) {
+    job->num_workers = num_workers;
+    job->num_workers_joined = 0;
+    spinlock_init(&job->queue.lock);
+    job->queue.head = NULL;
+    job->queue.tail = NULL;
+    job->done = false;
+    job->span = SPAN_NONE;
+
+    spinlock_lock(&jobs_lock);
+    job->next = jobs_head;
+    jobs_head = job;
+    spinlock_unlock(&jobs_lock);
+
+    current_job = job;
+}
+
+/* Finishes any work left in JOB's queue and waits for its workers to return
+ * to the pool. */
+void thread_job_end(struct thread_job *job) {
+    thread_work_until_empty();
+    job->done = true;
+
+    spinlock_lock(&jobs_lock);
+    struct thread_job *volatile *prev = &jobs_head;
+    while (*prev != job) {
+        prev = &(*prev)->next;
+    }
+    *prev = job->next;
+    spinlock_unlock(&jobs_lock);
+
+    while (__atomic_load_n(&job->num_workers_joined, __ATOMIC_ACQUIRE)) {}
+
+    current_job = NULL;
+}
+
+void thread_barrier_init(struct thread_barrier *barrier, size_t count) {
+    spinlock_init(&barrier->lock);
+    condvar_init(&barrier->all_arrived);
+    barrier->count = count;
+    barrier->num_waiting = 0;
+}
 
-    spinlock_lock(&all_threads_lock);
-    num_threads_waiting++;
-    if (num_threads_waiting >= total_num_threads) {
-        condvar_broadcast(&all_threads_finished, &all_threads_lock);
-        num_threads_waiting = 0;
+/* Blocks until BARRIER's COUNT threads have all arrived. The barrier belongs to
+ * a single piece of work rather than to the whole pool, so threads running
+ * other jobs never take part in it. */
+void thread_barrier_wait(struct thread_barrier *barrier) {
+    spinlock_lock(&barrier->lock);
+    barrier->num_waiting++;
+    if (barrier->num_waiting >= barrier->count) {
+        condvar_broadcast(&barrier->all_arrived, &barrier->lock);
+        barrier->num_waiting = 0;
     } else {
-        condvar_wait(&all_threads_finished, &all_threads_lock);
+        condvar_wait(&barrier->all_arrived, &barrier->lock);
     }
-    spinlock_unlock(&all_threads_lock);
+    spinlock_unlock(&barrier->lock);
 }
 
 void thread_release_all(void) {
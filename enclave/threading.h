@@ -3,8 +3,46 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <threads.h>
+#include "enclave/span.h"
 #include "enclave/synch.h"
 
+struct thread_work;
+
+struct thread_queue {
+    spinlock_t lock;
+    struct thread_work *volatile head;
+    struct thread_work *volatile tail;
+};
+
+/* The state of one sort job. Several jobs may share the pool at once, so
+ * work runs under the job of the thread that pushed it, and the engines read
+ * their per-job state from CURRENT_JOB wherever their work runs. */
+struct thread_job {
+    /* The total number of elements across all ranks. */
+    size_t total_length;
+
+    /* Added to the tag of every message the job sends or receives, so that
+     * concurrent jobs never match each other's messages. */
+    int mpi_tag_base;
+
+    /* The innermost span open on the thread that began the job, which the
+     * pool's threads attribute their time to. */
+    span_t span;
+
+    /* Set up by thread_job_begin. The job's work goes to its own queue, which
+     * only NUM_WORKERS pool threads dedicated to the job and the thread that
+     * began it take work from. */
+    size_t num_workers;
+    size_t num_workers_joined;
+    struct thread_queue queue;
+    volatile bool done;
+    struct thread_job *next;
+};
+
+/* The job the calling thread is working on, or NULL outside of a job. */
+extern thread_local struct thread_job *current_job;
+
 enum thread_work_type {
     THREAD_WORK_SINGLE,
     THREAD_WORK_ITER,
@@ -29,9 +67,18 @@ struct thread_work {
 
     sema_t done;
 
+    struct thread_job *job;
     struct thread_work *next;
 };
 
+/* A barrier between the iterations of one piece of work. */
+struct thread_barrier {
+    spinlock_t lock;
+    condvar_t all_arrived;
+    size_t count;
+    size_t num_waiting;
+};
+
 extern size_t total_num_threads;
 extern size_t num_threads_working;
 
@@ -39,7 +86,10 @@ void thread_work_push(struct thread_work *work);
 void thread_wait(struct thread_work *work);
 void thread_start_work(void);
 void thread_work_until_empty(void);
-void thread_wait_for_all(void);
+void thread_job_begin(struct thread_job *job, size_t num_workers);
+void thread_job_end(struct thread_job *job);
+void thread_barrier_init(struct thread_barrier *barrier, size_t count);
+void thread_barrier_wait(struct thread_barrier *barrier);
 void thread_release_all(void);
 void thread_unrelease_all(void);
 
@@ -0,0 +1,125 @@
+#include "enclave/trace.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "common/defs.h"
+#include "common/mem.h"
+#include "common/trace.h"
+#include "enclave/mem.h"
+#include "enclave/span.h"
+
+struct trace_buffer {
+    /* The number of events recorded since the last collection, which may
+     * exceed TRACE_BUFFER_EVENTS when the oldest were overwritten. */
+    size_t num_events;
+
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+bool trace_enabled;
+
+static struct trace_buffer *buffers[TRACE_MAX_THREADS];
+static uint32_t num_buffers;
+
+/* Counts the calls to trace_free, so that threads can tell that their buffer
+ * was freed. Starts at 1 so that no thread's buffer is current before its
+ * first event. */
+static uint32_t generation = 1;
+
+/* This thread's buffer, or NULL if it has none, and the generation it was
+ * allocated in. */
+static thread_local struct trace_buffer *buffer;
+static thread_local uint32_t buffer_generation;
+static thread_local uint32_t thread_id;
+
+void trace_record(enum trace_event_type type, uint64_t start_ns, int peer,
+        int tag, uint64_t bytes) {
+    uint32_t gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    if (buffer_generation != gen) {
+        /* Allocate this thread's buffer on its first event. Threads past
+         * TRACE_MAX_THREADS, or whose allocation fails, record nothing until
+         * the buffers are freed. */
+        buffer = NULL;
+        buffer_generation = gen;
+        uint32_t index =
+            __atomic_fetch_add(&num_buffers, 1, __ATOMIC_RELAXED);
+        if (index < TRACE_MAX_THREADS) {
+            buffer = mem_alloc(MEM_TRACE, sizeof(*buffer));
+            if (buffer) {
+                buffer->num_events = 0;
+            }
+            buffers[index] = buffer;
+            thread_id = index;
+        }
+    }
+    if (!buffer) {
+        return;
+    }
+
+    struct trace_event *event =
+        &buffer->events[buffer->num_events % TRACE_BUFFER_EVENTS];
+    event->start_ns = start_ns;
+    event->end_ns = span_time_ns();
+    event->bytes = bytes;
+    event->type = type;
+    event->thread = thread_id;
+    event->peer = peer;
+    event->tag = tag;
+    buffer->num_events++;
+}
+
+void trace_set_enabled(bool enabled) {
+    trace_enabled = enabled;
+}
+
+size_t trace_collect(struct trace_event *events, size_t capacity) {
+    size_t count = 0;
+    size_t buffers_len = MIN(num_buffers, TRACE_MAX_THREADS);
+    for (size_t i = 0; i < buffers_len; i++) {
+        if (buffers[i]) {
+            count += MIN(buffers[i]->num_events, TRACE_BUFFER_EVENTS);
+        }
+    }
+    if (count > capacity) {
+        return count;
+    }
+
+    size_t copied = 0;
+    for (size_t i = 0; i < buffers_len; i++) {
+        struct trace_buffer *b = buffers[i];
+        if (!b) {
+            continue;
+        }
+
+        /* Once the buffer has wrapped around, its oldest event is the one
+         * the next event would overwrite. */
+        size_t first = 0;
+        size_t len = b->num_events;
+        if (len > TRACE_BUFFER_EVENTS) {
+            first = len % TRACE_BUFFER_EVENTS;
+            len = TRACE_BUFFER_EVENTS;
+        }
+        memcpy(events + copied, b->events + first,
+                (len - first) * sizeof(*events));
+        memcpy(events + copied + len - first, b->events,
+                first * sizeof(*events));
+        copied += len;
+        b->num_events = 0;
+    }
+
+    return count;
+}
+
+void trace_free(void) {
+    size_t buffers_len = MIN(num_buffers, TRACE_MAX_THREADS);
+    for (size_t i = 0; i < buffers_len; i++) {
+        mem_free(buffers[i]);
+        buffers[i] = NULL;
+    }
+    num_buffers = 0;
+    trace_enabled = false;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,46 @@
+#ifndef DISTRIBUTED_SGX_SORT_ENCLAVE_TRACE_H
+#define DISTRIBUTED_SGX_SORT_ENCLAVE_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common/trace.h"
+#include "enclave/span.h"
+
+/* Timeline tracing. While tracing is enabled, the thread pool's tasks, the
+ * MPI-over-TLS calls, and the encryption of messages are recorded as events in
+ * per-thread buffers, which the host collects after a sort to lay out what
+ * every thread of every rank was doing when. Tracing is off by default and
+ * costs one branch per event while off. */
+
+extern bool trace_enabled;
+
+/* Returns the start time to pass to trace_end, or 0 if tracing is off. */
+static inline uint64_t trace_begin(void) {
+    return trace_enabled ? span_time_ns() : 0;
+}
+
+void trace_record(enum trace_event_type type, uint64_t start_ns, int peer,
+        int tag, uint64_t bytes);
+
+/* Records an event of TYPE from START_NS, as returned by trace_begin, until
+ * now. */
+static inline void trace_end(enum trace_event_type type, uint64_t start_ns,
+        int peer, int tag, uint64_t bytes) {
+    if (start_ns) {
+        trace_record(type, start_ns, peer, tag, bytes);
+    }
+}
+
+/* Turns tracing on or off. No job may be running. */
+void trace_set_enabled(bool enabled);
+
+/* Returns the number of events recorded since the last collection. If that
+ * many fit in CAPACITY, copies them into EVENTS, ordered by thread and then in
+ * the order they ended, and forgets them. No job may be running. */
+size_t trace_collect(struct trace_event *events, size_t capacity);
+
+/* Frees the per-thread buffers. No job may be running. */
+void trace_free(void);
+
+#endif /* distributed-sgx-sort/enclave/trace.h */
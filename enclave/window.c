@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "common/mem.h"
+#include "enclave/mem.h"
 
 #define WINDOW_INITAL_SIZE 16
 
@@ -18,7 +20,8 @@ int window_init(window_t *window) {
     int ret;
 
     window->window =
-        calloc(WINDOW_INITAL_SIZE / CHAR_BIT, sizeof(*window->window));
+        mem_calloc(MEM_MPI_SESSIONS, WINDOW_INITAL_SIZE / CHAR_BIT,
+                sizeof(*window->window));
     if (!window->window) {
         ret = errno;
         goto exit;
@@ -34,7 +37,7 @@ exit:
 }
 
 void window_free(window_t *window) {
-    free(window->window);
+    mem_free(window->window);
 }
 
 int window_add(window_t *restrict window, uint64_t val,
@@ -55,7 +58,8 @@ int window_add(window_t *restrict window, uint64_t val,
      * window, expand the window. */
     if (val_idx >= window->window_len) {
         unsigned char *new_window =
-            realloc(window->window, window->window_len * 2 / CHAR_BIT);
+            mem_realloc(MEM_MPI_SESSIONS, window->window,
+                    window->window_len * 2 / CHAR_BIT);
         if (!new_window) {
             ret = errno;
             goto exit;
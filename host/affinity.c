@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include "host/affinity.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/error.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/* The CPU of each thread slot, in the order given by the spec. If NULL, no
+ * affinity was requested. */
+static int *cpus;
+static size_t cpus_len;
+static size_t cpu_offset;
+
+struct cpu_list {
+    int *cpus;
+    size_t len;
+    size_t cap;
+};
+
+static int cpu_list_append(struct cpu_list *list, int cpu) {
+    if (list->len == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 16;
+        int *new_cpus = realloc(list->cpus, new_cap * sizeof(*new_cpus));
+        if (!new_cpus) {
+            perror("realloc CPU list");
+            return -1;
+        }
+        list->cpus = new_cpus;
+        list->cap = new_cap;
+    }
+    list->cpus[list->len] = cpu;
+    list->len++;
+    return 0;
+}
+
+/* Parses a Linux CPU list of the form "0-3,8,10-11", as used in sysfs. */
+static int parse_cpu_list(const char *str, struct cpu_list *list) {
+    const char *s = str;
+    int ret;
+
+    while (*s && *s != '\n') {
+        char *end;
+        errno = 0;
+        long first = strtol(s, &end, 10);
+        if (errno || end == s || first < 0) {
+            goto exit_invalid;
+        }
+        long last = first;
+        s = end;
+        if (*s == '-') {
+            s++;
+            errno = 0;
+            last = strtol(s, &end, 10);
+            if (errno || end == s || last < first) {
+                goto exit_invalid;
+            }
+            s = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            ret = cpu_list_append(list, cpu);
+            if (ret) {
+                goto exit;
+            }
+        }
+        if (*s == ',') {
+            s++;
+        } else if (*s && *s != '\n') {
+            goto exit_invalid;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+
+exit_invalid:
+    handle_error_string("Invalid CPU list: %s", str);
+    return -1;
+}
+
+static int read_cpu_list_file(const char *path, struct cpu_list *list) {
+    char buf[4096];
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    if (!fgets(buf, sizeof(buf), file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return parse_cpu_list(buf, list);
+}
+
+/* Builds the compact or scatter CPU order from the NUMA topology in sysfs,
+ * skipping CPUs that this process may not run on. Without sysfs, all allowed
+ * CPUs are treated as a single node. */
+static int build_topology_order(bool scatter, struct cpu_list *order) {
+    struct cpu_list nodes = { 0 };
+    struct cpu_list *node_cpus = NULL;
+    size_t num_nodes = 0;
+    cpu_set_t allowed;
+    int ret;
+
+    ret = sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (ret) {
+        perror("sched_getaffinity");
+        goto exit;
+    }
+
+    if (read_cpu_list_file(NODE_DIR "/online", &nodes)) {
+        nodes.len = 0;
+        ret = cpu_list_append(&nodes, -1);
+        if (ret) {
+            goto exit;
+        }
+    }
+
+    node_cpus = calloc(nodes.len, sizeof(*node_cpus));
+    if (!node_cpus) {
+        perror("malloc node CPU lists");
+        ret = -1;
+        goto exit_free_nodes;
+    }
+    num_nodes = nodes.len;
+
+    for (size_t i = 0; i < num_nodes; i++) {
+        struct cpu_list all = { 0 };
+        if (nodes.cpus[i] >= 0) {
+            char path[256];
+            snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist",
+                    nodes.cpus[i]);
+            if (read_cpu_list_file(path, &all)) {
+                /* Memory-only nodes have an empty CPU list. */
+                all.len = 0;
+            }
+        } else {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    ret = cpu_list_append(&all, cpu);
+                    if (ret) {
+                        free(all.cpus);
+                        goto exit_free_node_cpus;
+                    }
+                }
+            }
+        }
+
+        for (size_t j = 0; j < all.len; j++) {
+            if (all.cpus[j] < CPU_SETSIZE && CPU_ISSET(all.cpus[j], &allowed)) {
+                ret = cpu_list_append(&node_cpus[i], all.cpus[j]);
+                if (ret) {
+                    free(all.cpus);
+                    goto exit_free_node_cpus;
+                }
+            }
+        }
+        free(all.cpus);
+    }
+
+    if (scatter) {
+        /* Take the next CPU of each node in turn. */
+        bool any = true;
+        for (size_t j = 0; any; j++) {
+            any = false;
+            for (size_t i = 0; i < num_nodes; i++) {
+                if (j < node_cpus[i].len) {
+                    ret = cpu_list_append(order, node_cpus[i].cpus[j]);
+                    if (ret) {
+                        goto exit_free_node_cpus;
+                    }
+                    any = true;
+                }
+            }
+        }
+    } else {
+        /* Fill each node before moving on to the next. */
+        for (size_t i = 0; i < num_nodes; i++) {
+            for (size_t j = 0; j < node_cpus[i].len; j++) {
+                ret = cpu_list_append(order, node_cpus[i].cpus[j]);
+                if (ret) {
+                    goto exit_free_node_cpus;
+                }
+            }
+        }
+    }
+
+    ret = 0;
+
+exit_free_node_cpus:
+    for (size_t i = 0; i < num_nodes; i++) {
+        free(node_cpus[i].cpus);
+    }
+    free(node_cpus);
+exit_free_nodes:
+    free(nodes.cpus);
+exit:
+    return ret;
+}
+
+int affinity_init(const char *spec, int local_rank, size_t threads_per_rank) {
+    struct cpu_list order = { 0 };
+    int ret;
+
+    if (strcmp(spec, "compact") == 0) {
+        ret = build_topology_order(false, &order);
+    } else if (strcmp(spec, "scatter") == 0) {
+        ret = build_topology_order(true, &order);
+    } else {
+        ret = parse_cpu_list(spec, &order);
+    }
+    if (ret) {
+        handle_error_string("Error building CPU order for affinity %s", spec);
+        goto exit_free_order;
+    }
+    if (!order.len) {
+        handle_error_string("No CPUs available for affinity %s", spec);
+        ret = -1;
+        goto exit_free_order;
+    }
+    for (size_t i = 0; i < order.len; i++) {
+        if (order.cpus[i] >= CPU_SETSIZE) {
+            handle_error_string("CPU %d out of range", order.cpus[i]);
+            ret = -1;
+            goto exit_free_order;
+        }
+    }
+
+    if (local_rank * threads_per_rank + threads_per_rank > order.len) {
+        printf("Warning: %zu CPUs on this host for %zu threads, %zu for each of %d local ranks; some threads will share CPUs\n",
+                order.len, (local_rank + 1) * threads_per_rank,
+                threads_per_rank, local_rank + 1);
+    }
+
+    cpus = order.cpus;
+    cpus_len = order.len;
+    cpu_offset = local_rank * threads_per_rank;
+
+    return 0;
+
+exit_free_order:
+    free(order.cpus);
+    return ret;
+}
+
+static void get_cpu_set(size_t idx, cpu_set_t *set) {
+    CPU_ZERO(set);
+    CPU_SET(cpus[(cpu_offset + idx) % cpus_len], set);
+}
+
+int affinity_set_self(size_t idx) {
+    cpu_set_t set;
+    int ret;
+
+    if (!cpus) {
+        return 0;
+    }
+
+    get_cpu_set(idx, &set);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret) {
+        errno = ret;
+        perror("pthread_setaffinity_np");
+        return ret;
+    }
+
+    return 0;
+}
+
+int affinity_set_attr(pthread_attr_t *attr, size_t idx) {
+    cpu_set_t set;
+    int ret;
+
+    if (!cpus) {
+        return 0;
+    }
+
+    get_cpu_set(idx, &set);
+    ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    if (ret) {
+        errno = ret;
+        perror("pthread_attr_setaffinity_np");
+        return ret;
+    }
+
+    return 0;
+}
+
+void affinity_free(void) {
+    free(cpus);
+    cpus = NULL;
+    cpus_len = 0;
+}
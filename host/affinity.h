@@ -0,0 +1,24 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_AFFINITY_H
+#define DISTRIBUTED_SGX_SORT_HOST_AFFINITY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Parses an affinity spec, which is one of "compact" (fill one NUMA node
+ * before the next), "scatter" (round-robin across NUMA nodes), or an explicit
+ * CPU list such as "0-7,16-23". Thread slot i of this process is pinned to the
+ * (LOCAL_RANK * THREADS_PER_RANK + i)th CPU of the resulting order, so that
+ * ranks sharing a host do not share CPUs. */
+int affinity_init(const char *spec, int local_rank, size_t threads_per_rank);
+
+/* Pins the calling thread to the CPU of thread slot IDX. Does nothing if no
+ * affinity was requested. */
+int affinity_set_self(size_t idx);
+
+/* Sets ATTR so that the created thread is pinned to the CPU of thread slot
+ * IDX. Does nothing if no affinity was requested. */
+int affinity_set_attr(pthread_attr_t *attr, size_t idx);
+
+void affinity_free(void);
+
+#endif /* distributed-sgx-sort/host/affinity.h */
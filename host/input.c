@@ -0,0 +1,285 @@
+#include "host/input.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "common/error.h"
+#include "common/input.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/host.h>
+#include "host/parallel_u.h"
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+/* The number of chunk buffers. The reader thread fills one while the enclave
+ * decrypts the other. */
+#define NUM_BUFS 2
+
+struct reader {
+    int fd;
+    const struct input_header *header;
+    size_t first_chunk;
+    size_t end_chunk;
+
+    unsigned char *bufs[NUM_BUFS];
+    size_t lens[NUM_BUFS];
+    bool full[NUM_BUFS];
+    bool failed;
+    bool stopped;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+int input_read_key(const char *path, unsigned char *key) {
+    int ret;
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("fopen key file");
+        ret = -1;
+        goto exit;
+    }
+
+    if (fread(key, 1, INPUT_KEY_LEN, file) != INPUT_KEY_LEN) {
+        handle_error_string("Key file %s must hold %d bytes", path,
+                INPUT_KEY_LEN);
+        ret = -1;
+        goto exit_close_file;
+    }
+
+    ret = 0;
+
+exit_close_file:
+    fclose(file);
+exit:
+    return ret;
+}
+
+static int read_fully(int fd, void *buf_, size_t count, off_t offset) {
+    unsigned char *buf = buf_;
+    while (count) {
+        ssize_t bytes_read = pread(fd, buf, count, offset);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pread input");
+            return -1;
+        }
+        if (!bytes_read) {
+            handle_error_string("Input file truncated");
+            return -1;
+        }
+        buf += bytes_read;
+        count -= bytes_read;
+        offset += bytes_read;
+    }
+    return 0;
+}
+
+static void *read_chunks(void *reader_) {
+    struct reader *reader = reader_;
+
+    for (size_t chunk = reader->first_chunk; chunk < reader->end_chunk;
+            chunk++) {
+        size_t slot = (chunk - reader->first_chunk) % NUM_BUFS;
+
+        /* Wait for the enclave to be done with the buffer. */
+        pthread_mutex_lock(&reader->lock);
+        while (reader->full[slot] && !reader->stopped) {
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        }
+        bool stopped = reader->stopped;
+        pthread_mutex_unlock(&reader->lock);
+        if (stopped) {
+            break;
+        }
+
+        size_t len = input_chunk_len(reader->header, chunk);
+        int ret =
+            read_fully(reader->fd, reader->bufs[slot], len,
+                    input_chunk_offset(reader->header, chunk));
+
+        pthread_mutex_lock(&reader->lock);
+        if (ret) {
+            reader->failed = true;
+        } else {
+            reader->lens[slot] = len;
+            reader->full[slot] = true;
+        }
+        pthread_cond_broadcast(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+        if (ret) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+int input_ingest(oe_enclave_t *enclave, const char *path, int world_rank,
+        int world_size, size_t total_length) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+int input_ingest(const char *path, int world_rank, int world_size,
+        size_t total_length) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    struct reader reader = { 0 };
+    int ret;
+
+    /* Open this rank's file. */
+    char path_buf[4096];
+    if (strstr(path, "%d")) {
+        snprintf(path_buf, sizeof(path_buf), path, world_rank);
+    } else {
+        snprintf(path_buf, sizeof(path_buf), "%s", path);
+    }
+    reader.fd = open(path_buf, O_RDONLY);
+    if (reader.fd < 0) {
+        perror("open input");
+        ret = -1;
+        goto exit;
+    }
+
+    /* Read the header and hand it to the enclave, which checks it against
+     * the sort and authenticates it with every chunk. */
+    struct input_header header;
+    ret = read_fully(reader.fd, &header, sizeof(header), 0);
+    if (ret) {
+        goto exit_close_fd;
+    }
+    if (!header.chunk_elems) {
+        handle_error_string("Invalid input header in %s", path_buf);
+        ret = -1;
+        goto exit_close_fd;
+    }
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_ingest_begin(enclave, &ret, &header);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_ingest_begin");
+        ret = result;
+        goto exit_close_fd;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_ingest_begin(&header);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error beginning ingestion of %s", path_buf);
+        goto exit_close_fd;
+    }
+
+    /* Work out which chunks hold this rank's elements, using the same
+     * partitioning as the enclave. */
+    size_t local_start =
+        (world_rank * total_length + world_size - 1) / world_size;
+    size_t local_length =
+        ((world_rank + 1) * total_length + world_size - 1) / world_size
+            - local_start;
+    reader.header = &header;
+    input_chunk_range(&header, local_start, local_length, &reader.first_chunk,
+            &reader.end_chunk);
+
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.cond, NULL);
+    size_t buf_len =
+        sizeof(struct input_chunk_header)
+            + header.chunk_elems * header.elem_size;
+    for (size_t i = 0; i < NUM_BUFS; i++) {
+        reader.bufs[i] = malloc(buf_len);
+        if (!reader.bufs[i]) {
+            perror("malloc input buffer");
+            ret = -1;
+            goto exit_end_ingest;
+        }
+    }
+
+    /* Read chunks in the background and pass each to the enclave as soon as
+     * it is read. */
+    pthread_t reader_thread;
+    ret = pthread_create(&reader_thread, NULL, read_chunks, &reader);
+    if (ret) {
+        errno = ret;
+        perror("pthread_create input reader");
+        goto exit_end_ingest;
+    }
+
+    for (size_t chunk = reader.first_chunk; chunk < reader.end_chunk;
+            chunk++) {
+        size_t slot = (chunk - reader.first_chunk) % NUM_BUFS;
+
+        pthread_mutex_lock(&reader.lock);
+        while (!reader.full[slot] && !reader.failed) {
+            pthread_cond_wait(&reader.cond, &reader.lock);
+        }
+        bool full = reader.full[slot];
+        pthread_mutex_unlock(&reader.lock);
+        if (!full) {
+            handle_error_string("Error reading input chunk %zu", chunk);
+            ret = -1;
+            goto exit_stop_reader;
+        }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result =
+            ecall_ingest_chunk(enclave, &ret, reader.bufs[slot],
+                    reader.lens[slot]);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_ingest_chunk");
+            ret = result;
+            goto exit_stop_reader;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = ecall_ingest_chunk(reader.bufs[slot], reader.lens[slot]);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            handle_error_string("Error ingesting input chunk %zu", chunk);
+            goto exit_stop_reader;
+        }
+
+        pthread_mutex_lock(&reader.lock);
+        reader.full[slot] = false;
+        pthread_cond_broadcast(&reader.cond);
+        pthread_mutex_unlock(&reader.lock);
+    }
+
+exit_stop_reader:
+    pthread_mutex_lock(&reader.lock);
+    reader.stopped = true;
+    pthread_cond_broadcast(&reader.cond);
+    pthread_mutex_unlock(&reader.lock);
+    pthread_join(reader_thread, NULL);
+exit_end_ingest:
+    /* Always end the ingestion so the enclave frees its state. It fails if
+     * any chunk is missing. */
+    {
+        int end_ret;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_ingest_end(enclave, &end_ret);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_ingest_end");
+            end_ret = result;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        end_ret = ecall_ingest_end();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (!ret) {
+            ret = end_ret;
+        }
+    }
+    for (size_t i = 0; i < NUM_BUFS; i++) {
+        free(reader.bufs[i]);
+    }
+    pthread_cond_destroy(&reader.cond);
+    pthread_mutex_destroy(&reader.lock);
+exit_close_fd:
+    close(reader.fd);
+exit:
+    return ret;
+}
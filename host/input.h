@@ -0,0 +1,26 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_INPUT_H
+#define DISTRIBUTED_SGX_SORT_HOST_INPUT_H
+
+#include <stddef.h>
+#include "common/input.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/host.h>
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+/* Reads the INPUT_KEY_LEN-byte input key from PATH. */
+int input_read_key(const char *path, unsigned char *key);
+
+/* Streams this rank's part of the encrypted input at PATH into the enclave's
+ * array. If PATH contains %d, it is replaced by the rank to name a per-rank
+ * shard; otherwise, PATH is a single file shared by all ranks, from which
+ * only the chunks overlapping this rank's range are read. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+int input_ingest(oe_enclave_t *enclave, const char *path, int world_rank,
+        int world_size, size_t total_length);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+int input_ingest(const char *path, int world_rank, int world_size,
+        size_t total_length);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+#endif /* distributed-sgx-sort/host/input.h */
@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "common/error.h"
+#include "common/kbench.h"
+#include "host/error.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+#include <openenclave/host.h>
+#include "host/kbench_u.h"
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+/* Times the enclave's hot kernels in isolation. Rank 0 prints the results and
+ * can write them to a file to compare later runs against with
+ * scripts/compare-kbench.sh. The MPI-over-TLS round trip runs between ranks 0
+ * and 1, so it is only timed with at least two ranks. */
+
+static int world_rank;
+static int world_size;
+
+/* The host threads running the enclave's pool threads. */
+static pthread_t *threads;
+static size_t num_threads_created;
+
+static void usage(char **argv) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    printf("Usage: %s [options] <enclave image> <num threads>\n", argv[0]);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    printf("Usage: %s [options] <num threads>\n", argv[0]);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    printf("\n");
+    printf("Options:\n");
+    printf("  -o, --output <file>       Write each kernel's time per operation to\n");
+    printf("                            <file>, one \"<kernel> <ns>\" line each\n");
+}
+
+static void *start_thread_work(void *enclave_) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_enclave_t *enclave = enclave_;
+    oe_result_t result = ecall_kbench_start_work(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_kbench_start_work");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    (void) enclave_;
+    ecall_kbench_start_work();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    return 0;
+}
+
+/* Prints RESULTS and writes them to OUTPUT_PATH if it is not NULL. */
+static int write_results(const struct kbench_result *results,
+        size_t num_results, const char *output_path) {
+    int ret;
+
+    for (size_t i = 0; i < num_results; i++) {
+        printf("[kbench] %-23s: %14.3f ns/op (%" PRIu64 " ops)\n",
+                results[i].name, results[i].ns_per_op, results[i].iters);
+    }
+
+    if (!output_path) {
+        ret = 0;
+        goto exit;
+    }
+
+    FILE *file = fopen(output_path, "w");
+    if (!file) {
+        handle_error_string("Error opening %s", output_path);
+        ret = -1;
+        goto exit;
+    }
+    for (size_t i = 0; i < num_results; i++) {
+        fprintf(file, "%s %.3f\n", results[i].name, results[i].ns_per_op);
+    }
+    if (fclose(file)) {
+        handle_error_string("Error writing %s", output_path);
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int ret = -1;
+
+    /* Read arguments. */
+
+    struct option long_options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *output_path = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                usage(argv);
+                return ret;
+        }
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    if (argc < optind + 2) {
+        usage(argv);
+        return 0;
+    }
+    const char *enclave_image = argv[optind];
+    int argi = optind + 1;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (argc < optind + 1) {
+        usage(argv);
+        return 0;
+    }
+    int argi = optind;
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    errno = 0;
+    size_t num_threads = strtoull(argv[argi], NULL, 10);
+    if (errno || !num_threads) {
+        printf("Invalid number of threads\n");
+        return ret;
+    }
+
+    /* Init MPI. */
+
+    pthread_t thread_buf[num_threads];
+    threads = thread_buf;
+    int threading_provided;
+    ret = MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE,
+            &threading_provided);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Init_thread");
+        goto exit;
+    }
+    if (threading_provided != MPI_THREAD_MULTIPLE) {
+        printf("This program requires MPI_THREAD_MULTIPLE to be supported");
+        ret = 1;
+        goto exit_mpi_finalize;
+    }
+    ret = MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Comm_rank");
+        goto exit_mpi_finalize;
+    }
+    ret = MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Comm_size");
+        goto exit_mpi_finalize;
+    }
+
+    /* Create enclave. */
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_enclave_t *enclave;
+    oe_result_t result;
+    result = oe_create_kbench_enclave(
+            enclave_image,
+            OE_ENCLAVE_TYPE_AUTO,
+            0
+#ifdef OE_DEBUG
+                | OE_ENCLAVE_FLAG_DEBUG
+#endif
+#ifdef OE_SIMULATION
+                | OE_ENCLAVE_FLAG_SIMULATE
+#endif
+            ,
+            NULL,
+            0,
+            &enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "oe_create_kbench_enclave");
+        ret = result;
+        goto exit_mpi_finalize;
+    }
+
+    result =
+        ecall_kbench_init(enclave, &ret, world_rank, world_size, num_threads);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_kbench_init");
+        goto exit_terminate_enclave;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_kbench_init(world_rank, world_size, num_threads);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error initializing kernel benchmark");
+        goto exit_terminate_enclave;
+    }
+
+    /* Start the pool threads and wait for them to enter the enclave. */
+
+    for (size_t i = 0; i < num_threads - 1; i++) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = pthread_create(&threads[num_threads_created], NULL,
+                start_thread_work, enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = pthread_create(&threads[num_threads_created], NULL,
+                start_thread_work, NULL);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            errno = ret;
+            perror("pthread_create");
+            goto exit_release_threads;
+        }
+        num_threads_created++;
+    }
+    while (1) {
+        size_t num_threads_started;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result =
+            ecall_kbench_get_num_threads_started(enclave,
+                    &num_threads_started);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_kbench_get_num_threads_started");
+            ret = result;
+            goto exit_release_threads;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        num_threads_started = ecall_kbench_get_num_threads_started();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (num_threads_started == num_threads_created) {
+            break;
+        }
+        sched_yield();
+    }
+
+    /* Run the kernels. */
+
+    struct kbench_result results[KBENCH_MAX_RESULTS];
+    size_t num_results;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result =
+        ecall_kbench_run(enclave, &ret, results, KBENCH_MAX_RESULTS,
+                &num_results);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_kbench_run");
+        goto exit_release_threads;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_kbench_run(results, KBENCH_MAX_RESULTS, &num_results);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error running kernel benchmark");
+        goto exit_release_threads;
+    }
+
+    if (world_rank == 0) {
+        ret = write_results(results, num_results, output_path);
+        if (ret) {
+            goto exit_release_threads;
+        }
+    }
+
+    ret = 0;
+
+exit_release_threads:
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_kbench_release_threads(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_kbench_release_threads");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_kbench_release_threads();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    for (size_t i = 0; i < num_threads_created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_kbench_free(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_kbench_free");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_kbench_free();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+exit_terminate_enclave:
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_terminate_enclave(enclave);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+exit_mpi_finalize:
+    MPI_Finalize();
+exit:
+    return ret;
+}
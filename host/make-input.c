@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <mbedtls/gcm.h>
+#include "common/elem_t.h"
+#include "common/error.h"
+#include "common/input.h"
+
+/* Creates encrypted input files for the sort, either from a file of raw
+ * ELEM_SIZE-byte records or from random keys. */
+
+static void usage(char **argv) {
+    printf("Usage: %s [options] <key file> <output path>\n", argv[0]);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -p, --plaintext <file>    Encrypt the raw records in <file>\n");
+    printf("  -n, --random <num>        Generate <num> records with random keys\n");
+    printf("  -s, --shards <num>        Write <num> per-rank shards; <output path>\n");
+    printf("                            must contain %%d (default 1 shared file)\n");
+    printf("  -c, --chunk-elems <num>   Elements per chunk (default %d)\n",
+            INPUT_CHUNK_ELEMS);
+}
+
+static int read_key(const char *path, unsigned char *key) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("fopen key file");
+        return -1;
+    }
+    size_t bytes_read = fread(key, 1, INPUT_KEY_LEN, file);
+    fclose(file);
+    if (bytes_read != INPUT_KEY_LEN) {
+        handle_error_string("Key file %s must hold %d bytes", path,
+                INPUT_KEY_LEN);
+        return -1;
+    }
+    return 0;
+}
+
+static int get_random_bytes(void *buf_, size_t count) {
+    unsigned char *buf = buf_;
+    while (count) {
+        ssize_t bytes_read = getrandom(buf, count, 0);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("getrandom");
+            return -1;
+        }
+        buf += bytes_read;
+        count -= bytes_read;
+    }
+    return 0;
+}
+
+/* Fills ELEMS with the next NUM_ELEMS records, read from PLAINTEXT or, if it
+ * is NULL, generated. */
+static int next_records(FILE *plaintext, elem_t *elems, size_t num_elems) {
+    if (plaintext) {
+        if (fread(elems, sizeof(*elems), num_elems, plaintext) != num_elems) {
+            handle_error_string("Plaintext file too short");
+            return -1;
+        }
+        return 0;
+    }
+
+    memset(elems, '\0', num_elems * sizeof(*elems));
+    for (size_t i = 0; i < num_elems; i++) {
+        uint32_t key;
+        if (get_random_bytes(&key, sizeof(key))) {
+            return -1;
+        }
+        elems[i].key = key & INT32_MAX;
+    }
+    return 0;
+}
+
+static int write_file(const char *path, const unsigned char *key,
+        FILE *plaintext, size_t total_elems, size_t first_elem,
+        size_t num_elems, size_t chunk_elems, elem_t *elems,
+        unsigned char *ciphertext) {
+    int ret;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("fopen output");
+        ret = -1;
+        goto exit;
+    }
+
+    struct input_header header = {
+        .version = INPUT_VERSION,
+        .elem_size = sizeof(elem_t),
+        .total_elems = total_elems,
+        .first_elem = first_elem,
+        .num_elems = num_elems,
+        .chunk_elems = chunk_elems,
+    };
+    memcpy(header.magic, INPUT_MAGIC, INPUT_MAGIC_LEN);
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        perror("fwrite header");
+        ret = -1;
+        goto exit_close_file;
+    }
+
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key,
+            INPUT_KEY_LEN * CHAR_BIT);
+    if (ret) {
+        handle_mbedtls_error(ret, "mbedtls_gcm_setkey");
+        goto exit_free_gcm;
+    }
+
+    for (size_t chunk = 0; chunk < input_num_chunks(&header); chunk++) {
+        size_t chunk_num_elems = input_chunk_num_elems(&header, chunk);
+        ret = next_records(plaintext, elems, chunk_num_elems);
+        if (ret) {
+            goto exit_free_gcm;
+        }
+
+        struct input_chunk_header chunk_header = {
+            .chunk_idx = chunk,
+        };
+        ret = get_random_bytes(chunk_header.iv, sizeof(chunk_header.iv));
+        if (ret) {
+            goto exit_free_gcm;
+        }
+        struct input_chunk_aad aad = {
+            .header = header,
+            .chunk_idx = chunk,
+        };
+        ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT,
+                chunk_num_elems * sizeof(*elems), chunk_header.iv,
+                sizeof(chunk_header.iv), (unsigned char *) &aad, sizeof(aad),
+                (unsigned char *) elems, ciphertext, sizeof(chunk_header.tag),
+                chunk_header.tag);
+        if (ret) {
+            handle_mbedtls_error(ret, "mbedtls_gcm_crypt_and_tag");
+            goto exit_free_gcm;
+        }
+
+        if (fwrite(&chunk_header, sizeof(chunk_header), 1, file) != 1
+                || fwrite(ciphertext, sizeof(*elems), chunk_num_elems, file)
+                    != chunk_num_elems) {
+            perror("fwrite chunk");
+            ret = -1;
+            goto exit_free_gcm;
+        }
+    }
+
+    ret = 0;
+
+exit_free_gcm:
+    mbedtls_gcm_free(&gcm);
+exit_close_file:
+    if (fclose(file) && !ret) {
+        perror("fclose output");
+        ret = -1;
+    }
+exit:
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int ret = -1;
+
+    static const struct option long_options[] = {
+        { "plaintext", required_argument, NULL, 'p' },
+        { "random", required_argument, NULL, 'n' },
+        { "shards", required_argument, NULL, 's' },
+        { "chunk-elems", required_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *plaintext_path = NULL;
+    size_t num_random = 0;
+    size_t num_shards = 1;
+    size_t chunk_elems = INPUT_CHUNK_ELEMS;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:n:s:c:", long_options, NULL))
+            != -1) {
+        errno = 0;
+        switch (opt) {
+            case 'p':
+                plaintext_path = optarg;
+                break;
+            case 'n':
+                num_random = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                num_shards = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                chunk_elems = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv);
+                return ret;
+        }
+        if (errno) {
+            printf("Invalid argument to -%c\n", opt);
+            return ret;
+        }
+    }
+    if (argc - optind != 2 || !plaintext_path == !num_random || !num_shards
+            || !chunk_elems) {
+        usage(argv);
+        return ret;
+    }
+    const char *key_path = argv[optind];
+    const char *output_path = argv[optind + 1];
+    if (num_shards > 1 && !strstr(output_path, "%d")) {
+        printf("Output path must contain %%d when writing shards\n");
+        return ret;
+    }
+
+    unsigned char key[INPUT_KEY_LEN];
+    ret = read_key(key_path, key);
+    if (ret) {
+        goto exit;
+    }
+
+    /* Open the plaintext and count its records. */
+    FILE *plaintext = NULL;
+    size_t total_elems = num_random;
+    if (plaintext_path) {
+        plaintext = fopen(plaintext_path, "rb");
+        if (!plaintext) {
+            perror("fopen plaintext");
+            ret = -1;
+            goto exit;
+        }
+        if (fseeko(plaintext, 0, SEEK_END)) {
+            perror("fseeko plaintext");
+            ret = -1;
+            goto exit_close_plaintext;
+        }
+        off_t plaintext_len = ftello(plaintext);
+        if (plaintext_len < 0 || plaintext_len % sizeof(elem_t)) {
+            handle_error_string("Plaintext must hold whole %zu-byte records",
+                    sizeof(elem_t));
+            ret = -1;
+            goto exit_close_plaintext;
+        }
+        total_elems = plaintext_len / sizeof(elem_t);
+        rewind(plaintext);
+    }
+
+    elem_t *elems = malloc(chunk_elems * sizeof(*elems));
+    if (!elems) {
+        perror("malloc records");
+        ret = -1;
+        goto exit_close_plaintext;
+    }
+    unsigned char *ciphertext = malloc(chunk_elems * sizeof(*elems));
+    if (!ciphertext) {
+        perror("malloc ciphertext");
+        ret = -1;
+        goto exit_free_elems;
+    }
+
+    /* Shards split the elements the same way the sort splits them across
+     * ranks. */
+    for (size_t i = 0; i < num_shards; i++) {
+        size_t first_elem = (i * total_elems + num_shards - 1) / num_shards;
+        size_t end_elem =
+            ((i + 1) * total_elems + num_shards - 1) / num_shards;
+        char path[4096];
+        snprintf(path, sizeof(path), output_path, (int) i);
+        ret = write_file(path, key, plaintext, total_elems, first_elem,
+                end_elem - first_elem, chunk_elems, elems, ciphertext);
+        if (ret) {
+            handle_error_string("Error writing %s", path);
+            goto exit_free_ciphertext;
+        }
+    }
+
+    ret = 0;
+
+exit_free_ciphertext:
+    free(ciphertext);
+exit_free_elems:
+    free(elems);
+exit_close_plaintext:
+    if (plaintext) {
+        fclose(plaintext);
+    }
+exit:
+    memset(key, '\0', sizeof(key));
+    return ret;
+}
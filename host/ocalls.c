@@ -379,3 +379,24 @@ exit_free_request:
 void ocall_mpi_barrier(void) {
     MPI_Barrier(MPI_COMM_WORLD);
 }
+
+int ocall_mpi_tag_ub(void) {
+    int *tag_ub;
+    int flag;
+    int ret = MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+    if (ret || !flag) {
+        /* Fall back to the least bound the standard allows. */
+        return 32767;
+    }
+    return *tag_ub;
+}
+
+/* Host memory for the enclave's encrypted external-memory stores. The enclave
+ * authenticates everything it reads back, so this is plain malloc. */
+void *ocall_extmem_alloc(size_t size) {
+    return malloc(size);
+}
+
+void ocall_extmem_free(void *ptr) {
+    free(ptr);
+}
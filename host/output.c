@@ -0,0 +1,184 @@
+#include "host/output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "common/defs.h"
+#include "common/error.h"
+
+/* The most bytes queued for writing before ocall_output_write blocks, so that
+ * a slow disk holds back the enclave instead of growing the queue without
+ * bound. */
+#define MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+struct write {
+    unsigned char *buf;
+    size_t len;
+    size_t offset;
+    struct write *next;
+};
+
+static int fd = -1;
+static pthread_t writer_thread;
+
+static struct write *queue_head;
+static struct write *queue_tail;
+static size_t queued_bytes;
+static bool closing;
+static bool failed;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static int write_fully(const unsigned char *buf, size_t count, off_t offset) {
+    while (count) {
+        ssize_t bytes_written = pwrite(fd, buf, count, offset);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pwrite output");
+            return -1;
+        }
+        buf += bytes_written;
+        count -= bytes_written;
+        offset += bytes_written;
+    }
+    return 0;
+}
+
+static void *write_chunks(void *arg UNUSED) {
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (!queue_head && !closing) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (!queue_head) {
+            break;
+        }
+
+        struct write *write = queue_head;
+        queue_head = write->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        bool skip = failed;
+        pthread_mutex_unlock(&queue_lock);
+
+        /* Keep draining the queue after a failure so that the enclave is
+         * never left blocked on a full queue. */
+        int ret = 0;
+        if (!skip) {
+            ret = write_fully(write->buf, write->len, write->offset);
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        if (ret) {
+            failed = true;
+        }
+        queued_bytes -= write->len;
+        pthread_cond_broadcast(&queue_cond);
+        free(write->buf);
+        free(write);
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    return NULL;
+}
+
+int output_open(const char *path, int world_rank) {
+    int ret;
+
+    char path_buf[4096];
+    snprintf(path_buf, sizeof(path_buf), path, world_rank);
+    fd = open(path_buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open output");
+        ret = -1;
+        goto exit;
+    }
+
+    closing = false;
+    failed = false;
+    ret = pthread_create(&writer_thread, NULL, write_chunks, NULL);
+    if (ret) {
+        errno = ret;
+        perror("pthread_create output writer");
+        goto exit_close_fd;
+    }
+
+    return 0;
+
+exit_close_fd:
+    close(fd);
+    fd = -1;
+exit:
+    return ret;
+}
+
+/* Copies BUF, since the enclave reuses it as soon as this returns, and queues
+ * it for the writer thread. */
+int ocall_output_write(const unsigned char *buf, size_t len, size_t offset) {
+    int ret;
+
+    struct write *write = malloc(sizeof(*write));
+    if (!write) {
+        perror("malloc output write");
+        ret = -1;
+        goto exit;
+    }
+    write->buf = malloc(len);
+    if (!write->buf) {
+        perror("malloc output buffer");
+        ret = -1;
+        goto exit_free_write;
+    }
+    memcpy(write->buf, buf, len);
+    write->len = len;
+    write->offset = offset;
+    write->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    while (queued_bytes && queued_bytes + len > MAX_QUEUED_BYTES) {
+        pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+    if (!queue_tail) {
+        queue_head = write;
+    } else {
+        queue_tail->next = write;
+    }
+    queue_tail = write;
+    queued_bytes += len;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+
+exit_free_write:
+    free(write);
+exit:
+    return ret;
+}
+
+int output_close(void) {
+    int ret;
+
+    pthread_mutex_lock(&queue_lock);
+    closing = true;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(writer_thread, NULL);
+
+    ret = failed ? -1 : 0;
+    if (close(fd) && !ret) {
+        perror("close output");
+        ret = -1;
+    }
+    fd = -1;
+
+    return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_OUTPUT_H
+#define DISTRIBUTED_SGX_SORT_HOST_OUTPUT_H
+
+/* Opens this rank's output file and starts the writer thread, which writes
+ * the encrypted chunks the enclave hands over through ocall_output_write. %d
+ * in PATH is replaced by the rank. */
+int output_open(const char *path, int world_rank);
+
+/* Waits for all queued writes, stops the writer thread, and closes the file.
+ * Fails if any write failed. */
+int output_close(void);
+
+#endif /* distributed-sgx-sort/host/output.h */
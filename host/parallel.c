@@ -1,14 +1,33 @@
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <mpi.h>
+#include "common/defs.h"
+#include "common/elem_t.h"
 #include "common/error.h"
+#include "common/mem.h"
 #include "common/ocalls.h"
+#include "common/sort_params.h"
 #include "common/sort_type.h"
+#include "common/span.h"
+#include "common/trace.h"
+#include "host/affinity.h"
 #include "host/error.h"
+#include "host/input.h"
+#include "host/output.h"
+#include "host/params.h"
+#include "host/record.h"
+#include "host/service.h"
+#include "host/spans.h"
+#include "host/trace.h"
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 #include <openenclave/host.h>
@@ -17,15 +36,87 @@
 
 static int world_rank;
 static int world_size;
+static int local_rank;
+
+/* The encrypted input to sort, or NULL to generate a random input. */
+static const char *input_path;
+
+/* Where to write the encrypted sorted output, or NULL to not write it. */
+static const char *output_path;
+
+/* If nonzero, sort each rank's array as independent arrays of this many
+ * elements rather than as one distributed array. */
+static size_t batch_len;
+
+/* If nonzero, merge this many new elements into each sorted array. */
+static size_t merge_len;
+
+/* The Unix socket to take jobs from, or NULL to run the sort given on the
+ * command line. */
+static const char *serve_path;
+
+/* Where to append a JSON record of each sort, or NULL to not write them. */
+static const char *json_path;
+
+/* Where to write a timeline of each rank's threads, or NULL to not trace
+ * them. */
+static const char *trace_path;
+
+/* Whether to print each rank's memory use after each sort. */
+static bool verbose;
+
+/* The record of the current sort. */
+static struct run_record record;
+
+/* The number of worker threads whose start ecall failed, usually because the
+ * enclave ran out of TCSs. */
+static size_t num_threads_failed;
+
+/* The host threads running the enclave's worker and communication threads. */
+static pthread_t *threads;
+static size_t num_threads_created;
 
 static void usage(char **argv) {
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-        printf("Usage: %s <enclave image> {bitonic|bucket|opaque|orshuffle} <array size> <num threads> [num runs]\n", argv[0]);
-        printf("Usage: %s <enclave image> join <array size> <join size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] <enclave image> {bitonic|bucket|opaque|orshuffle|auto} <array size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] <enclave image> join <array size> <join size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] --serve <socket> <enclave image> <num threads>\n", argv[0]);
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-        printf("Usage: %s {bitonic|bucket|opaque|orshuffle} <array size> <num threads> [num runs]\n", argv[0]);
-        printf("Usage: %s join <array size> <join size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] {bitonic|bucket|opaque|orshuffle|auto} <array size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] join <array size> <join size> <num threads> [num runs]\n", argv[0]);
+        printf("Usage: %s [options] --serve <socket> <num threads>\n", argv[0]);
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        printf("\n");
+        printf("Options:\n");
+        printf("  -c, --comm-threads <num>  Dedicate <num> additional enclave threads to\n");
+        printf("                            communication (default 0)\n");
+        printf("  -a, --affinity <spec>     Pin threads to CPUs: compact, scatter, or a CPU\n");
+        printf("                            list such as 0-7,16-23 (default unpinned)\n");
+        printf("  -i, --input <path>        Sort the encrypted input at <path> instead of a\n");
+        printf("                            random array; %%d in <path> is replaced by the\n");
+        printf("                            rank to read per-rank shards\n");
+        printf("  -o, --output <path>       Write the encrypted sorted output to <path>; %%d\n");
+        printf("                            in <path> is replaced by the rank\n");
+        printf("  -k, --key <file>          Read the input and output key from <file>\n");
+        printf("  -x, --extmem <MiB>        Keep bucket sort's buckets encrypted in host\n");
+        printf("                            memory, paging them through <MiB> MiB of\n");
+        printf("                            enclave blocks\n");
+        printf("  -s, --serve <socket>      Keep the enclave up and run the jobs submitted\n");
+        printf("                            to the Unix socket <socket>\n");
+        printf("  -b, --batch <len>         Sort each rank's array as a batch of independent\n");
+        printf("                            arrays of <len> elements (bitonic only)\n");
+        printf("  -m, --merge <len>         After each sort, sort <len> new elements and\n");
+        printf("                            merge them into the sorted array\n");
+        printf("  -p, --params <file>       Read chunk and bucket sizes from <file>, or tune\n");
+        printf("                            them and write them to <file> if it does not\n");
+        printf("                            exist\n");
+        printf("  -t, --tune                Tune chunk and bucket sizes even if --params\n");
+        printf("                            names an existing file\n");
+        printf("  -j, --json <file>         Append a JSON record of each sort to <file>\n");
+        printf("  -T, --trace <path>        Write a Chrome trace of each rank's threads to\n");
+        printf("                            <path>; %%d in <path> is replaced by the rank\n");
+        printf("  -v, --verbose             Print each rank's memory use by allocation site\n");
+        printf("                            and phase after each sort\n");
 }
 
 static int init_mpi(int *argc, char ***argv) {
@@ -56,6 +147,22 @@ static int init_mpi(int *argc, char ***argv) {
         goto exit;
     }
 
+    /* Get rank among the processes sharing this host, used to keep their
+     * pinned threads apart. */
+    MPI_Comm local_comm;
+    ret = MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+            MPI_INFO_NULL, &local_comm);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Comm_split_type");
+        goto exit;
+    }
+    ret = MPI_Comm_rank(local_comm, &local_rank);
+    MPI_Comm_free(&local_comm);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Comm_rank");
+        goto exit;
+    }
+
 exit:
     return ret;
 }
@@ -66,6 +173,7 @@ static void *start_thread_work(void *enclave_) {
     oe_result_t result = ecall_start_work(enclave);
     if (result != OE_OK) {
         handle_oe_error(result, "ecall_start_work");
+        __atomic_add_fetch(&num_threads_failed, 1, __ATOMIC_RELEASE);
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     ecall_start_work();
@@ -73,91 +181,690 @@ static void *start_thread_work(void *enclave_) {
     return 0;
 }
 
+static void *start_comm_thread_work(void *enclave_) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_enclave_t *enclave = enclave_;
+    oe_result_t result = ecall_start_comm_work(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_start_comm_work");
+        __atomic_add_fetch(&num_threads_failed, 1, __ATOMIC_RELEASE);
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_start_comm_work();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    return 0;
+}
+
+/* Starts the enclave's worker and communication threads and waits for all of
+ * them to enter the enclave. On failure, the threads already created are left
+ * for stop_threads. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int start_threads(oe_enclave_t *enclave, size_t num_threads,
+        size_t num_comm_threads) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int start_threads(size_t num_threads, size_t num_comm_threads) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    int ret;
+
+    num_threads_failed = 0;
+    for (size_t i = 0; i < num_threads - 1 + num_comm_threads; i++) {
+        void *(*start_routine)(void *) =
+            i < num_threads - 1 ? start_thread_work : start_comm_thread_work;
+        pthread_attr_t attr;
+        ret = pthread_attr_init(&attr);
+        if (ret) {
+            errno = ret;
+            perror("pthread_attr_init");
+            goto exit;
+        }
+        ret = affinity_set_attr(&attr, num_threads_created + 1);
+        if (ret) {
+            pthread_attr_destroy(&attr);
+            goto exit;
+        }
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = pthread_create(&threads[num_threads_created], &attr,
+                start_routine, enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = pthread_create(&threads[num_threads_created], &attr,
+                start_routine, NULL);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        pthread_attr_destroy(&attr);
+        if (ret) {
+            errno = ret;
+            perror("pthread_create");
+            goto exit;
+        }
+        num_threads_created++;
+    }
+
+    /* Wait for every thread to enter the enclave. A thread that cannot get a
+     * TCS fails its ecall instead of blocking, so catch that here rather than
+     * letting the sort wait forever on a thread that never arrives. */
+    while (1) {
+        size_t num_threads_started;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result =
+            ecall_get_num_threads_started(enclave, &num_threads_started);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_get_num_threads_started");
+            ret = result;
+            goto exit;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        num_threads_started = ecall_get_num_threads_started();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (num_threads_started == num_threads_created) {
+            break;
+        }
+        if (__atomic_load_n(&num_threads_failed, __ATOMIC_ACQUIRE)) {
+            handle_error_string(
+                    "Only %zu of %zu threads entered the enclave; raise NumTCS in enclave/parallel.conf to at least %zu",
+                    num_threads_started, num_threads_created,
+                    num_threads + num_comm_threads);
+            ret = -1;
+            goto exit;
+        }
+        sched_yield();
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Releases the enclave's threads from their work loops and joins them, leaving
+ * the enclave ready for start_threads to start them again. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static void stop_threads(oe_enclave_t *enclave) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static void stop_threads(void) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_release_threads(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_release_threads");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_release_threads();
+#endif
+    for (size_t i = 0; i < num_threads_created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_unrelease_threads(enclave);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_release_threads");
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_unrelease_threads();
+#endif
+    num_threads_created = 0;
+}
+
+static const char *sort_type_name(enum sort_type sort_type) {
+    switch (sort_type) {
+        case SORT_BITONIC:
+            return "bitonic";
+        case SORT_BUCKET:
+            return "bucket";
+        case SORT_OPAQUE:
+            return "opaque";
+        case SORT_ORSHUFFLE:
+            return "orshuffle";
+        case OJOIN:
+            return "join";
+        case SORT_AUTO:
+            return "auto";
+        case SORT_UNSET:
+            break;
+    }
+    return "unset";
+}
+
+/* Replaces SORT_AUTO in *SORT_TYPE with the sort that the enclave's cost model
+ * picks for LENGTH elements, and reports the choice. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int choose_sort(oe_enclave_t *enclave, size_t length,
+        enum sort_type *sort_type) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int choose_sort(size_t length, enum sort_type *sort_type) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    int ret;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_choose_sort(enclave, &ret, length, sort_type);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_choose_sort");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_choose_sort(length, sort_type);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error choosing sort");
+        goto exit;
+    }
+
+    if (world_rank == 0) {
+        printf("auto             : %s\n", sort_type_name(*sort_type));
+    }
+
+exit:
+    return ret;
+}
+
+/* Prints how one enclave thread spent its time in one phase, in seconds. */
+static void print_thread_stats(const struct ocall_thread_stats *stats) {
+    double avg_task_us =
+        stats->num_tasks
+            ? (double) stats->task_ns / stats->num_tasks / 1000
+            : 0;
+    printf("[threads] %2d: thread %2" PRIu32 " %-17s: tasks = %" PRIu64
+                " (avg %f us), spin = %f, sema = %f, condvar = %f,"
+                " idle = %f\n",
+            world_rank, stats->thread,
+            *stats->phase ? stats->phase : "(none)", stats->num_tasks,
+            avg_task_us, (double) stats->spin_ns / 1000000000,
+            (double) stats->sema_ns / 1000000000,
+            (double) stats->condvar_ns / 1000000000,
+            (double) stats->idle_ns / 1000000000);
+}
+
+/* Prints the bytes each allocation site holds and the most it has held during
+ * the sort, and the most all sites held together during each phase. */
+static void print_mem_stats(const struct ocall_enclave_stats *stats,
+        const struct mem_phase_stats *phases, size_t num_phases) {
+    for (enum mem_site site = 0; site < MEM_NUM_SITES; site++) {
+        printf("[memory] %2d: site  %-23s: bytes = %zu, peak = %zu\n",
+                world_rank, mem_site_name(site), stats->site_bytes[site],
+                stats->site_peak_bytes[site]);
+    }
+    for (size_t i = 0; i < num_phases; i++) {
+        printf("[memory] %2d: phase %-23s: peak = %zu\n", world_rank,
+                *phases[i].phase ? phases[i].phase : "(none)",
+                phases[i].peak_bytes);
+    }
+}
+
+/* Collects the enclave's spans and prints the time each phase took across the
+ * ranks. The times are gathered into TIMES on rank 0, which the caller
+ * frees. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int print_spans(oe_enclave_t *enclave, struct phase_times *times) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int print_spans(struct phase_times *times) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    size_t num_spans;
+    int ret;
+
+    struct span_record *spans = malloc(SPAN_MAX_RECORDS * sizeof(*spans));
+    if (!spans) {
+        perror("malloc spans");
+        ret = -1;
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_get_spans(enclave, spans, SPAN_MAX_RECORDS, &num_spans);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_get_spans");
+        ret = result;
+        goto exit_free_spans;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_get_spans(spans, SPAN_MAX_RECORDS, &num_spans);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    ret = spans_gather(spans, num_spans, times);
+    if (ret) {
+        handle_error_string("Error gathering spans");
+        goto exit_free_spans;
+    }
+    if (world_rank == 0) {
+        spans_print(times);
+    }
+
+exit_free_spans:
+    free(spans);
+exit:
+    return ret;
+}
+
+/* Turns on the enclave's tracing and opens this rank's timeline at
+ * TRACE_PATH. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int open_trace(oe_enclave_t *enclave) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int open_trace(void) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    int ret;
+
+    /* Relate the enclave's clock to the host's by reading it between two
+     * readings of the host's. */
+    uint64_t enclave_time;
+    uint64_t host_start = trace_time_ns();
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_get_trace_time(enclave, &enclave_time);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_get_trace_time");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_get_trace_time(&enclave_time);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    uint64_t host_end = trace_time_ns();
+    int64_t enclave_offset =
+        (int64_t) (host_start + (host_end - host_start) / 2 - enclave_time);
+
+    ret = trace_open(trace_path, world_rank, enclave_offset);
+    if (ret) {
+        handle_error_string("Error opening trace");
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_set_trace(enclave, true);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_set_trace");
+        ret = result;
+        goto exit_close_trace;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_set_trace(true);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    return 0;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+exit_close_trace:
+    trace_close();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+exit:
+    return ret;
+}
+
+/* Collects the events the enclave traced since the last call and appends them
+ * to this rank's timeline. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int write_trace(oe_enclave_t *enclave) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int write_trace(void) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    struct trace_event *events = NULL;
+    size_t num_events;
+    int ret;
+
+    /* Ask for the number of events first, then copy them. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_collect_trace(enclave, NULL, 0, &num_events);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_collect_trace");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_collect_trace(NULL, 0, &num_events);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    events = malloc(MAX(num_events, 1) * sizeof(*events));
+    if (!events) {
+        perror("malloc trace events");
+        ret = -1;
+        goto exit;
+    }
+
+    size_t capacity = num_events;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_collect_trace(enclave, events, capacity, &num_events);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_collect_trace");
+        ret = result;
+        goto exit_free_events;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_collect_trace(events, capacity, &num_events);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    ret = trace_write(events, num_events);
+    if (ret) {
+        goto exit_free_events;
+    }
+
+exit_free_events:
+    free(events);
+exit:
+    return ret;
+}
+
+/* Sorts MERGE_LEN new elements with SORT_TYPE and merges them into the sorted
+ * array, printing the time taken, and verifies the result. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int time_merge(oe_enclave_t *enclave, enum sort_type sort_type) {
+    oe_result_t result;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int time_merge(enum sort_type sort_type) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    int ret;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_alloc_increment(enclave, &ret, merge_len, sort_type);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_alloc_increment");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_alloc_increment(merge_len, sort_type);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error allocating merge in enclave");
+        goto exit;
+    }
+
+    struct timespec start;
+    ret = timespec_get(&start, TIME_UTC);
+    if (!ret) {
+        perror("starting merge timespec_get");
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_merge_increment(enclave, &ret, sort_type);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_merge_increment");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_merge_increment(sort_type);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error merging in enclave");
+        goto exit;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    struct timespec end;
+    ret = timespec_get(&end, TIME_UTC);
+    if (!ret) {
+        perror("ending merge timespec_get");
+        goto exit;
+    }
+
+    if (world_rank == 0) {
+        double seconds_taken =
+            (double) ((end.tv_sec * 1000000000 + end.tv_nsec)
+                    - (start.tv_sec * 1000000000 + start.tv_nsec))
+            / 1000000000;
+        printf("merge            : %f\n", seconds_taken);
+        record.merge_length = merge_len;
+        record.merge_seconds = seconds_taken;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    ret = print_spans(enclave, &record.merge_phases);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = print_spans(&record.merge_phases);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_verify_sorted(enclave, &ret);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_verify_sorted");
+        ret = result;
+        goto exit;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = ecall_verify_sorted();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        handle_error_string("Error verifying merge");
+        goto exit;
+    }
+
+exit:
+    return ret;
+}
+
+/* Allocates, populates, sorts, and verifies an array, printing the time each
+ * step took. The time the sort itself took is also returned in *SORT_SECONDS
+ * on rank 0. */
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 int time_sort(oe_enclave_t *enclave, enum sort_type sort_type, size_t length,
-        size_t join_length) {
+        size_t join_length, double *sort_seconds) {
     oe_result_t result;
 #else
-int time_sort(enum sort_type sort_type, size_t length, size_t join_length) {
+int time_sort(enum sort_type sort_type, size_t length, size_t join_length,
+        double *sort_seconds) {
 #endif
+    struct ocall_thread_stats *thread_stats = NULL;
     int ret;
 
+    record.algorithm = sort_type_name(sort_type);
+    record.length = length;
+    record.join_length = join_length;
+    record.batch_length = batch_len;
+    record.merge_length = 0;
+
     /* Init random array. */
+
+    struct timespec alloc_start;
+    ret = timespec_get(&alloc_start, TIME_UTC);
+    if (!ret) {
+        perror("starting alloc timespec_get");
+        goto exit;
+    }
+
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     result =
-        ecall_sort_alloc_arr(enclave, &ret, length, sort_type, join_length);
+        ecall_sort_alloc_arr(enclave, &ret, length, sort_type, join_length,
+                !input_path);
     if (result != OE_OK) {
         handle_oe_error(result, "ecall_sort_alloc");
         goto exit;
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ret = ecall_sort_alloc_arr(length, sort_type, join_length);
+    ret = ecall_sort_alloc_arr(length, sort_type, join_length, !input_path);
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     if (ret) {
         handle_error_string("Error allocating array in enclave");
         goto exit_free_arr;
     }
 
+    struct timespec alloc_end;
+    ret = timespec_get(&alloc_end, TIME_UTC);
+    if (!ret) {
+        perror("ending alloc timespec_get");
+        goto exit_free_arr;
+    }
+
+    /* Print the slowest rank's allocation time, which includes committing
+     * and populating the array. */
+    double alloc_seconds =
+        (double) ((alloc_end.tv_sec * 1000000000 + alloc_end.tv_nsec)
+                - (alloc_start.tv_sec * 1000000000 + alloc_start.tv_nsec))
+        / 1000000000;
+    double max_alloc_seconds;
+    ret = MPI_Reduce(&alloc_seconds, &max_alloc_seconds, 1, MPI_DOUBLE,
+            MPI_MAX, 0, MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Reduce");
+        goto exit_free_arr;
+    }
+    if (world_rank == 0) {
+        printf("alloc            : %f\n", max_alloc_seconds);
+        record.alloc_seconds = max_alloc_seconds;
+    }
+
+    /* Stream in the encrypted input, if any. */
+    if (input_path) {
+        struct timespec ingest_start;
+        ret = timespec_get(&ingest_start, TIME_UTC);
+        if (!ret) {
+            perror("starting ingest timespec_get");
+            goto exit_free_arr;
+        }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = input_ingest(enclave, input_path, world_rank, world_size, length);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = input_ingest(input_path, world_rank, world_size, length);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            handle_error_string("Error ingesting input");
+        }
+
+        /* Fail on every rank if any rank failed, rather than leaving the rest
+         * waiting in the sort. */
+        int ingest_failed = !!ret;
+        int any_ingest_failed;
+        ret = MPI_Allreduce(&ingest_failed, &any_ingest_failed, 1, MPI_INT,
+                MPI_LOR, MPI_COMM_WORLD);
+        if (ret) {
+            handle_mpi_error(ret, "MPI_Allreduce");
+            goto exit_free_arr;
+        }
+        if (any_ingest_failed) {
+            ret = -1;
+            goto exit_free_arr;
+        }
+
+        struct timespec ingest_end;
+        ret = timespec_get(&ingest_end, TIME_UTC);
+        if (!ret) {
+            perror("ending ingest timespec_get");
+            goto exit_free_arr;
+        }
+
+        double ingest_seconds =
+            (double) ((ingest_end.tv_sec * 1000000000 + ingest_end.tv_nsec)
+                    - (ingest_start.tv_sec * 1000000000
+                        + ingest_start.tv_nsec))
+            / 1000000000;
+        double max_ingest_seconds;
+        ret = MPI_Reduce(&ingest_seconds, &max_ingest_seconds, 1, MPI_DOUBLE,
+                MPI_MAX, 0, MPI_COMM_WORLD);
+        if (ret) {
+            handle_mpi_error(ret, "MPI_Reduce");
+            goto exit_free_arr;
+        }
+        if (world_rank == 0) {
+            printf("ingest           : %f\n", max_ingest_seconds);
+        }
+    }
+
+    /* Start the output before the sort, so that the sort's last phase can
+     * hand over chunks as they become final. */
+    if (output_path) {
+        ret = output_open(output_path, world_rank);
+        if (ret) {
+            handle_error_string("Error opening output");
+            goto exit_free_arr;
+        }
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_output_begin(enclave, &ret);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_output_begin");
+            ret = result;
+            output_close();
+            goto exit_free_arr;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = ecall_output_begin();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            handle_error_string("Error beginning output");
+            output_close();
+            goto exit_free_arr;
+        }
+    }
+
     /* Time sort and join. */
 
     struct timespec start;
     ret = timespec_get(&start, TIME_UTC);
     if (!ret) {
         perror("starting timespec_get");
-        goto exit_free_arr;
+        goto exit_end_output;
     }
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-    switch (sort_type) {
-        case SORT_BITONIC:
-            result = ecall_bitonic_sort(enclave, &ret);
-            break;
-        case SORT_BUCKET:
-            result = ecall_bucket_sort(enclave, &ret);
-            break;
-        case SORT_OPAQUE:
-            result = ecall_opaque_sort(enclave, &ret);
-            break;
-        case SORT_ORSHUFFLE:
-            result = ecall_orshuffle_sort(enclave, &ret);
-            break;
-        case OJOIN:
-            result = ecall_ojoin(enclave, &ret);
-            break;
-        case SORT_UNSET:
-            handle_error_string("Invalid sort type");
-            ret = -1;
-            goto exit_free_arr;
+    if (batch_len) {
+        result = ecall_sort_batch(enclave, &ret);
+    } else {
+        switch (sort_type) {
+            case SORT_BITONIC:
+                result = ecall_bitonic_sort(enclave, &ret);
+                break;
+            case SORT_BUCKET:
+                result = ecall_bucket_sort(enclave, &ret);
+                break;
+            case SORT_OPAQUE:
+                result = ecall_opaque_sort(enclave, &ret);
+                break;
+            case SORT_ORSHUFFLE:
+                result = ecall_orshuffle_sort(enclave, &ret);
+                break;
+            case OJOIN:
+                result = ecall_ojoin(enclave, &ret);
+                break;
+            case SORT_AUTO:
+            case SORT_UNSET:
+                handle_error_string("Invalid sort type");
+                ret = -1;
+                goto exit_end_output;
+        }
     }
     if (result != OE_OK) {
-        goto exit_free_arr;
+        goto exit_end_output;
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    switch (sort_type) {
-        case SORT_BITONIC:
-            ret = ecall_bitonic_sort();
-            break;
-        case SORT_BUCKET:
-            ret = ecall_bucket_sort();
-            break;
-        case SORT_OPAQUE:
-            ret = ecall_opaque_sort();
-            break;
-        case SORT_ORSHUFFLE:
-            ret = ecall_orshuffle_sort();
-            break;
-        case OJOIN:
-            ret = ecall_ojoin();
-            break;
-        case SORT_UNSET:
-            handle_error_string("Invalid sort type");
-            ret = -1;
-            goto exit_free_arr;
+    if (batch_len) {
+        ret = ecall_sort_batch();
+    } else {
+        switch (sort_type) {
+            case SORT_BITONIC:
+                ret = ecall_bitonic_sort();
+                break;
+            case SORT_BUCKET:
+                ret = ecall_bucket_sort();
+                break;
+            case SORT_OPAQUE:
+                ret = ecall_opaque_sort();
+                break;
+            case SORT_ORSHUFFLE:
+                ret = ecall_orshuffle_sort();
+                break;
+            case OJOIN:
+                ret = ecall_ojoin();
+                break;
+            case SORT_AUTO:
+            case SORT_UNSET:
+                handle_error_string("Invalid sort type");
+                ret = -1;
+                goto exit_end_output;
+        }
     }
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     if (ret) {
         handle_error_string("Enclave exited with return code %d", ret);
-        goto exit_free_arr;
+        goto exit_end_output;
     }
 
     MPI_Barrier(MPI_COMM_WORLD);
@@ -166,7 +873,7 @@ int time_sort(enum sort_type sort_type, size_t length, size_t join_length) {
     ret = timespec_get(&end, TIME_UTC);
     if (!ret) {
         perror("ending timespec_get");
-        goto exit_free_arr;
+        goto exit_end_output;
     }
 
     /* Print time taken. */
@@ -177,26 +884,148 @@ int time_sort(enum sort_type sort_type, size_t length, size_t join_length) {
                     - (start.tv_sec * 1000000000 + start.tv_nsec))
             / 1000000000;
         printf("%f\n", seconds_taken);
+        *sort_seconds = seconds_taken;
+        record.sort_seconds = seconds_taken;
+    }
+
+    /* Finish the output. Chunks not already written during the sort are
+     * encrypted and written now, so this is the part of the output that did
+     * not overlap with the sort. */
+    if (output_path) {
+        struct timespec output_start;
+        ret = timespec_get(&output_start, TIME_UTC);
+        if (!ret) {
+            perror("starting output timespec_get");
+            goto exit_end_output;
+        }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_output_end(enclave, &ret);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_output_end");
+            ret = result;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = ecall_output_end();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        int close_ret = output_close();
+        if (!ret) {
+            ret = close_ret;
+        }
+        if (ret) {
+            handle_error_string("Error writing output");
+            goto exit_free_arr;
+        }
+
+        struct timespec output_end;
+        ret = timespec_get(&output_end, TIME_UTC);
+        if (!ret) {
+            perror("ending output timespec_get");
+            goto exit_free_arr;
+        }
+
+        double output_seconds =
+            (double) ((output_end.tv_sec * 1000000000 + output_end.tv_nsec)
+                    - (output_start.tv_sec * 1000000000
+                        + output_start.tv_nsec))
+            / 1000000000;
+        double max_output_seconds;
+        ret = MPI_Reduce(&output_seconds, &max_output_seconds, 1, MPI_DOUBLE,
+                MPI_MAX, 0, MPI_COMM_WORLD);
+        if (ret) {
+            handle_mpi_error(ret, "MPI_Reduce");
+            goto exit_free_arr;
+        }
+        if (world_rank == 0) {
+            printf("output           : %f\n", max_output_seconds);
+        }
     }
 
-    /* Print stats. */
+    /* Print stats. The thread stats are only measured by enclaves built to
+     * profile threading, so ask for their number first. */
     struct ocall_enclave_stats stats;
+    size_t num_thread_stats;
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-    result = ecall_get_stats(enclave, &stats);
+    result = ecall_get_stats(enclave, &stats, NULL, 0, &num_thread_stats);
     if (result != OE_OK) {
         handle_oe_error(result, "ecall_get_stats");
         goto exit_free_arr;
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ecall_get_stats(&stats);
+    ecall_get_stats(&stats, NULL, 0, &num_thread_stats);
+#endif
+    if (num_thread_stats) {
+        thread_stats = malloc(num_thread_stats * sizeof(*thread_stats));
+        if (!thread_stats) {
+            perror("malloc thread stats");
+            ret = -1;
+            goto exit_free_arr;
+        }
+        struct ocall_enclave_stats ignored_stats;
+        size_t capacity = num_thread_stats;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_get_stats(enclave, &ignored_stats, thread_stats,
+                capacity, &num_thread_stats);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_get_stats");
+            goto exit_free_arr;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ecall_get_stats(&ignored_stats, thread_stats, capacity,
+                &num_thread_stats);
+#endif
+    }
+    struct mem_phase_stats mem_phases[MEM_MAX_PHASES];
+    size_t num_mem_phases;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    result = ecall_get_mem_phases(enclave, mem_phases, MEM_MAX_PHASES,
+            &num_mem_phases);
+    if (result != OE_OK) {
+        handle_oe_error(result, "ecall_get_mem_phases");
+        goto exit_free_arr;
+    }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_get_mem_phases(mem_phases, MEM_MAX_PHASES, &num_mem_phases);
 #endif
     for (int i = 0; i < world_size; i++) {
         if (i == world_rank) {
             printf("[stats] %2d: mpi_tls_bytes_sent = %zu\n", world_rank,
                     stats.mpi_tls_bytes_sent);
+            for (size_t j = 0; j < num_thread_stats; j++) {
+                print_thread_stats(&thread_stats[j]);
+            }
+            if (verbose || json_path) {
+                print_mem_stats(&stats, mem_phases, num_mem_phases);
+            }
         }
         MPI_Barrier(MPI_COMM_WORLD);
     }
+    if (json_path) {
+        if (world_rank == 0) {
+            record.stats = malloc(world_size * sizeof(*record.stats));
+            if (!record.stats) {
+                perror("malloc stats");
+                ret = -1;
+                goto exit_free_arr;
+            }
+        }
+        ret = MPI_Gather(&stats, sizeof(stats), MPI_BYTE, record.stats,
+                sizeof(stats), MPI_BYTE, 0, MPI_COMM_WORLD);
+        if (ret) {
+            handle_mpi_error(ret, "MPI_Gather");
+            goto exit_free_arr;
+        }
+    }
+
+    /* Print the phases' times. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    ret = print_spans(enclave, &record.phases);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ret = print_spans(&record.phases);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        goto exit_free_arr;
+    }
 
     /* Check array. */
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
@@ -206,13 +1035,58 @@ int time_sort(enum sort_type sort_type, size_t length, size_t join_length) {
         goto exit_free_arr;
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ret = ecall_verify_sorted(world_rank);
+    ret = ecall_verify_sorted();
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     if (ret) {
         handle_error_string("Error verifying sort");
         goto exit_free_arr;
     }
 
+    if (merge_len) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = time_merge(enclave, sort_type);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = time_merge(sort_type);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            goto exit_free_arr;
+        }
+    }
+
+    if (trace_path) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = write_trace(enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = write_trace();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            goto exit_free_arr;
+        }
+    }
+
+    if (json_path && world_rank == 0) {
+        ret = record_append_json(json_path, &record);
+        if (ret) {
+            handle_error_string("Error writing record");
+            goto exit_free_arr;
+        }
+    }
+
+    goto exit_free_arr;
+
+exit_end_output:
+    if (output_path) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        int end_ret;
+        result = ecall_output_end(enclave, &end_ret);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_output_end");
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ecall_output_end();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        output_close();
+    }
 exit_free_arr:
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     result = ecall_sort_free_arr(enclave);
@@ -222,71 +1096,329 @@ exit_free_arr:
 #else
     ecall_sort_free_arr();
 #endif
+    free(thread_stats);
+    free(record.stats);
+    record.stats = NULL;
+    spans_free(&record.phases);
+    spans_free(&record.merge_phases);
 exit:
     return ret;
 }
 
-int main(int argc, char **argv) {
-    int ret = -1;
+/* Returns a failure on every rank if RET is a failure on any rank, so that
+ * the ranks agree on whether a job failed and move on to the next one
+ * together. */
+static int agree_on_failure(int ret) {
+    int failed = !!ret;
+    int any_failed;
+    int mpi_ret =
+        MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR,
+                MPI_COMM_WORLD);
+    if (mpi_ret) {
+        handle_mpi_error(mpi_ret, "MPI_Allreduce");
+        return mpi_ret;
+    }
+    if (any_failed) {
+        return ret ? ret : -1;
+    }
+    return 0;
+}
 
-    /* Read arguments. */
+/* Runs jobs from the service's socket until told to quit. Worker threads set
+ * up their per-thread buffers for one algorithm when they enter the enclave,
+ * so they are restarted whenever a job uses a different algorithm than the
+ * last one. The enclave, its TLS sessions, and the communication threads'
+ * state otherwise persist across jobs. A failed job is answered with an error
+ * and the service moves on to the next job; only failing to restart the
+ * worker threads ends the service. */
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+static int serve(oe_enclave_t *enclave, size_t num_threads,
+        size_t num_comm_threads, bool has_key) {
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+static int serve(size_t num_threads, size_t num_comm_threads, bool has_key) {
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    enum sort_type last_sort_type = SORT_UNSET;
+    int ret;
+
+    ret = service_open(serve_path, world_rank, world_size, has_key);
+    if (ret) {
+        handle_error_string("Error opening service");
+        goto exit;
+    }
+
+    while (1) {
+        struct service_job job;
+        ret = service_next_job(&job);
+        if (ret) {
+            handle_error_string("Error reading job");
+            goto exit_close_service;
+        }
+        if (job.quit) {
+            break;
+        }
 
+        if (job.sort_type == SORT_AUTO) {
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-    int argi = 2;
+            ret = choose_sort(enclave, job.length, &job.sort_type);
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    int argi = 1;
+            ret = choose_sort(job.length, &job.sort_type);
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+            ret = agree_on_failure(ret);
+            if (ret) {
+                service_reply(ret, 0);
+                continue;
+            }
+        }
 
-    if (argc + 1 <= argi + 2) {
-        usage(argv);
-        return 0;
+        if (last_sort_type != SORT_UNSET && job.sort_type != last_sort_type) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+            stop_threads(enclave);
+            ret = start_threads(enclave, num_threads, num_comm_threads);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+            stop_threads();
+            ret = start_threads(num_threads, num_comm_threads);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+            if (ret) {
+                service_reply(ret, 0);
+                goto exit_close_service;
+            }
+        }
+        last_sort_type = job.sort_type;
+
+        input_path = *job.input_path ? job.input_path : NULL;
+        output_path = *job.output_path ? job.output_path : NULL;
+        double sort_seconds = 0;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = time_sort(enclave, job.sort_type, job.length, job.join_length,
+                &sort_seconds);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = time_sort(job.sort_type, job.length, job.join_length,
+                &sort_seconds);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        input_path = NULL;
+        output_path = NULL;
+        ret = agree_on_failure(ret);
+        service_reply(ret, sort_seconds);
+        if (ret) {
+            handle_error_string("Error in sort");
+        }
     }
 
-    enum sort_type sort_type;
-    if (strcmp(argv[argi], "bitonic") == 0) {
-        sort_type = SORT_BITONIC;
-    } else if (strcmp(argv[argi], "bucket") == 0) {
-        sort_type = SORT_BUCKET;
-    } else if (strcmp(argv[argi], "opaque") == 0) {
-        sort_type = SORT_OPAQUE;
-    } else if (strcmp(argv[argi], "orshuffle") == 0) {
-        sort_type = SORT_ORSHUFFLE;
-    } else if (strcmp(argv[argi], "join") == 0) {
-        sort_type = OJOIN;
-    } else {
-        printf("Invalid sort type\n");
+    ret = 0;
+
+exit_close_service:
+    service_close();
+exit:
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int ret = -1;
+
+    /* Read options. */
+
+    static const struct option long_options[] = {
+        { "comm-threads", required_argument, NULL, 'c' },
+        { "affinity", required_argument, NULL, 'a' },
+        { "input", required_argument, NULL, 'i' },
+        { "output", required_argument, NULL, 'o' },
+        { "key", required_argument, NULL, 'k' },
+        { "extmem", required_argument, NULL, 'x' },
+        { "serve", required_argument, NULL, 's' },
+        { "batch", required_argument, NULL, 'b' },
+        { "merge", required_argument, NULL, 'm' },
+        { "params", required_argument, NULL, 'p' },
+        { "tune", no_argument, NULL, 't' },
+        { "json", required_argument, NULL, 'j' },
+        { "trace", required_argument, NULL, 'T' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+    size_t num_comm_threads = 0;
+    const char *affinity = NULL;
+    const char *key_path = NULL;
+    size_t extmem_block_bytes = 0;
+    const char *params_path = NULL;
+    bool tune = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:a:i:o:k:x:s:b:m:p:tj:T:v", long_options,
+                    NULL))
+            != -1) {
+        switch (opt) {
+            case 'c':
+                errno = 0;
+                num_comm_threads = strtoull(optarg, NULL, 10);
+                if (errno) {
+                    printf("Invalid number of communication threads\n");
+                    return ret;
+                }
+                break;
+            case 'a':
+                affinity = optarg;
+                break;
+            case 'i':
+                input_path = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'k':
+                key_path = optarg;
+                break;
+            case 's':
+                serve_path = optarg;
+                break;
+            case 'x':
+                errno = 0;
+                extmem_block_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024;
+                if (errno || !extmem_block_bytes) {
+                    printf("Invalid external memory block size\n");
+                    return ret;
+                }
+                break;
+            case 'b':
+                errno = 0;
+                batch_len = strtoull(optarg, NULL, 10);
+                if (errno || !batch_len) {
+                    printf("Invalid batch length\n");
+                    return ret;
+                }
+                break;
+            case 'm':
+                errno = 0;
+                merge_len = strtoull(optarg, NULL, 10);
+                if (errno || !merge_len) {
+                    printf("Invalid merge length\n");
+                    return ret;
+                }
+                break;
+            case 'p':
+                params_path = optarg;
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 't':
+                tune = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv);
+                return ret;
+        }
+    }
+    if (input_path && !key_path) {
+        printf("An input requires a key\n");
         return ret;
     }
-    argi++;
-
-    errno = 0;
-    size_t length = strtoull(argv[argi], NULL, 10);
-    if (errno) {
-        printf("Invalid array size\n");
+    if (output_path && !key_path) {
+        printf("An output requires a key\n");
         return ret;
     }
-    argi++;
+    if (serve_path && (input_path || output_path)) {
+        printf("A service takes inputs and outputs from each job\n");
+        return ret;
+    }
+    if (serve_path && batch_len) {
+        printf("A service does not support batches\n");
+        return ret;
+    }
+    if (merge_len
+            && (serve_path || batch_len || output_path || extmem_block_bytes)) {
+        printf("Merges do not support services, batches, outputs, or external"
+                " memory\n");
+        return ret;
+    }
+
+    /* Read arguments. */
 
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    const char *enclave_image = argv[optind];
+    int argi = optind + 1;
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    int argi = optind;
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+    /* A service reads the sort type and sizes from each job instead. */
+    enum sort_type sort_type = SORT_UNSET;
+    size_t length = 0;
     size_t join_length = 0;
-    if (sort_type == OJOIN) {
-        if (argc + 1 <= argi + 1) {
+    if (!serve_path) {
+        if (argc + 1 <= argi + 2) {
             usage(argv);
             return 0;
         }
 
-        errno = 0;
-        join_length = strtoll(argv[argi], NULL, 10);
-        if (errno) {
-            printf("Invalid join length\n");
+        if (strcmp(argv[argi], "bitonic") == 0) {
+            sort_type = SORT_BITONIC;
+        } else if (strcmp(argv[argi], "bucket") == 0) {
+            sort_type = SORT_BUCKET;
+        } else if (strcmp(argv[argi], "opaque") == 0) {
+            sort_type = SORT_OPAQUE;
+        } else if (strcmp(argv[argi], "orshuffle") == 0) {
+            sort_type = SORT_ORSHUFFLE;
+        } else if (strcmp(argv[argi], "join") == 0) {
+            sort_type = OJOIN;
+        } else if (strcmp(argv[argi], "auto") == 0) {
+            sort_type = SORT_AUTO;
+        } else {
+            printf("Invalid sort type\n");
             return ret;
         }
+        argi++;
 
-        if (join_length > length) {
-            printf("Join length must be less than or equal to array length\n");
+        if (extmem_block_bytes && sort_type != SORT_BUCKET
+                && sort_type != SORT_AUTO) {
+            printf("External memory is only supported by bucket sort\n");
+            return ret;
+        }
+        if (batch_len && sort_type != SORT_BITONIC) {
+            printf("Batches are only supported by bitonic sort\n");
+            return ret;
+        }
+        if (merge_len && sort_type == OJOIN) {
+            printf("Merges are not supported by joins\n");
             return ret;
         }
 
+        errno = 0;
+        length = strtoull(argv[argi], NULL, 10);
+        if (errno) {
+            printf("Invalid array size\n");
+            return ret;
+        }
         argi++;
+
+        if (sort_type == OJOIN) {
+            if (argc + 1 <= argi + 1) {
+                usage(argv);
+                return 0;
+            }
+
+            errno = 0;
+            join_length = strtoll(argv[argi], NULL, 10);
+            if (errno) {
+                printf("Invalid join length\n");
+                return ret;
+            }
+
+            if (join_length > length) {
+                printf("Join length must be less than or equal to array length\n");
+                return ret;
+            }
+
+            if (input_path || output_path) {
+                printf("Joins do not support encrypted inputs or outputs\n");
+                return ret;
+            }
+
+            argi++;
+        }
     }
 
     if (argc + 1 <= argi + 1) {
@@ -296,7 +1428,7 @@ int main(int argc, char **argv) {
 
     errno = 0;
     size_t num_threads = strtoll(argv[argi], NULL, 10);
-    if (errno) {
+    if (errno || !num_threads) {
         printf("Invalid number of threads\n");
         return ret;
     }
@@ -316,23 +1448,57 @@ int main(int argc, char **argv) {
     /* Init MPI. */
 
     ret = init_mpi(&argc, &argv);
-    pthread_t threads[num_threads - 1];
+    pthread_t thread_buf[num_threads - 1 + num_comm_threads];
+    threads = thread_buf;
     if (ret) {
         goto exit;
     }
 
+    record.world_size = world_size;
+    record.num_threads = num_threads;
+    record.num_comm_threads = num_comm_threads;
+    record.elem_size = sizeof(elem_t);
+
+    if (output_path && world_size > 1 && !strstr(output_path, "%d")) {
+        printf("Output path must contain %%d when running multiple ranks\n");
+        ret = -1;
+        goto exit_mpi_finalize;
+    }
+    if (trace_path && world_size > 1 && !strstr(trace_path, "%d")) {
+        printf("Trace path must contain %%d when running multiple ranks\n");
+        ret = -1;
+        goto exit_mpi_finalize;
+    }
+
+    /* Pin the main thread. Worker and communication threads are pinned as
+     * they are created, so their thread-local buffers are first touched, and
+     * thus placed, on their own NUMA node. */
+
+    if (affinity) {
+        ret = affinity_init(affinity, local_rank,
+                num_threads + num_comm_threads);
+        if (ret) {
+            handle_error_string("Error setting up thread affinity");
+            goto exit_mpi_finalize;
+        }
+        ret = affinity_set_self(0);
+        if (ret) {
+            goto exit_free_affinity;
+        }
+    }
+
     /* Create enclave. */
 
     if (ret) {
         handle_error_string("init_mpi");
-        goto exit_mpi_finalize;
+        goto exit_free_affinity;
     }
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     oe_enclave_t *enclave;
     oe_result_t result;
     result = oe_create_parallel_enclave(
-            argv[1],
+            enclave_image,
             OE_ENCLAVE_TYPE_AUTO,
             0
 #ifdef OE_DEBUG
@@ -349,73 +1515,186 @@ int main(int argc, char **argv) {
     if (result != OE_OK) {
         handle_oe_error(result, "oe_create_parallel_enclave");
         ret = result;
-        goto exit_mpi_finalize;
+        goto exit_free_affinity;
     }
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
+    /* Read the parameters, tuning them if there are none to read. Only rank
+     * 0's parameters are used, so only rank 0 reads them and tells the others
+     * whether to tune. Tuning still reads the file, so that the values it does
+     * not tune, such as the EPC cliff from the memory benchmark, are kept
+     * when it is rewritten. */
+
+    struct sort_params params = SORT_PARAMS_DEFAULT;
+    int params_ret = tune;
+    if (world_rank == 0 && params_path) {
+        int read_ret = params_read(params_path, &params);
+        if (read_ret < 0) {
+            handle_error_string("Error reading parameters from %s",
+                    params_path);
+        }
+        if (read_ret < 0 || !tune) {
+            params_ret = read_ret;
+        }
+    }
+    ret = MPI_Bcast(&params_ret, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Bcast");
+        goto exit_terminate_enclave;
+    }
+    if (params_ret < 0) {
+        ret = -1;
+        goto exit_terminate_enclave;
+    }
+    tune = params_ret > 0;
+
     /* Init enclave with threads. */
 
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     result =
-        ecall_sort_init(enclave, &ret, world_rank, world_size, num_threads);
+        ecall_sort_init(enclave, &ret, world_rank, world_size, num_threads,
+                num_comm_threads, &params, tune);
     if (result != OE_OK) {
         handle_oe_error(result, "ecall_sort_init");
         goto exit_terminate_enclave;
     }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ret = ecall_sort_init(world_rank, world_size, num_threads);
+    ret =
+        ecall_sort_init(world_rank, world_size, num_threads, num_comm_threads,
+                &params, tune);
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     if (ret) {
         handle_error_string("Error in enclave sorting initialization");
         goto exit_terminate_enclave;
     }
 
-    for (size_t i = 1; i < num_threads; i++) {
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-        ret = pthread_create(&threads[i - 1], NULL, start_thread_work, enclave);
+    ret = start_threads(enclave, num_threads, num_comm_threads);
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-        ret = pthread_create(&threads[i - 1], NULL, start_thread_work, NULL);
+    ret = start_threads(num_threads, num_comm_threads);
 #endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (ret) {
+        goto exit_release_threads;
+    }
+
+    if (tune && params_path && world_rank == 0) {
+        ret = params_write(params_path, &params);
         if (ret) {
-            perror("pthread_create");
-            goto exit_free_sort;
+            handle_error_string("Error writing parameters to %s",
+                    params_path);
+            goto exit_release_threads;
         }
     }
 
-    for (size_t i = 0; i < num_runs; i++) {
+    /* Pass the input and output key to the enclave. */
+    if (key_path) {
+        unsigned char key[INPUT_KEY_LEN];
+        ret = input_read_key(key_path, key);
+        if (ret) {
+            goto exit_release_threads;
+        }
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-        ret = time_sort(enclave, sort_type, length, join_length);
-#else
-        ret = time_sort(sort_type, length, join_length);
-#endif
+        result = ecall_set_data_key(enclave, &ret, key, sizeof(key));
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_set_data_key");
+            ret = result;
+            goto exit_release_threads;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = ecall_set_data_key(key, sizeof(key));
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        memset(key, '\0', sizeof(key));
         if (ret) {
-            handle_error_string("Error in sort");
-            goto exit_free_sort;
+            handle_error_string("Error setting data key");
+            goto exit_release_threads;
         }
     }
 
+    if (batch_len) {
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-    result = ecall_release_threads(enclave);
-    if (result != OE_OK) {
-        handle_oe_error(result, "ecall_release_threads");
+        result = ecall_set_batch(enclave, batch_len);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_set_batch");
+            ret = result;
+            goto exit_release_threads;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ecall_set_batch(batch_len);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     }
+
+    if (extmem_block_bytes) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_set_extmem(enclave, extmem_block_bytes);
+        if (result != OE_OK) {
+            handle_oe_error(result, "ecall_set_extmem");
+            ret = result;
+            goto exit_release_threads;
+        }
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ecall_release_threads();
-#endif
-    for (size_t i = 1; i < num_threads; i++) {
-        pthread_join(threads[i - 1], NULL);
+        ecall_set_extmem(extmem_block_bytes);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     }
 
+    if (trace_path) {
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
-    result = ecall_unrelease_threads(enclave);
-    if (result != OE_OK) {
-        handle_oe_error(result, "ecall_release_threads");
+        ret = open_trace(enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = open_trace();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            goto exit_release_threads;
+        }
+    }
+
+    if (serve_path) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = serve(enclave, num_threads, num_comm_threads, !!key_path);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ret = serve(num_threads, num_comm_threads, !!key_path);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        goto exit_close_trace;
     }
+
+    if (sort_type == SORT_AUTO) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = choose_sort(enclave, length, &sort_type);
 #else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
-    ecall_unrelease_threads();
+        ret = choose_sort(length, &sort_type);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (ret) {
+            goto exit_close_trace;
+        }
+    }
+
+    for (size_t i = 0; i < num_runs; i++) {
+        double sort_seconds;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        ret = time_sort(enclave, sort_type, length, join_length,
+                &sort_seconds);
+#else
+        ret = time_sort(sort_type, length, join_length, &sort_seconds);
 #endif
+        if (ret) {
+            handle_error_string("Error in sort");
+            goto exit_close_trace;
+        }
+    }
+
+exit_close_trace:
+    if (trace_path) {
+        int close_ret = trace_close();
+        if (!ret) {
+            ret = close_ret;
+        }
+    }
+exit_release_threads:
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    stop_threads(enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    stop_threads();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
-exit_free_sort:
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     result = ecall_sort_free(enclave);
     if (result != OE_OK) {
@@ -428,6 +1707,8 @@ exit_terminate_enclave:
 #ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     oe_terminate_enclave(enclave);
 #endif
+exit_free_affinity:
+    affinity_free();
 exit_mpi_finalize:
     MPI_Finalize();
 exit:
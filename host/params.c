@@ -0,0 +1,119 @@
+#include "host/params.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/error.h"
+#include "common/sort_params.h"
+
+#define PARAM(name) { #name, offsetof(struct sort_params, name) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} params_fields[] = {
+    PARAM(bitonic_chunk_size),
+    PARAM(orshuffle_chunk_size),
+    PARAM(ojoin_chunk_size),
+    PARAM(opaque_chunk_size),
+    PARAM(sample_partition_buf_size),
+    PARAM(bucket_size),
+    PARAM(bucket_swap_chunk_buckets),
+    PARAM(epc_cliff_bytes),
+    PARAM(epc_cliff_slowdown),
+};
+
+#define NUM_PARAMS_FIELDS (sizeof(params_fields) / sizeof(*params_fields))
+
+static size_t *get_field(struct sort_params *params, size_t i) {
+    return (size_t *) ((unsigned char *) params + params_fields[i].offset);
+}
+
+int params_read(const char *path, struct sort_params *params) {
+    char line[256];
+    size_t line_num = 0;
+    int ret;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        if (errno == ENOENT) {
+            ret = 1;
+            goto exit;
+        }
+        perror("fopen params file");
+        ret = -1;
+        goto exit;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+
+        char name[64];
+        unsigned long long value;
+        char extra;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (sscanf(line, "%63s %llu %c", name, &value, &extra) != 2) {
+            handle_error_string("%s:%zu: Expected <name> <value>", path,
+                    line_num);
+            ret = -1;
+            goto exit_close_file;
+        }
+
+        size_t i;
+        for (i = 0; i < NUM_PARAMS_FIELDS; i++) {
+            if (strcmp(name, params_fields[i].name) == 0) {
+                break;
+            }
+        }
+        if (i == NUM_PARAMS_FIELDS) {
+            handle_error_string("%s:%zu: Unknown parameter %s", path,
+                    line_num, name);
+            ret = -1;
+            goto exit_close_file;
+        }
+        *get_field(params, i) = value;
+    }
+    if (ferror(file)) {
+        perror("read params file");
+        ret = -1;
+        goto exit_close_file;
+    }
+
+    ret = 0;
+
+exit_close_file:
+    fclose(file);
+exit:
+    return ret;
+}
+
+int params_write(const char *path, const struct sort_params *params_) {
+    struct sort_params params = *params_;
+    int ret;
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("fopen params file");
+        ret = -1;
+        goto exit;
+    }
+
+    for (size_t i = 0; i < NUM_PARAMS_FIELDS; i++) {
+        fprintf(file, "%s %zu\n", params_fields[i].name,
+                *get_field(&params, i));
+    }
+
+    if (fclose(file)) {
+        perror("write params file");
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
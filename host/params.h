@@ -0,0 +1,16 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_PARAMS_H
+#define DISTRIBUTED_SGX_SORT_HOST_PARAMS_H
+
+#include "common/sort_params.h"
+
+/* Parameter files hold one "<name> <value>" line per parameter, named as in
+ * struct sort_params. Parameters missing from a file keep their values. */
+
+/* Reads the parameters in PATH into PARAMS. Returns 1 if PATH does not
+ * exist. */
+int params_read(const char *path, struct sort_params *params);
+
+/* Writes PARAMS to PATH. */
+int params_write(const char *path, const struct sort_params *params);
+
+#endif /* distributed-sgx-sort/host/params.h */
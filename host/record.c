@@ -0,0 +1,144 @@
+#include "host/record.h"
+#include <stddef.h>
+#include <stdio.h>
+#include "common/error.h"
+#include "common/mem.h"
+#include "common/ocalls.h"
+#include "host/spans.h"
+
+const char *mem_site_name(enum mem_site site) {
+    switch (site) {
+        case MEM_SORT_ARRAY:
+            return "sort_array";
+        case MEM_THREAD_BUFFERS:
+            return "thread_buffers";
+        case MEM_SCRATCH:
+            return "scratch";
+        case MEM_MPI_TLS:
+            return "mpi_tls";
+        case MEM_MPI_SESSIONS:
+            return "mpi_sessions";
+        case MEM_RNG:
+            return "rng";
+        case MEM_IO:
+            return "io";
+        case MEM_COST:
+            return "cost";
+        case MEM_TRACE:
+            return "trace";
+        case MEM_THREAD_STATS:
+            return "thread_stats";
+        case MEM_CONTEXT:
+            return "context";
+        case MEM_NUM_SITES:
+            break;
+    }
+    return "unknown";
+}
+
+/* Writes STR as a JSON string. Phase names and algorithms are identifiers, so
+ * only quotes, backslashes, and control characters need escaping. */
+static void write_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(file, "\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(file, "\\u%04x", *str);
+        } else {
+            fputc(*str, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/* Writes TIMES as an object mapping each phase to an array of its time on
+ * each rank, with null for ranks that did not run it. */
+static void write_phases(FILE *file, const struct phase_times *times) {
+    fputc('{', file);
+    for (size_t i = 0; i < times->num_phases; i++) {
+        if (i) {
+            fputc(',', file);
+        }
+        write_string(file, times->paths[i]);
+        fputs(":[", file);
+        for (int rank = 0; rank < times->world_size; rank++) {
+            double seconds = times->seconds[i * times->world_size + rank];
+            if (rank) {
+                fputc(',', file);
+            }
+            if (seconds >= 0) {
+                fprintf(file, "%.9g", seconds);
+            } else {
+                fputs("null", file);
+            }
+        }
+        fputc(']', file);
+    }
+    fputc('}', file);
+}
+
+int record_append_json(const char *path, const struct run_record *record) {
+    int ret;
+
+    FILE *file = fopen(path, "a");
+    if (!file) {
+        handle_error_string("Error opening %s", path);
+        ret = -1;
+        goto exit;
+    }
+
+    fputc('{', file);
+    fputs("\"algorithm\":", file);
+    write_string(file, record->algorithm);
+    fprintf(file, ",\"length\":%zu", record->length);
+    fprintf(file, ",\"join_length\":%zu", record->join_length);
+    fprintf(file, ",\"batch_length\":%zu", record->batch_length);
+    fprintf(file, ",\"world_size\":%d", record->world_size);
+    fprintf(file, ",\"threads\":%zu", record->num_threads);
+    fprintf(file, ",\"comm_threads\":%zu", record->num_comm_threads);
+    fprintf(file, ",\"elem_size\":%zu", record->elem_size);
+    fprintf(file, ",\"alloc_seconds\":%.9g", record->alloc_seconds);
+    fprintf(file, ",\"seconds\":%.9g", record->sort_seconds);
+    fputs(",\"phases\":", file);
+    write_phases(file, &record->phases);
+
+    fputs(",\"ranks\":[", file);
+    for (int rank = 0; rank < record->world_size; rank++) {
+        const struct ocall_enclave_stats *stats = &record->stats[rank];
+        fprintf(file,
+                "%s{\"bytes_sent\":%zu,\"messages_sent\":%zu,"
+                    "\"peak_memory_bytes\":%zu,\"site_peak_bytes\":{",
+                rank ? "," : "", stats->mpi_tls_bytes_sent,
+                stats->mpi_tls_messages_sent, stats->peak_memory_bytes);
+        for (enum mem_site site = 0; site < MEM_NUM_SITES; site++) {
+            if (site) {
+                fputc(',', file);
+            }
+            write_string(file, mem_site_name(site));
+            fprintf(file, ":%zu", stats->site_peak_bytes[site]);
+        }
+        fputs("}}", file);
+    }
+    fputc(']', file);
+
+    if (record->merge_length) {
+        fprintf(file, ",\"merge\":{\"length\":%zu,\"seconds\":%.9g",
+                record->merge_length, record->merge_seconds);
+        fputs(",\"phases\":", file);
+        write_phases(file, &record->merge_phases);
+        fputc('}', file);
+    }
+    fputs("}\n", file);
+
+    if (fclose(file)) {
+        handle_error_string("Error writing %s", path);
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
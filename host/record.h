@@ -0,0 +1,40 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_RECORD_H
+#define DISTRIBUTED_SGX_SORT_HOST_RECORD_H
+
+#include <stddef.h>
+#include "common/mem.h"
+#include "common/ocalls.h"
+#include "host/spans.h"
+
+/* Everything measured about one sort, for writing as a machine-readable
+ * record. */
+struct run_record {
+    const char *algorithm;
+    size_t length;
+    size_t join_length;
+    size_t batch_length;
+    int world_size;
+    size_t num_threads;
+    size_t num_comm_threads;
+    size_t elem_size;
+
+    double alloc_seconds;
+    double sort_seconds;
+    struct phase_times phases;
+
+    /* Each rank's counters, in rank order. */
+    struct ocall_enclave_stats *stats;
+
+    /* The merge that followed the sort, if MERGE_LENGTH is nonzero. */
+    size_t merge_length;
+    double merge_seconds;
+    struct phase_times merge_phases;
+};
+
+/* Returns the name SITE is printed and recorded under. */
+const char *mem_site_name(enum mem_site site);
+
+/* Appends RECORD to PATH as one line of JSON. */
+int record_append_json(const char *path, const struct run_record *record);
+
+#endif /* distributed-sgx-sort/host/record.h */
@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Where enclave threads sleep once they have spun on a semaphore for too long.
+ * The enclave's semaphores live in enclave memory, which the host cannot read,
+ * so each one is known here only by its address. Semaphores whose addresses
+ * hash to the same bucket share its condition variable, which only costs
+ * spurious wakeups. */
+#define NUM_BUCKETS 64
+
+/* The longest a thread sleeps before checking its semaphore again, which
+ * bounds the delay when an up lands between the enclave's last check and the
+ * wait here. */
+#define MAX_SLEEP_NS 1000000
+
+struct bucket {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static struct bucket buckets[NUM_BUCKETS];
+static pthread_once_t buckets_once = PTHREAD_ONCE_INIT;
+
+static void init_buckets(void) {
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        pthread_mutex_init(&buckets[i].lock, NULL);
+        pthread_cond_init(&buckets[i].cond, NULL);
+    }
+}
+
+static struct bucket *get_bucket(uint64_t key) {
+    pthread_once(&buckets_once, init_buckets);
+
+    /* Semaphores are at least word-aligned, so drop the low bits before
+     * mixing, and let the top six bits of the product pick the bucket. */
+    return &buckets[((key >> 3) * 0x9e3779b97f4a7c15) >> 58];
+}
+
+void ocall_sema_wait(uint64_t key) {
+    struct bucket *bucket = get_bucket(key);
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += MAX_SLEEP_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&bucket->lock);
+    pthread_cond_timedwait(&bucket->cond, &bucket->lock, &deadline);
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+void ocall_sema_wake(uint64_t key) {
+    struct bucket *bucket = get_bucket(key);
+
+    pthread_mutex_lock(&bucket->lock);
+    pthread_cond_broadcast(&bucket->cond);
+    pthread_mutex_unlock(&bucket->lock);
+}
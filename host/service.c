@@ -0,0 +1,346 @@
+#include "host/service.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <mpi.h>
+#include "common/defs.h"
+#include "common/error.h"
+#include "common/sort_type.h"
+#include "host/error.h"
+
+/* Jobs are submitted as lines of text on a Unix stream socket, one job per
+ * line, and each is answered with one line:
+ *
+ *   {bitonic|bucket|opaque|orshuffle|auto} <array size> [input <path>] [output <path>]
+ *   join <array size> <join size>
+ *   quit
+ *
+ * A job succeeds with "ok <seconds>" and fails with "error <message>". A
+ * client may submit any number of jobs over one connection; connections are
+ * served one at a time. */
+
+#define MAX_LINE_LEN (PATH_MAX * 2 + 128)
+
+static int world_rank;
+static int world_size;
+static bool has_key;
+
+static const char *socket_path;
+static int listen_fd = -1;
+static int conn_fd = -1;
+
+/* Bytes read from the connection but not yet consumed as lines. */
+static char line_buf[MAX_LINE_LEN];
+static size_t line_buf_len;
+
+int service_open(const char *path, int world_rank_, int world_size_,
+        bool has_key_) {
+    int ret;
+
+    world_rank = world_rank_;
+    world_size = world_size_;
+    has_key = has_key_;
+
+    if (world_rank != 0) {
+        ret = 0;
+        goto exit;
+    }
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        handle_error_string("Socket path too long");
+        ret = -1;
+        goto exit;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Replace a stale socket left by a previous service, but nothing else. */
+    struct stat st;
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        ret = -1;
+        goto exit;
+    }
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        perror("bind");
+        ret = -1;
+        goto exit_close_listen;
+    }
+    if (listen(listen_fd, 8)) {
+        perror("listen");
+        ret = -1;
+        goto exit_unlink;
+    }
+    socket_path = path;
+
+    printf("Serving on %s\n", path);
+    fflush(stdout);
+
+    ret = 0;
+    goto exit;
+
+exit_unlink:
+    unlink(path);
+exit_close_listen:
+    close(listen_fd);
+    listen_fd = -1;
+exit:
+    /* Every rank learns whether rank 0 managed to open the socket. */
+    if (MPI_Bcast(&ret, 1, MPI_INT, 0, MPI_COMM_WORLD)) {
+        handle_error_string("Error broadcasting service status");
+        ret = -1;
+    }
+    return ret;
+}
+
+static void reply(const char *fmt, ...) {
+    if (conn_fd < 0) {
+        return;
+    }
+
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    len = MIN((size_t) len, sizeof(buf) - 2);
+    buf[len] = '\n';
+    len++;
+
+    /* A client that hangs up early only loses its answer. */
+    const char *ptr = buf;
+    while (len) {
+        ssize_t bytes_sent = send(conn_fd, ptr, len, MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ptr += bytes_sent;
+        len -= bytes_sent;
+    }
+}
+
+/* Reads the next line from the current connection into LINE, accepting new
+ * connections as old ones close. */
+static int read_line(char *line) {
+    int ret;
+
+    while (1) {
+        char *newline = memchr(line_buf, '\n', line_buf_len);
+        if (newline) {
+            size_t len = newline - line_buf;
+            memcpy(line, line_buf, len);
+            line[len] = '\0';
+            memmove(line_buf, newline + 1, line_buf_len - len - 1);
+            line_buf_len -= len + 1;
+            break;
+        }
+
+        if (line_buf_len == sizeof(line_buf)) {
+            /* Drop the overlong line and the rest of the connection. */
+            reply("error line too long");
+            close(conn_fd);
+            conn_fd = -1;
+        }
+
+        if (conn_fd < 0) {
+            line_buf_len = 0;
+            conn_fd = accept(listen_fd, NULL, NULL);
+            if (conn_fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("accept");
+                ret = -1;
+                goto exit;
+            }
+        }
+
+        ssize_t bytes_read =
+            recv(conn_fd, line_buf + line_buf_len,
+                    sizeof(line_buf) - line_buf_len, 0);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            close(conn_fd);
+            conn_fd = -1;
+            continue;
+        }
+        line_buf_len += bytes_read;
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Parses LINE into JOB, replying with the reason if it is not a valid job. */
+static int parse_job(char *line, struct service_job *job) {
+    char *saveptr;
+    char *token = strtok_r(line, " \t\r", &saveptr);
+
+    memset(job, '\0', sizeof(*job));
+
+    if (!token) {
+        reply("error empty job");
+        return -1;
+    }
+
+    if (strcmp(token, "quit") == 0) {
+        job->quit = true;
+        return 0;
+    } else if (strcmp(token, "bitonic") == 0) {
+        job->sort_type = SORT_BITONIC;
+    } else if (strcmp(token, "bucket") == 0) {
+        job->sort_type = SORT_BUCKET;
+    } else if (strcmp(token, "opaque") == 0) {
+        job->sort_type = SORT_OPAQUE;
+    } else if (strcmp(token, "orshuffle") == 0) {
+        job->sort_type = SORT_ORSHUFFLE;
+    } else if (strcmp(token, "join") == 0) {
+        job->sort_type = OJOIN;
+    } else if (strcmp(token, "auto") == 0) {
+        job->sort_type = SORT_AUTO;
+    } else {
+        reply("error invalid sort type");
+        return -1;
+    }
+
+    char *end;
+    token = strtok_r(NULL, " \t\r", &saveptr);
+    errno = 0;
+    job->length = token ? strtoull(token, &end, 10) : 0;
+    if (!token || errno || *end || !job->length) {
+        reply("error invalid array size");
+        return -1;
+    }
+
+    if (job->sort_type == OJOIN) {
+        token = strtok_r(NULL, " \t\r", &saveptr);
+        errno = 0;
+        job->join_length = token ? strtoull(token, &end, 10) : 0;
+        if (!token || errno || *end || job->join_length > job->length) {
+            reply("error invalid join size");
+            return -1;
+        }
+    }
+
+    while ((token = strtok_r(NULL, " \t\r", &saveptr))) {
+        char *path;
+        if (strcmp(token, "input") == 0) {
+            path = job->input_path;
+        } else if (strcmp(token, "output") == 0) {
+            path = job->output_path;
+        } else {
+            reply("error unknown argument %s", token);
+            return -1;
+        }
+
+        token = strtok_r(NULL, " \t\r", &saveptr);
+        if (!token || strlen(token) >= PATH_MAX) {
+            reply("error invalid path");
+            return -1;
+        }
+        strcpy(path, token);
+    }
+
+    if ((*job->input_path || *job->output_path) && job->sort_type == OJOIN) {
+        reply("error joins do not support encrypted inputs or outputs");
+        return -1;
+    }
+    if ((*job->input_path || *job->output_path) && !has_key) {
+        reply("error inputs and outputs require the service to have a key");
+        return -1;
+    }
+    if (*job->output_path && world_size > 1
+            && !strstr(job->output_path, "%d")) {
+        reply("error output path must contain %%d");
+        return -1;
+    }
+
+    return 0;
+}
+
+int service_next_job(struct service_job *job) {
+    int ret = 0;
+
+    if (world_rank == 0) {
+        char line[MAX_LINE_LEN + 1];
+        while (1) {
+            ret = read_line(line);
+            if (ret) {
+                /* Tell the other ranks to stop rather than leaving them
+                 * waiting for a job. */
+                memset(job, '\0', sizeof(*job));
+                job->quit = true;
+                break;
+            }
+            if (!parse_job(line, job)) {
+                break;
+            }
+        }
+    }
+
+    int bcast_ret = MPI_Bcast(job, sizeof(*job), MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (bcast_ret) {
+        handle_mpi_error(bcast_ret, "MPI_Bcast");
+        return bcast_ret;
+    }
+
+    if (world_rank == 0 && job->quit && !ret) {
+        reply("ok");
+    }
+
+    return ret;
+}
+
+void service_reply(int result, double seconds) {
+    if (world_rank != 0) {
+        return;
+    }
+
+    if (result) {
+        reply("error sort failed with %d", result);
+    } else {
+        reply("ok %f", seconds);
+    }
+}
+
+void service_close(void) {
+    if (world_rank != 0) {
+        return;
+    }
+
+    if (conn_fd >= 0) {
+        close(conn_fd);
+        conn_fd = -1;
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_SERVICE_H
+#define DISTRIBUTED_SGX_SORT_HOST_SERVICE_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/sort_type.h"
+
+/* A job submitted to the sort service. Rank 0 reads it from the command
+ * channel and broadcasts it to every rank, so it holds no pointers. */
+struct service_job {
+    bool quit;
+    enum sort_type sort_type;
+    size_t length;
+    size_t join_length;
+    char input_path[PATH_MAX];
+    char output_path[PATH_MAX];
+};
+
+/* Starts listening for jobs on the Unix socket at PATH on rank 0. Other ranks
+ * only take part in the broadcasts. HAS_KEY says whether jobs may use
+ * encrypted inputs and outputs. */
+int service_open(const char *path, int world_rank, int world_size,
+        bool has_key);
+
+/* Waits for the next valid job and broadcasts it to every rank. Malformed
+ * jobs are answered on rank 0 and never reach the other ranks. */
+int service_next_job(struct service_job *job);
+
+/* Answers the current job on rank 0 with its result and, if it succeeded, the
+ * time the sort took. */
+void service_reply(int result, double seconds);
+
+/* Stops listening and removes the socket. */
+void service_close(void);
+
+#endif /* distributed-sgx-sort/host/service.h */
@@ -0,0 +1,581 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "common/defs.h"
+#include "common/error.h"
+#include "common/ocalls.h"
+#include "common/sort_params.h"
+#include "common/sort_type.h"
+#include "host/params.h"
+#include "host/sim_transport.h"
+
+/* Runs each logical rank as a group of threads in this process, carrying
+ * their messages over host/sim_transport.c instead of MPI.
+ *
+ * The ranks' sort engines keep their state in globals, so each rank runs its
+ * own copy of the host-only sort engines, loaded from a private copy of the
+ * rank library. Their ocalls are left undefined in the library and resolve to
+ * this executable's, and each thread tells the transport which rank it works
+ * for. */
+
+/* The ecalls each rank's copy of the rank library is driven through. */
+struct rank_lib {
+    void *handle;
+    int (*sort_init)(int world_rank, int world_size, size_t num_threads,
+            size_t num_comm_threads, struct sort_params *params, bool tune);
+    int (*sort_alloc_arr)(size_t total_length, enum sort_type sort_type,
+            size_t join_length, bool generate_input);
+    void (*sort_free_arr)(void);
+    void (*sort_free)(void);
+    int (*verify_sorted)(void);
+    void (*start_work)(void);
+    size_t (*get_num_threads_started)(void);
+    void (*release_threads)(void);
+    int (*choose_sort)(size_t total_length, enum sort_type *sort_type);
+    void (*get_stats)(struct ocall_enclave_stats *stats,
+            struct ocall_thread_stats *thread_stats, size_t capacity,
+            size_t *num_thread_stats);
+    int (*sorts[SORT_AUTO])(void);
+};
+
+struct rank {
+    int rank;
+    pthread_t thread;
+    struct rank_lib lib;
+    struct ocall_enclave_stats stats;
+    int ret;
+};
+
+static const char *const sort_names[] = {
+    [SORT_BITONIC] = "bitonic",
+    [SORT_BUCKET] = "bucket",
+    [SORT_OPAQUE] = "opaque",
+    [SORT_ORSHUFFLE] = "orshuffle",
+    [SORT_AUTO] = "auto",
+};
+static const char *const sort_ecalls[SORT_AUTO] = {
+    [SORT_BITONIC] = "ecall_bitonic_sort",
+    [SORT_BUCKET] = "ecall_bucket_sort",
+    [SORT_OPAQUE] = "ecall_opaque_sort",
+    [SORT_ORSHUFFLE] = "ecall_orshuffle_sort",
+};
+
+static int world_size;
+static struct rank *ranks;
+static enum sort_type sort_type;
+static size_t length;
+static size_t num_threads;
+static size_t num_runs;
+static struct sort_params params = SORT_PARAMS_DEFAULT;
+
+/* Stands in for MPI collectives between the ranks' main threads. */
+static pthread_barrier_t rank_barrier;
+static bool any_failed;
+
+static void usage(char **argv) {
+    printf("Usage: %s [options] <num ranks> {bitonic|bucket|opaque|orshuffle|auto} <array size> <num threads> [num runs]\n", argv[0]);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -l, --latency <us>        Delay each message by <us> microseconds\n");
+    printf("                            (default 0)\n");
+    printf("  -B, --bandwidth <MB/s>    Limit each link between two ranks to <MB/s>\n");
+    printf("                            megabytes per second (default unlimited)\n");
+    printf("  -M, --messages <file>     Write a CSV row for every message to <file>\n");
+    printf("  -p, --params <file>       Read chunk and bucket sizes from <file>\n");
+    printf("  -r, --rank-lib <file>     Load the ranks' sort engines from <file>\n");
+    printf("                            (default <this program>-rank.so)\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns whether every rank's RET was 0 so far. Every rank's main thread
+ * must call this, as with an MPI collective. The second barrier keeps a rank
+ * that fails its next step from being seen by a rank still checking this
+ * one. */
+static bool all_succeeded(int ret) {
+    if (ret) {
+        __atomic_store_n(&any_failed, true, __ATOMIC_RELAXED);
+    }
+    pthread_barrier_wait(&rank_barrier);
+    bool succeeded = !__atomic_load_n(&any_failed, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&rank_barrier);
+    return succeeded;
+}
+
+/* Copies the file at SRC_PATH to a new temporary file and returns its path in
+ * DST_PATH. dlopen returns the library already loaded for a path, so each
+ * rank loads its own copy to get its own globals. */
+static int copy_lib(const char *src_path, char *dst_path, size_t dst_len) {
+    int ret;
+
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(dst_path, dst_len, "%s/sim-rank-XXXXXX",
+            tmpdir ? tmpdir : "/tmp");
+    int dst_fd = mkstemp(dst_path);
+    if (dst_fd == -1) {
+        perror("mkstemp rank library");
+        ret = errno;
+        goto exit;
+    }
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd == -1) {
+        perror("open rank library");
+        ret = errno;
+        goto exit_unlink;
+    }
+
+    unsigned char buf[65536];
+    ssize_t bytes_read;
+    while ((bytes_read = read(src_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t written = 0; written < bytes_read;) {
+            ssize_t bytes_written =
+                write(dst_fd, buf + written, bytes_read - written);
+            if (bytes_written == -1) {
+                perror("write rank library");
+                ret = errno;
+                goto exit_close_src;
+            }
+            written += bytes_written;
+        }
+    }
+    if (bytes_read == -1) {
+        perror("read rank library");
+        ret = errno;
+        goto exit_close_src;
+    }
+
+    close(src_fd);
+    close(dst_fd);
+    return 0;
+
+exit_close_src:
+    close(src_fd);
+exit_unlink:
+    close(dst_fd);
+    unlink(dst_path);
+exit:
+    return ret;
+}
+
+static int lookup(struct rank_lib *lib, const char *name, void *fn) {
+    void *sym = dlsym(lib->handle, name);
+    if (!sym) {
+        handle_error_string("Rank library has no %s: %s", name, dlerror());
+        return -1;
+    }
+    memcpy(fn, &sym, sizeof(sym));
+    return 0;
+}
+
+static int load_rank_lib(const char *path, struct rank_lib *lib) {
+    int ret;
+
+    char copy_path[4096];
+    ret = copy_lib(path, copy_path, sizeof(copy_path));
+    if (ret) {
+        goto exit;
+    }
+
+    /* The copy can be removed as soon as it is mapped. */
+    lib->handle = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL);
+    unlink(copy_path);
+    if (!lib->handle) {
+        handle_error_string("Error loading rank library: %s", dlerror());
+        ret = -1;
+        goto exit;
+    }
+
+    ret = lookup(lib, "ecall_sort_init", &lib->sort_init)
+        || lookup(lib, "ecall_sort_alloc_arr", &lib->sort_alloc_arr)
+        || lookup(lib, "ecall_sort_free_arr", &lib->sort_free_arr)
+        || lookup(lib, "ecall_sort_free", &lib->sort_free)
+        || lookup(lib, "ecall_verify_sorted", &lib->verify_sorted)
+        || lookup(lib, "ecall_start_work", &lib->start_work)
+        || lookup(lib, "ecall_get_num_threads_started",
+                &lib->get_num_threads_started)
+        || lookup(lib, "ecall_release_threads", &lib->release_threads)
+        || lookup(lib, "ecall_choose_sort", &lib->choose_sort)
+        || lookup(lib, "ecall_get_stats", &lib->get_stats);
+    for (size_t i = 0; i < SORT_AUTO && !ret; i++) {
+        if (sort_ecalls[i]) {
+            ret = lookup(lib, sort_ecalls[i], &lib->sorts[i]);
+        }
+    }
+    if (ret) {
+        goto exit_dlclose;
+    }
+
+    return 0;
+
+exit_dlclose:
+    dlclose(lib->handle);
+exit:
+    return ret;
+}
+
+static void *start_thread_work(void *rank_) {
+    struct rank *rank = rank_;
+    sim_transport_set_rank(rank->rank);
+    rank->lib.start_work();
+    return NULL;
+}
+
+static void print_traffic(void) {
+    uint64_t bytes[world_size * world_size];
+    uint64_t messages[world_size * world_size];
+    sim_transport_get_counts(bytes, messages);
+
+    uint64_t total_bytes = 0;
+    uint64_t total_messages = 0;
+    for (int i = 0; i < world_size; i++) {
+        for (int j = 0; j < world_size; j++) {
+            if (!messages[i * world_size + j]) {
+                continue;
+            }
+            printf("[traffic] %2d -> %2d: bytes = %" PRIu64
+                    ", messages = %" PRIu64 "\n",
+                    i, j, bytes[i * world_size + j],
+                    messages[i * world_size + j]);
+            total_bytes += bytes[i * world_size + j];
+            total_messages += messages[i * world_size + j];
+        }
+    }
+    printf("[traffic] total   : bytes = %" PRIu64 ", messages = %" PRIu64 "\n",
+            total_bytes, total_messages);
+    for (int i = 0; i < world_size; i++) {
+        printf("[stats] %2d: mpi_tls_bytes_sent = %zu\n", i,
+                ranks[i].stats.mpi_tls_bytes_sent);
+    }
+}
+
+/* Sorts and verifies an array on RANK, printing the time the sort took and
+ * the messages it sent from rank 0. */
+static int time_sort(struct rank *rank, enum sort_type sort_type_) {
+    struct rank_lib *lib = &rank->lib;
+    int ret;
+
+    ret = lib->sort_alloc_arr(length, sort_type_, 0, true);
+    if (ret) {
+        handle_error_string("Error allocating array on rank %d", rank->rank);
+    }
+    if (!all_succeeded(ret)) {
+        ret = -1;
+        goto exit_free_arr;
+    }
+
+    /* Rank 0 resets the counts between two barriers, so that no rank sends
+     * before they are zeroed. */
+    if (rank->rank == 0) {
+        sim_transport_reset_counts();
+    }
+    pthread_barrier_wait(&rank_barrier);
+    uint64_t start_ns = now_ns();
+
+    ret = lib->sorts[sort_type_]();
+    if (ret) {
+        handle_error_string("Error sorting on rank %d", rank->rank);
+    }
+    if (!all_succeeded(ret)) {
+        ret = -1;
+        goto exit_free_arr;
+    }
+    uint64_t end_ns = now_ns();
+
+    size_t num_thread_stats;
+    lib->get_stats(&rank->stats, NULL, 0, &num_thread_stats);
+    pthread_barrier_wait(&rank_barrier);
+    if (rank->rank == 0) {
+        printf("%f\n", (double) (end_ns - start_ns) / 1000000000);
+        print_traffic();
+    }
+
+    ret = lib->verify_sorted();
+    if (ret) {
+        handle_error_string("Array not sorted on rank %d", rank->rank);
+    }
+    if (!all_succeeded(ret)) {
+        ret = -1;
+        goto exit_free_arr;
+    }
+
+exit_free_arr:
+    lib->sort_free_arr();
+    return ret;
+}
+
+static void *run_rank(void *rank_) {
+    struct rank *rank = rank_;
+    struct rank_lib *lib = &rank->lib;
+    pthread_t threads[num_threads - 1];
+    size_t num_threads_created = 0;
+    int ret;
+
+    sim_transport_set_rank(rank->rank);
+
+    struct sort_params rank_params = params;
+    ret = lib->sort_init(rank->rank, world_size, num_threads, 0, &rank_params,
+            false);
+    if (ret) {
+        handle_error_string("Error in sorting initialization on rank %d",
+                rank->rank);
+    }
+    if (!all_succeeded(ret)) {
+        ret = -1;
+        goto exit;
+    }
+
+    for (size_t i = 0; i < num_threads - 1; i++) {
+        ret = pthread_create(&threads[i], NULL, start_thread_work, rank);
+        if (ret) {
+            errno = ret;
+            perror("pthread_create");
+            break;
+        }
+        num_threads_created++;
+    }
+    while (!ret && lib->get_num_threads_started() < num_threads_created) {
+        sched_yield();
+    }
+    if (!all_succeeded(ret)) {
+        ret = -1;
+        goto exit_release_threads;
+    }
+
+    enum sort_type rank_sort_type = sort_type;
+    if (rank_sort_type == SORT_AUTO) {
+        ret = lib->choose_sort(length, &rank_sort_type);
+        if (!all_succeeded(ret)) {
+            ret = -1;
+            goto exit_release_threads;
+        }
+        if (rank->rank == 0) {
+            printf("auto             : %s\n", sort_names[rank_sort_type]);
+        }
+    }
+
+    for (size_t i = 0; i < num_runs; i++) {
+        ret = time_sort(rank, rank_sort_type);
+        if (ret) {
+            goto exit_release_threads;
+        }
+    }
+
+exit_release_threads:
+    lib->release_threads();
+    for (size_t i = 0; i < num_threads_created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    lib->sort_free();
+exit:
+    rank->ret = ret;
+    return NULL;
+}
+
+/* Host memory for the enclave's encrypted external-memory stores. */
+void *ocall_extmem_alloc(size_t size) {
+    return malloc(size);
+}
+
+void ocall_extmem_free(void *ptr) {
+    free(ptr);
+}
+
+int main(int argc, char **argv) {
+    int ret = -1;
+
+    /* Read options. */
+
+    struct option long_options[] = {
+        { "latency", required_argument, NULL, 'l' },
+        { "bandwidth", required_argument, NULL, 'B' },
+        { "messages", required_argument, NULL, 'M' },
+        { "params", required_argument, NULL, 'p' },
+        { "rank-lib", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct sim_link_model model = { 0 };
+    const char *messages_path = NULL;
+    const char *params_path = NULL;
+    const char *rank_lib_path = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:B:M:p:r:", long_options, NULL))
+            != -1) {
+        switch (opt) {
+            case 'l':
+                errno = 0;
+                model.latency_ns = strtoull(optarg, NULL, 10) * 1000;
+                if (errno) {
+                    printf("Invalid latency\n");
+                    return ret;
+                }
+                break;
+            case 'B':
+                errno = 0;
+                model.bandwidth = strtoull(optarg, NULL, 10) * 1000000;
+                if (errno || !model.bandwidth) {
+                    printf("Invalid bandwidth\n");
+                    return ret;
+                }
+                break;
+            case 'M':
+                messages_path = optarg;
+                break;
+            case 'p':
+                params_path = optarg;
+                break;
+            case 'r':
+                rank_lib_path = optarg;
+                break;
+            default:
+                usage(argv);
+                return ret;
+        }
+    }
+
+    /* Read arguments. */
+
+    int argi = optind;
+    if (argc < argi + 4) {
+        usage(argv);
+        return 0;
+    }
+
+    errno = 0;
+    world_size = strtol(argv[argi], NULL, 10);
+    if (errno || world_size <= 0) {
+        printf("Invalid number of ranks\n");
+        return ret;
+    }
+    argi++;
+
+    sort_type = SORT_UNSET;
+    for (size_t i = 0; i <= SORT_AUTO; i++) {
+        if (sort_names[i] && strcmp(argv[argi], sort_names[i]) == 0) {
+            sort_type = i;
+        }
+    }
+    if (sort_type == SORT_UNSET) {
+        printf("Invalid sort type\n");
+        return ret;
+    }
+    argi++;
+
+    errno = 0;
+    length = strtoull(argv[argi], NULL, 10);
+    if (errno) {
+        printf("Invalid array size\n");
+        return ret;
+    }
+    argi++;
+
+    errno = 0;
+    num_threads = strtoull(argv[argi], NULL, 10);
+    if (errno || !num_threads) {
+        printf("Invalid number of threads\n");
+        return ret;
+    }
+    argi++;
+
+    num_runs = 1;
+    if (argc > argi) {
+        errno = 0;
+        num_runs = strtoull(argv[argi], NULL, 10);
+        if (errno) {
+            printf("Invalid number of runs\n");
+            return ret;
+        }
+    }
+
+    if (params_path && params_read(params_path, &params)) {
+        handle_error_string("Error reading parameters from %s", params_path);
+        return ret;
+    }
+
+    char default_rank_lib_path[4096];
+    if (!rank_lib_path) {
+        snprintf(default_rank_lib_path, sizeof(default_rank_lib_path),
+                "%s-rank.so", argv[0]);
+        rank_lib_path = default_rank_lib_path;
+    }
+
+    /* Load a copy of the sort engines for each rank. */
+
+    ret = sim_transport_init(world_size, &model, messages_path);
+    if (ret) {
+        goto exit;
+    }
+
+    ranks = calloc(world_size, sizeof(*ranks));
+    if (!ranks) {
+        perror("malloc ranks");
+        ret = errno;
+        goto exit_free_transport;
+    }
+    int num_loaded;
+    for (num_loaded = 0; num_loaded < world_size; num_loaded++) {
+        ranks[num_loaded].rank = num_loaded;
+        ret = load_rank_lib(rank_lib_path, &ranks[num_loaded].lib);
+        if (ret) {
+            goto exit_unload;
+        }
+    }
+
+    /* Run the ranks. */
+
+    ret = pthread_barrier_init(&rank_barrier, NULL, world_size);
+    if (ret) {
+        errno = ret;
+        perror("pthread_barrier_init");
+        goto exit_unload;
+    }
+
+    int num_started;
+    for (num_started = 0; num_started < world_size; num_started++) {
+        ret = pthread_create(&ranks[num_started].thread, NULL, run_rank,
+                &ranks[num_started]);
+        if (ret) {
+            errno = ret;
+            perror("pthread_create");
+            break;
+        }
+    }
+
+    /* The ranks already started wait for the others at their first barrier,
+     * so a rank that failed to start leaves nothing to join. */
+    if (num_started < world_size) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < world_size; i++) {
+        pthread_join(ranks[i].thread, NULL);
+        if (!ret) {
+            ret = ranks[i].ret;
+        }
+    }
+
+    pthread_barrier_destroy(&rank_barrier);
+exit_unload:
+    for (int i = 0; i < num_loaded; i++) {
+        dlclose(ranks[i].lib.handle);
+    }
+    free(ranks);
+exit_free_transport:
+    sim_transport_free();
+exit:
+    return ret;
+}
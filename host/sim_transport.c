@@ -0,0 +1,623 @@
+#include "host/sim_transport.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include "common/defs.h"
+#include "common/error.h"
+#include "common/ocalls.h"
+
+struct sim_message {
+    struct sim_message *next;
+    int source;
+    int tag;
+
+    /* When the link model lets the receiver see the message. */
+    uint64_t arrival_ns;
+
+    size_t count;
+    unsigned char data[];
+};
+
+enum ocall_mpi_request_type {
+    OCALL_MPI_SEND,
+    OCALL_MPI_RECV,
+};
+
+struct ocall_mpi_request {
+    enum ocall_mpi_request_type type;
+
+    /* The next receive posted to the same rank while this one is unmatched. */
+    struct ocall_mpi_request *next;
+
+    /* What a receive accepts, and the message it matched, if any. */
+    int source;
+    int tag;
+    size_t count;
+    struct sim_message *msg;
+};
+
+/* What each rank receives. The lock guards everything here and the MSG of
+ * every receive posted to the rank. */
+struct sim_rank {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* Messages that arrived before a receive matching them was posted, and
+     * receives posted before a message matching them arrived, each in
+     * order. */
+    struct sim_message *unexpected;
+    struct sim_message **unexpected_tail;
+    struct ocall_mpi_request *posted;
+    struct ocall_mpi_request **posted_tail;
+
+    /* When the link from each source is next free. */
+    uint64_t *link_free_ns;
+};
+
+static int world_size;
+static struct sim_link_model model;
+static struct sim_rank *ranks;
+static thread_local int sim_rank;
+
+static uint64_t *sent_bytes;
+static uint64_t *sent_messages;
+
+static FILE *trace_file;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_start_ns;
+
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t barrier_cond = PTHREAD_COND_INITIALIZER;
+static int barrier_waiting;
+static uint64_t barrier_generation;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool matches(int want_source, int want_tag, int source, int tag) {
+    return (want_source == OCALL_MPI_ANY_SOURCE || want_source == source)
+        && (want_tag == OCALL_MPI_ANY_TAG || want_tag == tag);
+}
+
+/* Waits on R's condition variable until it is signaled or, if DEADLINE_NS is
+ * not 0, until DEADLINE_NS. R's lock is held. */
+static void wait_until(struct sim_rank *r, uint64_t deadline_ns) {
+    if (!deadline_ns) {
+        pthread_cond_wait(&r->cond, &r->lock);
+        return;
+    }
+    struct timespec deadline = {
+        .tv_sec = deadline_ns / 1000000000,
+        .tv_nsec = deadline_ns % 1000000000,
+    };
+    pthread_cond_timedwait(&r->cond, &r->lock, &deadline);
+}
+
+/* Returns whether REQUEST is complete, or sets *ARRIVAL_NS to when it will
+ * be if it has matched a message still on its way. The receiving rank's lock
+ * is held. */
+static bool is_complete(const struct ocall_mpi_request *request, uint64_t now,
+        uint64_t *arrival_ns) {
+    if (request->type == OCALL_MPI_SEND) {
+        return true;
+    }
+    if (!request->msg) {
+        return false;
+    }
+    if (request->msg->arrival_ns <= now) {
+        return true;
+    }
+    if (!*arrival_ns || request->msg->arrival_ns < *arrival_ns) {
+        *arrival_ns = request->msg->arrival_ns;
+    }
+    return false;
+}
+
+/* Copies a completed REQUEST's message to BUF, fills in STATUS, and frees the
+ * request. */
+static int finish_request(struct ocall_mpi_request *request,
+        unsigned char *buf, size_t count, ocall_mpi_status_t *status) {
+    int ret;
+
+    if (request->type == OCALL_MPI_RECV) {
+        struct sim_message *msg = request->msg;
+        if (msg->count > request->count) {
+            handle_error_string(
+                    "Message of %zu bytes from %d with tag %d truncated to %zu bytes",
+                    msg->count, msg->source, msg->tag, request->count);
+            ret = -1;
+            goto exit_free_request;
+        }
+        status->count = msg->count;
+        status->source = msg->source;
+        status->tag = msg->tag;
+        memcpy(buf, msg->data, MIN(count, msg->count));
+    }
+
+    ret = 0;
+
+exit_free_request:
+    if (request->type == OCALL_MPI_RECV) {
+        free(request->msg);
+    }
+    free(request);
+    return ret;
+}
+
+/* Puts a copy of BUF on its way from SOURCE to DEST. */
+static int deliver(int source, int dest, int tag, const unsigned char *buf,
+        size_t count) {
+    int ret;
+
+    if (dest < 0 || dest >= world_size) {
+        handle_error_string("Invalid destination rank %d", dest);
+        ret = -1;
+        goto exit;
+    }
+    if (count > INT_MAX) {
+        handle_error_string("Count too large");
+        ret = -1;
+        goto exit;
+    }
+
+    struct sim_message *msg = malloc(sizeof(*msg) + count);
+    if (!msg) {
+        perror("malloc sim message");
+        ret = errno;
+        goto exit;
+    }
+    msg->next = NULL;
+    msg->source = source;
+    msg->tag = tag;
+    msg->count = count;
+    memcpy(msg->data, buf, count);
+
+    struct sim_rank *r = &ranks[dest];
+    uint64_t now = now_ns();
+    pthread_mutex_lock(&r->lock);
+
+    /* Queue the message behind those already on the link, so that messages
+     * from one rank to another arrive in order. */
+    uint64_t leave_ns = MAX(now, r->link_free_ns[source]);
+    if (model.bandwidth) {
+        leave_ns += (uint64_t) ((double) count * 1e9 / model.bandwidth);
+    }
+    r->link_free_ns[source] = leave_ns;
+    msg->arrival_ns = leave_ns + model.latency_ns;
+
+    /* Hand the message to the first posted receive it matches, or leave it for
+     * a later one. */
+    struct ocall_mpi_request **posted;
+    for (posted = &r->posted; *posted; posted = &(*posted)->next) {
+        if (matches((*posted)->source, (*posted)->tag, source, tag)) {
+            break;
+        }
+    }
+    if (*posted) {
+        struct ocall_mpi_request *request = *posted;
+        request->msg = msg;
+        *posted = request->next;
+        if (!*posted) {
+            r->posted_tail = posted;
+        }
+    } else {
+        *r->unexpected_tail = msg;
+        r->unexpected_tail = &msg->next;
+    }
+
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    __atomic_add_fetch(&sent_bytes[source * world_size + dest], count,
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sent_messages[source * world_size + dest], 1,
+            __ATOMIC_RELAXED);
+
+    if (trace_file) {
+        pthread_mutex_lock(&trace_lock);
+        fprintf(trace_file, "%" PRIu64 ",%d,%d,%d,%zu\n",
+                now - trace_start_ns, source, dest, tag, count);
+        pthread_mutex_unlock(&trace_lock);
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Posts a receive to the calling rank, matching it to the first message
+ * already waiting for it, if any. */
+static int post_recv(size_t count, int source, int tag,
+        struct ocall_mpi_request **request_) {
+    int ret;
+
+    if (count > INT_MAX) {
+        handle_error_string("Count too large");
+        ret = -1;
+        goto exit;
+    }
+
+    struct ocall_mpi_request *request = malloc(sizeof(*request));
+    if (!request) {
+        perror("malloc ocall_mpi_request");
+        ret = errno;
+        goto exit;
+    }
+    request->type = OCALL_MPI_RECV;
+    request->next = NULL;
+    request->source = source;
+    request->tag = tag;
+    request->count = count;
+    request->msg = NULL;
+
+    struct sim_rank *r = &ranks[sim_rank];
+    pthread_mutex_lock(&r->lock);
+
+    struct sim_message **unexpected;
+    for (unexpected = &r->unexpected; *unexpected;
+            unexpected = &(*unexpected)->next) {
+        if (matches(source, tag, (*unexpected)->source, (*unexpected)->tag)) {
+            break;
+        }
+    }
+    if (*unexpected) {
+        request->msg = *unexpected;
+        *unexpected = request->msg->next;
+        if (!*unexpected) {
+            r->unexpected_tail = unexpected;
+        }
+    } else {
+        *r->posted_tail = request;
+        r->posted_tail = &request->next;
+    }
+
+    pthread_mutex_unlock(&r->lock);
+
+    *request_ = request;
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int ocall_mpi_send_bytes(const unsigned char *buf, size_t count, int dest,
+        int tag) {
+    return deliver(sim_rank, dest, tag, buf, count);
+}
+
+int ocall_mpi_recv_bytes(unsigned char *buf, size_t count, int source,
+        int tag, ocall_mpi_status_t *status) {
+    ocall_mpi_request_t request;
+    int ret;
+
+    ret = post_recv(count, source, tag, &request);
+    if (ret) {
+        goto exit;
+    }
+    ret = ocall_mpi_wait(buf, count, &request, status);
+
+exit:
+    return ret;
+}
+
+int ocall_mpi_try_recv_bytes(unsigned char *buf, size_t count, int source,
+        int tag, int *flag, ocall_mpi_status_t *status) {
+    struct sim_rank *r = &ranks[sim_rank];
+    int ret;
+
+    pthread_mutex_lock(&r->lock);
+
+    /* Only the first matching message may be taken, since messages with the
+     * same source and tag must be received in order. */
+    struct sim_message **unexpected;
+    for (unexpected = &r->unexpected; *unexpected;
+            unexpected = &(*unexpected)->next) {
+        if (matches(source, tag, (*unexpected)->source, (*unexpected)->tag)) {
+            break;
+        }
+    }
+    if (!*unexpected || (*unexpected)->arrival_ns > now_ns()) {
+        *flag = 0;
+        ret = 0;
+        goto exit_unlock;
+    }
+
+    struct sim_message *msg = *unexpected;
+    if (msg->count > count) {
+        handle_error_string(
+                "Message of %zu bytes from %d with tag %d truncated to %zu bytes",
+                msg->count, msg->source, msg->tag, count);
+        ret = -1;
+        goto exit_unlock;
+    }
+    *unexpected = msg->next;
+    if (!*unexpected) {
+        r->unexpected_tail = unexpected;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    *flag = 1;
+    status->count = msg->count;
+    status->source = msg->source;
+    status->tag = msg->tag;
+    memcpy(buf, msg->data, msg->count);
+    free(msg);
+    return 0;
+
+exit_unlock:
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+int ocall_mpi_isend_bytes(const unsigned char *buf, size_t count, int dest,
+        int tag, ocall_mpi_request_t *request) {
+    int ret;
+
+    /* Sends are buffered, so the request is complete as soon as it starts. */
+    *request = malloc(sizeof(**request));
+    if (!*request) {
+        perror("malloc ocall_mpi_request");
+        ret = errno;
+        goto exit;
+    }
+    (*request)->type = OCALL_MPI_SEND;
+
+    ret = deliver(sim_rank, dest, tag, buf, count);
+    if (ret) {
+        goto exit_free_request;
+    }
+
+    return 0;
+
+exit_free_request:
+    free(*request);
+exit:
+    return ret;
+}
+
+int ocall_mpi_irecv_bytes(size_t count, int source, int tag,
+        ocall_mpi_request_t *request) {
+    return post_recv(count, source, tag, request);
+}
+
+int ocall_mpi_wait(unsigned char *buf, size_t count,
+        ocall_mpi_request_t *request, ocall_mpi_status_t *status) {
+    struct sim_rank *r = &ranks[sim_rank];
+
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        uint64_t arrival_ns = 0;
+        if (is_complete(*request, now_ns(), &arrival_ns)) {
+            break;
+        }
+        wait_until(r, arrival_ns);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return finish_request(*request, buf, count, status);
+}
+
+int ocall_mpi_waitany(unsigned char *buf, size_t bufcount, size_t count,
+        ocall_mpi_request_t *requests, size_t *index,
+        ocall_mpi_status_t *status) {
+    struct sim_rank *r = &ranks[sim_rank];
+    int ret;
+
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        uint64_t now = now_ns();
+        uint64_t arrival_ns = 0;
+        bool any_active = false;
+        for (size_t i = 0; i < count; i++) {
+            if (requests[i] == OCALL_MPI_REQUEST_NULL) {
+                continue;
+            }
+            any_active = true;
+            if (is_complete(requests[i], now, &arrival_ns)) {
+                *index = i;
+                goto complete;
+            }
+        }
+        if (!any_active) {
+            handle_error_string(
+                    "All null requests passed to ocall_mpi_waitany");
+            ret = -1;
+            goto exit_unlock;
+        }
+        wait_until(r, arrival_ns);
+    }
+
+complete:
+    pthread_mutex_unlock(&r->lock);
+    return finish_request(requests[*index], buf, bufcount, status);
+
+exit_unlock:
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+int ocall_mpi_try_wait(unsigned char *buf, size_t count,
+        ocall_mpi_request_t *request, int *flag, ocall_mpi_status_t *status) {
+    struct sim_rank *r = &ranks[sim_rank];
+
+    pthread_mutex_lock(&r->lock);
+    uint64_t arrival_ns = 0;
+    *flag = is_complete(*request, now_ns(), &arrival_ns);
+    pthread_mutex_unlock(&r->lock);
+
+    if (!*flag) {
+        return 0;
+    }
+    return finish_request(*request, buf, count, status);
+}
+
+int ocall_mpi_cancel(ocall_mpi_request_t *request) {
+    struct sim_rank *r = &ranks[sim_rank];
+
+    /* An unmatched receive is taken off the posted list. A matched one
+     * completes, as in MPI, and its message is dropped with the request. */
+    if ((*request)->type == OCALL_MPI_RECV) {
+        pthread_mutex_lock(&r->lock);
+        if (!(*request)->msg) {
+            struct ocall_mpi_request **posted;
+            for (posted = &r->posted; *posted != *request;
+                    posted = &(*posted)->next) {}
+            *posted = (*request)->next;
+            if (!*posted) {
+                r->posted_tail = posted;
+            }
+        }
+        pthread_mutex_unlock(&r->lock);
+        free((*request)->msg);
+    }
+    free(*request);
+    return 0;
+}
+
+int ocall_mpi_tag_ub(void) {
+    /* Tags are only compared, so any tag will do. */
+    return INT_MAX;
+}
+
+void ocall_mpi_barrier(void) {
+    pthread_mutex_lock(&barrier_lock);
+    uint64_t generation = barrier_generation;
+    barrier_waiting++;
+    if (barrier_waiting == world_size) {
+        barrier_waiting = 0;
+        barrier_generation++;
+        pthread_cond_broadcast(&barrier_cond);
+    } else {
+        while (barrier_generation == generation) {
+            pthread_cond_wait(&barrier_cond, &barrier_lock);
+        }
+    }
+    pthread_mutex_unlock(&barrier_lock);
+}
+
+int sim_transport_init(int world_size_, const struct sim_link_model *model_,
+        const char *trace_path) {
+    int ret;
+
+    world_size = world_size_;
+    model = *model_;
+
+    ranks = calloc(world_size, sizeof(*ranks));
+    if (!ranks) {
+        perror("malloc sim ranks");
+        ret = errno;
+        goto exit;
+    }
+    sent_bytes = calloc(world_size * world_size, sizeof(*sent_bytes));
+    if (!sent_bytes) {
+        perror("malloc sent bytes");
+        ret = errno;
+        goto exit_free_ranks;
+    }
+    sent_messages = calloc(world_size * world_size, sizeof(*sent_messages));
+    if (!sent_messages) {
+        perror("malloc sent messages");
+        ret = errno;
+        goto exit_free_sent_bytes;
+    }
+
+    /* Deadlines are on the monotonic clock. */
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    int num_inited;
+    for (num_inited = 0; num_inited < world_size; num_inited++) {
+        struct sim_rank *r = &ranks[num_inited];
+        r->link_free_ns = calloc(world_size, sizeof(*r->link_free_ns));
+        if (!r->link_free_ns) {
+            perror("malloc link times");
+            ret = errno;
+            pthread_condattr_destroy(&condattr);
+            goto exit_free_ranks_inited;
+        }
+        pthread_mutex_init(&r->lock, NULL);
+        pthread_cond_init(&r->cond, &condattr);
+        r->unexpected_tail = &r->unexpected;
+        r->posted_tail = &r->posted;
+    }
+    pthread_condattr_destroy(&condattr);
+
+    if (trace_path) {
+        trace_file = fopen(trace_path, "w");
+        if (!trace_file) {
+            perror("fopen message trace");
+            ret = errno;
+            goto exit_free_ranks_inited;
+        }
+        fprintf(trace_file, "time_ns,source,dest,tag,bytes\n");
+        trace_start_ns = now_ns();
+    }
+
+    return 0;
+
+exit_free_ranks_inited:
+    for (int i = 0; i < num_inited; i++) {
+        pthread_cond_destroy(&ranks[i].cond);
+        pthread_mutex_destroy(&ranks[i].lock);
+        free(ranks[i].link_free_ns);
+    }
+    free(sent_messages);
+exit_free_sent_bytes:
+    free(sent_bytes);
+exit_free_ranks:
+    free(ranks);
+exit:
+    return ret;
+}
+
+void sim_transport_free(void) {
+    if (trace_file) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    for (int i = 0; i < world_size; i++) {
+        struct sim_rank *r = &ranks[i];
+        while (r->unexpected) {
+            struct sim_message *next = r->unexpected->next;
+            free(r->unexpected);
+            r->unexpected = next;
+        }
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        free(r->link_free_ns);
+    }
+    free(sent_messages);
+    free(sent_bytes);
+    free(ranks);
+}
+
+void sim_transport_set_rank(int rank) {
+    sim_rank = rank;
+}
+
+void sim_transport_reset_counts(void) {
+    for (int i = 0; i < world_size * world_size; i++) {
+        __atomic_store_n(&sent_bytes[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&sent_messages[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void sim_transport_get_counts(uint64_t *bytes, uint64_t *messages) {
+    for (int i = 0; i < world_size * world_size; i++) {
+        bytes[i] = __atomic_load_n(&sent_bytes[i], __ATOMIC_RELAXED);
+        messages[i] = __atomic_load_n(&sent_messages[i], __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_SIM_TRANSPORT_H
+#define DISTRIBUTED_SGX_SORT_HOST_SIM_TRANSPORT_H
+
+#include <stdint.h>
+
+/* An in-memory stand-in for MPI, implementing the MPI ocalls of
+ * distsort.edl for ranks that run as thread groups of one process. Each
+ * thread names the rank it works for with sim_transport_set_rank before it
+ * makes any ocall.
+ *
+ * Sends are buffered and never block. A message becomes visible to its
+ * receiver after the link model's delay: messages from one rank to another
+ * queue on their link for BYTES / BANDWIDTH and then take LATENCY to arrive.
+ * Receives match in the order they are posted, and messages between a pair
+ * of ranks with the same tag arrive in the order they were sent, as in MPI. */
+
+struct sim_link_model {
+    /* The time each message takes to arrive after it leaves its link. */
+    uint64_t latency_ns;
+
+    /* The bytes per second each link carries, or 0 for no limit. */
+    uint64_t bandwidth;
+};
+
+/* Sets up the transport for WORLD_SIZE ranks. If TRACE_PATH is not NULL, every
+ * message sent is appended to it as a CSV row. */
+int sim_transport_init(int world_size, const struct sim_link_model *model,
+        const char *trace_path);
+
+/* Frees the transport once every rank has stopped using it. */
+void sim_transport_free(void);
+
+/* Makes the calling thread's ocalls those of rank RANK. */
+void sim_transport_set_rank(int rank);
+
+/* Zeroes the message counts. */
+void sim_transport_reset_counts(void);
+
+/* Copies the bytes and messages sent from each rank to each other rank since
+ * the counts were last reset into BYTES and MESSAGES, which hold world_size *
+ * world_size entries indexed by source * world_size + dest. */
+void sim_transport_get_counts(uint64_t *bytes, uint64_t *messages);
+
+#endif /* distributed-sgx-sort/host/sim_transport.h */
@@ -0,0 +1,228 @@
+#include "host/spans.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "common/defs.h"
+#include "common/error.h"
+#include "common/span.h"
+#include "host/error.h"
+
+/* A phase's time on one thread, or once summed, on one rank. */
+struct phase {
+    char path[SPAN_PATH_LEN];
+    uint32_t thread;
+    int rank;
+    double seconds;
+};
+
+static int comp_double(const void *a_, const void *b_) {
+    const double *a = a_;
+    const double *b = b_;
+    return (*a > *b) - (*a < *b);
+}
+
+/* Returns the index of PATH on THREAD in PHASES, adding it with 0 seconds if
+ * it is not there yet. */
+static size_t find_phase(struct phase *phases, size_t *num_phases,
+        const char *path, uint32_t thread) {
+    for (size_t i = 0; i < *num_phases; i++) {
+        if (phases[i].thread == thread && !strcmp(phases[i].path, path)) {
+            return i;
+        }
+    }
+    snprintf(phases[*num_phases].path, sizeof(phases[*num_phases].path), "%s",
+            path);
+    phases[*num_phases].thread = thread;
+    phases[*num_phases].seconds = 0;
+    return (*num_phases)++;
+}
+
+/* Sums the spans into this rank's time for each phase. Returns the number of
+ * phases written to PHASES, which has room for NUM_SPANS. */
+static size_t sum_phases(const struct span_record *spans, size_t num_spans,
+        struct phase *phases) {
+    size_t num_phases = 0;
+
+    char (*paths)[SPAN_PATH_LEN] = malloc(MAX(num_spans, 1) * sizeof(*paths));
+    struct phase *thread_phases =
+        malloc(MAX(num_spans, 1) * sizeof(*thread_phases));
+    if (!paths || !thread_phases) {
+        perror("malloc phases");
+        goto exit;
+    }
+
+    /* Total each phase on each thread. Spans are recorded in the order they
+     * began, so each span's parent comes before it and already has its
+     * path. */
+    size_t num_thread_phases = 0;
+    for (size_t i = 0; i < num_spans; i++) {
+        if (spans[i].parent == SPAN_NONE || spans[i].parent >= i) {
+            snprintf(paths[i], sizeof(paths[i]), "%s", spans[i].name);
+        } else {
+            snprintf(paths[i], sizeof(paths[i]), "%s/%s",
+                    paths[spans[i].parent], spans[i].name);
+        }
+        if (!spans[i].end_ns) {
+            continue;
+        }
+
+        size_t index =
+            find_phase(thread_phases, &num_thread_phases, paths[i],
+                    spans[i].thread);
+        thread_phases[index].seconds +=
+            (double) (spans[i].end_ns - spans[i].start_ns) / 1000000000;
+    }
+
+    /* Take each phase's longest total on any thread. */
+    for (size_t i = 0; i < num_thread_phases; i++) {
+        size_t index =
+            find_phase(phases, &num_phases, thread_phases[i].path, 0);
+        phases[index].seconds =
+            MAX(phases[index].seconds, thread_phases[i].seconds);
+    }
+
+exit:
+    free(thread_phases);
+    free(paths);
+    return num_phases;
+}
+
+int spans_gather(const struct span_record *spans, size_t num_spans,
+        struct phase_times *times) {
+    int world_rank;
+    int world_size;
+    struct phase *all_phases = NULL;
+    int *counts = NULL;
+    int *displs = NULL;
+    int ret;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    times->num_phases = 0;
+    times->world_size = world_size;
+    times->paths = NULL;
+    times->seconds = NULL;
+
+    struct phase *phases = malloc(MAX(num_spans, 1) * sizeof(*phases));
+    if (!phases) {
+        perror("malloc phases");
+        ret = -1;
+        goto exit;
+    }
+    size_t num_phases = sum_phases(spans, num_spans, phases);
+
+    /* Gather every rank's phases on rank 0. */
+    for (size_t i = 0; i < num_phases; i++) {
+        phases[i].rank = world_rank;
+    }
+    int bytes = num_phases * sizeof(*phases);
+    if (world_rank == 0) {
+        counts = malloc(world_size * sizeof(*counts));
+        displs = malloc(world_size * sizeof(*displs));
+        if (!counts || !displs) {
+            perror("malloc phase counts");
+            ret = -1;
+            goto exit_free_phases;
+        }
+    }
+    ret = MPI_Gather(&bytes, 1, MPI_INT, counts, 1, MPI_INT, 0,
+            MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Gather");
+        goto exit_free_phases;
+    }
+    size_t total_phases = 0;
+    if (world_rank == 0) {
+        for (int i = 0; i < world_size; i++) {
+            displs[i] = total_phases * sizeof(*phases);
+            total_phases += counts[i] / sizeof(*phases);
+        }
+        all_phases = malloc(MAX(total_phases, 1) * sizeof(*all_phases));
+        if (!all_phases) {
+            perror("malloc all phases");
+            ret = -1;
+            goto exit_free_phases;
+        }
+    }
+    ret = MPI_Gatherv(phases, bytes, MPI_BYTE, all_phases, counts, displs,
+            MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Gatherv");
+        goto exit_free_phases;
+    }
+
+    if (world_rank != 0) {
+        goto exit_free_phases;
+    }
+
+    /* Lay the phases out as a table of ranks, in the order they first
+     * appear. */
+    times->paths = malloc(MAX(total_phases, 1) * sizeof(*times->paths));
+    times->seconds =
+        malloc(MAX(total_phases, 1) * world_size * sizeof(*times->seconds));
+    if (!times->paths || !times->seconds) {
+        perror("malloc phase times");
+        spans_free(times);
+        ret = -1;
+        goto exit_free_phases;
+    }
+    for (size_t i = 0; i < total_phases; i++) {
+        size_t index;
+        for (index = 0; index < times->num_phases; index++) {
+            if (!strcmp(times->paths[index], all_phases[i].path)) {
+                break;
+            }
+        }
+        if (index == times->num_phases) {
+            memcpy(times->paths[index], all_phases[i].path,
+                    sizeof(times->paths[index]));
+            for (int rank = 0; rank < world_size; rank++) {
+                times->seconds[index * world_size + rank] = -1;
+            }
+            times->num_phases++;
+        }
+        times->seconds[index * world_size + all_phases[i].rank] =
+            all_phases[i].seconds;
+    }
+
+    ret = 0;
+
+exit_free_phases:
+    free(all_phases);
+    free(displs);
+    free(counts);
+    free(phases);
+exit:
+    return ret;
+}
+
+void spans_print(const struct phase_times *times) {
+    double seconds[MAX(times->world_size, 1)];
+
+    for (size_t i = 0; i < times->num_phases; i++) {
+        size_t num_seconds = 0;
+        for (int rank = 0; rank < times->world_size; rank++) {
+            if (times->seconds[i * times->world_size + rank] >= 0) {
+                seconds[num_seconds] =
+                    times->seconds[i * times->world_size + rank];
+                num_seconds++;
+            }
+        }
+        qsort(seconds, num_seconds, sizeof(*seconds), comp_double);
+        double median =
+            (seconds[(num_seconds - 1) / 2] + seconds[num_seconds / 2]) / 2;
+        printf("%-17s: %f (min %f, max %f)\n", times->paths[i], median,
+                seconds[0], seconds[num_seconds - 1]);
+    }
+}
+
+void spans_free(struct phase_times *times) {
+    free(times->seconds);
+    free(times->paths);
+    times->num_phases = 0;
+    times->paths = NULL;
+    times->seconds = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_SPANS_H
+#define DISTRIBUTED_SGX_SORT_HOST_SPANS_H
+
+#include <stddef.h>
+#include "common/span.h"
+
+/* The longest phase path, including the terminating null. */
+#define SPAN_PATH_LEN 64
+
+/* The time each phase took on each rank. A nested phase is named by its path,
+ * such as "shuffle/assign_ids", and a rank's time for a phase is its longest
+ * total on any one thread. */
+struct phase_times {
+    size_t num_phases;
+    int world_size;
+
+    /* The phases' paths, in the order they first appear. */
+    char (*paths)[SPAN_PATH_LEN];
+
+    /* SECONDS[I * WORLD_SIZE + RANK] is the time phase I took on RANK, or
+     * negative if RANK did not run it. */
+    double *seconds;
+};
+
+/* Gathers the phases of the NUM_SPANS spans each rank recorded into TIMES on
+ * rank 0. Every rank must call this, and TIMES is empty on the other ranks. */
+int spans_gather(const struct span_record *spans, size_t num_spans,
+        struct phase_times *times);
+
+/* Prints one "<phase> : <median> (min <min>, max <max>)" line per phase, over
+ * the ranks that ran it. */
+void spans_print(const struct phase_times *times);
+
+void spans_free(struct phase_times *times);
+
+#endif /* distributed-sgx-sort/host/spans.h */
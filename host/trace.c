@@ -0,0 +1,205 @@
+#include "host/trace.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <mpi.h>
+#include "common/error.h"
+#include "common/trace.h"
+#include "host/error.h"
+
+/* The number of round trips to rank 0 each rank times, keeping the
+ * shortest, whose midpoint is the least skewed by delays on either leg. */
+#define CLOCK_SYNC_ROUNDS 8
+
+#define CLOCK_SYNC_MPI_TAG 0
+
+static FILE *file;
+static int rank;
+
+/* Added to enclave times to put them on rank 0's host clock, relative to when
+ * rank 0 opened its file. */
+static int64_t time_offset_ns;
+
+static const char *const event_names[] = {
+    [TRACE_TASK] = "task",
+    [TRACE_SEND] = "send",
+    [TRACE_RECV] = "recv",
+    [TRACE_ISEND] = "isend",
+    [TRACE_IRECV] = "irecv",
+    [TRACE_WAIT] = "wait",
+    [TRACE_WAITANY] = "waitany",
+    [TRACE_ENCRYPT] = "encrypt",
+    [TRACE_DECRYPT] = "decrypt",
+};
+
+static const char *const event_categories[] = {
+    [TRACE_TASK] = "compute",
+    [TRACE_SEND] = "comm",
+    [TRACE_RECV] = "comm",
+    [TRACE_ISEND] = "comm",
+    [TRACE_IRECV] = "comm",
+    [TRACE_WAIT] = "comm",
+    [TRACE_WAITANY] = "comm",
+    [TRACE_ENCRYPT] = "crypto",
+    [TRACE_DECRYPT] = "crypto",
+};
+
+uint64_t trace_time_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    }
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/* Sets *OFFSET_NS to the offset of rank 0's host clock from this rank's,
+ * estimated from the round trip to rank 0 with the least delay. Rank 0 answers
+ * each other rank's round trips with its time, one rank after another. */
+static int sync_clock(int world_rank, int world_size, int64_t *offset_ns) {
+    int ret;
+
+    *offset_ns = 0;
+
+    if (world_rank == 0) {
+        for (int i = 1; i < world_size; i++) {
+            for (size_t j = 0; j < CLOCK_SYNC_ROUNDS; j++) {
+                uint64_t time;
+                ret = MPI_Recv(&time, 1, MPI_UINT64_T, i, CLOCK_SYNC_MPI_TAG,
+                        MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                if (ret) {
+                    handle_mpi_error(ret, "MPI_Recv");
+                    goto exit;
+                }
+                time = trace_time_ns();
+                ret = MPI_Send(&time, 1, MPI_UINT64_T, i, CLOCK_SYNC_MPI_TAG,
+                        MPI_COMM_WORLD);
+                if (ret) {
+                    handle_mpi_error(ret, "MPI_Send");
+                    goto exit;
+                }
+            }
+        }
+    } else {
+        uint64_t best_round_trip = UINT64_MAX;
+        for (size_t j = 0; j < CLOCK_SYNC_ROUNDS; j++) {
+            uint64_t start = trace_time_ns();
+            uint64_t time = start;
+            ret = MPI_Send(&time, 1, MPI_UINT64_T, 0, CLOCK_SYNC_MPI_TAG,
+                    MPI_COMM_WORLD);
+            if (ret) {
+                handle_mpi_error(ret, "MPI_Send");
+                goto exit;
+            }
+            ret = MPI_Recv(&time, 1, MPI_UINT64_T, 0, CLOCK_SYNC_MPI_TAG,
+                    MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if (ret) {
+                handle_mpi_error(ret, "MPI_Recv");
+                goto exit;
+            }
+            uint64_t end = trace_time_ns();
+
+            if (end - start < best_round_trip) {
+                best_round_trip = end - start;
+                *offset_ns =
+                    (int64_t) (time - (start + (end - start) / 2));
+            }
+        }
+    }
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+int trace_open(const char *path, int world_rank, int64_t enclave_offset_ns) {
+    int world_size;
+    int ret;
+
+    ret = MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Comm_size");
+        goto exit;
+    }
+
+    int64_t clock_offset_ns;
+    ret = sync_clock(world_rank, world_size, &clock_offset_ns);
+    if (ret) {
+        goto exit;
+    }
+
+    /* Start the timeline at 0 at the time rank 0 opens its file. */
+    uint64_t epoch_ns = trace_time_ns();
+    ret = MPI_Bcast(&epoch_ns, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (ret) {
+        handle_mpi_error(ret, "MPI_Bcast");
+        goto exit;
+    }
+    time_offset_ns =
+        enclave_offset_ns + clock_offset_ns - (int64_t) epoch_ns;
+
+    char path_buf[4096];
+    snprintf(path_buf, sizeof(path_buf), path, world_rank);
+    file = fopen(path_buf, "w");
+    if (!file) {
+        handle_error_string("Error opening %s", path_buf);
+        ret = -1;
+        goto exit;
+    }
+    rank = world_rank;
+
+    fprintf(file,
+            "{\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"rank %d\"}}",
+            rank, rank);
+
+exit:
+    return ret;
+}
+
+int trace_write(const struct trace_event *events, size_t num_events) {
+    for (size_t i = 0; i < num_events; i++) {
+        const struct trace_event *event = &events[i];
+        if (event->type >= sizeof(event_names) / sizeof(*event_names)) {
+            handle_error_string("Invalid trace event type %u", event->type);
+            return -1;
+        }
+
+        double start_us =
+            (double) ((int64_t) event->start_ns + time_offset_ns) / 1000;
+        double duration_us =
+            (double) (event->end_ns - event->start_ns) / 1000;
+        fprintf(file,
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                    "\"args\":{\"peer\":%d,\"tag\":%d,\"bytes\":%" PRIu64 "}}",
+                event_names[event->type], event_categories[event->type],
+                start_us, duration_us, rank, event->thread, event->peer,
+                event->tag, event->bytes);
+    }
+
+    if (ferror(file)) {
+        handle_error_string("Error writing trace");
+        return -1;
+    }
+    return 0;
+}
+
+int trace_close(void) {
+    int ret = 0;
+
+    fputs("\n]}\n", file);
+    if (ferror(file)) {
+        handle_error_string("Error writing trace");
+        ret = -1;
+    }
+    if (fclose(file)) {
+        perror("fclose trace");
+        ret = -1;
+    }
+    file = NULL;
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef DISTRIBUTED_SGX_SORT_HOST_TRACE_H
+#define DISTRIBUTED_SGX_SORT_HOST_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common/trace.h"
+
+/* Returns the host's monotonic time in nanoseconds, for relating the
+ * enclave's clock to the host's. */
+uint64_t trace_time_ns(void);
+
+/* Opens this rank's timeline file, in the Chrome trace event format that
+ * chrome://tracing and Perfetto load. %d in PATH is replaced by the rank.
+ * ENCLAVE_OFFSET_NS is added to the enclave's event times to put them on this
+ * rank's host clock. Every rank must call this, since it also measures the
+ * offset of each rank's host clock from rank 0's, so that the ranks' files
+ * line up when loaded together. */
+int trace_open(const char *path, int world_rank, int64_t enclave_offset_ns);
+
+/* Appends NUM_EVENTS events collected from the enclave to the file. */
+int trace_write(const struct trace_event *events, size_t num_events);
+
+/* Finishes and closes the file. */
+int trace_close(void);
+
+#endif /* distributed-sgx-sort/host/trace.h */
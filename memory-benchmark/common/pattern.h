@@ -0,0 +1,34 @@
+#ifndef DISTRIBUTED_SGX_SORT_MEMORY_BENCHMARK_COMMON_PATTERN_H
+#define DISTRIBUTED_SGX_SORT_MEMORY_BENCHMARK_COMMON_PATTERN_H
+
+#include <stdint.h>
+
+/* The ways the benchmark walks the array. Each thread works on its own
+ * contiguous share of the array, except that random accesses range over the
+ * whole array. */
+enum pattern {
+    /* Read or write every 8-byte word in order. */
+    PATTERN_SEQ_READ,
+    PATTERN_SEQ_WRITE,
+
+    /* Read or write one word of a random cache line at a time. */
+    PATTERN_RAND_READ,
+    PATTERN_RAND_WRITE,
+
+    /* Follow a random cycle of pointers through cache lines spread over the
+     * share, so that each load waits for the one before. */
+    PATTERN_CHASE,
+
+    /* Read one word per cache line, visiting the lines STRIDE bytes apart and
+     * then moving over by a line, until every line is read. */
+    PATTERN_STRIDE,
+};
+
+/* What one run of a pattern did, summed over threads. BYTES counts whole
+ * cache lines touched. */
+struct pattern_counts {
+    uint64_t accesses;
+    uint64_t bytes;
+};
+
+#endif /* distributed-sgx-sort/memory-benchmark/common/pattern.h */
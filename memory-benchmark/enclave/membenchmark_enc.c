@@ -1,43 +1,242 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "common/pattern.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 #include "enclave/membenchmark_t.h"
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+#define LINE_SIZE 64
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Arrays smaller than this are swept repeatedly, so that each run moves at
+ * least this many bytes and takes long enough to time. */
+#define MIN_SWEEP_BYTES (1lu << 28)
+
+/* Accesses per thread of the random patterns and steps per thread of the
+ * pointer chase. These do not grow with the array, or runs far past the EPC
+ * would take hours. */
+#define RAND_ACCESSES (1lu << 22)
+#define CHASE_STEPS (1lu << 20)
+
+/* The most cache lines in each thread's pointer cycle. Larger shares are
+ * sampled evenly, which still touches a new page on every step. */
+#define CHASE_MAX_LINES (1lu << 20)
 
 static char *_arr;
 static size_t _len;
 static size_t _num_threads;
+static enum pattern _pattern;
+static size_t _stride;
 static volatile size_t threads_finished;
 static volatile bool ready;
 
-static void access_array(char *arr, size_t len, size_t num_threads,
-        size_t thread_idx) {
-    for (size_t i = len * thread_idx / num_threads;
-            i < len * (thread_idx + 1) / num_threads; i++) {
-        arr[i] += 1;
+/* Sums of what the threads did, and of the values they read, which keeps the
+ * compiler from dropping the reads. */
+static uint64_t total_accesses;
+static uint64_t total_bytes;
+static uint64_t sink;
+
+static uint64_t xorshift64star(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1d;
+}
+
+/* Returns a random number below N without a division. */
+static size_t rand_below(uint64_t *state, size_t n) {
+    return ((unsigned __int128) xorshift64star(state) * n) >> 64;
+}
+
+/* Thread THREAD_IDX's share of the array, in cache lines. */
+static size_t get_share_start(size_t thread_idx) {
+    return _len / LINE_SIZE * thread_idx / _num_threads;
+}
+
+/* The byte offset in a share of SHARE_LINES lines of the Kth of CHASE_LINES
+ * lines spread evenly over it. */
+static size_t get_line_offset(size_t share_lines, size_t chase_lines,
+        size_t k) {
+    return k * share_lines / chase_lines * LINE_SIZE;
+}
+
+/* Links CHASE_LINES lines spread over thread THREAD_IDX's share into a single
+ * random cycle with Sattolo's algorithm, each line holding a pointer to the
+ * next. */
+static void build_chase(size_t thread_idx) {
+    size_t start = get_share_start(thread_idx);
+    size_t share_lines = get_share_start(thread_idx + 1) - start;
+    size_t chase_lines = MIN(share_lines, CHASE_MAX_LINES);
+    char *share = _arr + start * LINE_SIZE;
+    uint64_t state = thread_idx + 1;
+
+    if (!chase_lines) {
+        return;
+    }
+
+    /* Shuffle line indices in place, then turn them into pointers. */
+    for (size_t k = 0; k < chase_lines; k++) {
+        *(uint64_t *) (share + get_line_offset(share_lines, chase_lines, k)) =
+            k;
+    }
+    for (size_t k = chase_lines - 1; k > 0; k--) {
+        size_t j = rand_below(&state, k);
+        uint64_t *a =
+            (uint64_t *) (share + get_line_offset(share_lines, chase_lines, k));
+        uint64_t *b =
+            (uint64_t *) (share + get_line_offset(share_lines, chase_lines, j));
+        uint64_t tmp = *a;
+        *a = *b;
+        *b = tmp;
+    }
+    for (size_t k = 0; k < chase_lines; k++) {
+        char *line = share + get_line_offset(share_lines, chase_lines, k);
+        *(char **) line =
+            share + get_line_offset(share_lines, chase_lines,
+                    *(uint64_t *) line);
     }
 }
 
-void ecall_thread_work(size_t thread_idx) {
-    while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {}
-    access_array(_arr, _len, _num_threads, thread_idx);
-    __atomic_fetch_add(&threads_finished, 1, __ATOMIC_RELEASE);
+static void access_array(size_t thread_idx) {
+    size_t start = get_share_start(thread_idx) * LINE_SIZE;
+    size_t end = get_share_start(thread_idx + 1) * LINE_SIZE;
+    size_t reps = MAX(MIN_SWEEP_BYTES / _len, 1);
+    uint64_t state = thread_idx + 1;
+    uint64_t accesses = 0;
+    uint64_t bytes = 0;
+    uint64_t sum = 0;
+
+    switch (_pattern) {
+        case PATTERN_SEQ_READ:
+            for (size_t r = 0; r < reps; r++) {
+                for (size_t i = start; i < end; i += sizeof(uint64_t)) {
+                    sum += *(volatile uint64_t *) (_arr + i);
+                }
+            }
+            accesses = (end - start) / sizeof(uint64_t) * reps;
+            bytes = (end - start) * reps;
+            break;
+
+        case PATTERN_SEQ_WRITE:
+            for (size_t r = 0; r < reps; r++) {
+                for (size_t i = start; i < end; i += sizeof(uint64_t)) {
+                    *(volatile uint64_t *) (_arr + i) = i;
+                }
+            }
+            accesses = (end - start) / sizeof(uint64_t) * reps;
+            bytes = (end - start) * reps;
+            break;
+
+        case PATTERN_RAND_READ: {
+            size_t lines = _len / LINE_SIZE;
+            for (size_t i = 0; i < RAND_ACCESSES; i++) {
+                size_t line = rand_below(&state, lines);
+                sum += *(volatile uint64_t *) (_arr + line * LINE_SIZE);
+            }
+            accesses = RAND_ACCESSES;
+            bytes = RAND_ACCESSES * LINE_SIZE;
+            break;
+        }
+
+        case PATTERN_RAND_WRITE: {
+            size_t lines = _len / LINE_SIZE;
+            for (size_t i = 0; i < RAND_ACCESSES; i++) {
+                size_t line = rand_below(&state, lines);
+                *(volatile uint64_t *) (_arr + line * LINE_SIZE) = i;
+            }
+            accesses = RAND_ACCESSES;
+            bytes = RAND_ACCESSES * LINE_SIZE;
+            break;
+        }
+
+        case PATTERN_CHASE: {
+            char *p = _arr + start;
+            for (size_t i = 0; i < CHASE_STEPS; i++) {
+                p = *(char *volatile *) p;
+            }
+            sum = (uintptr_t) p;
+            accesses = CHASE_STEPS;
+            bytes = CHASE_STEPS * LINE_SIZE;
+            break;
+        }
+
+        case PATTERN_STRIDE:
+            for (size_t r = 0; r < reps; r++) {
+                for (size_t offset = 0; offset < _stride;
+                        offset += LINE_SIZE) {
+                    for (size_t i = start + offset; i < end; i += _stride) {
+                        sum += *(volatile uint64_t *) (_arr + i);
+                    }
+                }
+            }
+            accesses = (end - start) / LINE_SIZE * reps;
+            bytes = (end - start) * reps;
+            break;
+    }
+
+    __atomic_fetch_add(&total_accesses, accesses, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sink, sum, __ATOMIC_RELAXED);
 }
 
-int ecall_benchmark(size_t alloc_size, size_t num_threads) {
+/* Allocates and zeroes an array of ALLOC_SIZE bytes, a multiple of the cache
+ * line size, so that its pages are in place before they are timed. Returns 1
+ * if there is not enough memory. */
+int ecall_benchmark_alloc(size_t alloc_size) {
     int ret;
 
     char *arr = malloc(alloc_size);
     if (!arr) {
-        ret = -1;
-        perror("malloc arr");
+        ret = 1;
         goto exit;
     }
+    memset(arr, 0, alloc_size);
 
     _arr = arr;
     _len = alloc_size;
+
+    ret = 0;
+
+exit:
+    return ret;
+}
+
+/* Sets up the next run of PATTERN with NUM_THREADS threads. STRIDE, a
+ * multiple of the cache line size, is only used by PATTERN_STRIDE. */
+void ecall_benchmark_prepare(enum pattern pattern, size_t stride,
+        size_t num_threads) {
+    _pattern = pattern;
+    _stride = stride;
     _num_threads = num_threads;
+    if (pattern == PATTERN_CHASE) {
+        for (size_t i = 0; i < num_threads; i++) {
+            build_chase(i);
+        }
+    }
+}
+
+void ecall_benchmark_free(void) {
+    free(_arr);
+    _arr = NULL;
+}
+
+void ecall_thread_work(size_t thread_idx) {
+    while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {}
+    access_array(thread_idx);
+    __atomic_fetch_add(&threads_finished, 1, __ATOMIC_RELEASE);
+}
+
+void ecall_benchmark(size_t num_threads, struct pattern_counts *counts) {
     threads_finished = 0;
+    total_accesses = 0;
+    total_bytes = 0;
     __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
 
     ecall_thread_work(0);
@@ -45,9 +244,6 @@ int ecall_benchmark(size_t alloc_size, size_t num_threads) {
     while (__atomic_load_n(&threads_finished, __ATOMIC_ACQUIRE) < num_threads) {}
     __atomic_store_n(&ready, false, __ATOMIC_RELEASE);
 
-    ret = 0;
-
-    free(arr);
-exit:
-    return ret;
+    counts->accesses = total_accesses;
+    counts->bytes = total_bytes;
 }
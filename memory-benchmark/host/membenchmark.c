@@ -1,46 +1,268 @@
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "common/pattern.h"
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 #include <openenclave/host.h>
 #include "host/membenchmark_u.h"
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+
+/* Sizes from which sequential reads have left the caches, so that the EPC
+ * cliff is measured against memory bandwidth rather than cache bandwidth. */
+#define CLIFF_MIN_SIZE (1lu << 26)
+
+/* How much sequential reads must slow down from one size to the next to count
+ * as the EPC cliff. Leaving the last-level cache costs much less. */
+#define CLIFF_SLOWDOWN 2
+
+#define MAX_SIZES 64
+
+struct test {
+    const char *name;
+    enum pattern pattern;
+    size_t stride;
+};
 
 struct do_thread_work_args {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     oe_enclave_t *enclave;
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
     size_t thread_idx;
 };
 
-void *do_thread_work(void *args_) {
+static void *do_thread_work(void *args_) {
     struct do_thread_work_args *args = args_;
-    oe_enclave_t *enclave = args->enclave;
     size_t thread_idx = args->thread_idx;
     void *ret;
 
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    oe_enclave_t *enclave = args->enclave;
     oe_result_t result = ecall_thread_work(enclave, thread_idx);
     if (result != OE_OK) {
         fprintf(stderr, "ecall_thread_work: %s\n", oe_result_str(result));
         ret = (void *) -1;
         goto exit;
     }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_thread_work(thread_idx);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
     ret = NULL;
 
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
 exit:
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    return ret;
+}
+
+static double get_seconds(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    }
+    return ts.tv_sec + (double) ts.tv_nsec / 1000000000;
+}
+
+static void usage(char **argv) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    fprintf(stderr, "Usage: %s [options] <enclave image>\n", argv[0]);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -t, --threads <num>       Sweep thread counts in powers of two up to\n");
+    fprintf(stderr, "                            <num> (default 8)\n");
+    fprintf(stderr, "  --min-size <bytes>        Start the size sweep at <bytes> (default 1 MiB)\n");
+    fprintf(stderr, "  --max-size <bytes>        End the size sweep at <bytes>, or when memory\n");
+    fprintf(stderr, "                            runs out (default 1 TiB)\n");
+    fprintf(stderr, "  --bucket-bytes <bytes>    Stride of the bucket-sized strided reads\n");
+    fprintf(stderr, "                            (default 65536, 512 elements of 128 bytes)\n");
+    fprintf(stderr, "  -o, --output <file>       Write the results to <file> as CSV\n");
+    fprintf(stderr, "  -p, --params <file>       Write the EPC cliff to the sort parameters\n");
+    fprintf(stderr, "                            file <file>, keeping its other lines\n");
+}
+
+/* Replaces the epc_cliff_bytes and epc_cliff_slowdown lines of the sort
+ * parameters file at PATH, creating it if it does not exist. */
+static int write_params(const char *path, size_t cliff_bytes,
+        size_t cliff_slowdown) {
+    char *contents = NULL;
+    size_t contents_len = 0;
+    int ret;
+
+    FILE *file = fopen(path, "r");
+    if (file) {
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "epc_cliff_", strlen("epc_cliff_")) == 0) {
+                continue;
+            }
+            size_t line_len = strlen(line);
+            char *new_contents = realloc(contents, contents_len + line_len);
+            if (!new_contents) {
+                perror("realloc params contents");
+                ret = -1;
+                goto exit_close_file;
+            }
+            contents = new_contents;
+            memcpy(contents + contents_len, line, line_len);
+            contents_len += line_len;
+        }
+        if (ferror(file)) {
+            perror("read params file");
+            ret = -1;
+            goto exit_close_file;
+        }
+        fclose(file);
+
+        /* End the last line we keep. */
+        if (contents_len && contents[contents_len - 1] != '\n') {
+            char *new_contents = realloc(contents, contents_len + 1);
+            if (!new_contents) {
+                perror("realloc params contents");
+                ret = -1;
+                goto exit;
+            }
+            contents = new_contents;
+            contents[contents_len++] = '\n';
+        }
+    } else if (errno != ENOENT) {
+        perror("fopen params file");
+        ret = -1;
+        goto exit;
+    }
+
+    file = fopen(path, "w");
+    if (!file) {
+        perror("fopen params file");
+        ret = -1;
+        goto exit;
+    }
+    fwrite(contents, 1, contents_len, file);
+    fprintf(file, "epc_cliff_bytes %zu\n", cliff_bytes);
+    fprintf(file, "epc_cliff_slowdown %zu\n", cliff_slowdown);
+    if (fclose(file)) {
+        perror("write params file");
+        ret = -1;
+        goto exit;
+    }
+
+    ret = 0;
+    goto exit;
+
+exit_close_file:
+    fclose(file);
+exit:
+    free(contents);
     return ret;
 }
 
 int main(int argc, char **argv) {
     int ret;
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <enclave image>\n", argv[0]);
+    /* Read arguments. */
+
+    struct option long_options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "min-size", required_argument, NULL, 'm' },
+        { "max-size", required_argument, NULL, 'M' },
+        { "bucket-bytes", required_argument, NULL, 'b' },
+        { "output", required_argument, NULL, 'o' },
+        { "params", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 },
+    };
+    size_t max_threads = 8;
+    size_t min_size = 1lu << 20;
+    size_t max_size = 1lu << 40;
+    size_t bucket_bytes = 512 * 128;
+    const char *output_path = NULL;
+    const char *params_path = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:o:p:", long_options, NULL))
+            != -1) {
+        size_t *value = NULL;
+        switch (opt) {
+            case 't':
+                value = &max_threads;
+                break;
+            case 'm':
+                value = &min_size;
+                break;
+            case 'M':
+                value = &max_size;
+                break;
+            case 'b':
+                value = &bucket_bytes;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'p':
+                params_path = optarg;
+                break;
+            default:
+                usage(argv);
+                ret = 1;
+                goto exit;
+        }
+        if (value) {
+            errno = 0;
+            *value = strtoull(optarg, NULL, 10);
+            if (errno || !*value) {
+                fprintf(stderr, "Invalid size or count: %s\n", optarg);
+                ret = 1;
+                goto exit;
+            }
+        }
+    }
+    if (bucket_bytes % 64 || min_size % 64) {
+        fprintf(stderr, "Sizes must be multiples of the 64-byte line size\n");
+        ret = 1;
+        goto exit;
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    if (argc < optind + 1) {
+        usage(argv);
         ret = 1;
         goto exit;
     }
+    const char *enclave_path = argv[optind];
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
-    const char *enclave_path = argv[1];
+    const struct test tests[] = {
+        { "seq_read", PATTERN_SEQ_READ, 0 },
+        { "seq_write", PATTERN_SEQ_WRITE, 0 },
+        { "rand_read", PATTERN_RAND_READ, 0 },
+        { "rand_write", PATTERN_RAND_WRITE, 0 },
+        { "chase", PATTERN_CHASE, 0 },
+        { "stride_128", PATTERN_STRIDE, 128 },
+        { "stride_bucket", PATTERN_STRIDE, bucket_bytes },
+    };
 
+    FILE *output = NULL;
+    if (output_path) {
+        output = fopen(output_path, "w");
+        if (!output) {
+            perror("fopen output");
+            ret = 1;
+            goto exit;
+        }
+        fprintf(output, "pattern,size,num_threads,seconds,accesses,bytes,"
+                "ns_per_access,gb_per_s\n");
+    }
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     oe_result_t result;
 
     /* Allocate enclave. */
@@ -63,74 +285,191 @@ int main(int argc, char **argv) {
         fprintf(stderr, "oe_create_membenchmark_enclave: %s\n",
                 oe_result_str(result));
         ret = 1;
-        goto exit;
+        goto exit_close_output;
     }
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
-    /* Benchmark. */
-    for (size_t size = 1lu << 20; size <= 1lu << 40; size *= 2) {
-        for (size_t num_threads = 1; num_threads <= 8; num_threads *= 2) {
-            /* Spawn threads. */
-            pthread_t threads[num_threads];
-            struct do_thread_work_args args[num_threads];
-            for (size_t i = 1; i < num_threads; i++) {
-                args[i] = (struct do_thread_work_args) {
-                    .enclave = enclave,
-                    .thread_idx = i,
-                };
-                if (pthread_create(&threads[i], NULL, do_thread_work,
-                            &args[i])) {
-                    perror("pthread_create");
+    /* Benchmark. The sequential read bandwidth with the most threads at each
+     * size is kept to find the EPC cliff. */
+    size_t sizes[MAX_SIZES];
+    double seq_read_bandwidths[MAX_SIZES];
+    size_t num_sizes = 0;
+    for (size_t size = min_size; size <= max_size && num_sizes < MAX_SIZES;
+            size *= 2) {
+        int alloc_ret;
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_benchmark_alloc(enclave, &alloc_ret, size);
+        if (result != OE_OK) {
+            fprintf(stderr, "ecall_benchmark_alloc: %s\n",
+                    oe_result_str(result));
+            ret = 1;
+            goto exit_terminate_enclave;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        alloc_ret = ecall_benchmark_alloc(size);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        if (alloc_ret) {
+            printf("Stopping at size = %zu: out of memory\n", size);
+            break;
+        }
+
+        for (size_t t = 0; t < sizeof(tests) / sizeof(*tests); t++) {
+            for (size_t num_threads = 1; num_threads <= max_threads;
+                    num_threads *= 2) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+                result =
+                    ecall_benchmark_prepare(enclave, tests[t].pattern,
+                            tests[t].stride, num_threads);
+                if (result != OE_OK) {
+                    fprintf(stderr, "ecall_benchmark_prepare: %s\n",
+                            oe_result_str(result));
                     ret = 1;
-                    goto exit_terminate_enclave;
+                    goto exit_free_arr;
                 }
-            }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+                ecall_benchmark_prepare(tests[t].pattern, tests[t].stride,
+                        num_threads);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 
-            /* Start timer. */
-            clock_t start = clock();
+                /* Spawn threads. */
+                pthread_t threads[num_threads];
+                struct do_thread_work_args args[num_threads];
+                for (size_t i = 1; i < num_threads; i++) {
+                    args[i] = (struct do_thread_work_args) {
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+                        .enclave = enclave,
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+                        .thread_idx = i,
+                    };
+                    if (pthread_create(&threads[i], NULL, do_thread_work,
+                                &args[i])) {
+                        perror("pthread_create");
+                        ret = 1;
+                        goto exit_free_arr;
+                    }
+                }
 
-            /* Do benchmark. */
-            result = ecall_benchmark(enclave, &ret, size, num_threads);
-            if (result != OE_OK) {
-                fprintf(stderr, "ecall_benchmark: %s\n", oe_result_str(result));
-                ret = 1;
-                goto exit_terminate_enclave;
-            }
-            if (ret) {
-                fprintf(stderr, "ecall_benchmark: %d\n", ret);
-                goto exit_terminate_enclave;
-            }
+                /* Do benchmark. */
+                struct pattern_counts counts;
+                double start = get_seconds();
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+                result = ecall_benchmark(enclave, num_threads, &counts);
+                if (result != OE_OK) {
+                    fprintf(stderr, "ecall_benchmark: %s\n",
+                            oe_result_str(result));
+                    ret = 1;
+                    goto exit_free_arr;
+                }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+                ecall_benchmark(num_threads, &counts);
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+                double seconds = get_seconds() - start;
 
-            /* End timer and print time. */
-            clock_t end = clock();
-            printf("size = %zu; num_threads = %zu; time = %f\n", size,
-                    num_threads, (double) (end - start) / CLOCKS_PER_SEC);
+                /* Join threads. */
+                for (size_t i = 1; i < num_threads; i++) {
+                    void *thread_ret;
+                    if (pthread_join(threads[i], &thread_ret)) {
+                        perror("pthread_join");
+                        ret = 1;
+                        goto exit_free_arr;
+                    }
+                    if (thread_ret) {
+                        fprintf(stderr, "Thread returned %zd\n",
+                                (intptr_t) thread_ret);
+                        ret = 1;
+                        goto exit_free_arr;
+                    }
+                }
 
-            /* Join threads. */
-            for (size_t i = 1; i < num_threads; i++) {
-                void *thread_ret;
-                if (pthread_join(threads[i], &thread_ret)) {
-                    perror("pthread_join");
-                    ret = 1;
-                    goto exit_terminate_enclave;
+                /* Print results. The time per access is as seen by one
+                 * thread, which for the pointer chase is the latency. */
+                double ns_per_access =
+                    seconds * num_threads * 1e9 / counts.accesses;
+                double gb_per_s = counts.bytes / seconds / 1e9;
+                printf("pattern = %s; size = %zu; num_threads = %zu; "
+                        "time = %f; ns_per_access = %f; bandwidth = %f GB/s\n",
+                        tests[t].name, size, num_threads, seconds,
+                        ns_per_access, gb_per_s);
+                if (output) {
+                    fprintf(output, "%s,%zu,%zu,%f,%" PRIu64 ",%" PRIu64
+                            ",%f,%f\n",
+                            tests[t].name, size, num_threads, seconds,
+                            counts.accesses, counts.bytes, ns_per_access,
+                            gb_per_s);
                 }
-                if (thread_ret) {
-                    fprintf(stderr, "Thread returned %zd\n",
-                            (intptr_t) thread_ret);
-                    ret = 1;
-                    goto exit_terminate_enclave;
+                if (tests[t].pattern == PATTERN_SEQ_READ) {
+                    sizes[num_sizes] = size;
+                    seq_read_bandwidths[num_sizes] = gb_per_s;
                 }
             }
         }
+        num_sizes++;
+
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+        result = ecall_benchmark_free(enclave);
+        if (result != OE_OK) {
+            fprintf(stderr, "ecall_benchmark_free: %s\n",
+                    oe_result_str(result));
+            ret = 1;
+            goto exit_terminate_enclave;
+        }
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+        ecall_benchmark_free();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    }
+
+    /* Find the EPC cliff: the first size past the caches at which sequential
+     * reads get CLIFF_SLOWDOWN times slower than at the size before. The
+     * slowdown is measured at the largest size, where paging is steadiest. */
+    size_t cliff_bytes = 0;
+    size_t cliff_slowdown = 100;
+    for (size_t i = 1; i < num_sizes; i++) {
+        if (sizes[i - 1] >= CLIFF_MIN_SIZE
+                && seq_read_bandwidths[i] * CLIFF_SLOWDOWN
+                    < seq_read_bandwidths[i - 1]) {
+            cliff_bytes = sizes[i - 1];
+            cliff_slowdown =
+                seq_read_bandwidths[i - 1] * 100
+                    / seq_read_bandwidths[num_sizes - 1];
+            break;
+        }
+    }
+    if (cliff_bytes) {
+        printf("epc_cliff_bytes = %zu; epc_cliff_slowdown = %zu%%\n",
+                cliff_bytes, cliff_slowdown);
+    } else if (num_sizes) {
+        printf("No EPC cliff up to size = %zu\n", sizes[num_sizes - 1]);
+    }
+    if (params_path) {
+        ret = write_params(params_path, cliff_bytes, cliff_slowdown);
+        if (ret) {
+            ret = 1;
+            goto exit_terminate_enclave;
+        }
     }
 
     ret = 0;
+    goto exit_terminate_enclave;
 
     /* Cleanup. */
+exit_free_arr:
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
+    ecall_benchmark_free(enclave);
+#else /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    ecall_benchmark_free();
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
 exit_terminate_enclave:
+#ifndef DISTRIBUTED_SGX_SORT_HOSTONLY
     result = oe_terminate_enclave(enclave);
     if (result != OE_OK) {
         fprintf(stderr, "oe_terminate_enclave: %s\n", oe_result_str(result));
     }
+exit_close_output:
+#endif /* DISTRIBUTED_SGX_SORT_HOSTONLY */
+    if (output && fclose(output)) {
+        perror("write output");
+        ret = 1;
+    }
 exit:
     return ret;
 }
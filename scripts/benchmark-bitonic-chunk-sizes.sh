@@ -7,6 +7,7 @@ cd "$(dirname "$0")/.."
 . scripts/benchmark-common.sh
 
 BENCHMARK_DIR=benchmarks
+PARAMS_FILE=sort-params.txt
 
 mkdir -p "$BENCHMARK_DIR"
 
@@ -53,7 +54,7 @@ for e in 32 16 8 4 2; do
 
         (
             flock 9
-            sed -Ei "s/^#define (SWAP_CHUNK_SIZE) .*\$/#define \\1 $c/" enclave/bitonic.c
+            echo "bitonic_chunk_size $c" > "$PARAMS_FILE"
             set_sort_params_unlocked "$a" "$e" "$b" "$s" "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
         ) 9<.
 
@@ -63,7 +64,7 @@ for e in 32 16 8 4 2; do
             continue
         fi
 
-        cmd="$cmd_template $a $s $t $REPEAT"
+        cmd="$cmd_template --params $PARAMS_FILE $a $s $t $REPEAT"
         echo "Command: $cmd"
         $cmd | tee "$output_filename"
     done
@@ -7,6 +7,7 @@ cd "$(dirname "$0")/.."
 . scripts/benchmark-common.sh
 
 BENCHMARK_DIR=benchmarks
+PARAMS_FILE=sort-params.txt
 BUCKET_SIZE=512
 
 mkdir -p "$BENCHMARK_DIR"
@@ -50,7 +51,7 @@ for e in 32 16 8 4 2; do
 
         (
             flock 9
-            sed -Ei "s/^#define (SWAP_CHUNK_BUCKETS) .*\$/#define \\1 $c/" enclave/bucket.c
+            echo "bucket_swap_chunk_buckets $c" > "$PARAMS_FILE"
             set_sort_params_unlocked "$a" "$e" "$b" "$s" "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
         ) 9<.
 
@@ -60,7 +61,7 @@ for e in 32 16 8 4 2; do
             continue
         fi
 
-        cmd="$cmd_template $a $s $t $REPEAT"
+        cmd="$cmd_template --params $PARAMS_FILE $a $s $t $REPEAT"
         echo "Command: $cmd"
         $cmd | tee "$output_filename"
     done
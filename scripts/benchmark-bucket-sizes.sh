@@ -7,6 +7,7 @@ cd "$(dirname "$0")/.."
 . scripts/benchmark-common.sh
 
 BENCHMARK_DIR=benchmarks
+PARAMS_FILE=sort-params.txt
 BITONIC_CHUNK_SIZE=4096
 
 mkdir -p "$BENCHMARK_DIR"
@@ -50,7 +51,7 @@ for e in 16 4 1; do
 
         (
             flock 9
-            sed -Ei "s/^#define (BUCKET_SIZE) .*\$/#define \\1 $z/" enclave/bucket.h
+            echo "bucket_size $z" > "$PARAMS_FILE"
             set_sort_params_unlocked "$a" "$e" "$b" "$s" "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
         ) 9<.
 
@@ -60,7 +61,7 @@ for e in 16 4 1; do
             continue
         fi
 
-        cmd="$cmd_template $a $s $t $REPEAT"
+        cmd="$cmd_template --params $PARAMS_FILE $a $s $t $REPEAT"
         echo "Command: $cmd"
         $cmd | tee "$output_filename"
     done
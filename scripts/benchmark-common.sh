@@ -74,6 +74,7 @@ set_sort_params_unlocked () {
     num_elems=$4
     first=$5
     last=$6
+    num_threads=${7:-8}
 
     # Rewrite ELEM_SIZE.
     find . -name '*.[ch]' -print0 | xargs -0 sed -Ei "s/^#define (ELEM_SIZE) .*\$/#define \\1 $elem_size/"
@@ -84,8 +85,13 @@ set_sort_params_unlocked () {
     if [ $num_heap_pages -lt 1048576 ]; then
         num_heap_pages=1048576
     fi
+    # Each thread carries its own RNG pool and exchange buffers, about 4 MiB.
+    num_heap_pages=$(( num_heap_pages + num_threads * 1024 ))
     sed -Ei "s/^(NumHeapPages)=[0-9]+\$/\1=$num_heap_pages/" enclave/parallel.conf
 
+    # Reconfigure NumTCS, leaving room for communication threads.
+    sed -Ei "s/^(NumTCS)=[0-9]+\$/\1=$(( num_threads + 2 ))/" enclave/parallel.conf
+
     # Make and sync.
     make -j >/dev/null
     ./scripts/sync.sh "$first" "$last" >/dev/null
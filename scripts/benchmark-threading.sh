@@ -10,6 +10,8 @@ BENCHMARK_DIR=benchmarks
 BITONIC_CHUNK_SIZE=4096
 BUCKET_SIZE=512
 MAX_MEM_SIZE=$(( 1 << 35 ))
+THREADS='1 2 4 8 16 32 48 64'
+MAX_THREADS=64
 
 mkdir -p "$BENCHMARK_DIR"
 
@@ -31,7 +33,7 @@ done
 hosts="${hosts%,}"
 cmd_template="mpiexec -hosts $hosts ./host/parallel ./enclave/parallel_enc.signed"
 
-set_sort_params bitonic "$e" "$b" 4096 "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
+set_sort_params bitonic "$e" "$b" 4096 "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))" "$MAX_THREADS"
 warm_up="$cmd_template bitonic 4096 1"
 echo "Warming up: $warm_up"
 $warm_up
@@ -43,9 +45,10 @@ for a in bitonic bucket orshuffle; do
             continue
         fi
 
-        set_sort_params "$a" "$e" "$b" "$s" "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
+        set_sort_params "$a" "$e" "$b" "$s" "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))" "$MAX_THREADS"
 
-        for t in 1 2 4 8 16 32 48; do
+        output_filenames=
+        for t in $THREADS; do
             if [ "$a" = 'bitonic' ]; then
                 output_filename="$BENCHMARK_DIR/$a-sgx2-enclaves$e-chunked$BITONIC_CHUNK_SIZE-elemsize$b-size$s-threads$t.txt"
             elif [ "$a" = 'bucket' ]; then
@@ -59,6 +62,8 @@ for a in bitonic bucket orshuffle; do
                 exit -1
             fi
 
+            output_filenames="$output_filenames $output_filename"
+
             if [ -f "$output_filename" ]; then
                 echo "Output file $output_filename already exists; skipping"
                 continue
@@ -68,5 +73,9 @@ for a in bitonic bucket orshuffle; do
             echo "Command: $cmd"
             $cmd | tee "$output_filename"
         done
+
+        # Per-phase scaling table, marking where each phase stops scaling.
+        ./scripts/summarize-threading.sh $output_filenames \
+            | tee "$BENCHMARK_DIR/$a-sgx2-enclaves$e-elemsize$b-size$s-threading-summary.txt"
     done
 done
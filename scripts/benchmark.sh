@@ -37,7 +37,7 @@ for e in 32 16 8 4 2 1; do
         i=$(( i + 1 ))
     done
     hosts="${hosts%,}"
-    cmd_template="mpiexec -hosts $hosts ./host/parallel ./enclave/parallel_enc.signed"
+    cmd_template="mpiexec -hosts $hosts ./host/parallel --json $BENCHMARK_DIR/results.jsonl ./enclave/parallel_enc.signed"
 
     set_sort_params bitonic "$e" "$b" 4096 "$ENCLAVE_OFFSET" "$(( e + ENCLAVE_OFFSET - 1 ))"
     warm_up="$cmd_template bitonic 4096 1"
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# Compares two kernel benchmark outputs, as written by the kbench host's
+# --output option, one "kernel ns_per_op" line per kernel. For each kernel in
+# both files, prints the baseline and new time per operation and the change,
+# and marks as a regression any kernel that got slower by more than THRESHOLD
+# percent (10 by default). Exits with status 1 if any kernel regressed.
+
+set -eu
+
+if [ "$#" -lt 2 ] || [ "$#" -gt 3 ]; then
+    echo "Usage: $0 baseline_file new_file [threshold_percent]" >&2
+    exit 2
+fi
+
+baseline=$1
+new=$2
+threshold=${3:-10}
+
+awk -v threshold="$threshold" '
+    FNR == NR {
+        base[$1] = $2
+        next
+    }
+    {
+        seen[$1] = 1
+        if (!($1 in base)) {
+            printf "%-23s %14s %14.3f %9s  new\n", $1, "-", $2, "-"
+            next
+        }
+        change = base[$1] > 0 ? ($2 - base[$1]) * 100 / base[$1] : 0
+        mark = ""
+        if (change > threshold) {
+            mark = "  REGRESSION"
+            regressed++
+        }
+        printf "%-23s %14.3f %14.3f %+8.1f%%%s\n", $1, base[$1], $2, change,
+            mark
+    }
+    END {
+        for (name in base) {
+            if (!(name in seen)) {
+                printf "%-23s %14.3f %14s %9s  missing\n", name, base[name],
+                    "-", "-"
+            }
+        }
+        if (regressed) {
+            printf "%d kernel(s) regressed by more than %s%%\n", regressed,
+                threshold
+            exit 1
+        }
+    }
+' "$baseline" "$new"
@@ -0,0 +1,92 @@
+#!/bin/sh
+
+# Summarizes thread-scaling benchmark outputs, as produced by
+# benchmark-threading.sh. Each argument is an output file whose name ends in
+# -threadsT.txt; files that differ only in T are grouped into one table.
+#
+# For each phase, prints the mean time over all runs at each thread count, the
+# speedup over the smallest thread count, and marks with * the first thread
+# count where adding threads improved the phase by less than 10% over the
+# previous thread count, i.e. where the phase stopped scaling.
+
+set -eu
+
+if [ "$#" -eq 0 ]; then
+    echo "Usage: $0 output_file..." >&2
+    exit 1
+fi
+
+for f in "$@"; do
+    t=$(echo "$f" | sed -En 's/.*-threads([0-9]+)\.txt$/\1/p')
+    if [ -z "$t" ]; then
+        echo "Skipping $f: no thread count in filename" >&2
+        continue
+    fi
+    group=$(basename "$f" | sed -E 's/-threads[0-9]+\.txt$//')
+
+    # Phase lines are "name : seconds", optionally followed by the spread
+    # across ranks in parentheses, where nested phases are named by their path
+    # such as "shuffle/assign_ids"; the total time of each run is printed on a
+    # line of its own.
+    awk -v group="$group" -v t="$t" '
+        /^[A-Za-z0-9_\/-]+ *: *[0-9.]+( \(.*\))?$/ {
+            split($0, parts, ":")
+            name = parts[1]
+            gsub(/ /, "", name)
+            print group, t, name, parts[2] + 0
+            next
+        }
+        /^[0-9]+\.[0-9]+$/ {
+            print group, t, "total", $1 + 0
+        }
+    ' "$f"
+done \
+    | sort -k1,1 -k3,3 -k2,2n \
+    | awk '
+        function flush_phase(    i, base, prev, mean, speedup, mark, stopped) {
+            if (!num_threads) {
+                return
+            }
+            base = sum[threads[0]] / count[threads[0]]
+            stopped = 0
+            for (i = 0; i < num_threads; i++) {
+                mean = sum[threads[i]] / count[threads[i]]
+                speedup = mean > 0 ? base / mean : 0
+                mark = ""
+                if (i > 0 && !stopped && mean > 0 && prev / mean < 1.1) {
+                    mark = "*"
+                    stopped = 1
+                }
+                printf "%-20s %8d %12.6f %8.2fx %s\n", phase, threads[i],
+                       mean, speedup, mark
+                prev = mean
+            }
+            delete sum
+            delete count
+            num_threads = 0
+        }
+
+        {
+            if ($1 != group) {
+                flush_phase()
+                group = $1
+                phase = ""
+                printf "\n%s\n", group
+                printf "%-20s %8s %12s %9s\n", "phase", "threads", "time (s)",
+                       "speedup"
+            }
+            if ($3 != phase) {
+                flush_phase()
+                phase = $3
+            }
+            if (!($2 in count)) {
+                threads[num_threads++] = $2
+            }
+            sum[$2] += $4
+            count[$2]++
+        }
+
+        END {
+            flush_phase()
+        }
+    '